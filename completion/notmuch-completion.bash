@@ -147,7 +147,30 @@ _notmuch_compact()
     ! $split &&
     case "${cur}" in
 	-*)
-	    local options="--backup= --quiet ${_notmuch_shared_options}"
+	    local options="--backup= --online --quiet ${_notmuch_shared_options}"
+	    compopt -o nospace
+	    COMPREPLY=( $(compgen -W "$options" -- ${cur}) )
+	    ;;
+    esac
+}
+
+_notmuch_serve()
+{
+    local cur prev words cword split
+    _init_completion -s || return
+
+    $split &&
+    case "${prev}" in
+	--socket)
+	    _filedir
+	    return
+	    ;;
+    esac
+
+    ! $split &&
+    case "${cur}" in
+	-*)
+	    local options="--socket= ${_notmuch_shared_options}"
 	    compopt -o nospace
 	    COMPREPLY=( $(compgen -W "$options" -- ${cur}) )
 	    ;;
@@ -230,7 +253,7 @@ _notmuch_dump()
     ! $split &&
     case "${cur}" in
 	-*)
-	    local options="--gzip --format= --output= ${_notmuch_shared_options}"
+	    local options="--gzip --format= --output= --jobs= ${_notmuch_shared_options}"
 	    compopt -o nospace
 	    COMPREPLY=( $(compgen -W "$options" -- ${cur}) )
 	    ;;
@@ -328,7 +351,7 @@ _notmuch_new()
     ! $split &&
     case "${cur}" in
 	-*)
-	    local options="--no-hooks --decrypt= --quiet ${_notmuch_shared_options}"
+	    local options="--no-hooks --decrypt= --jobs= --watch --thread-summaries --no-thread-summaries --message-values --no-message-values --quiet ${_notmuch_shared_options}"
 	    compopt -o nospace
 	    COMPREPLY=( $(compgen -W "${options}" -- ${cur}) )
 	    ;;
@@ -389,7 +412,7 @@ _notmuch_restore()
     ! $split &&
     case "${cur}" in
 	-*)
-	    local options="--format= --accumulate --input= ${_notmuch_shared_options}"
+	    local options="--format= --accumulate --bulk --input= ${_notmuch_shared_options}"
 	    compopt -o nospace
 	    COMPREPLY=( $(compgen -W "$options" -- ${cur}) )
 	    ;;
@@ -530,7 +553,7 @@ _notmuch_show()
     ! $split &&
     case "${cur}" in
 	-*)
-	    local options="--entire-thread= --format= --exclude= --body= --format-version= --part= --verify --decrypt= --include-html --limit= --offset= ${_notmuch_shared_options}"
+	    local options="--entire-thread= --format= --exclude= --body= --format-version= --part= --verify --decrypt= --include-html --limit= --offset= --prefetch= ${_notmuch_shared_options}"
 	    compopt -o nospace
 	    COMPREPLY=( $(compgen -W "$options" -- ${cur}) )
 	    ;;
@@ -579,7 +602,7 @@ _notmuch_tag()
 
 _notmuch()
 {
-    local _notmuch_commands="compact config count dump help insert new reply restore reindex search address setup show tag emacs-mua"
+    local _notmuch_commands="compact config count dump help insert new reply restore reindex search serve address setup show tag emacs-mua"
     local arg cur prev words cword split
 
     # require bash-completion with _init_completion
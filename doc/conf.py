@@ -170,6 +170,10 @@ man_pages = [
      u'search for messages matching the given search terms',
      [notmuch_authors], 1),
 
+    ('man1/notmuch-serve', 'notmuch-serve',
+     u'answer notmuch requests over a local socket',
+     [notmuch_authors], 1),
+
     ('man7/notmuch-search-terms', 'notmuch-search-terms',
      u'syntax for notmuch queries',
      [notmuch_authors], 7),
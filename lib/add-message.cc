@@ -201,6 +201,9 @@ _merge_threads (notmuch_database_t *notmuch,
 	message = NULL;
     }
 
+    /* The loser thread is left empty. */
+    _notmuch_thread_summary_invalidate (notmuch, loser_thread_id);
+
   DONE:
     if (message)
 	notmuch_message_destroy (message);
@@ -460,6 +463,148 @@ _notmuch_database_link_message (notmuch_database_t *notmuch,
     return status;
 }
 
+/* Return the absolute path of 'filename', which is relative to the
+ * mail root or absolute under it, or NULL if it is not under the mail
+ * root. */
+static char *
+_index_file_path (void *ctx, notmuch_database_t *notmuch, const char *filename)
+{
+    const char *prefix;
+
+    prefix = notmuch_config_get (notmuch, NOTMUCH_CONFIG_MAIL_ROOT);
+    if (prefix == NULL)
+	return NULL;
+
+    if (*filename == '/') {
+	if (strncmp (filename, prefix, strlen (prefix)) != 0)
+	    return NULL;
+	return talloc_strdup (ctx, filename);
+    }
+
+    return talloc_asprintf (ctx, "%s/%s", prefix, filename);
+}
+
+/* Return the length of the maildir name of 'path', i.e. of its base
+ * name up to any ':' starting the info (flags) part, and point
+ * '*name' to it. */
+static size_t
+_maildir_name (const char *path, const char **name)
+{
+    const char *slash = strrchr (path, '/');
+    const char *base = slash ? slash + 1 : path;
+
+    *name = base;
+    return strcspn (base, ":");
+}
+
+static bool
+_message_has_maildir_name (notmuch_message_t *message, const char *filename)
+{
+    notmuch_filenames_t *filenames;
+    const char *name;
+    size_t len;
+    bool found = false;
+
+    len = _maildir_name (filename, &name);
+    if (len == 0)
+	return false;
+
+    for (filenames = notmuch_message_get_filenames (message);
+	 notmuch_filenames_valid (filenames) && ! found;
+	 notmuch_filenames_move_to_next (filenames)) {
+	const char *other;
+
+	if (_maildir_name (notmuch_filenames_get (filenames), &other) == len &&
+	    strncmp (name, other, len) == 0)
+	    found = true;
+    }
+    notmuch_filenames_destroy (filenames);
+
+    return found;
+}
+
+/* Fast path for notmuch_database_index_file: if 'filename' is a new
+ * name for a file of an indexed message (see _message_has_maildir_name),
+ * find the message from the header block alone and only add the
+ * filename.
+ *
+ * Returns NOTMUCH_STATUS_DUPLICATE_MESSAGE_ID (with the message in
+ * '*message_ret') if the file was added this way, and
+ * NOTMUCH_STATUS_SUCCESS if it must be indexed in full. */
+static notmuch_status_t
+_index_file_from_headers (notmuch_database_t *notmuch,
+			  const char *filename,
+			  notmuch_message_t **message_ret)
+{
+    void *local = talloc_new (NULL);
+    notmuch_message_t *message = NULL;
+    notmuch_status_t status = NOTMUCH_STATUS_SUCCESS;
+    notmuch_bool_t is_ghost;
+    const char *name;
+    char *path, *message_id;
+
+    /* Only a file carrying maildir info can be a renamed copy of an
+     * indexed one; skip the extra open and lookup for anything else,
+     * such as files delivered to new/. */
+    _maildir_name (filename, &name);
+    if (strstr (name, ":2,") == NULL)
+	goto DONE;
+
+    path = _index_file_path (local, notmuch, filename);
+    if (path == NULL)
+	goto DONE;
+
+    message_id = _notmuch_message_file_peek_message_id (local, path);
+    if (message_id == NULL)
+	goto DONE;
+
+    status = notmuch_database_find_message (notmuch, message_id, &message);
+    if (status || message == NULL)
+	goto DONE;
+
+    status = notmuch_message_get_flag_st (message, NOTMUCH_MESSAGE_FLAG_GHOST, &is_ghost);
+    if (status || is_ghost || ! _message_has_maildir_name (message, filename))
+	goto DONE;
+
+    status = notmuch_database_begin_atomic (notmuch);
+    if (status)
+	goto DONE;
+
+    try {
+	status = _notmuch_message_add_filename (message, filename);
+	if (! status)
+	    _notmuch_message_sync (message);
+    } catch (const Xapian::Error &error) {
+	_notmuch_database_log (notmuch, "A Xapian exception occurred adding message: %s.\n",
+			       error.get_msg ().c_str ());
+	notmuch->exception_reported = true;
+	status = _notmuch_xapian_error ();
+    }
+
+    if (status) {
+	(void) notmuch_database_end_atomic (notmuch);
+	goto DONE;
+    }
+
+    status = notmuch_database_end_atomic (notmuch);
+    if (status)
+	goto DONE;
+
+    _notmuch_trace_count (notmuch, NOTMUCH_TRACE_INDEX_HEADER_ONLY, 1);
+    status = NOTMUCH_STATUS_DUPLICATE_MESSAGE_ID;
+
+  DONE:
+    if (message) {
+	if (status == NOTMUCH_STATUS_DUPLICATE_MESSAGE_ID && message_ret)
+	    *message_ret = message;
+	else
+	    notmuch_message_destroy (message);
+    }
+    talloc_free (local);
+
+    return status;
+}
+
 notmuch_status_t
 notmuch_database_index_file (notmuch_database_t *notmuch,
 			     const char *filename,
@@ -484,7 +629,21 @@ notmuch_database_index_file (notmuch_database_t *notmuch,
     if (ret)
 	return ret;
 
-    message_file = _notmuch_message_file_open (notmuch, filename);
+    if (notmuch_indexopts_get_expect_renames (indexopts)) {
+	ret = _index_file_from_headers (notmuch, filename, message_ret);
+	if (ret) {
+	    /* The file need not be parsed after all. */
+	    if (notmuch->parse_queue)
+		_notmuch_parse_queue_drop (notmuch->parse_queue, filename);
+	    return ret;
+	}
+    }
+
+    message_file = NULL;
+    if (notmuch->parse_queue)
+	message_file = _notmuch_parse_queue_take (notmuch->parse_queue, filename);
+    if (message_file == NULL)
+	message_file = _notmuch_message_file_open (notmuch, filename);
     if (message_file == NULL)
 	return NOTMUCH_STATUS_FILE_ERROR;
 
@@ -545,8 +704,10 @@ notmuch_database_index_file (notmuch_database_t *notmuch,
 	if (ret)
 	    goto DONE;
 
-	if (is_new || is_ghost)
+	if (is_new || is_ghost) {
 	    _notmuch_message_set_header_values (message, date, from, subject);
+	    _notmuch_message_set_recipient_values (message, message_file);
+	}
 
 	if (! indexopts) {
 	    def_indexopts = notmuch_database_get_default_indexopts (notmuch);
@@ -593,6 +754,53 @@ notmuch_database_index_file (notmuch_database_t *notmuch,
     return ret;
 }
 
+notmuch_status_t
+notmuch_database_set_index_jobs (notmuch_database_t *notmuch,
+				 unsigned int jobs)
+{
+    notmuch_status_t status;
+
+    status = _notmuch_database_ensure_writable (notmuch);
+    if (status)
+	return status;
+
+    if (notmuch->parse_queue) {
+	talloc_free (notmuch->parse_queue);
+	notmuch->parse_queue = NULL;
+    }
+
+    if (jobs == 0)
+	return NOTMUCH_STATUS_SUCCESS;
+
+    notmuch->parse_queue = _notmuch_parse_queue_create (notmuch, jobs);
+    if (notmuch->parse_queue == NULL)
+	return NOTMUCH_STATUS_OUT_OF_MEMORY;
+
+    return NOTMUCH_STATUS_SUCCESS;
+}
+
+notmuch_status_t
+notmuch_database_prepare_index_file (notmuch_database_t *notmuch,
+				     const char *filename)
+{
+    char *path;
+    notmuch_status_t status;
+
+    if (! notmuch->parse_queue)
+	return NOTMUCH_STATUS_SUCCESS;
+
+    /* Leave any path the queue cannot handle to
+     * notmuch_database_index_file, which reports the error. */
+    path = _index_file_path (notmuch, notmuch, filename);
+    if (path == NULL)
+	return NOTMUCH_STATUS_SUCCESS;
+
+    status = _notmuch_parse_queue_push (notmuch->parse_queue, filename, path);
+    talloc_free (path);
+
+    return status;
+}
+
 notmuch_status_t
 notmuch_database_add_message (notmuch_database_t *notmuch,
 			      const char *filename,
@@ -86,6 +86,9 @@ notmuch_database_set_config (notmuch_database_t *notmuch,
 
     _notmuch_string_map_set (notmuch->config, key, value);
 
+    /* Named queries may have changed. */
+    _notmuch_query_cache_clear (notmuch);
+
     return NOTMUCH_STATUS_SUCCESS;
 }
 
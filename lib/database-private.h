@@ -121,6 +121,33 @@ enum _notmuch_features {
      *
      * Introduced: version 3. */
     NOTMUCH_FEATURE_UNPREFIX_BODY_ONLY		= 1 << 7,
+
+    /* If set, the summary of each thread (see thread-summary.cc) is
+     * stored as database metadata and kept up to date by writers.
+     *
+     * Introduced: optional in version 3. */
+    NOTMUCH_FEATURE_THREAD_SUMMARIES		= 1 << 8,
+
+    /* If set, message documents store their thread ID in
+     * NOTMUCH_VALUE_THREAD_ID, so that thread:{} subqueries need not
+     * read the terms of each matching message.
+     *
+     * Introduced: optional in version 3. */
+    NOTMUCH_FEATURE_THREAD_ID_VALUES		= 1 << 9,
+
+    /* If set, the to, cc, and bcc headers are stored in message
+     * document values, like the from and subject headers.  If unset,
+     * they must be retrieved from the message file.
+     *
+     * Introduced: optional in version 3. */
+    NOTMUCH_FEATURE_RECIPIENT_VALUES		= 1 << 10,
+
+    /* If set, message documents store their number of filenames in
+     * NOTMUCH_VALUE_FILE_COUNT, so that files can be counted without
+     * reading them.
+     *
+     * Introduced: optional in version 3. */
+    NOTMUCH_FEATURE_FILE_COUNT_VALUES		= 1 << 11,
 };
 
 /* In C++, a named enum is its own type, so define bitwise operators
@@ -244,6 +271,10 @@ struct _notmuch_database {
     bool atomic_dirty;
     Xapian::Database *xapian_db;
     Xapian::WritableDatabase *writable_xapian_db;
+    /* Descriptor of <xapian_path>.compact.lock while it is locked,
+     * else -1. See _notmuch_database_lock_compact. */
+    int compact_lock_fd;
+    bool compact_lock_exclusive;
     bool open;
     /* Bit mask of features used by this database.  This is a
      * bitwise-OR of NOTMUCH_FEATURE_* values (above). */
@@ -296,6 +327,33 @@ struct _notmuch_database {
     /* list of regular expressions to check for text indexing */
     regex_t *index_as_text;
     size_t index_as_text_length;
+
+    /* Message files being parsed ahead of notmuch_database_index_file,
+     * or NULL if indexing is done synchronously. */
+    notmuch_parse_queue_t *parse_queue;
+
+    /* Directory document id -> path (relative to the mail root),
+     * valid only while directory_paths_view matches view. */
+    GHashTable *directory_paths;
+    unsigned long directory_paths_view;
+
+    /* See notmuch_database_get_trace_counter. Timings are only taken
+     * if trace_timing is set. */
+    unsigned long long trace[NOTMUCH_TRACE_LAST];
+    bool trace_timing;
+
+    /* Ids of the threads whose summaries must be rewritten before the
+     * changes to their messages are committed, or NULL. */
+    GHashTable *stale_thread_summaries;
+
+    /* Parsed queries, see query-cache.cc, valid only while
+     * query_cache_view and query_cache_revision match view and
+     * revision. */
+    GHashTable *query_cache;
+    unsigned long query_cache_view;
+    unsigned long query_cache_revision;
+    /* Set while parsing a query that refers to the current time. */
+    bool query_uses_time;
 };
 
 /* Prior to database version 3, features were implied by the database
@@ -310,12 +368,19 @@ struct _notmuch_database {
  * NOTMUCH_FEATURE_FROM_SUBJECT_ID_VALUES and
  * NOTMUCH_FEATURE_INDEXED_MIMETYPES are not included because upgrade
  * doesn't currently introduce the features (though brand new databases
- * will have it). */
+ * will have it). NOTMUCH_FEATURES_MESSAGE_VALUES are not included
+ * because they lock older writers out, so they are only added on
+ * request. */
 #define NOTMUCH_FEATURES_CURRENT \
     (NOTMUCH_FEATURE_FILE_TERMS | NOTMUCH_FEATURE_DIRECTORY_DOCS | \
      NOTMUCH_FEATURE_BOOL_FOLDER | NOTMUCH_FEATURE_GHOSTS | \
      NOTMUCH_FEATURE_LAST_MOD)
 
+/* Features turned on and off by notmuch_database_set_message_values. */
+#define NOTMUCH_FEATURES_MESSAGE_VALUES \
+    (NOTMUCH_FEATURE_THREAD_ID_VALUES | NOTMUCH_FEATURE_RECIPIENT_VALUES | \
+     NOTMUCH_FEATURE_FILE_COUNT_VALUES)
+
 /* Return the list of terms from the given iterator matching a prefix.
  * The prefix will be stripped from the strings in the returned list.
  * The list will be allocated using ctx as the talloc context.
@@ -364,6 +429,39 @@ notmuch_status_t
 _notmuch_query_expand (notmuch_database_t *notmuch, const char *field, Xapian::Query subquery,
 		       Xapian::Query &output, std::string &msg);
 
+/* query-cache.cc */
+
+/* Kinds of query strings, for _notmuch_query_cache_*. */
+#define NOTMUCH_QUERY_CACHE_XAPIAN 'x'
+#define NOTMUCH_QUERY_CACHE_SEXP 's'
+#define NOTMUCH_QUERY_CACHE_NAMED 'q'
+#define NOTMUCH_QUERY_CACHE_EXPANSION 'e'
+
+/* Set 'output' to the cached parse of 'query_string' (of the given
+ * kind), and return true, if there is one. */
+bool
+_notmuch_query_cache_lookup (notmuch_database_t *notmuch, char kind,
+			     const char *query_string, Xapian::Query &output);
+
+/* Cache 'query' as the parse of 'query_string', unconditionally. */
+void
+_notmuch_query_cache_store (notmuch_database_t *notmuch, char kind,
+			    const char *query_string, const Xapian::Query &query);
+
+/* Bracket the parsing of a query string, passing the return value of
+ * _notmuch_query_cache_begin on to _notmuch_query_cache_end with the
+ * result of the parse ('query', or NULL on failure), which is cached
+ * if it can be. */
+bool
+_notmuch_query_cache_begin (notmuch_database_t *notmuch);
+
+void
+_notmuch_query_cache_end (notmuch_database_t *notmuch, bool outer, char kind,
+			  const char *query_string, const Xapian::Query *query);
+
+void
+_notmuch_query_cache_clear (notmuch_database_t *notmuch);
+
 /* regexp-fields.cc */
 notmuch_status_t
 _notmuch_regexp_to_query (notmuch_database_t *notmuch, Xapian::valueno slot, std::string field,
@@ -384,7 +482,8 @@ _notmuch_sexp_string_to_xapian_query (notmuch_database_t *notmuch, const char *q
 
 /* parse-time-vrp.h */
 notmuch_status_t
-_notmuch_date_strings_to_query (Xapian::valueno slot, const std::string &from, const std::string &to,
+_notmuch_date_strings_to_query (notmuch_database_t *notmuch, Xapian::valueno slot,
+				const std::string &from, const std::string &to,
 				Xapian::Query &output, std::string &msg);
 
 /* lastmod-fp.h */
@@ -25,6 +25,7 @@
 
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/file.h>
 #include <signal.h>
 #include <ftw.h>
 
@@ -514,6 +515,11 @@ notmuch_database_close (notmuch_database_t *notmuch)
      * the database, so merely deleting the database may not suffice to
      * close it.  Thus, we explicitly close it here. */
     if (notmuch->open) {
+	/* Changes made in an unfinished atomic section are discarded
+	 * below, so only summarise changes made outside of one. */
+	if (notmuch->atomic_nesting == 0)
+	    status = _notmuch_thread_summary_flush (notmuch);
+
 	try {
 	    /* Close the database.  This implicitly flushes
 	     * outstanding changes. If there is an open (non-flushed)
@@ -528,6 +534,7 @@ notmuch_database_close (notmuch_database_t *notmuch)
 	    }
 	}
     }
+    _notmuch_database_unlock_compact (notmuch, true);
     notmuch->open = false;
     return status;
 }
@@ -620,117 +627,554 @@ notmuch_database_compact (const char *path,
 					closure);
 }
 
-notmuch_status_t
-notmuch_database_compact_db (notmuch_database_t *notmuch,
-			     const char *backup_path,
-			     notmuch_compact_status_cb_t status_cb,
-			     void *closure)
+/* The paths involved in compacting a database.
+ *
+ * Online compaction does most of its work without the database lock,
+ * so compactions (online or not) serialize on a lock file of their
+ * own, <xapian_path>.compactor.lock, which guards the
+ * work-in-progress and backup paths. Writers are only kept out, by
+ * <xapian_path>.compact.lock, from when the compacted database is
+ * brought up to date until it is in place. */
+typedef struct {
+    const char *xapian_path;
+    const char *compact_path;
+    const char *backup_path;
+    bool keep_backup;
+    int lock_fd;
+} _notmuch_compaction_t;
+
+/* How many times to start over when the database changes under an
+ * online compaction. */
+#define COMPACT_RETRY_MAX 5
+
+static void
+_compact_report (notmuch_compact_status_cb_t status_cb, void *closure,
+		 const char *format, ...) PRINTF_ATTRIBUTE (3, 4);
+
+static void
+_compact_report (notmuch_compact_status_cb_t status_cb, void *closure,
+		 const char *format, ...)
 {
-    void *local;
-    const char *xapian_path, *compact_xapian_path;
+    va_list va_args;
+    char *msg;
+
+    if (status_cb == NULL)
+	return;
+
+    va_start (va_args, format);
+    msg = talloc_vasprintf (NULL, format, va_args);
+    va_end (va_args);
+
+    if (msg == NULL)
+	return;
+
+    status_cb (msg, closure);
+    talloc_free (msg);
+}
+
+/* Fill in 'compaction' for the database, take the compaction lock,
+ * and check that the backup does not exist yet. */
+static notmuch_status_t
+_compact_prepare (notmuch_database_t *notmuch, void *local,
+		  const char *backup_path, _notmuch_compaction_t *compaction)
+{
+    const char *xapian_path;
     const char *path;
-    notmuch_status_t ret = NOTMUCH_STATUS_SUCCESS;
     struct stat statbuf;
-    bool keep_backup;
     char *message;
+    char *lock_path;
+    notmuch_status_t ret;
 
-    ret = _notmuch_database_ensure_writable (notmuch);
-    if (ret)
-	return ret;
+    compaction->lock_fd = -1;
 
     path = notmuch_config_get (notmuch, NOTMUCH_CONFIG_DATABASE_PATH);
     if (! path)
 	return NOTMUCH_STATUS_PATH_ERROR;
 
-    local = talloc_new (NULL);
-    if (! local)
-	return NOTMUCH_STATUS_OUT_OF_MEMORY;
-
     ret = _notmuch_choose_xapian_path (local, path, &xapian_path, &message);
     if (ret)
-	goto DONE;
-
-    if (! (compact_xapian_path = talloc_asprintf (local, "%s.compact", xapian_path))) {
-	ret = NOTMUCH_STATUS_OUT_OF_MEMORY;
-	goto DONE;
-    }
+	return ret;
 
     if (backup_path == NULL) {
-	if (! (backup_path = talloc_asprintf (local, "%s.old", xapian_path))) {
-	    ret = NOTMUCH_STATUS_OUT_OF_MEMORY;
-	    goto DONE;
-	}
-	keep_backup = false;
+	if (! (backup_path = talloc_asprintf (local, "%s.old", xapian_path)))
+	    return NOTMUCH_STATUS_OUT_OF_MEMORY;
+	compaction->keep_backup = false;
     } else {
-	keep_backup = true;
+	compaction->keep_backup = true;
+    }
+
+    compaction->xapian_path = xapian_path;
+    compaction->backup_path = backup_path;
+    if (! (compaction->compact_path = talloc_asprintf (local, "%s.compact", xapian_path)))
+	return NOTMUCH_STATUS_OUT_OF_MEMORY;
+
+    lock_path = talloc_asprintf (local, "%s.compactor.lock", xapian_path);
+    if (! lock_path)
+	return NOTMUCH_STATUS_OUT_OF_MEMORY;
+
+    compaction->lock_fd = open (lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (compaction->lock_fd < 0) {
+	_notmuch_database_log (notmuch, "Cannot open %s: %s\n", lock_path, strerror (errno));
+	return NOTMUCH_STATUS_FILE_ERROR;
+    }
+    if (flock (compaction->lock_fd, LOCK_EX | LOCK_NB) < 0) {
+	if (errno == EWOULDBLOCK)
+	    _notmuch_database_log (notmuch, "Another compaction of this database is running.\n");
+	else
+	    _notmuch_database_log (notmuch, "Cannot lock %s: %s\n", lock_path, strerror (errno));
+	return NOTMUCH_STATUS_FILE_ERROR;
     }
 
     if (stat (backup_path, &statbuf) != -1) {
 	_notmuch_database_log (notmuch, "Path already exists: %s\n", backup_path);
-	ret = NOTMUCH_STATUS_FILE_ERROR;
-	goto DONE;
+	return NOTMUCH_STATUS_FILE_ERROR;
     }
     if (errno != ENOENT) {
 	_notmuch_database_log (notmuch, "Unknown error while stat()ing path: %s\n",
 			       strerror (errno));
-	ret = NOTMUCH_STATUS_FILE_ERROR;
-	goto DONE;
+	return NOTMUCH_STATUS_FILE_ERROR;
     }
 
-    /* Unconditionally attempt to remove old work-in-progress database (if
-     * any). This is "protected" by database lock. If this fails due to write
-     * errors (etc), the following code will fail and provide error message.
-     */
-    (void) rmtree (compact_xapian_path);
+    return NOTMUCH_STATUS_SUCCESS;
+}
 
-    try {
-	NotmuchCompactor compactor (status_cb, closure);
-	notmuch->xapian_db->compact (compact_xapian_path, Xapian::DBCOMPACT_NO_RENUMBER, 0,
-				     compactor);
-    } catch (const Xapian::Error &error) {
-	_notmuch_database_log (notmuch, "Error while compacting: %s\n", error.get_msg ().c_str ());
-	ret = _notmuch_xapian_error ();
-	goto DONE;
+/* Wait until no other process has the database open for writing,
+ * keep them from opening it until 'notmuch' is closed, and reopen it
+ * for writing. Writers opening the database meanwhile thus wait for
+ * the compacted database to be in place, rather than keep writing to
+ * the one it replaces. */
+static notmuch_status_t
+_compact_lock_writers (notmuch_database_t *notmuch)
+{
+    notmuch_status_t ret;
+
+    /* Our own shared lock would keep us waiting. */
+    ret = notmuch_database_reopen (notmuch, NOTMUCH_DATABASE_MODE_READ_ONLY);
+    if (ret)
+	return ret;
+
+    ret = _notmuch_database_lock_compact (notmuch, true);
+    if (ret)
+	return ret;
+
+    return notmuch_database_reopen (notmuch, NOTMUCH_DATABASE_MODE_READ_WRITE);
+}
+
+/* Release the lock taken by _compact_prepare. */
+static void
+_compact_release (_notmuch_compaction_t *compaction)
+{
+    if (compaction->lock_fd >= 0)
+	close (compaction->lock_fd);
+    compaction->lock_fd = -1;
+}
+
+/* Write a compacted copy of the database. If 'snapshot' is true, it
+ * is read from its last committed state rather than through the open
+ * database, which need not be locked; if it changes too much
+ * meanwhile for Xapian to keep reading that state, it is compacted
+ * again from its new state. */
+static notmuch_status_t
+_compact_copy (notmuch_database_t *notmuch, _notmuch_compaction_t *compaction,
+	       bool snapshot, notmuch_compact_status_cb_t status_cb, void *closure)
+{
+    for (unsigned int attempt = 1; ; attempt++) {
+	/* Unconditionally attempt to remove old work-in-progress
+	 * database (if any). This is protected by the compaction
+	 * lock. If this fails due to write errors (etc), the
+	 * following code will fail and provide error message. */
+	(void) rmtree (compaction->compact_path);
+
+	try {
+	    NotmuchCompactor compactor (status_cb, closure);
+	    if (snapshot)
+		Xapian::Database (compaction->xapian_path).compact (
+		    compaction->compact_path, Xapian::DBCOMPACT_NO_RENUMBER, 0, compactor);
+	    else
+		notmuch->xapian_db->compact (compaction->compact_path,
+					     Xapian::DBCOMPACT_NO_RENUMBER, 0, compactor);
+	    return NOTMUCH_STATUS_SUCCESS;
+	} catch (const Xapian::DatabaseModifiedError &error) {
+	    if (! snapshot || attempt == COMPACT_RETRY_MAX) {
+		_notmuch_database_log (notmuch, "Error while compacting: %s\n",
+				       error.get_msg ().c_str ());
+		return _notmuch_xapian_error ();
+	    }
+	    _compact_report (status_cb, closure,
+			     "database changed during compaction, starting over");
+	} catch (const Xapian::Error &error) {
+	    _notmuch_database_log (notmuch, "Error while compacting: %s\n",
+				   error.get_msg ().c_str ());
+	    return _notmuch_xapian_error ();
+	}
     }
+}
 
-    if (rename (xapian_path, backup_path)) {
+/* Move the compacted database in place of the original, which is
+ * kept in the backup path, or removed. */
+static notmuch_status_t
+_compact_swap (notmuch_database_t *notmuch, _notmuch_compaction_t *compaction)
+{
+    if (rename (compaction->xapian_path, compaction->backup_path)) {
 	_notmuch_database_log (notmuch, "Error moving %s to %s: %s\n",
-			       xapian_path, backup_path, strerror (errno));
-	ret = NOTMUCH_STATUS_FILE_ERROR;
-	goto DONE;
+			       compaction->xapian_path, compaction->backup_path,
+			       strerror (errno));
+	return NOTMUCH_STATUS_FILE_ERROR;
     }
 
-    if (rename (compact_xapian_path, xapian_path)) {
+    if (rename (compaction->compact_path, compaction->xapian_path)) {
 	_notmuch_database_log (notmuch, "Error moving %s to %s: %s\n",
-			       compact_xapian_path, xapian_path, strerror (errno));
-	ret = NOTMUCH_STATUS_FILE_ERROR;
-	goto DONE;
+			       compaction->compact_path, compaction->xapian_path,
+			       strerror (errno));
+	return NOTMUCH_STATUS_FILE_ERROR;
     }
 
-    if (! keep_backup) {
-	if (rmtree (backup_path)) {
+    if (! compaction->keep_backup) {
+	if (rmtree (compaction->backup_path)) {
 	    _notmuch_database_log (notmuch, "Error removing old database %s: %s\n",
-				   backup_path, strerror (errno));
-	    ret = NOTMUCH_STATUS_FILE_ERROR;
-	    goto DONE;
+				   compaction->backup_path, strerror (errno));
+	    return NOTMUCH_STATUS_FILE_ERROR;
+	}
+    }
+
+    return NOTMUCH_STATUS_SUCCESS;
+}
+
+/* Return the total size in bytes of the files of the database at
+ * 'path'. */
+static uint64_t
+_compact_size (const char *path)
+{
+    GDir *dir = g_dir_open (path, 0, NULL);
+    const char *name;
+    uint64_t size = 0;
+
+    if (dir == NULL)
+	return 0;
+
+    while ((name = g_dir_read_name (dir))) {
+	char *file = g_build_filename (path, name, NULL);
+	struct stat statbuf;
+
+	if (stat (file, &statbuf) == 0 && S_ISREG (statbuf.st_mode))
+	    size += statbuf.st_size;
+	g_free (file);
+    }
+    g_dir_close (dir);
+
+    return size;
+}
+
+/* Add the ids of the threads of 'doc' to 'threads'. */
+static void
+_compact_doc_threads (const Xapian::Document &doc, std::set<std::string> &threads)
+{
+    const std::string prefix = _find_prefix ("thread");
+    Xapian::TermIterator i = doc.termlist_begin ();
+
+    for (i.skip_to (prefix); i != doc.termlist_end (); i++) {
+	if ((*i).compare (0, prefix.size (), prefix) != 0)
+	    break;
+	threads.insert ((*i).substr (prefix.size ()));
+    }
+}
+
+/* Copy document 'did' of 'source' to 'target', noting the threads it
+ * belongs to in either. */
+static void
+_compact_copy_doc (Xapian::Database &source, Xapian::WritableDatabase &target,
+		   Xapian::docid did, std::set<std::string> &threads)
+{
+    Xapian::Document doc = source.get_document (did);
+
+    try {
+	_compact_doc_threads (target.get_document (did), threads);
+    } catch (const Xapian::DocNotFoundError &error) {
+	/* a new document */
+    }
+    _compact_doc_threads (doc, threads);
+    target.replace_document (did, doc);
+}
+
+/* Make the metadata 'key' of 'target' the same as in 'source'. */
+static void
+_compact_copy_metadata (Xapian::Database &source, Xapian::WritableDatabase &target,
+			const std::string &key)
+{
+    std::string value = source.get_metadata (key);
+
+    if (target.get_metadata (key) != value)
+	target.set_metadata (key, value);
+}
+
+/* Return the metadata keys of 'db', except thread summaries. */
+static std::vector<std::string>
+_compact_metadata_keys (Xapian::Database &db)
+{
+    std::vector<std::string> keys;
+    std::string summaries_end = THREAD_SUMMARY_PREFIX;
+
+    /* the first key after all those starting with the prefix */
+    summaries_end.back ()++;
+
+    for (Xapian::TermIterator key = db.metadata_keys_begin ();
+	 key != db.metadata_keys_end (); key++) {
+	if ((*key).compare (0, strlen (THREAD_SUMMARY_PREFIX), THREAD_SUMMARY_PREFIX) == 0) {
+	    key.skip_to (summaries_end);
+	    if (key == db.metadata_keys_end ())
+		break;
 	}
+	keys.push_back (*key);
     }
 
+    return keys;
+}
+
+/* Bring 'target', a compacted copy of an earlier state of 'source',
+ * up to date with it, and return the number of documents copied or
+ * removed.
+ *
+ * Messages changed since revision 'since' are found by their
+ * NOTMUCH_VALUE_LAST_MOD, and directory documents, which carry no
+ * revision, by their terms (there are few of them). Copying them
+ * leaves both databases with the same documents unless some were
+ * removed, which only comparing the document ids of both databases
+ * finds, so that is only done when the numbers of documents differ.
+ *
+ * Only the thread summaries of the threads of the documents copied or
+ * removed are compared, along with the rest of the metadata, so this
+ * is cheap when little has changed.
+ */
+static unsigned int
+_compact_replay (Xapian::Database &source, Xapian::WritableDatabase &target,
+		 unsigned long since)
+{
+    const std::string dir_prefix = _find_prefix ("directory");
+    std::set<std::string> threads;
+    std::vector<Xapian::docid> to_copy, to_remove;
+    Xapian::Enquire enquire (source);
+    Xapian::MSet changed;
+
+    enquire.set_weighting_scheme (Xapian::BoolWeight ());
+    enquire.set_query (Xapian::Query (Xapian::Query::OP_VALUE_GE, NOTMUCH_VALUE_LAST_MOD,
+				      Xapian::sortable_serialise (since + 1)));
+    changed = enquire.get_mset (0, source.get_doccount ());
+    for (Xapian::MSetIterator i = changed.begin (); i != changed.end (); i++)
+	to_copy.push_back (*i);
+
+    for (Xapian::TermIterator term = source.allterms_begin (dir_prefix);
+	 term != source.allterms_end (dir_prefix); term++) {
+	for (Xapian::PostingIterator p = source.postlist_begin (*term);
+	     p != source.postlist_end (*term); p++)
+	    to_copy.push_back (*p);
+    }
+
+    for (auto did : to_copy)
+	_compact_copy_doc (source, target, did, threads);
+
+    if (target.get_doccount () != source.get_doccount ()) {
+	Xapian::PostingIterator s = source.postlist_begin ("");
+	Xapian::PostingIterator s_end = source.postlist_end ("");
+	Xapian::PostingIterator t = target.postlist_begin ("");
+	Xapian::PostingIterator t_end = target.postlist_end ("");
+	std::vector<Xapian::docid> missing;
+
+	/* Collect the differences first: the target's postings must
+	 * not change while they are read. */
+	while (s != s_end || t != t_end) {
+	    if (s == s_end || (t != t_end && *t < *s)) {
+		to_remove.push_back (*t++);
+	    } else if (t == t_end || *s < *t) {
+		missing.push_back (*s++);
+	    } else {
+		s++;
+		t++;
+	    }
+	}
+
+	for (auto did : to_remove) {
+	    _compact_doc_threads (target.get_document (did), threads);
+	    target.delete_document (did);
+	}
+	for (auto did : missing)
+	    _compact_copy_doc (source, target, did, threads);
+	to_copy.insert (to_copy.end (), missing.begin (), missing.end ());
+    }
+
+    for (auto &key : _compact_metadata_keys (target))
+	_compact_copy_metadata (source, target, key);
+    for (auto &key : _compact_metadata_keys (source))
+	_compact_copy_metadata (source, target, key);
+    for (auto &thread : threads)
+	_compact_copy_metadata (source, target, THREAD_SUMMARY_PREFIX + thread);
+
+    return to_remove.size () + to_copy.size ();
+}
+
+static notmuch_status_t
+_compact_finish (notmuch_database_t *notmuch, notmuch_status_t ret,
+		 notmuch_compact_status_cb_t status_cb, void *closure)
+{
+    notmuch_status_t ret2;
+
+    const char *str = notmuch_database_status_string (notmuch);
+    if (status_cb && str)
+	status_cb (str, closure);
+
+    ret2 = notmuch_database_destroy (notmuch);
+
+    /* don't clobber previous error status */
+    if (ret == NOTMUCH_STATUS_SUCCESS && ret2 != NOTMUCH_STATUS_SUCCESS)
+	ret = ret2;
+
+    return ret;
+}
+
+notmuch_status_t
+notmuch_database_compact_db (notmuch_database_t *notmuch,
+			     const char *backup_path,
+			     notmuch_compact_status_cb_t status_cb,
+			     void *closure)
+{
+    void *local;
+    notmuch_status_t ret = NOTMUCH_STATUS_SUCCESS;
+    _notmuch_compaction_t compaction;
+
+    ret = _notmuch_database_ensure_writable (notmuch);
+    if (ret)
+	return ret;
+
+    local = talloc_new (NULL);
+    if (! local)
+	return NOTMUCH_STATUS_OUT_OF_MEMORY;
+
+    ret = _compact_prepare (notmuch, local, backup_path, &compaction);
+    if (ret)
+	goto DONE;
+
+    ret = _compact_lock_writers (notmuch);
+    if (ret)
+	goto DONE;
+
+    ret = _compact_copy (notmuch, &compaction, false, status_cb, closure);
+    if (ret)
+	goto DONE;
+
+    ret = _compact_swap (notmuch, &compaction);
+
   DONE:
-    if (notmuch) {
-	notmuch_status_t ret2;
+    _compact_release (&compaction);
+    ret = _compact_finish (notmuch, ret, status_cb, closure);
 
-	const char *str = notmuch_database_status_string (notmuch);
-	if (status_cb && str)
-	    status_cb (str, closure);
+    talloc_free (local);
 
-	ret2 = notmuch_database_destroy (notmuch);
+    return ret;
+}
 
-	/* don't clobber previous error status */
-	if (ret == NOTMUCH_STATUS_SUCCESS && ret2 != NOTMUCH_STATUS_SUCCESS)
-	    ret = ret2;
+notmuch_status_t
+notmuch_database_compact_online (notmuch_database_t *notmuch,
+				 const char *backup_path,
+				 notmuch_compact_status_cb_t status_cb,
+				 void *closure)
+{
+    void *local;
+    notmuch_status_t ret = NOTMUCH_STATUS_SUCCESS;
+    _notmuch_compaction_t compaction;
+    unsigned long revision;
+    const char *uuid;
+    uint64_t old_size, new_size;
+
+    if (! (notmuch->features & NOTMUCH_FEATURE_LAST_MOD)) {
+	_notmuch_database_log (notmuch, "Online compaction requires revision tracking;"
+			       " please upgrade the database.\n");
+	return NOTMUCH_STATUS_UNSUPPORTED_OPERATION;
     }
 
+    local = talloc_new (NULL);
+    if (! local)
+	return NOTMUCH_STATUS_OUT_OF_MEMORY;
+
+    ret = _compact_prepare (notmuch, local, backup_path, &compaction);
+    if (ret)
+	goto DONE;
+
+    /* Let other processes write while the snapshot is compacted. */
+    ret = notmuch_database_reopen (notmuch, NOTMUCH_DATABASE_MODE_READ_ONLY);
+    if (ret)
+	goto DONE;
+
+    revision = notmuch->revision;
+    uuid = talloc_strdup (local, notmuch->uuid);
+    old_size = _compact_size (compaction.xapian_path);
+
+    _compact_report (status_cb, closure, "compacting revision %lu (%.1f MiB)",
+		     revision, old_size / 1048576.0);
+
+    ret = _compact_copy (notmuch, &compaction, true, status_cb, closure);
+    if (ret)
+	goto DONE;
+
+    new_size = _compact_size (compaction.compact_path);
+    _compact_report (status_cb, closure, "compacted to %.1f MiB (%.0f%% smaller)",
+		     new_size / 1048576.0,
+		     old_size ? 100.0 * ((double) old_size - new_size) / old_size : 0.0);
+
+    try {
+	Xapian::WritableDatabase copy (compaction.compact_path, Xapian::DB_OPEN);
+	unsigned int changes;
+
+	/* Catch up with most of the changes made meanwhile without
+	 * blocking writers, then take the lock for the last ones.
+	 * Without the lock, the database can change under the replay;
+	 * it is then replayed again from the same revision, which only
+	 * brings the copy further up to date. If it keeps changing,
+	 * the locked pass replays the changes since the snapshot. */
+	for (unsigned int attempt = 1; attempt <= COMPACT_RETRY_MAX; attempt++) {
+	    ret = notmuch_database_reopen (notmuch, NOTMUCH_DATABASE_MODE_READ_ONLY);
+	    if (ret)
+		goto DONE;
+	    try {
+		changes = _compact_replay (*notmuch->xapian_db, copy, revision);
+		copy.commit ();
+		_compact_report (status_cb, closure, "replayed %u changes up to revision %lu",
+				 changes, notmuch->revision);
+		revision = notmuch->revision;
+		break;
+	    } catch (const Xapian::DatabaseModifiedError &error) {
+		_compact_report (status_cb, closure, "database changed during replay");
+	    }
+	}
+
+	_compact_report (status_cb, closure, "waiting for write access");
+	ret = _compact_lock_writers (notmuch);
+	if (ret)
+	    goto DONE;
+
+	if (strcmp (uuid, notmuch->uuid) != 0) {
+	    _notmuch_database_log (notmuch, "Database was replaced during compaction.\n");
+	    ret = NOTMUCH_STATUS_FILE_ERROR;
+	    goto DONE;
+	}
+
+	changes = _compact_replay (*notmuch->xapian_db, copy, revision);
+	copy.commit ();
+	copy.close ();
+	_compact_report (status_cb, closure, "replayed %u changes up to revision %lu",
+			 changes, notmuch->revision);
+    } catch (const Xapian::Error &error) {
+	_notmuch_database_log (notmuch, "Error while updating compacted database: %s\n",
+			       error.get_msg ().c_str ());
+	ret = _notmuch_xapian_error ();
+	goto DONE;
+    }
+
+    _compact_report (status_cb, closure, "moving the compacted database into place");
+    ret = _compact_swap (notmuch, &compaction);
+
+  DONE:
+    _compact_release (&compaction);
+    ret = _compact_finish (notmuch, ret, status_cb, closure);
+
     talloc_free (local);
 
     return ret;
@@ -767,6 +1211,18 @@ notmuch_database_destroy (notmuch_database_t *notmuch)
     delete notmuch->stemmer;
     notmuch->stemmer = NULL;
 
+    if (notmuch->directory_paths) {
+	g_hash_table_unref (notmuch->directory_paths);
+	notmuch->directory_paths = NULL;
+    }
+
+    if (notmuch->stale_thread_summaries) {
+	g_hash_table_unref (notmuch->stale_thread_summaries);
+	notmuch->stale_thread_summaries = NULL;
+    }
+
+    _notmuch_query_cache_clear (notmuch);
+
     talloc_free (notmuch);
 
     return status;
@@ -831,23 +1287,15 @@ handle_sigalrm (unused (int signal))
     do_progress_notify = 1;
 }
 
-/* Upgrade the current database.
- *
- * After opening a database in read-write mode, the client should
- * check if an upgrade is needed (notmuch_database_needs_upgrade) and
- * if so, upgrade with this function before making any modifications.
- *
- * The optional progress_notify callback can be used by the caller to
- * provide progress indication to the user. If non-NULL it will be
- * called periodically with 'count' as the number of messages upgraded
- * so far and 'total' the overall number of messages that will be
- * converted.
- */
-notmuch_status_t
-notmuch_database_upgrade (notmuch_database_t *notmuch,
-			  void (*progress_notify)(void *closure,
-						  double progress),
-			  void *closure)
+/* Convert the database to 'new_features' (on top of the ones it
+ * has), rewriting every document that needs it, and bring its version
+ * up to date. */
+static notmuch_status_t
+_notmuch_database_add_features (notmuch_database_t *notmuch,
+				enum _notmuch_features new_features,
+				void (*progress_notify)(void *closure,
+							double progress),
+				void *closure)
 {
     void *local = talloc_new (NULL);
     Xapian::TermIterator t, t_end;
@@ -855,22 +1303,15 @@ notmuch_database_upgrade (notmuch_database_t *notmuch,
     struct sigaction action;
     struct itimerval timerval;
     bool timer_is_active = false;
-    enum _notmuch_features target_features, new_features;
+    enum _notmuch_features target_features;
     notmuch_status_t status;
     notmuch_private_status_t private_status;
     notmuch_query_t *query = NULL;
     unsigned int count = 0, total = 0;
 
-    if (_notmuch_database_mode (notmuch) != NOTMUCH_DATABASE_MODE_READ_WRITE)
-	return NOTMUCH_STATUS_READ_ONLY_DATABASE;
-
     db = notmuch->writable_xapian_db;
 
-    target_features = notmuch->features | NOTMUCH_FEATURES_CURRENT;
-    new_features = NOTMUCH_FEATURES_CURRENT & ~notmuch->features;
-
-    if (! notmuch_database_needs_upgrade (notmuch))
-	return NOTMUCH_STATUS_SUCCESS;
+    target_features = notmuch->features | new_features;
 
     if (progress_notify) {
 	/* Set up our handler for SIGALRM */
@@ -893,7 +1334,8 @@ notmuch_database_upgrade (notmuch_database_t *notmuch,
     /* Figure out how much total work we need to do. */
     if (new_features &
 	(NOTMUCH_FEATURE_FILE_TERMS | NOTMUCH_FEATURE_BOOL_FOLDER |
-	 NOTMUCH_FEATURE_LAST_MOD)) {
+	 NOTMUCH_FEATURE_LAST_MOD | NOTMUCH_FEATURE_THREAD_ID_VALUES |
+	 NOTMUCH_FEATURE_RECIPIENT_VALUES | NOTMUCH_FEATURE_FILE_COUNT_VALUES)) {
 	query = notmuch_query_create (notmuch, "");
 	unsigned msg_count;
 
@@ -928,7 +1370,8 @@ notmuch_database_upgrade (notmuch_database_t *notmuch,
     /* Perform per-message upgrades. */
     if (new_features &
 	(NOTMUCH_FEATURE_FILE_TERMS | NOTMUCH_FEATURE_BOOL_FOLDER |
-	 NOTMUCH_FEATURE_LAST_MOD)) {
+	 NOTMUCH_FEATURE_LAST_MOD | NOTMUCH_FEATURE_THREAD_ID_VALUES |
+	 NOTMUCH_FEATURE_RECIPIENT_VALUES | NOTMUCH_FEATURE_FILE_COUNT_VALUES)) {
 	notmuch_messages_t *messages;
 	notmuch_message_t *message;
 	char *filename;
@@ -976,6 +1419,18 @@ notmuch_database_upgrade (notmuch_database_t *notmuch,
 	    if (new_features & NOTMUCH_FEATURE_LAST_MOD)
 		_notmuch_message_upgrade_last_mod (message);
 
+	    /* Copy the thread ID of each message into its value slot. */
+	    if (new_features & NOTMUCH_FEATURE_THREAD_ID_VALUES)
+		_notmuch_message_upgrade_thread_id (message);
+
+	    /* Read the recipients of each message from its file once,
+	     * so that "notmuch address" need not. */
+	    if (new_features & NOTMUCH_FEATURE_RECIPIENT_VALUES)
+		_notmuch_message_upgrade_recipients (message);
+
+	    if (new_features & NOTMUCH_FEATURE_FILE_COUNT_VALUES)
+		_notmuch_message_upgrade_file_count (message);
+
 	    _notmuch_message_sync (message);
 
 	    notmuch_message_destroy (message);
@@ -1111,6 +1566,82 @@ notmuch_database_upgrade (notmuch_database_t *notmuch,
     return status;
 }
 
+/* Upgrade the current database.
+ *
+ * After opening a database in read-write mode, the client should
+ * check if an upgrade is needed (notmuch_database_needs_upgrade) and
+ * if so, upgrade with this function before making any modifications.
+ *
+ * The optional progress_notify callback can be used by the caller to
+ * provide progress indication to the user. If non-NULL it will be
+ * called periodically with 'count' as the number of messages upgraded
+ * so far and 'total' the overall number of messages that will be
+ * converted.
+ */
+notmuch_status_t
+notmuch_database_upgrade (notmuch_database_t *notmuch,
+			  void (*progress_notify)(void *closure,
+						  double progress),
+			  void *closure)
+{
+    if (_notmuch_database_mode (notmuch) != NOTMUCH_DATABASE_MODE_READ_WRITE)
+	return NOTMUCH_STATUS_READ_ONLY_DATABASE;
+
+    if (! notmuch_database_needs_upgrade (notmuch))
+	return NOTMUCH_STATUS_SUCCESS;
+
+    return _notmuch_database_add_features (notmuch,
+					   NOTMUCH_FEATURES_CURRENT & ~notmuch->features,
+					   progress_notify, closure);
+}
+
+notmuch_status_t
+notmuch_database_set_message_values (notmuch_database_t *notmuch,
+				     notmuch_bool_t enable)
+{
+    _notmuch_features old_features = notmuch->features;
+    notmuch_status_t status = NOTMUCH_STATUS_SUCCESS;
+    void *local;
+
+    status = _notmuch_database_ensure_writable (notmuch);
+    if (status)
+	return status;
+
+    if (notmuch_database_needs_upgrade (notmuch))
+	return NOTMUCH_STATUS_UPGRADE_REQUIRED;
+
+    if (enable) {
+	if (! (NOTMUCH_FEATURES_MESSAGE_VALUES & ~notmuch->features))
+	    return NOTMUCH_STATUS_SUCCESS;
+	return _notmuch_database_add_features (notmuch,
+					       NOTMUCH_FEATURES_MESSAGE_VALUES & ~notmuch->features,
+					       NULL, NULL);
+    }
+
+    if (! (notmuch->features & NOTMUCH_FEATURES_MESSAGE_VALUES))
+	return NOTMUCH_STATUS_SUCCESS;
+
+    /* The values are left in place: they are ignored, and rewritten
+     * if the feature is turned on again. */
+    local = talloc_new (notmuch);
+    notmuch->features &= ~NOTMUCH_FEATURES_MESSAGE_VALUES;
+
+    try {
+	notmuch->writable_xapian_db->set_metadata ("features",
+						   _notmuch_database_print_features (
+						       local, notmuch->features));
+    } catch (const Xapian::Error &error) {
+	_notmuch_database_log (notmuch, "A Xapian exception occurred changing message values: %s.\n",
+			       error.get_msg ().c_str ());
+	notmuch->exception_reported = true;
+	status = _notmuch_xapian_error ();
+	notmuch->features = old_features;
+    }
+
+    talloc_free (local);
+    return status;
+}
+
 notmuch_status_t
 notmuch_database_begin_atomic (notmuch_database_t *notmuch)
 {
@@ -1139,6 +1670,9 @@ notmuch_status_t
 notmuch_database_end_atomic (notmuch_database_t *notmuch)
 {
     Xapian::WritableDatabase *db;
+    notmuch_status_t status;
+    const char *thresh;
+    bool commit;
 
     if (notmuch->atomic_nesting == 0)
 	return NOTMUCH_STATUS_UNBALANCED_ATOMIC;
@@ -1147,21 +1681,29 @@ notmuch_database_end_atomic (notmuch_database_t *notmuch)
 	notmuch->atomic_nesting > 1)
 	goto DONE;
 
+    /* Xapian never flushes on a non-flushed commit, even if the
+     * flush threshold is 1.  However, we rely on flushing to test
+     * atomicity. On the other hand, we can't straight replace
+     * XAPIAN_FLUSH_THRESHOLD with our autocommit counter, because
+     * the former also applies outside notmuch atomic
+     * commits. Hence the follow complicated  test */
+    thresh = getenv ("XAPIAN_FLUSH_THRESHOLD");
+    commit = (notmuch->transaction_threshold > 0 &&
+	      notmuch->transaction_count + 1 >= notmuch->transaction_threshold) ||
+	     (thresh && atoi (thresh) == 1);
+
+    /* Summaries are normally committed along with the changes they
+     * reflect; until then, readers notice they are out of date. */
+    status = _notmuch_thread_summary_flush_batch (notmuch, commit);
+    if (status)
+	return status;
+
     db = notmuch->writable_xapian_db;
     try {
 	db->commit_transaction ();
 	notmuch->transaction_count++;
 
-	/* Xapian never flushes on a non-flushed commit, even if the
-	 * flush threshold is 1.  However, we rely on flushing to test
-	 * atomicity. On the other hand, we can't straight replace
-	 * XAPIAN_FLUSH_THRESHOLD with our autocommit counter, because
-	 * the former also applies outside notmuch atomic
-	 * commits. Hence the follow complicated  test */
-	const char *thresh = getenv ("XAPIAN_FLUSH_THRESHOLD");
-	if ((notmuch->transaction_threshold > 0 &&
-	     notmuch->transaction_count >= notmuch->transaction_threshold) ||
-	    (thresh && atoi (thresh) == 1)) {
+	if (commit) {
 	    db->commit ();
 	    notmuch->transaction_count = 0;
 	}
@@ -1191,6 +1733,20 @@ notmuch_database_get_revision (notmuch_database_t *notmuch,
     return notmuch->revision;
 }
 
+unsigned int
+notmuch_database_get_last_doc_id (notmuch_database_t *notmuch)
+{
+    try {
+	return notmuch->xapian_db->get_lastdocid ();
+    } catch (const Xapian::Error &error) {
+	_notmuch_database_log (notmuch,
+			       "A Xapian exception occurred getting the last document id: %s\n",
+			       error.get_msg ().c_str ());
+	notmuch->exception_reported = true;
+	return 0;
+    }
+}
+
 /* We allow the user to use arbitrarily long paths for directories. But
  * we have a term-length limit. So if we exceed that, we'll use the
  * SHA-1 of the path for the database term.
@@ -1314,16 +1870,60 @@ _notmuch_database_find_directory_id (notmuch_database_t *notmuch,
     return NOTMUCH_STATUS_SUCCESS;
 }
 
+/* Directory documents are never rewritten with a different path, so
+ * the mapping from document id to path can be kept for as long as
+ * the current view of the database is valid. */
 const char *
 _notmuch_database_get_directory_path (void *ctx,
 				      notmuch_database_t *notmuch,
 				      unsigned int doc_id)
 {
     Xapian::Document document;
+    const char *path;
+    char *copy;
+
+    if (notmuch->directory_paths == NULL) {
+	notmuch->directory_paths = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+	notmuch->directory_paths_view = notmuch->view;
+    } else if (notmuch->directory_paths_view != notmuch->view) {
+	g_hash_table_remove_all (notmuch->directory_paths);
+	notmuch->directory_paths_view = notmuch->view;
+    }
+
+    path = (const char *) g_hash_table_lookup (notmuch->directory_paths,
+					       GUINT_TO_POINTER (doc_id));
+    if (path) {
+	_notmuch_trace_count (notmuch, NOTMUCH_TRACE_DIRECTORY_CACHE_HIT, 1);
+	return talloc_strdup (ctx, path);
+    }
+
+    _notmuch_trace_count (notmuch, NOTMUCH_TRACE_DIRECTORY_CACHE_MISS, 1);
 
     document = find_document_for_doc_id (notmuch, doc_id);
 
-    return talloc_strdup (ctx, document.get_data ().c_str ());
+    copy = g_strdup (document.get_data ().c_str ());
+    g_hash_table_insert (notmuch->directory_paths, GUINT_TO_POINTER (doc_id), copy);
+
+    return talloc_strdup (ctx, copy);
+}
+
+void
+_notmuch_database_forget_directory_path (notmuch_database_t *notmuch,
+					 unsigned int doc_id)
+{
+    if (notmuch->directory_paths)
+	g_hash_table_remove (notmuch->directory_paths, GUINT_TO_POINTER (doc_id));
+}
+
+void
+notmuch_database_get_directory_cache_stats (notmuch_database_t *notmuch,
+					    unsigned long *hits,
+					    unsigned long *misses)
+{
+    if (hits)
+	*hits = notmuch->trace[NOTMUCH_TRACE_DIRECTORY_CACHE_HIT];
+    if (misses)
+	*misses = notmuch->trace[NOTMUCH_TRACE_DIRECTORY_CACHE_MISS];
 }
 
 /* Given a legal 'filename' for the database, (either relative to
@@ -316,6 +316,8 @@ notmuch_directory_delete (notmuch_directory_t *directory)
     try {
 	directory->notmuch->
 	    writable_xapian_db->delete_document (directory->document_id);
+	_notmuch_database_forget_directory_path (directory->notmuch,
+						 directory->document_id);
     } catch (const Xapian::Error &error) {
 	_notmuch_database_log (directory->notmuch,
 			       "A Xapian exception occurred deleting directory entry: %s.\n",
@@ -0,0 +1,339 @@
+/* doc-id-set.c - Sets of document ids
+ *
+ * This file is part of notmuch.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see https://www.gnu.org/licenses/ .
+ */
+
+#include "notmuch-private.h"
+
+#include <glib.h>
+#include <stdint.h>
+
+/* A set of document ids, used to match the results of a query to the
+ * threads built from them. It is split into chunks of 2^16 ids, and
+ * each chunk holding any id is stored in whichever of three forms
+ * is the smallest for it (as in "roaring" bitmaps):
+ *
+ *   o a sorted array of the low 16 bits of its ids, for sparse chunks;
+ *   o a bitmap of 2^16 bits, for dense chunks;
+ *   o a sorted array of runs of consecutive ids, for chunks that are
+ *     mostly contiguous (as for a query matching everything).
+ *
+ * So a query matching a handful of messages costs a few bytes, where
+ * a single bitmap would be as large as the database.
+ *
+ * The set cannot grow once created, but ids can be removed. A run
+ * chunk is turned into a bitmap on its first removal.
+ *
+ * Chunk contents are allocated with GLib (which aborts when out of
+ * memory, like the GArray the ids come from) so that removal cannot
+ * fail.
+ */
+
+#define CHUNK_BITS 16
+#define CHUNK_SIZE (1U << CHUNK_BITS)
+#define CHUNK_LOW(doc_id) ((doc_id) & (CHUNK_SIZE - 1))
+#define CHUNK_WORDS (CHUNK_SIZE / 64)
+
+/* Arrays larger than this take more room than a bitmap. */
+#define CHUNK_ARRAY_MAX (CHUNK_WORDS * sizeof (uint64_t) / sizeof (uint16_t))
+
+typedef enum {
+    CHUNK_ARRAY,
+    CHUNK_BITMAP,
+    CHUNK_RUNS,
+} _chunk_type_t;
+
+typedef struct {
+    uint16_t start;
+    /* number of ids after start */
+    uint16_t length;
+} _run_t;
+
+typedef struct {
+    /* doc_id >> CHUNK_BITS of the ids in this chunk */
+    unsigned int key;
+    _chunk_type_t type;
+    /* number of values (for arrays) or runs */
+    unsigned int count;
+    /* Only the one matching 'type' is set. */
+    uint16_t *values;
+    uint64_t *words;
+    _run_t *runs;
+} _chunk_t;
+
+struct _notmuch_doc_id_set {
+    _chunk_t *chunks;
+    unsigned int count;
+    /* Index of the chunk last looked up: consecutive lookups are
+     * often close to each other. */
+    unsigned int last;
+};
+
+static int
+_doc_id_set_destructor (notmuch_doc_id_set_t *doc_ids)
+{
+    for (unsigned int i = 0; i < doc_ids->count; i++) {
+	g_free (doc_ids->chunks[i].values);
+	g_free (doc_ids->chunks[i].words);
+	g_free (doc_ids->chunks[i].runs);
+    }
+    g_free (doc_ids->chunks);
+
+    return 0;
+}
+
+static int
+_compare_doc_id (const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *) a, y = *(const unsigned int *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Fill 'chunk' from the 'n' sorted, distinct ids in 'ids', all of
+ * which share the same key. */
+static void
+_chunk_init (_chunk_t *chunk, const unsigned int *ids, unsigned int n)
+{
+    const size_t bitmap_size = CHUNK_WORDS * sizeof (uint64_t);
+    size_t array_size, runs_size;
+    unsigned int runs = 1, i, j;
+
+    for (i = 1; i < n; i++) {
+	if (ids[i] != ids[i - 1] + 1)
+	    runs++;
+    }
+
+    memset (chunk, 0, sizeof (*chunk));
+    chunk->key = ids[0] >> CHUNK_BITS;
+
+    array_size = n <= CHUNK_ARRAY_MAX ? n * sizeof (uint16_t) : SIZE_MAX;
+    runs_size = runs * sizeof (_run_t);
+
+    if (runs_size < array_size && runs_size < bitmap_size) {
+	chunk->type = CHUNK_RUNS;
+	chunk->count = runs;
+	chunk->runs = g_new (_run_t, runs);
+	for (i = 0, j = 0; i < n; i++) {
+	    if (i > 0 && ids[i] == ids[i - 1] + 1) {
+		chunk->runs[j - 1].length++;
+	    } else {
+		chunk->runs[j].start = CHUNK_LOW (ids[i]);
+		chunk->runs[j].length = 0;
+		j++;
+	    }
+	}
+    } else if (n <= CHUNK_ARRAY_MAX) {
+	chunk->type = CHUNK_ARRAY;
+	chunk->count = n;
+	chunk->values = g_new (uint16_t, n);
+	for (i = 0; i < n; i++)
+	    chunk->values[i] = CHUNK_LOW (ids[i]);
+    } else {
+	chunk->type = CHUNK_BITMAP;
+	chunk->count = 0;
+	chunk->words = g_new0 (uint64_t, CHUNK_WORDS);
+	for (i = 0; i < n; i++) {
+	    unsigned int low = CHUNK_LOW (ids[i]);
+	    chunk->words[low / 64] |= UINT64_C (1) << (low % 64);
+	}
+    }
+}
+
+notmuch_doc_id_set_t *
+_notmuch_doc_id_set_create (void *ctx, const unsigned int *ids, unsigned int n)
+{
+    notmuch_doc_id_set_t *doc_ids;
+    unsigned int *sorted;
+    unsigned int distinct = 0, chunks = 0, i, start;
+
+    doc_ids = talloc_zero (ctx, notmuch_doc_id_set_t);
+    if (doc_ids == NULL)
+	return NULL;
+    talloc_set_destructor (doc_ids, _doc_id_set_destructor);
+
+    if (n == 0)
+	return doc_ids;
+
+    sorted = g_new (unsigned int, n);
+    memcpy (sorted, ids, n * sizeof (unsigned int));
+    qsort (sorted, n, sizeof (unsigned int), _compare_doc_id);
+    for (i = 0; i < n; i++) {
+	if (distinct > 0 && sorted[i] == sorted[distinct - 1])
+	    continue;
+	if (distinct == 0 ||
+	    (sorted[i] >> CHUNK_BITS) != (sorted[distinct - 1] >> CHUNK_BITS))
+	    chunks++;
+	sorted[distinct++] = sorted[i];
+    }
+
+    doc_ids->chunks = g_new (_chunk_t, chunks);
+
+    for (start = 0, i = 1; i <= distinct; i++) {
+	if (i == distinct || (sorted[i] >> CHUNK_BITS) != (sorted[start] >> CHUNK_BITS)) {
+	    _chunk_init (&doc_ids->chunks[doc_ids->count++], sorted + start, i - start);
+	    start = i;
+	}
+    }
+
+    g_free (sorted);
+
+    return doc_ids;
+}
+
+/* Return the chunk that would hold 'doc_id', or NULL if there is
+ * none. */
+static _chunk_t *
+_doc_id_set_find_chunk (notmuch_doc_id_set_t *doc_ids, unsigned int doc_id)
+{
+    unsigned int key = doc_id >> CHUNK_BITS;
+    unsigned int lo = 0, hi = doc_ids->count;
+
+    if (doc_ids->count == 0)
+	return NULL;
+
+    if (doc_ids->chunks[doc_ids->last].key == key)
+	return &doc_ids->chunks[doc_ids->last];
+
+    while (lo < hi) {
+	unsigned int mid = lo + (hi - lo) / 2;
+
+	if (doc_ids->chunks[mid].key < key)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+
+    if (lo == doc_ids->count || doc_ids->chunks[lo].key != key)
+	return NULL;
+
+    doc_ids->last = lo;
+    return &doc_ids->chunks[lo];
+}
+
+/* Return the position of the first value of the array chunk not less
+ * than 'low'. */
+static unsigned int
+_array_lower_bound (const _chunk_t *chunk, unsigned int low)
+{
+    unsigned int lo = 0, hi = chunk->count;
+
+    while (lo < hi) {
+	unsigned int mid = lo + (hi - lo) / 2;
+
+	if (chunk->values[mid] < low)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+
+    return lo;
+}
+
+/* Return whether the run chunk contains 'low'. */
+static bool
+_runs_contain (const _chunk_t *chunk, unsigned int low)
+{
+    unsigned int lo = 0, hi = chunk->count;
+
+    /* Find the last run starting at or before low. */
+    while (lo < hi) {
+	unsigned int mid = lo + (hi - lo) / 2;
+
+	if (chunk->runs[mid].start <= low)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+
+    return lo > 0 &&
+	   low <= (unsigned int) chunk->runs[lo - 1].start + chunk->runs[lo - 1].length;
+}
+
+bool
+_notmuch_doc_id_set_contains (notmuch_doc_id_set_t *doc_ids,
+			      unsigned int doc_id)
+{
+    _chunk_t *chunk = _doc_id_set_find_chunk (doc_ids, doc_id);
+    unsigned int low = CHUNK_LOW (doc_id);
+    unsigned int pos;
+
+    if (chunk == NULL)
+	return false;
+
+    switch (chunk->type) {
+    case CHUNK_ARRAY:
+	pos = _array_lower_bound (chunk, low);
+	return pos < chunk->count && chunk->values[pos] == low;
+    case CHUNK_BITMAP:
+	return (chunk->words[low / 64] >> (low % 64)) & 1;
+    case CHUNK_RUNS:
+	return _runs_contain (chunk, low);
+    }
+
+    return false;
+}
+
+static void
+_runs_to_bitmap (_chunk_t *chunk)
+{
+    uint64_t *words = g_new0 (uint64_t, CHUNK_WORDS);
+
+    for (unsigned int i = 0; i < chunk->count; i++) {
+	unsigned int low = chunk->runs[i].start;
+	unsigned int end = low + chunk->runs[i].length;
+
+	for (; low <= end; low++)
+	    words[low / 64] |= UINT64_C (1) << (low % 64);
+    }
+
+    g_free (chunk->runs);
+    chunk->runs = NULL;
+    chunk->type = CHUNK_BITMAP;
+    chunk->count = 0;
+    chunk->words = words;
+}
+
+void
+_notmuch_doc_id_set_remove (notmuch_doc_id_set_t *doc_ids,
+			    unsigned int doc_id)
+{
+    _chunk_t *chunk = _doc_id_set_find_chunk (doc_ids, doc_id);
+    unsigned int low = CHUNK_LOW (doc_id);
+    unsigned int pos;
+
+    if (chunk == NULL)
+	return;
+
+    switch (chunk->type) {
+    case CHUNK_ARRAY:
+	pos = _array_lower_bound (chunk, low);
+	if (pos < chunk->count && chunk->values[pos] == low) {
+	    memmove (chunk->values + pos, chunk->values + pos + 1,
+		     (chunk->count - pos - 1) * sizeof (uint16_t));
+	    chunk->count--;
+	}
+	break;
+    case CHUNK_RUNS:
+	if (! _runs_contain (chunk, low))
+	    break;
+	_runs_to_bitmap (chunk);
+	/* fall through */
+    case CHUNK_BITMAP:
+	chunk->words[low / 64] &= ~(UINT64_C (1) << (low % 64));
+	break;
+    }
+}
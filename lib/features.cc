@@ -33,6 +33,24 @@ static const struct {
      * 'body:' */
     { NOTMUCH_FEATURE_UNPREFIX_BODY_ONLY,
       "index body and headers separately", "w" },
+    /* Readers that don't know about thread summaries just build
+     * threads from their messages, but writers must keep them up to
+     * date. */
+    { NOTMUCH_FEATURE_THREAD_SUMMARIES,
+      "thread summaries", "w" },
+    /* Readers fall back to the thread terms of messages without a
+     * thread ID value, but writers must keep the values in sync with
+     * the terms. */
+    { NOTMUCH_FEATURE_THREAD_ID_VALUES,
+      "thread IDs in database", "w" },
+    /* Readers without this feature read recipients from the message
+     * files, but writers must store them. */
+    { NOTMUCH_FEATURE_RECIPIENT_VALUES,
+      "to/cc/bcc in database", "w" },
+    /* Readers without this feature count the filenames of each
+     * message, but writers must keep the counts up to date. */
+    { NOTMUCH_FEATURE_FILE_COUNT_VALUES,
+      "file counts in database", "w" },
 };
 
 char *
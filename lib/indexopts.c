@@ -22,6 +22,7 @@
 
 struct _notmuch_indexopts {
     _notmuch_crypto_t crypto;
+    bool expect_renames;
 };
 
 notmuch_indexopts_t *
@@ -32,6 +33,7 @@ notmuch_database_get_default_indexopts (notmuch_database_t *db)
     if (! ret)
 	return ret;
     ret->crypto.decrypt = NOTMUCH_DECRYPT_AUTO;
+    ret->expect_renames = true;
 
     char *decrypt_policy;
     notmuch_status_t err = notmuch_database_get_config (db, "index.decrypt", &decrypt_policy);
@@ -78,6 +80,24 @@ notmuch_indexopts_get_decrypt_policy (const notmuch_indexopts_t *indexopts)
     return indexopts->crypto.decrypt;
 }
 
+notmuch_status_t
+notmuch_indexopts_set_expect_renames (notmuch_indexopts_t *indexopts,
+				      notmuch_bool_t expect_renames)
+{
+    if (! indexopts)
+	return NOTMUCH_STATUS_NULL_POINTER;
+    indexopts->expect_renames = expect_renames;
+    return NOTMUCH_STATUS_SUCCESS;
+}
+
+notmuch_bool_t
+notmuch_indexopts_get_expect_renames (const notmuch_indexopts_t *indexopts)
+{
+    if (! indexopts)
+	return true;
+    return indexopts->expect_renames;
+}
+
 void
 notmuch_indexopts_destroy (notmuch_indexopts_t *indexopts)
 {
@@ -24,7 +24,7 @@
 
 #include <gmime/gmime.h>
 
-#include <glib.h> /* GHashTable */
+#include <glib.h> /* GHashTable, GThreadPool */
 
 struct _notmuch_message_file {
     /* open stream to (possibly gzipped) file */
@@ -35,6 +35,10 @@ struct _notmuch_message_file {
     GHashTable *headers;
 
     GMimeMessage *message;
+
+    /* Message ID found by _notmuch_message_file_get_headers, so that
+     * a file parsed in the background is not hashed twice. */
+    char *message_id;
 };
 
 static int
@@ -108,6 +112,37 @@ _notmuch_message_file_open (notmuch_database_t *notmuch,
     return _notmuch_message_file_open_ctx (notmuch, NULL, filename);
 }
 
+/* Open the already resolved absolute 'path' with 'ctx' as the talloc
+ * owner. Unlike _notmuch_message_file_open_ctx, this neither consults
+ * nor logs to the database, so it may be called from the parse queue
+ * threads below. */
+static notmuch_message_file_t *
+_notmuch_message_file_open_path (void *ctx, const char *path)
+{
+    notmuch_message_file_t *message;
+
+    message = talloc_zero (ctx, notmuch_message_file_t);
+    if (unlikely (message == NULL))
+	return NULL;
+
+    message->filename = talloc_strdup (message, path);
+    if (message->filename == NULL)
+	goto FAIL;
+
+    talloc_set_destructor (message, _notmuch_message_file_destructor);
+
+    message->stream = g_mime_stream_gzfile_open (message->filename);
+    if (message->stream == NULL)
+	goto FAIL;
+
+    return message;
+
+  FAIL:
+    talloc_free (message);
+
+    return NULL;
+}
+
 const char *
 _notmuch_message_file_get_filename (notmuch_message_file_t *message_file)
 {
@@ -356,6 +391,13 @@ _notmuch_message_file_get_headers (notmuch_message_file_t *message_file,
 	goto DONE;
     }
 
+    if (message_file->message_id) {
+	message_id = talloc_strdup (message_file, message_file->message_id);
+	if (message_id == NULL)
+	    ret = NOTMUCH_STATUS_OUT_OF_MEMORY;
+	goto DONE;
+    }
+
     /* Now that we're sure it's mail, the first order of business
      * is to find a message ID (or else create one ourselves).
      */
@@ -385,6 +427,9 @@ _notmuch_message_file_get_headers (notmuch_message_file_t *message_file,
 	message_id = talloc_asprintf (message_file, "notmuch-sha1-%s", sha1);
 	free (sha1);
     }
+
+    /* Callers free the ID they get, so keep a copy. */
+    message_file->message_id = talloc_strdup (message_file, message_id);
   DONE:
     if (ret == NOTMUCH_STATUS_SUCCESS) {
 	if (from_out)
@@ -400,3 +445,302 @@ _notmuch_message_file_get_headers (notmuch_message_file_t *message_file,
     }
     return ret;
 }
+
+/* Headers longer than this are left to GMime. */
+#define PEEK_HEADER_MAX 4096
+
+char *
+_notmuch_message_file_peek_message_id (void *ctx, const char *path)
+{
+    FILE *file;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+    char *value = NULL;
+    size_t value_len = 0;
+    bool in_message_id = false;
+    bool first = true;
+    char *message_id = NULL;
+
+    file = fopen (path, "r");
+    if (file == NULL)
+	return NULL;
+
+    while ((len = getline (&line, &line_size, file)) != -1) {
+	/* Strip the line ending, including a CR before the LF. */
+	while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+	    line[--len] = '\0';
+
+	if (first) {
+	    first = false;
+	    /* gzip magic, or an mbox "From " line */
+	    if ((len >= 2 && line[0] == 0x1f && (unsigned char) line[1] == 0x8b) ||
+		strncmp (line, "From ", 5) == 0)
+		goto DONE;
+	}
+
+	/* The blank line ending the header block. */
+	if (len == 0)
+	    break;
+
+	if (*line == ' ' || *line == '\t') {
+	    /* Continuation of the previous header. */
+	    if (! in_message_id)
+		continue;
+	} else if (value) {
+	    /* Only the first Message-ID counts, as with GMime. */
+	    break;
+	} else {
+	    in_message_id = (strncasecmp (line, "message-id:", 11) == 0);
+	    if (! in_message_id)
+		continue;
+	    memmove (line, line + 11, len - 10);
+	    len -= 11;
+	}
+
+	if (value_len + len > PEEK_HEADER_MAX)
+	    goto DONE;
+
+	value = talloc_realloc (ctx, value, char, value_len + len + 1);
+	if (value == NULL)
+	    goto DONE;
+	memcpy (value + value_len, line, len + 1);
+	value_len += len;
+    }
+
+    if (value == NULL || ferror (file))
+	goto DONE;
+
+    /* Leave anything GMime might decode differently to GMime. */
+    for (size_t i = 0; i < value_len; i++) {
+	if ((unsigned char) value[i] >= 0x80 || value[i] == '\0')
+	    goto DONE;
+    }
+    if (strstr (value, "=?"))
+	goto DONE;
+
+    message_id = _notmuch_message_id_parse (ctx, value, NULL);
+
+  DONE:
+    talloc_free (value);
+    free (line);
+    fclose (file);
+
+    return message_id;
+}
+
+/* The parse queue lets the (single) thread writing to the database
+ * hand message files to a pool of threads that open and parse them
+ * ahead of time. Only the parsing is done in the background: term
+ * generation, thread linking and everything else touching Xapian
+ * stays with the caller.
+ *
+ * Each job is its own talloc root so that the main thread and the
+ * worker never allocate from the same talloc hierarchy at the same
+ * time; ownership passes back to the main thread once 'done' is set
+ * under the queue mutex. A job dropped before it is done stays with
+ * the worker, which frees it instead.
+ */
+typedef struct {
+    char *path;
+    notmuch_message_file_t *message_file;
+    bool done;
+    bool dropped;
+} _notmuch_parse_job_t;
+
+struct _notmuch_parse_queue {
+    GThreadPool *pool;
+    GMutex mutex;
+    GCond cond;
+
+    /* filename (as passed to _notmuch_parse_queue_push) -> job */
+    GHashTable *jobs;
+
+    /* jobs dropped before they were done, until their worker frees
+     * them (or the queue, for those no worker started on) */
+    GHashTable *dropped;
+};
+
+static void
+_parse_job_run (gpointer data, gpointer user_data)
+{
+    _notmuch_parse_job_t *job = (_notmuch_parse_job_t *) data;
+    notmuch_parse_queue_t *queue = (notmuch_parse_queue_t *) user_data;
+    notmuch_message_file_t *message_file;
+    bool dropped;
+
+    g_mutex_lock (&queue->mutex);
+    dropped = job->dropped;
+    if (dropped)
+	g_hash_table_remove (queue->dropped, job);
+    g_mutex_unlock (&queue->mutex);
+    if (dropped)
+	return;
+
+    message_file = _notmuch_message_file_open_path (job, job->path);
+    if (message_file &&
+	_notmuch_message_file_get_headers (message_file, NULL, NULL, NULL, NULL,
+					   NULL) == NOTMUCH_STATUS_SUCCESS) {
+	/* Also decode the headers needed for thread linking, and the
+	 * recipients stored in the database. */
+	_notmuch_message_file_get_header (message_file, "in-reply-to");
+	_notmuch_message_file_get_header (message_file, "references");
+	_notmuch_message_file_get_header (message_file, "cc");
+	_notmuch_message_file_get_header (message_file, "bcc");
+    }
+
+    g_mutex_lock (&queue->mutex);
+    if (job->dropped) {
+	g_hash_table_remove (queue->dropped, job);
+    } else {
+	job->message_file = message_file;
+	job->done = true;
+	g_cond_broadcast (&queue->cond);
+    }
+    g_mutex_unlock (&queue->mutex);
+}
+
+static void
+_parse_job_free (gpointer data)
+{
+    talloc_free (data);
+}
+
+static int
+_notmuch_parse_queue_destructor (notmuch_parse_queue_t *queue)
+{
+    /* Drop jobs no thread has started on yet, and wait for the
+     * running ones, before freeing what they write to. */
+    if (queue->pool)
+	g_thread_pool_free (queue->pool, TRUE, TRUE);
+
+    if (queue->jobs)
+	g_hash_table_destroy (queue->jobs);
+
+    if (queue->dropped)
+	g_hash_table_destroy (queue->dropped);
+
+    g_cond_clear (&queue->cond);
+    g_mutex_clear (&queue->mutex);
+
+    return 0;
+}
+
+notmuch_parse_queue_t *
+_notmuch_parse_queue_create (void *ctx, unsigned int threads)
+{
+    notmuch_parse_queue_t *queue;
+
+    /* Make sure GMime is initialized before any worker needs it. */
+    _notmuch_init ();
+
+    queue = talloc_zero (ctx, notmuch_parse_queue_t);
+    if (unlikely (queue == NULL))
+	return NULL;
+
+    g_mutex_init (&queue->mutex);
+    g_cond_init (&queue->cond);
+    talloc_set_destructor (queue, _notmuch_parse_queue_destructor);
+
+    queue->jobs = g_hash_table_new_full (g_str_hash, g_str_equal,
+					 NULL, _parse_job_free);
+    queue->dropped = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+					    _parse_job_free, NULL);
+    queue->pool = g_thread_pool_new (_parse_job_run, queue, threads,
+				     FALSE, NULL);
+    if (queue->pool == NULL) {
+	talloc_free (queue);
+	return NULL;
+    }
+
+    return queue;
+}
+
+notmuch_status_t
+_notmuch_parse_queue_push (notmuch_parse_queue_t *queue,
+			   const char *filename,
+			   const char *path)
+{
+    _notmuch_parse_job_t *job;
+    char *key;
+
+    g_mutex_lock (&queue->mutex);
+    job = (_notmuch_parse_job_t *) g_hash_table_lookup (queue->jobs, filename);
+    g_mutex_unlock (&queue->mutex);
+    if (job)
+	return NOTMUCH_STATUS_SUCCESS;
+
+    job = talloc_zero (NULL, _notmuch_parse_job_t);
+    if (unlikely (job == NULL))
+	return NOTMUCH_STATUS_OUT_OF_MEMORY;
+
+    /* The key is never touched by the worker, so it is safe to keep
+     * it in the job's talloc hierarchy. */
+    key = talloc_strdup (job, filename);
+    job->path = talloc_strdup (job, path);
+    if (key == NULL || job->path == NULL) {
+	talloc_free (job);
+	return NOTMUCH_STATUS_OUT_OF_MEMORY;
+    }
+
+    g_mutex_lock (&queue->mutex);
+    g_hash_table_insert (queue->jobs, key, job);
+    g_mutex_unlock (&queue->mutex);
+
+    if (! g_thread_pool_push (queue->pool, job, NULL)) {
+	g_mutex_lock (&queue->mutex);
+	g_hash_table_remove (queue->jobs, key);
+	g_mutex_unlock (&queue->mutex);
+	return NOTMUCH_STATUS_OUT_OF_MEMORY;
+    }
+
+    return NOTMUCH_STATUS_SUCCESS;
+}
+
+notmuch_message_file_t *
+_notmuch_parse_queue_take (notmuch_parse_queue_t *queue,
+			   const char *filename)
+{
+    _notmuch_parse_job_t *job;
+    notmuch_message_file_t *message_file = NULL;
+
+    g_mutex_lock (&queue->mutex);
+    job = (_notmuch_parse_job_t *) g_hash_table_lookup (queue->jobs, filename);
+    if (job) {
+	while (! job->done)
+	    g_cond_wait (&queue->cond, &queue->mutex);
+	g_hash_table_steal (queue->jobs, filename);
+    }
+    g_mutex_unlock (&queue->mutex);
+
+    if (job) {
+	if (job->message_file)
+	    message_file = talloc_steal (NULL, job->message_file);
+	talloc_free (job);
+    }
+
+    return message_file;
+}
+
+void
+_notmuch_parse_queue_drop (notmuch_parse_queue_t *queue,
+			   const char *filename)
+{
+    _notmuch_parse_job_t *job;
+    bool done = false;
+
+    g_mutex_lock (&queue->mutex);
+    job = (_notmuch_parse_job_t *) g_hash_table_lookup (queue->jobs, filename);
+    if (job) {
+	g_hash_table_steal (queue->jobs, filename);
+	done = job->done;
+	if (! done) {
+	    job->dropped = true;
+	    g_hash_table_add (queue->dropped, job);
+	}
+    }
+    g_mutex_unlock (&queue->mutex);
+
+    if (done)
+	talloc_free (job);
+}
@@ -208,6 +208,7 @@ _notmuch_message_create (const void *talloc_owner,
 
     try {
 	doc = notmuch->xapian_db->get_document (doc_id);
+	_notmuch_trace_count (notmuch, NOTMUCH_TRACE_DOCUMENT_FETCH, 1);
     } catch (const Xapian::DocNotFoundError &error) {
 	if (status)
 	    *status = NOTMUCH_PRIVATE_STATUS_NO_DOCUMENT_FOUND;
@@ -349,10 +350,13 @@ static void
 _notmuch_message_ensure_metadata (notmuch_message_t *message, void *field)
 {
     Xapian::TermIterator i, end;
+    unsigned long long start;
 
     if (field && (message->last_view >= message->notmuch->view))
 	return;
 
+    start = _notmuch_trace_start (message->notmuch);
+
     const char *thread_prefix = _find_prefix ("thread"),
 	       *tag_prefix = _find_prefix ("tag"),
 	       *id_prefix = _find_prefix ("id"),
@@ -447,14 +451,19 @@ _notmuch_message_ensure_metadata (notmuch_message_t *message, void *field)
 	    /* all the way without an exception */
 	    break;
 	} catch (const Xapian::DatabaseModifiedError &error) {
-	    notmuch_status_t status = notmuch_database_reopen (message->notmuch,
-							       NOTMUCH_DATABASE_MODE_READ_ONLY);
+	    notmuch_status_t status;
+
+	    _notmuch_trace_count (message->notmuch,
+				  NOTMUCH_TRACE_MODIFIED_RETRY, 1);
+	    status = notmuch_database_reopen (message->notmuch,
+					      NOTMUCH_DATABASE_MODE_READ_ONLY);
 	    if (status != NOTMUCH_STATUS_SUCCESS)
 		INTERNAL_ERROR ("unhandled error from notmuch_database_reopen: %s\n",
 				notmuch_status_to_string (status));
 	}
     }
     message->last_view = message->notmuch->view;
+    _notmuch_trace_end (message->notmuch, NOTMUCH_TRACE_METADATA_LOAD, 1, start);
 }
 
 void
@@ -538,30 +547,55 @@ _notmuch_message_ensure_message_file (notmuch_message_t *message)
 	notmuch_message_get_database (message), message, filename);
 }
 
+/* Headers stored in message document values. */
+static const struct {
+    const char *header;
+    Xapian::valueno slot;
+    /* The feature with which all messages store this header. */
+    _notmuch_features feature;
+    /* If set, values are ignored without the feature, since writers
+     * that predate it do not update them on reindexing. */
+    bool feature_required;
+} header_values[] = {
+    { "from",		NOTMUCH_VALUE_FROM,
+      NOTMUCH_FEATURE_FROM_SUBJECT_ID_VALUES, false },
+    { "subject",	NOTMUCH_VALUE_SUBJECT,
+      NOTMUCH_FEATURE_FROM_SUBJECT_ID_VALUES, false },
+    { "message-id",	NOTMUCH_VALUE_MESSAGE_ID,
+      NOTMUCH_FEATURE_FROM_SUBJECT_ID_VALUES, false },
+    { "to",		NOTMUCH_VALUE_TO,
+      NOTMUCH_FEATURE_RECIPIENT_VALUES, true },
+    { "cc",		NOTMUCH_VALUE_CC,
+      NOTMUCH_FEATURE_RECIPIENT_VALUES, true },
+    { "bcc",		NOTMUCH_VALUE_BCC,
+      NOTMUCH_FEATURE_RECIPIENT_VALUES, true },
+};
+
 const char *
 notmuch_message_get_header (notmuch_message_t *message, const char *header)
 {
     Xapian::valueno slot = Xapian::BAD_VALUENO;
+    bool have_feature = false;
 
     /* Fetch header from the appropriate xapian value field if
      * available */
-    if (strcasecmp (header, "from") == 0)
-	slot = NOTMUCH_VALUE_FROM;
-    else if (strcasecmp (header, "subject") == 0)
-	slot = NOTMUCH_VALUE_SUBJECT;
-    else if (strcasecmp (header, "message-id") == 0)
-	slot = NOTMUCH_VALUE_MESSAGE_ID;
+    for (size_t i = 0; i < ARRAY_SIZE (header_values); i++) {
+	if (strcasecmp (header, header_values[i].header) == 0) {
+	    have_feature = message->notmuch->features & header_values[i].feature;
+	    if (have_feature || ! header_values[i].feature_required)
+		slot = header_values[i].slot;
+	    break;
+	}
+    }
 
     if (slot != Xapian::BAD_VALUENO) {
 	try {
 	    std::string value = message->doc.get_value (slot);
 
-	    /* If we have NOTMUCH_FEATURE_FROM_SUBJECT_ID_VALUES, then
-	     * empty values indicate empty headers.  If we don't, then
-	     * it could just mean we didn't record the header. */
-	    if ((message->notmuch->features &
-		 NOTMUCH_FEATURE_FROM_SUBJECT_ID_VALUES) ||
-		! value.empty ())
+	    /* If we have the feature, then empty values indicate
+	     * empty headers.  If we don't, then it could just mean we
+	     * didn't record the header. */
+	    if (have_feature || ! value.empty ())
 		return talloc_strdup (message, value.c_str ());
 
 	} catch (Xapian::Error &error) {
@@ -935,6 +969,36 @@ _notmuch_message_add_directory_terms (void *ctx, notmuch_message_t *message)
     return status;
 }
 
+/* Store the number of filenames of 'message', as found in
+ * message->doc, in NOTMUCH_VALUE_FILE_COUNT. */
+static void
+_notmuch_message_update_file_count (notmuch_message_t *message)
+{
+    const std::string direntry_prefix = _find_prefix ("file-direntry");
+    Xapian::TermIterator i = message->doc.termlist_begin ();
+    unsigned int count = 0;
+
+    if (! (message->notmuch->features & NOTMUCH_FEATURE_FILE_COUNT_VALUES))
+	return;
+
+    for (i.skip_to (direntry_prefix);
+	 i != message->doc.termlist_end () &&
+	 (*i).compare (0, direntry_prefix.size (), direntry_prefix) == 0;
+	 i++)
+	count++;
+
+    message->doc.add_value (NOTMUCH_VALUE_FILE_COUNT, Xapian::sortable_serialise (count));
+    message->modified = true;
+}
+
+/* Upgrade a message to support NOTMUCH_FEATURE_FILE_COUNT_VALUES.  The
+ * caller must call _notmuch_message_sync. */
+void
+_notmuch_message_upgrade_file_count (notmuch_message_t *message)
+{
+    _notmuch_message_update_file_count (message);
+}
+
 /* Add an additional 'filename' for 'message'.
  *
  * This change will not be reflected in the database until the next
@@ -981,6 +1045,8 @@ _notmuch_message_add_filename (notmuch_message_t *message,
 	return COERCE_STATUS (private_status, "adding file-direntry term");
     }
 
+    _notmuch_message_update_file_count (message);
+
     status = _notmuch_message_add_folder_terms (message, directory);
     if (status)
 	return status;
@@ -1032,6 +1098,8 @@ _notmuch_message_remove_filename (notmuch_message_t *message,
     if (status)
 	return status;
 
+    _notmuch_message_update_file_count (message);
+
     /* Re-synchronize "folder:" and "path:" terms for this message. */
 
     /* Remove all "folder:" terms. */
@@ -1148,6 +1216,46 @@ _notmuch_message_ensure_filename_list (notmuch_message_t *message)
     message->filename_term_list = NULL;
 }
 
+static int
+_compare_doc_id (const void *a, const void *b)
+{
+    const notmuch_message_t *ma = *(notmuch_message_t *const *) a;
+    const notmuch_message_t *mb = *(notmuch_message_t *const *) b;
+
+    return (ma->doc_id > mb->doc_id) - (ma->doc_id < mb->doc_id);
+}
+
+/* Load the metadata (thread, tags, id, references, ...) of 'count'
+ * messages in one go, and if 'filenames' is set also resolve their
+ * filenames. The messages are visited in doc id order, so that
+ * reading their term lists walks the database sequentially rather
+ * than jumping around. 'messages' is reordered in the process. */
+notmuch_status_t
+_notmuch_message_prefetch_metadata (notmuch_message_t **messages,
+				    unsigned int count,
+				    bool filenames)
+{
+    notmuch_message_t *message = NULL;
+
+    qsort (messages, count, sizeof (notmuch_message_t *), _compare_doc_id);
+
+    try {
+	for (unsigned int i = 0; i < count; i++) {
+	    message = messages[i];
+
+	    _notmuch_message_ensure_metadata (message, NULL);
+	    if (filenames &&
+		! NOTMUCH_TEST_BIT (message->flags, NOTMUCH_MESSAGE_FLAG_GHOST))
+		_notmuch_message_ensure_filename_list (message);
+	}
+    } catch (const Xapian::Error &error) {
+	LOG_XAPIAN_EXCEPTION (message, error);
+	return NOTMUCH_STATUS_XAPIAN_EXCEPTION;
+    }
+
+    return NOTMUCH_STATUS_SUCCESS;
+}
+
 const char *
 notmuch_message_get_filename (notmuch_message_t *message)
 {
@@ -1186,6 +1294,15 @@ int
 notmuch_message_count_files (notmuch_message_t *message)
 {
     try {
+	if (message->notmuch->features & NOTMUCH_FEATURE_FILE_COUNT_VALUES) {
+	    std::string value = message->doc.get_value (NOTMUCH_VALUE_FILE_COUNT);
+
+	    /* Ghost messages have no files, and no count. */
+	    if (value.empty ())
+		return 0;
+	    return Xapian::sortable_unserialise (value);
+	}
+
 	_notmuch_message_ensure_filename_list (message);
     } catch (Xapian::Error &error) {
 	LOG_XAPIAN_EXCEPTION (message, error);
@@ -1337,6 +1454,41 @@ _notmuch_message_update_subject (notmuch_message_t *message,
     message->modified = true;
 }
 
+/* Store the recipient headers of 'message_file' in the values of
+ * 'message'.  The caller must call _notmuch_message_sync. */
+void
+_notmuch_message_set_recipient_values (notmuch_message_t *message,
+				       notmuch_message_file_t *message_file)
+{
+    for (size_t i = 0; i < ARRAY_SIZE (header_values); i++) {
+	const char *value;
+
+	if (header_values[i].feature != NOTMUCH_FEATURE_RECIPIENT_VALUES)
+	    continue;
+
+	value = _notmuch_message_file_get_header (message_file, header_values[i].header);
+	if (value && *value)
+	    message->doc.add_value (header_values[i].slot, value);
+	else
+	    message->doc.remove_value (header_values[i].slot);
+    }
+    message->modified = true;
+}
+
+/* Upgrade a message to support NOTMUCH_FEATURE_RECIPIENT_VALUES.  The
+ * caller must call _notmuch_message_sync. */
+void
+_notmuch_message_upgrade_recipients (notmuch_message_t *message)
+{
+    /* A message whose file has gone missing keeps no recipients
+     * until it is reindexed. */
+    _notmuch_message_ensure_message_file (message);
+    if (message->message_file == NULL)
+	return;
+
+    _notmuch_message_set_recipient_values (message, message->message_file);
+}
+
 /* Upgrade a message to support NOTMUCH_FEATURE_LAST_MOD.  The caller
  * must call _notmuch_message_sync. */
 void
@@ -1347,6 +1499,30 @@ _notmuch_message_upgrade_last_mod (notmuch_message_t *message)
     message->modified = true;
 }
 
+void
+_notmuch_message_upgrade_thread_id (notmuch_message_t *message)
+{
+    /* _notmuch_message_sync will store the thread ID value; we just
+     * have to ask it to. */
+    message->modified = true;
+}
+
+/* Return the thread ID of 'message' as found in message->doc, or an
+ * empty string if it has none. */
+static std::string
+_notmuch_message_doc_thread_id (notmuch_message_t *message)
+{
+    const std::string thread_prefix = _find_prefix ("thread");
+    Xapian::TermIterator i = message->doc.termlist_begin ();
+
+    i.skip_to (thread_prefix);
+    if (i != message->doc.termlist_end () &&
+	(*i).compare (0, thread_prefix.size (), thread_prefix) == 0)
+	return (*i).substr (thread_prefix.size ());
+
+    return std::string ();
+}
+
 /* Synchronize changes made to message->doc out into the database. */
 void
 _notmuch_message_sync (notmuch_message_t *message)
@@ -1357,6 +1533,23 @@ _notmuch_message_sync (notmuch_message_t *message)
     if (! message->modified)
 	return;
 
+    if (message->notmuch->features &
+	(NOTMUCH_FEATURE_THREAD_SUMMARIES | NOTMUCH_FEATURE_THREAD_ID_VALUES)) {
+	std::string thread_id = _notmuch_message_doc_thread_id (message);
+
+	/* Mark the summary of the thread as out of date. */
+	if ((message->notmuch->features & NOTMUCH_FEATURE_THREAD_SUMMARIES) &&
+	    ! thread_id.empty ())
+	    _notmuch_thread_summary_invalidate (message->notmuch, thread_id.c_str ());
+
+	if (message->notmuch->features & NOTMUCH_FEATURE_THREAD_ID_VALUES) {
+	    if (thread_id.empty ())
+		message->doc.remove_value (NOTMUCH_VALUE_THREAD_ID);
+	    else
+		message->doc.add_value (NOTMUCH_VALUE_THREAD_ID, thread_id);
+	}
+    }
+
     /* Update the last modification of this message. */
     if (message->notmuch->features & NOTMUCH_FEATURE_LAST_MOD)
 	/* sortable_serialise gives a reasonably compact encoding,
@@ -1411,6 +1604,8 @@ _notmuch_message_delete (notmuch_message_t *message)
 	if (is_ghost)
 	    return NOTMUCH_STATUS_SUCCESS;
 
+	_notmuch_thread_summary_invalidate (notmuch, tid);
+
 	_notmuch_database_find_doc_ids (message->notmuch, "thread", tid, &thread_doc,
 					&thread_doc_end);
 	_notmuch_database_find_doc_ids (message->notmuch, "type", "mail", &mail_doc, &mail_doc_end);
@@ -2325,8 +2520,10 @@ notmuch_message_reindex (notmuch_message_t *message,
 	    goto DONE;
 
 	/* Take header values only from first filename */
-	if (found == 0)
+	if (found == 0) {
 	    _notmuch_message_set_header_values (message, date, from, subject);
+	    _notmuch_message_set_recipient_values (message, message_file);
+	}
 
 	ret = _notmuch_message_index_file (message, indexopts, message_file);
 
@@ -2349,6 +2546,8 @@ notmuch_message_reindex (notmuch_message_t *message,
 	ret = _notmuch_message_delete (message);
     } else {
 	_notmuch_message_sync (message);
+	/* The message may have moved to another thread. */
+	_notmuch_thread_summary_invalidate (notmuch, orig_thread_id);
     }
 
   DONE:
@@ -163,6 +163,34 @@ notmuch_messages_move_to_next (notmuch_messages_t *messages)
     messages->iterator = messages->iterator->next;
 }
 
+notmuch_status_t
+notmuch_messages_prefetch (notmuch_messages_t *messages, unsigned int count)
+{
+    notmuch_message_node_t *node;
+    notmuch_message_t **loaded;
+    notmuch_status_t status;
+    unsigned int n = 0;
+
+    if (messages == NULL)
+	return NOTMUCH_STATUS_NULL_POINTER;
+
+    if (! messages->is_of_list_type)
+	return _notmuch_mset_messages_prefetch (messages, count, true);
+
+    loaded = talloc_array (messages, notmuch_message_t *, count);
+    if (unlikely (loaded == NULL))
+	return NOTMUCH_STATUS_OUT_OF_MEMORY;
+
+    for (node = messages->iterator; node && n < count; node = node->next)
+	loaded[n++] = node->message;
+
+    status = _notmuch_message_prefetch_metadata (loaded, n, true);
+
+    talloc_free (loaded);
+
+    return status;
+}
+
 void
 notmuch_messages_destroy (notmuch_messages_t *messages)
 {
@@ -104,6 +104,11 @@ typedef enum {
     NOTMUCH_VALUE_FROM,
     NOTMUCH_VALUE_SUBJECT,
     NOTMUCH_VALUE_LAST_MOD,
+    NOTMUCH_VALUE_THREAD_ID,
+    NOTMUCH_VALUE_TO,
+    NOTMUCH_VALUE_CC,
+    NOTMUCH_VALUE_BCC,
+    NOTMUCH_VALUE_FILE_COUNT,
 } notmuch_value_t;
 
 /* Xapian (with flint backend) complains if we provide a term longer
@@ -254,6 +259,10 @@ _notmuch_database_get_directory_path (void *ctx,
 				      notmuch_database_t *notmuch,
 				      unsigned int doc_id);
 
+void
+_notmuch_database_forget_directory_path (notmuch_database_t *notmuch,
+					 unsigned int doc_id);
+
 notmuch_status_t
 _notmuch_database_filename_to_direntry (void *ctx,
 					notmuch_database_t *notmuch,
@@ -298,6 +307,11 @@ _notmuch_message_get_doc_id (notmuch_message_t *message);
 const char *
 _notmuch_message_get_in_reply_to (notmuch_message_t *message);
 
+notmuch_status_t
+_notmuch_message_prefetch_metadata (notmuch_message_t **messages,
+				    unsigned int count,
+				    bool filenames);
+
 notmuch_private_status_t
 _notmuch_message_add_term (notmuch_message_t *message,
 			   const char *prefix_name,
@@ -350,9 +364,22 @@ void
 _notmuch_message_update_subject (notmuch_message_t *message,
 				 const char *subject);
 
+void
+_notmuch_message_set_recipient_values (notmuch_message_t *message,
+				       notmuch_message_file_t *message_file);
+
+void
+_notmuch_message_upgrade_recipients (notmuch_message_t *message);
+
 void
 _notmuch_message_upgrade_last_mod (notmuch_message_t *message);
 
+void
+_notmuch_message_upgrade_thread_id (notmuch_message_t *message);
+
+void
+_notmuch_message_upgrade_file_count (notmuch_message_t *message);
+
 void
 _notmuch_message_sync (notmuch_message_t *message);
 
@@ -470,6 +497,60 @@ _notmuch_message_file_get_headers (notmuch_message_file_t *message_file,
 const char *
 _notmuch_message_file_get_filename (notmuch_message_file_t *message);
 
+/* Read the Message-ID of the message in the file at absolute 'path'
+ * from its header block alone, i.e. without parsing the file with
+ * GMime.
+ *
+ * Returns the message id (as by _notmuch_message_id_parse, allocated
+ * with 'ctx' as the talloc owner), or NULL if it cannot be found this
+ * way: the file is compressed, an mbox, unreadable, has no (or a
+ * non-ASCII or encoded) Message-ID header, or the header does not
+ * parse. The caller should then parse the file in full. */
+char *
+_notmuch_message_file_peek_message_id (void *ctx, const char *path);
+
+/* Background parsing of message files, see
+ * notmuch_database_set_index_jobs.
+ */
+typedef struct _notmuch_parse_queue notmuch_parse_queue_t;
+
+/* Create a queue parsing files with up to 'threads' threads, with
+ * 'ctx' as the talloc owner. Destroying the queue waits for files
+ * currently being parsed and drops the rest.
+ *
+ * Returns NULL if any error occurs.
+ */
+notmuch_parse_queue_t *
+_notmuch_parse_queue_create (void *ctx, unsigned int threads);
+
+/* Start parsing the message file at absolute 'path' in the
+ * background, to be collected with _notmuch_parse_queue_take under
+ * the name 'filename'. Pushing a filename that is already queued
+ * does nothing. */
+notmuch_status_t
+_notmuch_parse_queue_push (notmuch_parse_queue_t *queue,
+			   const char *filename,
+			   const char *path);
+
+/* Remove 'filename' from the queue, waiting for it to be parsed if
+ * necessary.
+ *
+ * Returns the parsed message file (to be closed by the caller with
+ * _notmuch_message_file_close), or NULL if 'filename' was not queued
+ * or could not be opened; in the latter case the caller should fall
+ * back to _notmuch_message_file_open, which reports the error. */
+notmuch_message_file_t *
+_notmuch_parse_queue_take (notmuch_parse_queue_t *queue,
+			   const char *filename);
+
+/* Remove 'filename' from the queue without waiting for it: a file no
+ * thread has started on yet is not parsed at all, and one being
+ * parsed is freed by its thread when done. Does nothing if
+ * 'filename' was not queued. */
+void
+_notmuch_parse_queue_drop (notmuch_parse_queue_t *queue,
+			   const char *filename);
+
 /* add-message.cc */
 notmuch_status_t
 _notmuch_database_link_message_to_parents (notmuch_database_t *notmuch,
@@ -540,13 +621,11 @@ _notmuch_mset_messages_get (notmuch_messages_t *messages);
 void
 _notmuch_mset_messages_move_to_next (notmuch_messages_t *messages);
 
-bool
-_notmuch_doc_id_set_contains (notmuch_doc_id_set_t *doc_ids,
-			      unsigned int doc_id);
+notmuch_status_t
+_notmuch_mset_messages_prefetch (notmuch_messages_t *messages,
+				 unsigned int count,
+				 bool filenames);
 
-void
-_notmuch_doc_id_set_remove (notmuch_doc_id_set_t *doc_ids,
-			    unsigned int doc_id);
 
 /* querying xapian documents by type (e.g. "mail" or "ghost"): */
 notmuch_status_t
@@ -649,6 +728,24 @@ _notmuch_string_list_sort (notmuch_string_list_t *list);
 const notmuch_string_list_t *
 _notmuch_message_get_references (notmuch_message_t *message);
 
+/* doc-id-set.c */
+
+/* Create a set holding the 'n' document ids in 'ids' (in any order,
+ * possibly repeated), with 'ctx' as the talloc owner.
+ *
+ * Returns NULL if any error occurs.
+ */
+notmuch_doc_id_set_t *
+_notmuch_doc_id_set_create (void *ctx, const unsigned int *ids, unsigned int n);
+
+bool
+_notmuch_doc_id_set_contains (notmuch_doc_id_set_t *doc_ids,
+			      unsigned int doc_id);
+
+void
+_notmuch_doc_id_set_remove (notmuch_doc_id_set_t *doc_ids,
+			    unsigned int doc_id);
+
 /* string-map.c */
 typedef struct _notmuch_string_map notmuch_string_map_t;
 typedef struct _notmuch_string_map_iterator notmuch_string_map_iterator_t;
@@ -717,6 +814,56 @@ _notmuch_thread_create (void *ctx,
 			notmuch_sort_t sort,
 			notmuch_thread_t **thread);
 
+notmuch_private_status_t
+_notmuch_thread_create_batch (void *ctx,
+			      notmuch_database_t *notmuch,
+			      notmuch_message_t **seed_messages,
+			      unsigned int count,
+			      notmuch_doc_id_set_t *match_set,
+			      notmuch_string_list_t *excluded_terms,
+			      notmuch_exclude_t omit_exclude,
+			      notmuch_sort_t sort,
+			      notmuch_thread_t **threads);
+
+char *
+_notmuch_thread_message_author (const void *ctx, notmuch_message_t *message);
+
+/* thread-summary.cc */
+
+/* Prefix of the metadata keys holding thread summaries, followed by
+ * the thread id. */
+#define THREAD_SUMMARY_PREFIX "thread_summary_"
+
+/* What a thread needs to know about one of its messages to compute
+ * its subject, authors, dates, counts and tags. */
+typedef struct _notmuch_thread_summary_entry {
+    unsigned int doc_id;
+    time_t date;
+    int files;
+    /* NULL if the message has no author or subject */
+    const char *author;
+    const char *subject;
+    notmuch_string_list_t *tags;
+} notmuch_thread_summary_entry_t;
+
+notmuch_private_status_t
+_notmuch_thread_summary_load (const void *ctx,
+			      notmuch_database_t *notmuch,
+			      const char **thread_ids,
+			      unsigned int count,
+			      notmuch_thread_summary_entry_t **entries,
+			      unsigned int *counts);
+
+void
+_notmuch_thread_summary_invalidate (notmuch_database_t *notmuch,
+				    const char *thread_id);
+
+notmuch_status_t
+_notmuch_thread_summary_flush (notmuch_database_t *notmuch);
+
+notmuch_status_t
+_notmuch_thread_summary_flush_batch (notmuch_database_t *notmuch, bool committing);
+
 /* indexopts.c */
 
 struct _notmuch_indexopts;
@@ -743,6 +890,42 @@ notmuch_status_t
 _notmuch_choose_xapian_path (void *ctx, const char *database_path, const char **xapian_path,
 			     char **message);
 
+/* Lock <xapian_path>.compact.lock, waiting as long as needed.
+ * Writers hold a shared lock while the database is open for writing,
+ * and compaction an exclusive one while it moves the compacted
+ * database in place, so that nobody keeps writing to the old one.
+ * Does nothing if the lock is already held. */
+notmuch_status_t
+_notmuch_database_lock_compact (notmuch_database_t *notmuch, bool exclusive);
+
+/* Release the lock taken by _notmuch_database_lock_compact. An
+ * exclusive lock is only released if 'exclusive' is true. */
+void
+_notmuch_database_unlock_compact (notmuch_database_t *notmuch, bool exclusive);
+
+/* trace.cc */
+
+/* Whether timings should be taken for databases opened now, i.e.
+ * whether NOTMUCH_TRACE is set. */
+bool
+_notmuch_trace_enabled (void);
+
+/* Add 'n' to 'counter'. */
+void
+_notmuch_trace_count (notmuch_database_t *notmuch, notmuch_trace_counter_t counter,
+		      unsigned long long n);
+
+/* Return the start time of an event to be passed to _notmuch_trace_end,
+ * or 0 if no timings are taken for 'notmuch'. */
+unsigned long long
+_notmuch_trace_start (notmuch_database_t *notmuch);
+
+/* Add 'n' events to 'counter', and the time since 'start' to the
+ * _NS counter following it. */
+void
+_notmuch_trace_end (notmuch_database_t *notmuch, notmuch_trace_counter_t counter,
+		    unsigned long long n, unsigned long long start);
+
 NOTMUCH_END_DECLS
 
 #ifdef __cplusplus
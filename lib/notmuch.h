@@ -58,7 +58,7 @@ NOTMUCH_BEGIN_DECLS
  * version in Makefile.local.
  */
 #define LIBNOTMUCH_MAJOR_VERSION        5
-#define LIBNOTMUCH_MINOR_VERSION        7
+#define LIBNOTMUCH_MINOR_VERSION        8
 #define LIBNOTMUCH_MICRO_VERSION        0
 
 
@@ -617,6 +617,50 @@ notmuch_database_compact_db (notmuch_database_t *database,
 			     notmuch_compact_status_cb_t status_cb,
 			     void *closure);
 
+/**
+ * Like notmuch_database_compact_db, but let other processes write to
+ * the database for most of the compaction.
+ *
+ * The database is reopened read-only, and its last committed state
+ * is compacted. Changes made meanwhile are then copied to the
+ * compacted database, found through their revision numbers (see
+ * notmuch_database_get_revision). Only the last of these changes,
+ * and the move of the compacted database into place, are made with
+ * the database opened with NOTMUCH_DATABASE_MODE_READ_WRITE. This
+ * waits until no other process has the database open for writing,
+ * and processes opening it for writing from then on wait until the
+ * compacted database is in place.
+ *
+ * If other processes commit so many changes during the compaction
+ * that Xapian can no longer read the state being compacted, the
+ * compaction starts over from the new state, up to a few times.
+ *
+ * As with notmuch_database_compact_db, the database is destroyed
+ * when compaction is done.
+ *
+ * Return value:
+ *
+ * NOTMUCH_STATUS_SUCCESS: Successfully compacted the database.
+ *
+ * NOTMUCH_STATUS_UNSUPPORTED_OPERATION: The database does not track
+ *	revisions; it needs to be upgraded first.
+ *
+ * NOTMUCH_STATUS_FILE_ERROR: The backup already exists, another
+ *	compaction of the database is running, the database was
+ *	replaced by another process during compaction, or moving the
+ *	compacted database into place failed.
+ *
+ * NOTMUCH_STATUS_XAPIAN_EXCEPTION: A Xapian exception occurred,
+ *	e.g. the database kept changing during compaction.
+ *
+ * @since libnotmuch 5.8 (notmuch 0.40)
+ */
+notmuch_status_t
+notmuch_database_compact_online (notmuch_database_t *database,
+				 const char *backup_path,
+				 notmuch_compact_status_cb_t status_cb,
+				 void *closure);
+
 /**
  * Destroy the notmuch database, closing it if necessary and freeing
  * all associated resources.
@@ -743,6 +787,16 @@ unsigned long
 notmuch_database_get_revision (notmuch_database_t *notmuch,
 			       const char **uuid);
 
+/**
+ * Return the highest document id used so far in the database, or 0
+ * if there are no documents. Document ids start from 1; see
+ * notmuch_query_set_doc_id_range.
+ *
+ * @since libnotmuch 5.8 (notmuch 0.40)
+ */
+unsigned int
+notmuch_database_get_last_doc_id (notmuch_database_t *notmuch);
+
 /**
  * Retrieve a directory object from the database for 'path'.
  *
@@ -774,6 +828,144 @@ notmuch_database_get_directory (notmuch_database_t *database,
 				const char *path,
 				notmuch_directory_t **directory);
 
+/**
+ * Report how well the cache of directory paths is doing.
+ *
+ * Resolving the filenames of a message requires mapping each of its
+ * directory document ids back to a path. These are cached for as long
+ * as the database view stays valid (i.e. until the next reopen). On
+ * return, '*hits' and '*misses' (either of which may be NULL) hold
+ * the number of lookups answered from the cache and from the
+ * database, respectively, since 'database' was opened.
+ *
+ * @since libnotmuch 5.8 (notmuch 0.40)
+ */
+void
+notmuch_database_get_directory_cache_stats (notmuch_database_t *database,
+					    unsigned long *hits,
+					    unsigned long *misses);
+
+/**
+ * Counters of the work done through a database handle, for finding
+ * out where the time of an operation goes.
+ *
+ * Each counter whose name ends in _NS follows the counter of the
+ * events it times, and holds their total elapsed time in nanoseconds.
+ * Timings are only taken if the environment variable NOTMUCH_TRACE is
+ * set to a non-empty value when the database is opened; otherwise
+ * they stay 0. The other counters are always maintained.
+ *
+ * @since libnotmuch 5.8 (notmuch 0.40)
+ */
+typedef enum {
+    NOTMUCH_TRACE_FIRST,
+    /** Query strings parsed into Xapian queries */
+    NOTMUCH_TRACE_QUERY_PARSE = NOTMUCH_TRACE_FIRST,
+    NOTMUCH_TRACE_QUERY_PARSE_NS,
+    /** Result sets retrieved from Xapian (i.e. Enquire::get_mset) */
+    NOTMUCH_TRACE_ENQUIRE,
+    NOTMUCH_TRACE_ENQUIRE_NS,
+    /** Message documents fetched from the database */
+    NOTMUCH_TRACE_DOCUMENT_FETCH,
+    /** Message term lists decoded to load tags, filenames etc. */
+    NOTMUCH_TRACE_METADATA_LOAD,
+    NOTMUCH_TRACE_METADATA_LOAD_NS,
+    /** Threads constructed */
+    NOTMUCH_TRACE_THREAD_CREATE,
+    NOTMUCH_TRACE_THREAD_CREATE_NS,
+    /** Reads retried after Xapian::DatabaseModifiedError */
+    NOTMUCH_TRACE_MODIFIED_RETRY,
+    /** See notmuch_database_get_directory_cache_stats */
+    NOTMUCH_TRACE_DIRECTORY_CACHE_HIT,
+    NOTMUCH_TRACE_DIRECTORY_CACHE_MISS,
+    /** Files added to an already indexed message by
+     * notmuch_database_index_file from their headers alone */
+    NOTMUCH_TRACE_INDEX_HEADER_ONLY,
+    /** Query strings whose earlier parse was reused (see
+     * notmuch_query_create) */
+    NOTMUCH_TRACE_QUERY_CACHE_HIT,
+    NOTMUCH_TRACE_LAST
+} notmuch_trace_counter_t;
+
+/**
+ * Return the value of 'counter' for 'database', accumulated since the
+ * database was opened, or 0 if 'counter' is out of range.
+ *
+ * @since libnotmuch 5.8 (notmuch 0.40)
+ */
+unsigned long long
+notmuch_database_get_trace_counter (notmuch_database_t *database,
+				    notmuch_trace_counter_t counter);
+
+/**
+ * Return a short lower-case name for 'counter' (e.g. "query_parse_ns"
+ * for NOTMUCH_TRACE_QUERY_PARSE_NS), or NULL if it is out of range.
+ *
+ * @since libnotmuch 5.8 (notmuch 0.40)
+ */
+const char *
+notmuch_trace_counter_name (notmuch_trace_counter_t counter);
+
+/**
+ * Turn the thread summaries of 'database' on or off.
+ *
+ * While they are on, the database holds a summary of each thread
+ * (the date, author, subject and tags of each of its messages), kept
+ * up to date as messages are added, removed, re-indexed and tagged.
+ * The threads returned by notmuch_query_search_threads are then built
+ * from these summaries, and their messages are only read from the
+ * database if notmuch_thread_get_messages or
+ * notmuch_thread_get_toplevel_messages is called.
+ *
+ * Turning them on computes the summary of every thread, which takes
+ * about as long as a search for all threads; turning them off deletes
+ * the summaries.
+ *
+ * Return value:
+ *
+ * NOTMUCH_STATUS_SUCCESS: Thread summaries are now on (or off).
+ *
+ * NOTMUCH_STATUS_READ_ONLY_DATABASE: Database was opened in read-only
+ *	mode so the summaries cannot be changed.
+ *
+ * NOTMUCH_STATUS_XAPIAN_EXCEPTION: A Xapian exception occurred.
+ *
+ * @since libnotmuch 5.8 (notmuch 0.40)
+ */
+notmuch_status_t
+notmuch_database_set_thread_summaries (notmuch_database_t *database,
+				       notmuch_bool_t enable);
+
+/**
+ * Turn on or off storing extra data about each message in the
+ * database: its thread ID, for thread:{} queries, its To, Cc and Bcc
+ * headers, which notmuch_message_get_header then returns without
+ * reading the message file, and its number of files, for
+ * notmuch_message_count_files and notmuch_query_count_files.
+ *
+ * Turning it on rewrites every message document, which takes about as
+ * long as a database upgrade, and older versions of notmuch refuse to
+ * write to the database afterwards. Turning it off only marks the
+ * data as unused.
+ *
+ * Return value:
+ *
+ * NOTMUCH_STATUS_SUCCESS: The data is now stored (or not).
+ *
+ * NOTMUCH_STATUS_READ_ONLY_DATABASE: Database was opened in read-only
+ *	mode so the setting cannot be changed.
+ *
+ * NOTMUCH_STATUS_UPGRADE_REQUIRED: The database must be upgraded
+ *	first.
+ *
+ * NOTMUCH_STATUS_XAPIAN_EXCEPTION: A Xapian exception occurred.
+ *
+ * @since libnotmuch 5.8 (notmuch 0.40)
+ */
+notmuch_status_t
+notmuch_database_set_message_values (notmuch_database_t *database,
+				     notmuch_bool_t enable);
+
 /**
  * Add a message file to a database, indexing it for retrieval by
  * future searches.  If a message already exists with the same message
@@ -794,6 +986,12 @@ notmuch_database_get_directory (notmuch_database_t *database,
  * database, rather than creating a new message, this adds the search
  * terms from the identified file to the existing message's index, and
  * adds 'filename' to the list of filenames known for the message.
+ * As an exception, if the message already has a file of the same
+ * maildir name (the part of the file name before any ':'), as when a
+ * file is renamed to change its maildir flags or folder, the new file
+ * is assumed to hold the same message: only its header block is read
+ * to find the message ID, and only the filename is added (unless
+ * turned off with notmuch_indexopts_set_expect_renames).
  *
  * The 'indexopts' parameter can be NULL (meaning, use the indexing
  * defaults from the database), or can be an explicit choice of
@@ -846,6 +1044,62 @@ notmuch_database_index_file (notmuch_database_t *database,
 			     notmuch_indexopts_t *indexopts,
 			     notmuch_message_t **message);
 
+/**
+ * Parse message files in the background while indexing.
+ *
+ * After a call with 'jobs' greater than zero, up to 'jobs' threads
+ * are used to open and parse the files announced with
+ * notmuch_database_prepare_index_file, so that this work overlaps
+ * with notmuch_database_index_file updating the database. All
+ * database updates are still made by the thread calling
+ * notmuch_database_index_file. Calling this with 'jobs' equal to zero
+ * (the default) turns background parsing off again; files prepared
+ * but not yet indexed are discarded.
+ *
+ * Return value:
+ *
+ * NOTMUCH_STATUS_SUCCESS: Background parsing configured.
+ *
+ * NOTMUCH_STATUS_OUT_OF_MEMORY: The worker threads could not be
+ *	created.
+ *
+ * NOTMUCH_STATUS_READ_ONLY_DATABASE: Database was opened in read-only
+ *	mode so no message can be indexed.
+ *
+ * @since libnotmuch 5.8 (notmuch 0.40)
+ */
+notmuch_status_t
+notmuch_database_set_index_jobs (notmuch_database_t *database,
+				 unsigned int jobs);
+
+/**
+ * Announce that 'filename' will shortly be passed to
+ * notmuch_database_index_file.
+ *
+ * If background parsing is enabled (see
+ * notmuch_database_set_index_jobs) the file starts being parsed
+ * right away; otherwise this does nothing. 'filename' is interpreted
+ * as for notmuch_database_index_file, and must be passed to it as the
+ * very same string. Errors with the file itself are not reported here
+ * but by notmuch_database_index_file.
+ *
+ * Callers should keep the number of prepared but not yet indexed
+ * files bounded (a small multiple of the number of jobs suffices),
+ * since each of them is held in memory.
+ *
+ * Return value:
+ *
+ * NOTMUCH_STATUS_SUCCESS: File queued (or background parsing is
+ *	disabled).
+ *
+ * NOTMUCH_STATUS_OUT_OF_MEMORY: Out of memory queuing the file.
+ *
+ * @since libnotmuch 5.8 (notmuch 0.40)
+ */
+notmuch_status_t
+notmuch_database_prepare_index_file (notmuch_database_t *database,
+				     const char *filename);
+
 /**
  * Deprecated alias for notmuch_database_index_file called with
  * NULL indexopts.
@@ -1105,6 +1359,58 @@ notmuch_query_set_sort (notmuch_query_t *query, notmuch_sort_t sort);
 notmuch_sort_t
 notmuch_query_get_sort (const notmuch_query_t *query);
 
+/**
+ * Restrict the results of notmuch_query_search_messages to those
+ * after the first 'offset' ones, in the order given by the query's
+ * sort. By default, no results are skipped.
+ *
+ * Unlike skipping results while iterating, this lets the database
+ * avoid retrieving the skipped results at all.
+ *
+ * This has no effect on notmuch_query_search_threads or the count
+ * functions.
+ *
+ * @since libnotmuch 5.8 (notmuch 0.40)
+ */
+void
+notmuch_query_set_offset (notmuch_query_t *query, unsigned int offset);
+
+/**
+ * Return at most 'limit' results from notmuch_query_search_messages,
+ * after skipping those before the offset (see
+ * notmuch_query_set_offset). A negative limit, the default, means no
+ * limit.
+ *
+ * This has no effect on notmuch_query_search_threads or the count
+ * functions.
+ *
+ * @since libnotmuch 5.8 (notmuch 0.40)
+ */
+void
+notmuch_query_set_limit (notmuch_query_t *query, int limit);
+
+/**
+ * Restrict the results of notmuch_query_search_messages to messages
+ * whose document id is between 'first' and 'last' (inclusive). A
+ * 'last' of 0, the default, means no restriction.
+ *
+ * Document ids are the internal numbers of the documents in the
+ * database, in which order results come with NOTMUCH_SORT_UNSORTED;
+ * see notmuch_database_get_last_doc_id. Disjoint ranges thus split
+ * the results of a query into parts that can be searched
+ * independently, each at a cost proportional to its own size, where
+ * an offset would have the database skip all results before it.
+ *
+ * This has no effect on notmuch_query_search_threads or the count
+ * functions.
+ *
+ * @since libnotmuch 5.8 (notmuch 0.40)
+ */
+void
+notmuch_query_set_doc_id_range (notmuch_query_t *query,
+				unsigned int first,
+				unsigned int last);
+
 /**
  * Add a tag that will be excluded from the query results by default.
  * This exclusion will be ignored if this tag appears explicitly in
@@ -1362,6 +1668,27 @@ NOTMUCH_DEPRECATED (5, 0)
 notmuch_status_t
 notmuch_query_count_messages_st (notmuch_query_t *query, unsigned int *count);
 
+/**
+ * Return the number of files of the messages matching a search.
+ *
+ * This counts the same messages as notmuch_query_count_messages, and
+ * returns the sum of notmuch_message_count_files over them. On
+ * databases storing per-message file counts (see
+ * notmuch_database_set_message_values) this reads neither the
+ * messages nor their filenames.
+ *
+ * @returns
+ *
+ * NOTMUCH_STATUS_SUCCESS: query completed successfully.
+ *
+ * NOTMUCH_STATUS_XAPIAN_EXCEPTION: a Xapian exception occurred. The
+ *      value of *count is not defined.
+ *
+ * @since libnotmuch 5.8 (notmuch 0.40)
+ */
+notmuch_status_t
+notmuch_query_count_files (notmuch_query_t *query, unsigned int *count);
+
 /**
  * Return the number of threads matching a search.
  *
@@ -1622,6 +1949,31 @@ notmuch_messages_get (notmuch_messages_t *messages);
 void
 notmuch_messages_move_to_next (notmuch_messages_t *messages);
 
+/**
+ * Load the next 'count' messages of 'messages' ahead of time.
+ *
+ * Starting at the current position of the iterator, the metadata
+ * (message ID, thread ID, tags, filenames, references) of up to
+ * 'count' messages is read in a single pass, in database order rather
+ * than result order. This is considerably faster than letting each
+ * message load its metadata when it is first used. Messages returned
+ * by later calls to notmuch_messages_get have their metadata ready.
+ *
+ * Return value:
+ *
+ * NOTMUCH_STATUS_SUCCESS: Messages loaded (or nothing left to load).
+ *
+ * NOTMUCH_STATUS_NULL_POINTER: 'messages' is NULL.
+ *
+ * NOTMUCH_STATUS_OUT_OF_MEMORY: Out of memory.
+ *
+ * NOTMUCH_STATUS_XAPIAN_EXCEPTION: A Xapian exception occurred.
+ *
+ * @since libnotmuch 5.8 (notmuch 0.40)
+ */
+notmuch_status_t
+notmuch_messages_prefetch (notmuch_messages_t *messages, unsigned int count);
+
 /**
  * Destroy a notmuch_messages_t object.
  *
@@ -2926,6 +3278,32 @@ notmuch_indexopts_set_decrypt_policy (notmuch_indexopts_t *indexopts,
 notmuch_decryption_policy_t
 notmuch_indexopts_get_decrypt_policy (const notmuch_indexopts_t *indexopts);
 
+/**
+ * Specify whether files indexed with these options may be renamed
+ * files of messages already in the database, as when maildir flags
+ * change.
+ *
+ * If so (the default), notmuch_database_index_file first reads the
+ * header block of each file with maildir info in its name, to add a
+ * renamed file without parsing it (see notmuch_database_index_file).
+ * Callers that know no file was renamed, e.g. because none
+ * disappeared, can turn this off to save that read.
+ *
+ * @since libnotmuch 5.8 (notmuch 0.40)
+ */
+notmuch_status_t
+notmuch_indexopts_set_expect_renames (notmuch_indexopts_t *indexopts,
+				      notmuch_bool_t expect_renames);
+
+/**
+ * Return whether files indexed with these options may be renamed
+ * files, see notmuch_indexopts_set_expect_renames.
+ *
+ * @since libnotmuch 5.8 (notmuch 0.40)
+ */
+notmuch_bool_t
+notmuch_indexopts_get_expect_renames (const notmuch_indexopts_t *indexopts);
+
 /**
  * Destroy a notmuch_indexopts_t object.
  *
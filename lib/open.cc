@@ -1,5 +1,6 @@
 #include <unistd.h>
 #include <libgen.h>
+#include <sys/file.h>
 
 #include "database-private.h"
 #include "parse-time-vrp.h"
@@ -320,6 +321,7 @@ _alloc_notmuch (const char *database_path, const char *config_path, const char *
     notmuch->exception_reported = false;
     notmuch->status_string = NULL;
     notmuch->writable_xapian_db = NULL;
+    notmuch->compact_lock_fd = -1;
     notmuch->config_path = NULL;
     notmuch->atomic_nesting = 0;
     notmuch->transaction_count = 0;
@@ -327,6 +329,7 @@ _alloc_notmuch (const char *database_path, const char *config_path, const char *
     notmuch->view = 1;
     notmuch->index_as_text = NULL;
     notmuch->index_as_text_length = 0;
+    notmuch->trace_timing = _notmuch_trace_enabled ();
 
     notmuch->params = NOTMUCH_PARAM_NONE;
     if (database_path)
@@ -392,6 +395,54 @@ _notmuch_choose_xapian_path (void *ctx, const char *database_path,
     return status;
 }
 
+notmuch_status_t
+_notmuch_database_lock_compact (notmuch_database_t *notmuch, bool exclusive)
+{
+    char *lock_path;
+    int fd;
+
+    if (notmuch->compact_lock_fd >= 0)
+	return NOTMUCH_STATUS_SUCCESS;
+
+    lock_path = talloc_asprintf (notmuch, "%s.compact.lock", notmuch->xapian_path);
+    if (! lock_path)
+	return NOTMUCH_STATUS_OUT_OF_MEMORY;
+
+    fd = open (lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+	_notmuch_database_log (notmuch, "Cannot open %s: %s\n", lock_path, strerror (errno));
+	talloc_free (lock_path);
+	return NOTMUCH_STATUS_FILE_ERROR;
+    }
+
+    while (flock (fd, exclusive ? LOCK_EX : LOCK_SH) < 0) {
+	if (errno != EINTR) {
+	    _notmuch_database_log (notmuch, "Cannot lock %s: %s\n", lock_path,
+				   strerror (errno));
+	    close (fd);
+	    talloc_free (lock_path);
+	    return NOTMUCH_STATUS_FILE_ERROR;
+	}
+    }
+
+    notmuch->compact_lock_fd = fd;
+    notmuch->compact_lock_exclusive = exclusive;
+    talloc_free (lock_path);
+    return NOTMUCH_STATUS_SUCCESS;
+}
+
+void
+_notmuch_database_unlock_compact (notmuch_database_t *notmuch, bool exclusive)
+{
+    if (notmuch->compact_lock_fd < 0 ||
+	(notmuch->compact_lock_exclusive && ! exclusive))
+	return;
+
+    close (notmuch->compact_lock_fd);
+    notmuch->compact_lock_fd = -1;
+    notmuch->compact_lock_exclusive = false;
+}
+
 static void
 _set_database_path (notmuch_database_t *notmuch,
 		    const char *database_path)
@@ -510,6 +561,15 @@ _finish_open (notmuch_database_t *notmuch,
     unsigned int version;
     const char *database_path = notmuch_database_get_path (notmuch);
 
+    if (mode == NOTMUCH_DATABASE_MODE_READ_WRITE) {
+	status = _notmuch_database_lock_compact (notmuch, false);
+	if (status) {
+	    message = strdup (notmuch->status_string ? notmuch->status_string :
+			      "Error: Cannot lock database for writing.\n");
+	    goto DONE;
+	}
+    }
+
     try {
 
 	if (mode == NOTMUCH_DATABASE_MODE_READ_WRITE) {
@@ -556,7 +616,8 @@ _finish_open (notmuch_database_t *notmuch,
 	notmuch->term_gen = new Xapian::TermGenerator;
 	notmuch->term_gen->set_stemmer (Xapian::Stem ("english"));
 	notmuch->value_range_processor = new Xapian::NumberRangeProcessor (NOTMUCH_VALUE_TIMESTAMP);
-	notmuch->date_range_processor = new ParseTimeRangeProcessor (NOTMUCH_VALUE_TIMESTAMP,
+	notmuch->date_range_processor = new ParseTimeRangeProcessor (notmuch,
+								     NOTMUCH_VALUE_TIMESTAMP,
 								     "date:");
 	notmuch->last_mod_range_processor = new LastModRangeProcessor (notmuch, "lastmod:");
 	notmuch->query_parser->set_default_op (Xapian::Query::OP_AND);
@@ -857,17 +918,30 @@ notmuch_database_reopen (notmuch_database_t *notmuch,
 			 notmuch_database_mode_t new_mode)
 {
     notmuch_database_mode_t cur_mode = _notmuch_database_mode (notmuch);
+    notmuch_status_t status;
 
     if (notmuch->xapian_db == NULL) {
 	_notmuch_database_log (notmuch, "Cannot reopen closed or nonexistent database\n");
 	return NOTMUCH_STATUS_ILLEGAL_ARGUMENT;
     }
 
+    if (notmuch->atomic_nesting == 0) {
+	status = _notmuch_thread_summary_flush (notmuch);
+	if (status)
+	    return status;
+    }
+
     try {
 	if (cur_mode == new_mode &&
 	    new_mode == NOTMUCH_DATABASE_MODE_READ_ONLY) {
 	    notmuch->xapian_db->reopen ();
 	} else {
+	    if (new_mode == NOTMUCH_DATABASE_MODE_READ_WRITE) {
+		status = _notmuch_database_lock_compact (notmuch, false);
+		if (status)
+		    return status;
+	    }
+
 	    notmuch->xapian_db->close ();
 
 	    delete notmuch->xapian_db;
@@ -880,6 +954,7 @@ notmuch_database_reopen (notmuch_database_t *notmuch,
 									    DB_ACTION);
 		notmuch->xapian_db = notmuch->writable_xapian_db;
 	    } else {
+		_notmuch_database_unlock_compact (notmuch, false);
 		notmuch->xapian_db = new Xapian::Database (notmuch->xapian_path,
 							   DB_ACTION);
 	    }
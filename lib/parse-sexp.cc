@@ -574,7 +574,8 @@ _sexp_parse_range (notmuch_database_t *notmuch,  const _sexp_prefix_t *prefix,
 
     if (strcmp (prefix->name, "date") == 0) {
 	notmuch_status_t status;
-	status = _notmuch_date_strings_to_query (NOTMUCH_VALUE_TIMESTAMP, from, to, output, msg);
+	status = _notmuch_date_strings_to_query (notmuch, NOTMUCH_VALUE_TIMESTAMP,
+						 from, to, output, msg);
 	if (status) {
 	    if (! msg.empty ())
 		_notmuch_database_log (notmuch, "%s\n", msg.c_str ());
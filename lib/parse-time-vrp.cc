@@ -25,7 +25,7 @@
 #include "parse-time-string.h"
 
 notmuch_status_t
-_notmuch_date_strings_to_query (Xapian::valueno slot,
+_notmuch_date_strings_to_query (notmuch_database_t *notmuch, Xapian::valueno slot,
 				const std::string &begin, const std::string &end,
 				Xapian::Query &output, std::string &msg)
 {
@@ -33,6 +33,8 @@ _notmuch_date_strings_to_query (Xapian::valueno slot,
     time_t parsed_time, now;
     std::string str;
 
+    notmuch->query_uses_time = true;
+
     /* Use the same 'now' for begin and end. */
     if (time (&now) == (time_t) -1) {
 	msg = "unable to get current time";
@@ -74,7 +76,7 @@ ParseTimeRangeProcessor::operator() (const std::string &begin, const std::string
     Xapian::Query output;
     std::string msg;
 
-    if (_notmuch_date_strings_to_query (slot, begin, end, output, msg))
+    if (_notmuch_date_strings_to_query (notmuch, slot, begin, end, output, msg))
 	throw Xapian::QueryParserError (msg);
 
     return output;
@@ -87,6 +89,8 @@ DateFieldProcessor::operator() (const std::string & str)
     double from = DBL_MIN, to = DBL_MAX;
     time_t parsed_time, now;
 
+    notmuch->query_uses_time = true;
+
     /* Use the same 'now' for begin and end. */
     if (time (&now) == (time_t) -1)
 	throw Xapian::QueryParserError ("Unable to get current time");
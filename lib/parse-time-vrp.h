@@ -27,19 +27,24 @@
 
 /* see *ValueRangeProcessor in xapian-core/include/xapian/queryparser.h */
 class ParseTimeRangeProcessor : public Xapian::RangeProcessor {
+protected:
+    notmuch_database_t *notmuch;
 
 public:
-    ParseTimeRangeProcessor (Xapian::valueno slot_, const std::string prefix_)
-	:  Xapian::RangeProcessor(slot_, prefix_, 0) { }
+    ParseTimeRangeProcessor (notmuch_database_t *notmuch_, Xapian::valueno slot_,
+			     const std::string prefix_)
+	:  Xapian::RangeProcessor(slot_, prefix_, 0), notmuch(notmuch_) { }
 
     Xapian::Query operator() (const std::string &begin, const std::string &end);
 };
 
 class DateFieldProcessor : public Xapian::FieldProcessor {
 private:
+    notmuch_database_t *notmuch;
     Xapian::valueno slot;
 public:
-    DateFieldProcessor(Xapian::valueno slot_) : slot(slot_) { };
+    DateFieldProcessor(notmuch_database_t *notmuch_, Xapian::valueno slot_)
+	: notmuch(notmuch_), slot(slot_) { };
     Xapian::Query operator()(const std::string & str);
 };
 
@@ -0,0 +1,148 @@
+/* query-cache.cc - Reuse of parsed queries
+ *
+ * This file is part of notmuch.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see https://www.gnu.org/licenses/ .
+ */
+
+#include "database-private.h"
+
+/* Parsing a query string runs the Xapian query parser (or the
+ * s-expression parser), expands named queries from the configuration,
+ * and may even run searches (for thread:{} subqueries). The result
+ * only depends on the query string, the configuration and the
+ * contents of the database, so it is kept for as long as none of
+ * these change, i.e. until the next change of revision, reopen, or
+ * change of configuration.
+ *
+ * Queries mentioning dates are never kept, since relative dates
+ * ("date:yesterday..") depend on the time of parsing, and neither
+ * are queries parsed by a database that does not track revisions.
+ *
+ * The expansions of subqueries (thread:{...}) are kept the same way,
+ * keyed by the description of the subquery, in which dates are
+ * already absolute.
+ */
+
+/* When the cache grows beyond this many queries it is emptied. */
+#define QUERY_CACHE_MAX 256
+
+static void
+_free_query (gpointer data)
+{
+    delete static_cast<Xapian::Query *> (data);
+}
+
+/* Return the cache, emptied if it no longer matches the database,
+ * or NULL if queries cannot be cached right now. */
+static GHashTable *
+_query_cache (notmuch_database_t *notmuch)
+{
+    /* Changes made in an atomic section don't get a new revision
+     * until it is committed. */
+    if (! (notmuch->features & NOTMUCH_FEATURE_LAST_MOD) || notmuch->atomic_dirty)
+	return NULL;
+
+    if (notmuch->query_cache == NULL) {
+	notmuch->query_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+						      g_free, _free_query);
+    } else if (notmuch->query_cache_view == notmuch->view &&
+	       notmuch->query_cache_revision == notmuch->revision) {
+	return notmuch->query_cache;
+    } else {
+	g_hash_table_remove_all (notmuch->query_cache);
+    }
+
+    notmuch->query_cache_view = notmuch->view;
+    notmuch->query_cache_revision = notmuch->revision;
+
+    return notmuch->query_cache;
+}
+
+static char *
+_query_cache_key (char kind, const char *query_string)
+{
+    return g_strdup_printf ("%c%s", kind, query_string);
+}
+
+bool
+_notmuch_query_cache_lookup (notmuch_database_t *notmuch, char kind,
+			     const char *query_string, Xapian::Query &output)
+{
+    GHashTable *cache = _query_cache (notmuch);
+    Xapian::Query *query;
+    char *key;
+
+    if (cache == NULL)
+	return false;
+
+    key = _query_cache_key (kind, query_string);
+    query = static_cast<Xapian::Query *> (g_hash_table_lookup (cache, key));
+    g_free (key);
+
+    if (query == NULL)
+	return false;
+
+    output = *query;
+    _notmuch_trace_count (notmuch, NOTMUCH_TRACE_QUERY_CACHE_HIT, 1);
+
+    return true;
+}
+
+void
+_notmuch_query_cache_store (notmuch_database_t *notmuch, char kind,
+			    const char *query_string, const Xapian::Query &query)
+{
+    GHashTable *cache = _query_cache (notmuch);
+
+    if (cache == NULL)
+	return;
+
+    if (g_hash_table_size (cache) >= QUERY_CACHE_MAX)
+	g_hash_table_remove_all (cache);
+
+    g_hash_table_replace (cache, _query_cache_key (kind, query_string),
+			  new Xapian::Query (query));
+}
+
+bool
+_notmuch_query_cache_begin (notmuch_database_t *notmuch)
+{
+    bool outer = notmuch->query_uses_time;
+
+    notmuch->query_uses_time = false;
+
+    return outer;
+}
+
+void
+_notmuch_query_cache_end (notmuch_database_t *notmuch, bool outer, char kind,
+			  const char *query_string, const Xapian::Query *query)
+{
+    if (query && ! notmuch->query_uses_time)
+	_notmuch_query_cache_store (notmuch, kind, query_string, *query);
+
+    /* A query containing this one depends on the time if this one
+     * does. */
+    notmuch->query_uses_time = outer || notmuch->query_uses_time;
+}
+
+void
+_notmuch_query_cache_clear (notmuch_database_t *notmuch)
+{
+    if (notmuch->query_cache) {
+	g_hash_table_unref (notmuch->query_cache);
+	notmuch->query_cache = NULL;
+    }
+}
@@ -31,12 +31,26 @@ _notmuch_query_name_to_query (notmuch_database_t *notmuch, const std::string nam
     std::string key = "query." + name;
     char *expansion;
     notmuch_status_t status;
+    bool outer;
+
+    if (_notmuch_query_cache_lookup (notmuch, NOTMUCH_QUERY_CACHE_NAMED, name.c_str (), output))
+	return NOTMUCH_STATUS_SUCCESS;
 
     status = notmuch_database_get_config (notmuch, key.c_str (), &expansion);
     if (status)
 	return status;
 
-    output = notmuch->query_parser->parse_query (expansion, NOTMUCH_QUERY_PARSER_FLAGS);
+    outer = _notmuch_query_cache_begin (notmuch);
+    try {
+	output = notmuch->query_parser->parse_query (expansion, NOTMUCH_QUERY_PARSER_FLAGS);
+    } catch (const Xapian::Error &error) {
+	_notmuch_query_cache_end (notmuch, outer, NOTMUCH_QUERY_CACHE_NAMED, name.c_str (), NULL);
+	free (expansion);
+	throw;
+    }
+    _notmuch_query_cache_end (notmuch, outer, NOTMUCH_QUERY_CACHE_NAMED, name.c_str (), &output);
+    free (expansion);
+
     return NOTMUCH_STATUS_SUCCESS;
 }
 
@@ -24,12 +24,23 @@
 
 #include <glib.h> /* GHashTable, GPtrArray */
 
+#include <algorithm>
+
 struct _notmuch_query {
     notmuch_database_t *notmuch;
     const char *query_string;
     notmuch_sort_t sort;
     notmuch_string_list_t *exclude_terms;
     notmuch_exclude_t omit_excluded;
+    /* Window of results returned by notmuch_query_search_messages. A
+     * negative limit means no limit. */
+    unsigned int offset;
+    int limit;
+    /* Range of document ids searched by
+     * notmuch_query_search_messages. A last doc id of 0 means no
+     * restriction. */
+    Xapian::docid first_doc_id;
+    Xapian::docid last_doc_id;
     bool parsed;
     notmuch_query_syntax_t syntax;
     Xapian::Query xapian_query;
@@ -41,15 +52,25 @@ typedef struct _notmuch_mset_messages {
     notmuch_database_t *notmuch;
     Xapian::MSetIterator iterator;
     Xapian::MSetIterator iterator_end;
-} notmuch_mset_messages_t;
 
-struct _notmuch_doc_id_set {
-    unsigned char *bitmap;
-    unsigned int bound;
-};
+    /* Results are fetched from 'enquire' in pages: a small first
+     * one, so that callers stopping early never pay for the full
+     * result set, then pages of 'page_size' results, which doubles up
+     * to NOTMUCH_MSET_MAX_PAGE with each page. 'remaining' is how many
+     * results are still wanted after those fetched. 'enquire' is NULL
+     * once nothing more is to be fetched. */
+    Xapian::Enquire *enquire;
+    Xapian::doccount next_first;
+    Xapian::doccount remaining;
+    Xapian::doccount page_size;
+
+    /* doc id -> message loaded ahead by notmuch_messages_prefetch and
+     * not yet handed out, or NULL if nothing was prefetched. */
+    GHashTable *prefetched;
+} notmuch_mset_messages_t;
 
-#define DOCIDSET_WORD(bit) ((bit) / CHAR_BIT)
-#define DOCIDSET_BIT(bit) ((bit) % CHAR_BIT)
+#define NOTMUCH_MSET_FIRST_PAGE 1000
+#define NOTMUCH_MSET_MAX_PAGE 64000
 
 struct _notmuch_threads {
     notmuch_query_t *query;
@@ -60,15 +81,174 @@ struct _notmuch_threads {
     unsigned int doc_id_pos;
     /* The set of matched docid's that have not been assigned to a
      * thread. Initially, this contains every docid in doc_ids. */
-    notmuch_doc_id_set_t match_set;
+    notmuch_doc_id_set_t *match_set;
     notmuch_status_t status;
+
+    /* Threads built ahead of the iterator by a single search, and the
+     * position in doc_ids of the message each was found from.
+     * batch_next is the first of them not yet returned. */
+    notmuch_thread_t **batch;
+    unsigned int *batch_pos;
+    unsigned int batch_len;
+    unsigned int batch_next;
+    /* How many threads to build in the next batch. This starts small
+     * so that the first results arrive quickly. */
+    unsigned int batch_size;
 };
 
-/* We need this in the message functions so forward declare. */
-static bool
-_notmuch_doc_id_set_init (void *ctx,
-			  notmuch_doc_id_set_t *doc_ids,
-			  GArray *arr);
+#define NOTMUCH_THREADS_BATCH_MIN 16
+#define NOTMUCH_THREADS_BATCH_MAX 256
+
+/* A posting source returning every document with an id in [first,
+ * last], skipping straight to the first one. Filtering a search with
+ * it restricts the search to that range without the matcher visiting
+ * any document before it, as skipping an offset of results would. */
+class DocIdRangePostingSource : public Xapian::PostingSource
+{
+protected:
+    const Xapian::docid first_, last_;
+    Xapian::Database db_;
+    bool started_;
+    Xapian::PostingIterator it_, end_;
+
+/* No copying */
+    DocIdRangePostingSource (const DocIdRangePostingSource &);
+    DocIdRangePostingSource &operator= (const DocIdRangePostingSource &);
+
+public:
+    DocIdRangePostingSource (Xapian::docid first, Xapian::docid last)
+	: first_ (first), last_ (last)
+    {
+    }
+
+    void init (const Xapian::Database &db)
+    {
+	db_ = db;
+	it_ = db_.postlist_begin ("");
+	end_ = db_.postlist_end ("");
+	started_ = false;
+    }
+
+    Xapian::doccount get_termfreq_min () const
+    {
+	return 0;
+    }
+
+    Xapian::doccount get_termfreq_est () const
+    {
+	return get_termfreq_max () / 2;
+    }
+
+    Xapian::doccount get_termfreq_max () const
+    {
+	Xapian::doccount count = db_.get_doccount ();
+
+	if (last_ < first_)
+	    return 0;
+	/* Careful: last_ - first_ + 1 may wrap around. */
+	return last_ - first_ < count ? last_ - first_ + 1 : count;
+    }
+
+    Xapian::docid get_docid () const
+    {
+	return *it_;
+    }
+
+    bool at_end () const
+    {
+	return it_ == end_ || *it_ > last_;
+    }
+
+    void next (unused (double min_wt))
+    {
+	if (started_)
+	    ++it_;
+	else
+	    it_.skip_to (first_);
+	started_ = true;
+    }
+
+    void skip_to (Xapian::docid did, unused (double min_wt))
+    {
+	it_.skip_to (std::max (did, first_));
+	started_ = true;
+    }
+
+    std::string get_description () const
+    {
+	return "DocIdRangePostingSource(" + std::to_string (first_) + ", " +
+	       std::to_string (last_) + ")";
+    }
+};
+
+static int
+_compare_docid (const void *a, const void *b)
+{
+    Xapian::docid da = *(const Xapian::docid *) a;
+    Xapian::docid db = *(const Xapian::docid *) b;
+
+    return (da > db) - (da < db);
+}
+
+notmuch_status_t
+_notmuch_mset_messages_prefetch (notmuch_messages_t *messages,
+				 unsigned int count,
+				 bool filenames)
+{
+    notmuch_mset_messages_t *mset_messages;
+    notmuch_message_t **loaded;
+    Xapian::docid *doc_ids;
+    Xapian::MSetIterator iterator;
+    notmuch_private_status_t status;
+    notmuch_status_t ret = NOTMUCH_STATUS_SUCCESS;
+    unsigned int n = 0, i;
+    void *local;
+
+    mset_messages = (notmuch_mset_messages_t *) messages;
+
+    local = talloc_new (mset_messages);
+    doc_ids = talloc_array (local, Xapian::docid, count);
+    loaded = talloc_array (local, notmuch_message_t *, count);
+    if (unlikely (doc_ids == NULL || loaded == NULL)) {
+	talloc_free (local);
+	return NOTMUCH_STATUS_OUT_OF_MEMORY;
+    }
+
+    if (! mset_messages->prefetched)
+	mset_messages->prefetched = g_hash_table_new (NULL, NULL);
+
+    /* Only look ahead within the page already fetched from Xapian. */
+    for (iterator = mset_messages->iterator;
+	 n < count && iterator != mset_messages->iterator_end;
+	 iterator++) {
+	if (! g_hash_table_contains (mset_messages->prefetched,
+				     GUINT_TO_POINTER (*iterator)))
+	    doc_ids[n++] = *iterator;
+    }
+
+    /* Fetch the documents in doc id order too, not just their term
+     * lists. */
+    qsort (doc_ids, n, sizeof (Xapian::docid), _compare_docid);
+
+    for (i = 0; i < n; i++) {
+	loaded[i] = _notmuch_message_create (mset_messages,
+					     mset_messages->notmuch, doc_ids[i],
+					     &status);
+	if (loaded[i] == NULL) {
+	    ret = COERCE_STATUS (status, "error prefetching a message");
+	    break;
+	}
+	g_hash_table_insert (mset_messages->prefetched,
+			     GUINT_TO_POINTER (doc_ids[i]), loaded[i]);
+    }
+
+    if (ret == NOTMUCH_STATUS_SUCCESS)
+	ret = _notmuch_message_prefetch_metadata (loaded, n, filenames);
+
+    talloc_free (local);
+
+    return ret;
+}
 
 static bool
 _debug_query (void)
@@ -78,6 +258,21 @@ _debug_query (void)
     return (env && strcmp (env, "") != 0);
 }
 
+/* Run 'enquire', charging the time spent to the ENQUIRE counter. */
+static Xapian::MSet
+_notmuch_enquire_get_mset (notmuch_database_t *notmuch,
+			   Xapian::Enquire &enquire,
+			   Xapian::doccount first,
+			   Xapian::doccount maxitems,
+			   Xapian::doccount checkatleast = 0)
+{
+    unsigned long long start = _notmuch_trace_start (notmuch);
+    Xapian::MSet mset = enquire.get_mset (first, maxitems, checkatleast);
+
+    _notmuch_trace_end (notmuch, NOTMUCH_TRACE_ENQUIRE, 1, start);
+    return mset;
+}
+
 /* Explicit destructor call for placement new */
 static int
 _notmuch_query_destructor (notmuch_query_t *query)
@@ -119,6 +314,12 @@ _notmuch_query_constructor (notmuch_database_t *notmuch,
 
     query->omit_excluded = NOTMUCH_EXCLUDE_TRUE;
 
+    query->offset = 0;
+    query->limit = -1;
+
+    query->first_doc_id = 0;
+    query->last_doc_id = 0;
+
     return query;
 }
 
@@ -249,17 +450,54 @@ _notmuch_query_ensure_parsed_sexpr (notmuch_query_t *query)
 #endif
 
 static notmuch_status_t
-_notmuch_query_ensure_parsed (notmuch_query_t *query)
+_notmuch_query_parse (notmuch_query_t *query)
 {
-    if (query->parsed)
-	return NOTMUCH_STATUS_SUCCESS;
+    notmuch_database_t *notmuch = query->notmuch;
+    notmuch_status_t status;
+    char kind = NOTMUCH_QUERY_CACHE_XAPIAN;
+    bool outer;
 
 #if HAVE_SFSEXP
     if (query->syntax == NOTMUCH_QUERY_SYNTAX_SEXP)
-	return _notmuch_query_ensure_parsed_sexpr (query);
+	kind = NOTMUCH_QUERY_CACHE_SEXP;
 #endif
 
-    return _notmuch_query_ensure_parsed_xapian (query);
+    if (_notmuch_query_cache_lookup (notmuch, kind, query->query_string,
+				     query->xapian_query)) {
+	query->parsed = true;
+	_notmuch_query_cache_terms (query);
+	return NOTMUCH_STATUS_SUCCESS;
+    }
+
+    outer = _notmuch_query_cache_begin (notmuch);
+
+#if HAVE_SFSEXP
+    if (kind == NOTMUCH_QUERY_CACHE_SEXP)
+	status = _notmuch_query_ensure_parsed_sexpr (query);
+    else
+#endif
+    status = _notmuch_query_ensure_parsed_xapian (query);
+
+    _notmuch_query_cache_end (notmuch, outer, kind, query->query_string,
+			      status ? NULL : &query->xapian_query);
+
+    return status;
+}
+
+static notmuch_status_t
+_notmuch_query_ensure_parsed (notmuch_query_t *query)
+{
+    notmuch_status_t status;
+    unsigned long long start;
+
+    if (query->parsed)
+	return NOTMUCH_STATUS_SUCCESS;
+
+    start = _notmuch_trace_start (query->notmuch);
+    status = _notmuch_query_parse (query);
+    _notmuch_trace_end (query->notmuch, NOTMUCH_TRACE_QUERY_PARSE, 1, start);
+
+    return status;
 }
 
 const char *
@@ -287,6 +525,27 @@ notmuch_query_get_sort (const notmuch_query_t *query)
     return query->sort;
 }
 
+void
+notmuch_query_set_offset (notmuch_query_t *query, unsigned int offset)
+{
+    query->offset = offset;
+}
+
+void
+notmuch_query_set_limit (notmuch_query_t *query, int limit)
+{
+    query->limit = limit;
+}
+
+void
+notmuch_query_set_doc_id_range (notmuch_query_t *query,
+				unsigned int first,
+				unsigned int last)
+{
+    query->first_doc_id = first;
+    query->last_doc_id = last;
+}
+
 notmuch_status_t
 notmuch_query_add_tag_exclude (notmuch_query_t *query, const char *tag)
 {
@@ -316,6 +575,9 @@ _notmuch_messages_destructor (notmuch_mset_messages_t *messages)
 {
     messages->iterator.~MSetIterator ();
     messages->iterator_end.~MSetIterator ();
+    delete messages->enquire;
+    if (messages->prefetched)
+	g_hash_table_unref (messages->prefetched);
 
     return 0;
 }
@@ -344,17 +606,41 @@ notmuch_query_search_messages_st (notmuch_query_t *query,
     return notmuch_query_search_messages (query, out);
 }
 
+static notmuch_status_t
+_notmuch_query_search_window (notmuch_query_t *query,
+			      const char *type,
+			      Xapian::doccount first,
+			      int limit,
+			      bool paged,
+			      notmuch_messages_t **out);
+
 notmuch_status_t
 notmuch_query_search_messages (notmuch_query_t *query,
 			       notmuch_messages_t **out)
 {
-    return _notmuch_query_search_documents (query, "mail", out);
+    return _notmuch_query_search_window (query, "mail", query->offset,
+					 query->limit, true, out);
 }
 
 notmuch_status_t
 _notmuch_query_search_documents (notmuch_query_t *query,
 				 const char *type,
 				 notmuch_messages_t **out)
+{
+    return _notmuch_query_search_window (query, type, 0, -1, false, out);
+}
+
+/* Search for documents of the given type, skipping the first 'first'
+ * results and returning at most 'limit' (if not negative). If 'paged'
+ * is true, only a first page of results is fetched up front, for the
+ * benefit of callers not reading all of them. */
+static notmuch_status_t
+_notmuch_query_search_window (notmuch_query_t *query,
+			      const char *type,
+			      Xapian::doccount first,
+			      int limit,
+			      bool paged,
+			      notmuch_messages_t **out)
 {
     notmuch_database_t *notmuch = query->notmuch;
     notmuch_mset_messages_t *messages;
@@ -376,6 +662,11 @@ _notmuch_query_search_documents (notmuch_query_t *query,
 	messages->notmuch = notmuch;
 	new (&messages->iterator) Xapian::MSetIterator ();
 	new (&messages->iterator_end) Xapian::MSetIterator ();
+	messages->enquire = NULL;
+	messages->next_first = 0;
+	messages->remaining = 0;
+	messages->page_size = 0;
+	messages->prefetched = NULL;
 
 	talloc_set_destructor (messages, _notmuch_messages_destructor);
 
@@ -390,6 +681,15 @@ _notmuch_query_search_documents (notmuch_query_t *query,
 	final_query = Xapian::Query (Xapian::Query::OP_AND,
 				     mail_query, query->xapian_query);
 
+	/* Like the offset and limit, the doc id range only applies to
+	 * notmuch_query_search_messages. */
+	if (paged && query->last_doc_id) {
+	    DocIdRangePostingSource *range =
+		new DocIdRangePostingSource (query->first_doc_id, query->last_doc_id);
+	    final_query = Xapian::Query (Xapian::Query::OP_FILTER, final_query,
+					 Xapian::Query (range->release ()));
+	}
+
 	messages->base.excluded_doc_ids = NULL;
 
 	if ((query->omit_excluded != NOTMUCH_EXCLUDE_FALSE) && (query->exclude_terms)) {
@@ -406,7 +706,8 @@ _notmuch_query_search_documents (notmuch_query_t *query,
 		enquire.set_weighting_scheme (Xapian::BoolWeight ());
 		enquire.set_query (exclude_query);
 
-		mset = enquire.get_mset (0, notmuch->xapian_db->get_doccount ());
+		mset = _notmuch_enquire_get_mset (notmuch, enquire, 0,
+					  notmuch->xapian_db->get_doccount ());
 
 		GArray *excluded_doc_ids = g_array_new (false, false, sizeof (unsigned int));
 
@@ -414,9 +715,8 @@ _notmuch_query_search_documents (notmuch_query_t *query,
 		    unsigned int doc_id = *iterator;
 		    g_array_append_val (excluded_doc_ids, doc_id);
 		}
-		messages->base.excluded_doc_ids = talloc (messages, _notmuch_doc_id_set);
-		_notmuch_doc_id_set_init (query, messages->base.excluded_doc_ids,
-					  excluded_doc_ids);
+		messages->base.excluded_doc_ids = _notmuch_doc_id_set_create (
+		    messages, (unsigned int *) excluded_doc_ids->data, excluded_doc_ids->len);
 		g_array_unref (excluded_doc_ids);
 	    }
 	}
@@ -447,7 +747,22 @@ _notmuch_query_search_documents (notmuch_query_t *query,
 
 	enquire.set_query (final_query);
 
-	mset = enquire.get_mset (0, notmuch->xapian_db->get_doccount ());
+	Xapian::doccount count = notmuch->xapian_db->get_doccount ();
+	if (limit >= 0 && (Xapian::doccount) limit < count)
+	    count = limit;
+
+	if (paged && count > NOTMUCH_MSET_FIRST_PAGE) {
+	    mset = _notmuch_enquire_get_mset (notmuch, enquire, first,
+					      NOTMUCH_MSET_FIRST_PAGE);
+	    if (mset.size () == NOTMUCH_MSET_FIRST_PAGE) {
+		messages->enquire = new Xapian::Enquire (enquire);
+		messages->next_first = first + NOTMUCH_MSET_FIRST_PAGE;
+		messages->remaining = count - NOTMUCH_MSET_FIRST_PAGE;
+		messages->page_size = 2 * NOTMUCH_MSET_FIRST_PAGE;
+	    }
+	} else {
+	    mset = _notmuch_enquire_get_mset (notmuch, enquire, first, count);
+	}
 
 	messages->iterator = mset.begin ();
 	messages->iterator_end = mset.end ();
@@ -507,9 +822,18 @@ _notmuch_mset_messages_get (notmuch_messages_t *messages)
 
     doc_id = *mset_messages->iterator;
 
-    message = _notmuch_message_create (mset_messages,
-				       mset_messages->notmuch, doc_id,
-				       &status);
+    message = NULL;
+    if (mset_messages->prefetched) {
+	message = (notmuch_message_t *) g_hash_table_lookup (mset_messages->prefetched,
+							     GUINT_TO_POINTER (doc_id));
+	if (message)
+	    g_hash_table_remove (mset_messages->prefetched, GUINT_TO_POINTER (doc_id));
+    }
+
+    if (! message)
+	message = _notmuch_message_create (mset_messages,
+					   mset_messages->notmuch, doc_id,
+					   &status);
 
     if (message == NULL) {
 	if (status == NOTMUCH_PRIVATE_STATUS_NO_DOCUMENT_FOUND) {
@@ -533,53 +857,46 @@ void
 _notmuch_mset_messages_move_to_next (notmuch_messages_t *messages)
 {
     notmuch_mset_messages_t *mset_messages;
+    Xapian::MSet mset;
+
+    Xapian::doccount page;
 
     mset_messages = (notmuch_mset_messages_t *) messages;
 
     mset_messages->iterator++;
-}
-
-static bool
-_notmuch_doc_id_set_init (void *ctx,
-			  notmuch_doc_id_set_t *doc_ids,
-			  GArray *arr)
-{
-    unsigned int max = 0;
-    unsigned char *bitmap;
-
-    for (unsigned int i = 0; i < arr->len; i++)
-	max = MAX (max, g_array_index (arr, unsigned int, i));
-    bitmap = talloc_zero_array (ctx, unsigned char, DOCIDSET_WORD (max) + 1);
-
-    if (bitmap == NULL)
-	return false;
 
-    doc_ids->bitmap = bitmap;
-    doc_ids->bound = max + 1;
+    if (mset_messages->iterator != mset_messages->iterator_end ||
+	mset_messages->enquire == NULL)
+	return;
 
-    for (unsigned int i = 0; i < arr->len; i++) {
-	unsigned int doc_id = g_array_index (arr, unsigned int, i);
-	bitmap[DOCIDSET_WORD (doc_id)] |= 1 << DOCIDSET_BIT (doc_id);
+    /* The current page is used up, so fetch the next one. */
+    page = std::min (mset_messages->page_size, mset_messages->remaining);
+    try {
+	mset = _notmuch_enquire_get_mset (mset_messages->notmuch,
+					  *mset_messages->enquire,
+					  mset_messages->next_first,
+					  page);
+	mset_messages->iterator = mset.begin ();
+	mset_messages->iterator_end = mset.end ();
+    } catch (const Xapian::Error &error) {
+	_notmuch_database_log (mset_messages->notmuch,
+			       "A Xapian exception occurred fetching query results: %s\n",
+			       error.get_msg ().c_str ());
+	mset_messages->notmuch->exception_reported = true;
+	messages->status = _notmuch_xapian_error ();
+	page = 0;
     }
 
-    return true;
-}
-
-bool
-_notmuch_doc_id_set_contains (notmuch_doc_id_set_t *doc_ids,
-			      unsigned int doc_id)
-{
-    if (doc_id >= doc_ids->bound)
-	return false;
-    return doc_ids->bitmap[DOCIDSET_WORD (doc_id)] & (1 << DOCIDSET_BIT (doc_id));
-}
+    mset_messages->next_first += page;
+    mset_messages->remaining -= page;
+    mset_messages->page_size = std::min (2 * mset_messages->page_size,
+					 (Xapian::doccount) NOTMUCH_MSET_MAX_PAGE);
 
-void
-_notmuch_doc_id_set_remove (notmuch_doc_id_set_t *doc_ids,
-			    unsigned int doc_id)
-{
-    if (doc_id < doc_ids->bound)
-	doc_ids->bitmap[DOCIDSET_WORD (doc_id)] &= ~(1 << DOCIDSET_BIT (doc_id));
+    /* A short page is the last one. */
+    if (mset.size () < page || mset_messages->remaining == 0 || page == 0) {
+	delete mset_messages->enquire;
+	mset_messages->enquire = NULL;
+    }
 }
 
 /* Glib objects force use to use a talloc destructor as well, (but not
@@ -614,11 +931,21 @@ notmuch_query_search_threads (notmuch_query_t *query,
 	return NOTMUCH_STATUS_OUT_OF_MEMORY;
     threads->status = NOTMUCH_STATUS_SUCCESS;
     threads->doc_ids = NULL;
+    threads->batch = NULL;
+    threads->batch_pos = NULL;
+    threads->batch_len = 0;
+    threads->batch_next = 0;
+    threads->batch_size = NOTMUCH_THREADS_BATCH_MIN;
     talloc_set_destructor (threads, _notmuch_threads_destructor);
 
     threads->query = query;
 
-    status = notmuch_query_search_messages (query, &messages);
+    /* Unlike message searches, this fetches every match up front and
+     * ignores the query's offset and limit: the order of the threads
+     * and the number of matched messages in each depend on all the
+     * matches, and the offset and limit count threads rather than
+     * messages. */
+    status = _notmuch_query_search_documents (query, "mail", &messages);
     if (status) {
 	talloc_free (threads);
 	return status;
@@ -634,8 +961,9 @@ notmuch_query_search_threads (notmuch_query_t *query,
 
     talloc_free (messages);
 
-    if (! _notmuch_doc_id_set_init (threads, &threads->match_set,
-				    threads->doc_ids)) {
+    threads->match_set = _notmuch_doc_id_set_create (
+	threads, (unsigned int *) threads->doc_ids->data, threads->doc_ids->len);
+    if (threads->match_set == NULL) {
 	talloc_free (threads);
 	return NOTMUCH_STATUS_OUT_OF_MEMORY;
     }
@@ -656,6 +984,116 @@ notmuch_threads_valid (notmuch_threads_t *threads)
     return notmuch_threads_status (threads) == NOTMUCH_STATUS_SUCCESS;
 }
 
+/* Does the next unreturned thread of the current batch belong to the
+ * iterator's current position? */
+static bool
+_notmuch_threads_batch_at_pos (notmuch_threads_t *threads)
+{
+    return threads->batch_next < threads->batch_len &&
+	   threads->batch_pos[threads->batch_next] == threads->doc_id_pos;
+}
+
+/* Free any threads of the current batch that the iterator was moved
+ * past without returning them. */
+static void
+_notmuch_threads_drop_passed (notmuch_threads_t *threads)
+{
+    while (threads->batch_next < threads->batch_len &&
+	   threads->batch_pos[threads->batch_next] < threads->doc_id_pos) {
+	talloc_free (threads->batch[threads->batch_next]);
+	threads->batch_next++;
+    }
+}
+
+/* Build the threads for the next batch of not yet assigned messages,
+ * starting at the iterator's current position, with a single search
+ * instead of one per thread. */
+static notmuch_status_t
+_notmuch_threads_fill_batch (notmuch_threads_t *threads)
+{
+    notmuch_database_t *notmuch = threads->query->notmuch;
+    notmuch_message_t **seeds;
+    GHashTable *seen;
+    notmuch_private_status_t private_status;
+    notmuch_status_t status = NOTMUCH_STATUS_SUCCESS;
+    unsigned int pos, count = 0;
+    unsigned long long start;
+    void *local;
+
+    while (threads->batch_next < threads->batch_len)
+	talloc_free (threads->batch[threads->batch_next++]);
+    talloc_free (threads->batch);
+    talloc_free (threads->batch_pos);
+    threads->batch_len = threads->batch_next = 0;
+
+    threads->batch = talloc_array (threads, notmuch_thread_t *,
+				   threads->batch_size);
+    threads->batch_pos = talloc_array (threads, unsigned int,
+				       threads->batch_size);
+    local = talloc_new (threads);
+    seeds = talloc_array (local, notmuch_message_t *, threads->batch_size);
+    if (unlikely (threads->batch == NULL || threads->batch_pos == NULL ||
+		  seeds == NULL)) {
+	talloc_free (local);
+	return NOTMUCH_STATUS_OUT_OF_MEMORY;
+    }
+
+    /* Thread ids are owned by the seed messages. */
+    seen = g_hash_table_new (g_str_hash, g_str_equal);
+
+    for (pos = threads->doc_id_pos;
+	 pos < threads->doc_ids->len && count < threads->batch_size;
+	 pos++) {
+	unsigned int doc_id = g_array_index (threads->doc_ids, unsigned int, pos);
+	notmuch_message_t *message;
+	const char *thread_id;
+
+	if (! _notmuch_doc_id_set_contains (threads->match_set, doc_id))
+	    continue;
+
+	message = _notmuch_message_create (local, notmuch, doc_id,
+					   &private_status);
+	if (private_status) {
+	    status = COERCE_STATUS (private_status, "error creating a thread");
+	    goto DONE;
+	}
+
+	thread_id = notmuch_message_get_thread_id (message);
+	if (g_hash_table_contains (seen, thread_id)) {
+	    talloc_free (message);
+	    continue;
+	}
+	g_hash_table_add (seen, (gpointer) thread_id);
+
+	seeds[count] = message;
+	threads->batch_pos[count] = pos;
+	count++;
+    }
+
+    start = _notmuch_trace_start (notmuch);
+    private_status = _notmuch_thread_create_batch (threads, notmuch,
+						   seeds, count,
+						   threads->match_set,
+						   threads->query->exclude_terms,
+						   threads->query->omit_excluded,
+						   threads->query->sort,
+						   threads->batch);
+    _notmuch_trace_end (notmuch, NOTMUCH_TRACE_THREAD_CREATE, count, start);
+    if (private_status) {
+	status = COERCE_STATUS (private_status, "error creating a thread");
+	goto DONE;
+    }
+    threads->batch_len = count;
+
+    if (threads->batch_size < NOTMUCH_THREADS_BATCH_MAX)
+	threads->batch_size *= 2;
+
+  DONE:
+    g_hash_table_unref (seen);
+    talloc_free (local);
+    return status;
+}
+
 notmuch_status_t
 notmuch_threads_status (notmuch_threads_t *threads)
 {
@@ -666,10 +1104,18 @@ notmuch_threads_status (notmuch_threads_t *threads)
     if (threads->status)
 	return threads->status;
 
+    _notmuch_threads_drop_passed (threads);
+
     while (threads->doc_id_pos < threads->doc_ids->len) {
+	/* Messages belonging to the threads of the current batch are
+	 * already gone from match_set, including the ones the batch
+	 * threads were found from. */
+	if (_notmuch_threads_batch_at_pos (threads))
+	    break;
+
 	doc_id = g_array_index (threads->doc_ids, unsigned int,
 				threads->doc_id_pos);
-	if (_notmuch_doc_id_set_contains (&threads->match_set, doc_id))
+	if (_notmuch_doc_id_set_contains (threads->match_set, doc_id))
 	    break;
 
 	threads->doc_id_pos++;
@@ -685,20 +1131,38 @@ notmuch_threads_get (notmuch_threads_t *threads)
     notmuch_thread_t *thread;
     unsigned int doc_id;
     notmuch_private_status_t status;
+    unsigned long long start;
 
     if (! notmuch_threads_valid (threads))
 	return NULL;
 
     doc_id = g_array_index (threads->doc_ids, unsigned int,
 			    threads->doc_id_pos);
+
+    if (! _notmuch_threads_batch_at_pos (threads) &&
+	_notmuch_doc_id_set_contains (threads->match_set, doc_id)) {
+	threads->status = _notmuch_threads_fill_batch (threads);
+	if (threads->status)
+	    return NULL;
+    }
+
+    if (_notmuch_threads_batch_at_pos (threads))
+	return talloc_steal (threads->query,
+			     threads->batch[threads->batch_next++]);
+
+    /* The thread for this position was already returned; build it
+     * afresh, as notmuch_threads_get always did. */
+    start = _notmuch_trace_start (threads->query->notmuch);
     status = _notmuch_thread_create (threads->query,
 				     threads->query->notmuch,
 				     doc_id,
-				     &threads->match_set,
+				     threads->match_set,
 				     threads->query->exclude_terms,
 				     threads->query->omit_excluded,
 				     threads->query->sort,
 				     &thread);
+    _notmuch_trace_end (threads->query->notmuch, NOTMUCH_TRACE_THREAD_CREATE,
+			1, start);
     if (status) {
 	threads->status = COERCE_STATUS (status, "error creating a thread");
     }
@@ -730,6 +1194,38 @@ notmuch_query_count_messages (notmuch_query_t *query, unsigned *count_out)
     return _notmuch_query_count_documents (query, "mail", count_out);
 }
 
+/* Prepare 'enquire' to match the documents of the given type
+ * matching 'query', without excluded ones, in order of doc id. */
+static void
+_notmuch_query_set_count_query (notmuch_query_t *query, const char *type,
+				Xapian::Enquire &enquire)
+{
+    Xapian::Query mail_query (talloc_asprintf (query, "%s%s",
+					       _find_prefix ("type"),
+					       type));
+    Xapian::Query final_query, exclude_query;
+
+    final_query = Xapian::Query (Xapian::Query::OP_AND,
+				 mail_query, query->xapian_query);
+
+    exclude_query = _notmuch_exclude_tags (query);
+
+    final_query = Xapian::Query (Xapian::Query::OP_AND_NOT,
+				 final_query, exclude_query);
+
+    enquire.set_weighting_scheme (Xapian::BoolWeight ());
+    enquire.set_docid_order (Xapian::Enquire::ASCENDING);
+
+    if (_debug_query ()) {
+	fprintf (stderr, "Exclude query is:\n%s\n",
+		 exclude_query.get_description ().c_str ());
+	fprintf (stderr, "Final query is:\n%s\n",
+		 final_query.get_description ().c_str ());
+    }
+
+    enquire.set_query (final_query);
+}
+
 notmuch_status_t
 _notmuch_query_count_documents (notmuch_query_t *query, const char *type, unsigned *count_out)
 {
@@ -743,39 +1239,17 @@ _notmuch_query_count_documents (notmuch_query_t *query, const char *type, unsign
 
     try {
 	Xapian::Enquire enquire (*notmuch->xapian_db);
-	Xapian::Query mail_query (talloc_asprintf (query, "%s%s",
-						   _find_prefix ("type"),
-						   type));
-	Xapian::Query final_query, exclude_query;
 	Xapian::MSet mset;
 
-	final_query = Xapian::Query (Xapian::Query::OP_AND,
-				     mail_query, query->xapian_query);
-
-	exclude_query = _notmuch_exclude_tags (query);
-
-	final_query = Xapian::Query (Xapian::Query::OP_AND_NOT,
-				     final_query, exclude_query);
-
-	enquire.set_weighting_scheme (Xapian::BoolWeight ());
-	enquire.set_docid_order (Xapian::Enquire::ASCENDING);
-
-	if (_debug_query ()) {
-	    fprintf (stderr, "Exclude query is:\n%s\n",
-		     exclude_query.get_description ().c_str ());
-	    fprintf (stderr, "Final query is:\n%s\n",
-		     final_query.get_description ().c_str ());
-	}
-
-	enquire.set_query (final_query);
+	_notmuch_query_set_count_query (query, type, enquire);
 
 	/*
 	 * Set the checkatleast parameter to the number of documents
 	 * in the database to make get_matches_estimated() exact.
 	 * Set the max parameter to 1 to avoid fetching documents we will discard.
 	 */
-	mset = enquire.get_mset (0, 1,
-				 notmuch->xapian_db->get_doccount ());
+	mset = _notmuch_enquire_get_mset (notmuch, enquire, 0, 1,
+					  notmuch->xapian_db->get_doccount ());
 
 	count = mset.get_matches_estimated ();
 
@@ -793,6 +1267,72 @@ _notmuch_query_count_documents (notmuch_query_t *query, const char *type, unsign
     return NOTMUCH_STATUS_SUCCESS;
 }
 
+notmuch_status_t
+notmuch_query_count_files (notmuch_query_t *query, unsigned *count_out)
+{
+    notmuch_database_t *notmuch = query->notmuch;
+    unsigned int count = 0;
+    notmuch_status_t status;
+
+    status = _notmuch_query_ensure_parsed (query);
+    if (status)
+	return status;
+
+    try {
+	Xapian::Enquire enquire (*notmuch->xapian_db);
+	Xapian::MSet mset;
+
+	_notmuch_query_set_count_query (query, "mail", enquire);
+
+	mset = _notmuch_enquire_get_mset (notmuch, enquire, 0,
+					  notmuch->xapian_db->get_doccount ());
+
+	if (notmuch->features & NOTMUCH_FEATURE_FILE_COUNT_VALUES) {
+	    /* Sum the counts over the value stream, which the matches
+	     * (in doc id order) visit sequentially. */
+	    Xapian::ValueIterator value =
+		notmuch->xapian_db->valuestream_begin (NOTMUCH_VALUE_FILE_COUNT);
+	    Xapian::ValueIterator value_end =
+		notmuch->xapian_db->valuestream_end (NOTMUCH_VALUE_FILE_COUNT);
+
+	    for (Xapian::MSetIterator i = mset.begin (); i != mset.end (); i++) {
+		if (value == value_end)
+		    break;
+		value.skip_to (*i);
+		if (value != value_end && value.get_docid () == *i)
+		    count += Xapian::sortable_unserialise (*value);
+	    }
+	} else {
+	    for (Xapian::MSetIterator i = mset.begin (); i != mset.end (); i++) {
+		notmuch_private_status_t private_status;
+		notmuch_message_t *message;
+		int files;
+
+		message = _notmuch_message_create (query, notmuch, *i, &private_status);
+		if (message == NULL)
+		    return COERCE_STATUS (private_status, "error creating message");
+
+		files = notmuch_message_count_files (message);
+		notmuch_message_destroy (message);
+		if (files < 0)
+		    return NOTMUCH_STATUS_XAPIAN_EXCEPTION;
+		count += files;
+	    }
+	}
+    } catch (const Xapian::Error &error) {
+	_notmuch_database_log (notmuch,
+			       "A Xapian exception occurred performing query: %s\n",
+			       error.get_msg ().c_str ());
+	_notmuch_database_log_append (notmuch,
+				      "Query string was: %s\n",
+				      query->query_string);
+	return _notmuch_xapian_error ();
+    }
+
+    *count_out = count;
+    return NOTMUCH_STATUS_SUCCESS;
+}
+
 notmuch_status_t
 notmuch_query_count_threads_st (notmuch_query_t *query, unsigned *count)
 {
@@ -809,7 +1349,7 @@ notmuch_query_count_threads (notmuch_query_t *query, unsigned *count)
 
     sort = query->sort;
     query->sort = NOTMUCH_SORT_UNSORTED;
-    ret = notmuch_query_search_messages (query, &messages);
+    ret = _notmuch_query_search_documents (query, "mail", &messages);
     if (ret)
 	return ret;
     query->sort = sort;
@@ -851,12 +1391,31 @@ notmuch_query_get_database (const notmuch_query_t *query)
     return query->notmuch;
 }
 
+/* Return the value slot holding the term of 'field' (without its
+ * prefix) in each message document, or Xapian::BAD_VALUENO. */
+static Xapian::valueno
+_expand_value_slot (notmuch_database_t *notmuch, const char *field)
+{
+    if (strcmp (field, "thread") == 0 &&
+	(notmuch->features & NOTMUCH_FEATURE_THREAD_ID_VALUES))
+	return NOTMUCH_VALUE_THREAD_ID;
+
+    /* Documents created before the message ID was stored have an
+     * empty value, and fall back to their terms below. */
+    if (strcmp (field, "id") == 0 || strcmp (field, "mid") == 0)
+	return NOTMUCH_VALUE_MESSAGE_ID;
+
+    return Xapian::BAD_VALUENO;
+}
+
 notmuch_status_t
 _notmuch_query_expand (notmuch_database_t *notmuch, const char *field, Xapian::Query subquery,
 		       Xapian::Query &output, std::string &msg)
 {
     std::set<std::string> terms;
     const std::string term_prefix =  _find_prefix (field);
+    Xapian::valueno slot = _expand_value_slot (notmuch, field);
+    std::string key;
 
     if (_debug_query ()) {
 	fprintf (stderr, "Expanding subquery:\n%s\n",
@@ -866,14 +1425,42 @@ _notmuch_query_expand (notmuch_database_t *notmuch, const char *field, Xapian::Q
     try {
 	Xapian::Enquire enquire (*notmuch->xapian_db);
 	Xapian::MSet mset;
+	std::vector<Xapian::docid> doc_ids;
+	Xapian::ValueIterator value, value_end;
+
+	key = std::string (field) + ":" + subquery.get_description ();
+	if (_notmuch_query_cache_lookup (notmuch, NOTMUCH_QUERY_CACHE_EXPANSION,
+					 key.c_str (), output))
+	    return NOTMUCH_STATUS_SUCCESS;
 
 	enquire.set_weighting_scheme (Xapian::BoolWeight ());
 	enquire.set_query (subquery);
 
-	mset = enquire.get_mset (0, notmuch->xapian_db->get_doccount ());
+	mset = _notmuch_enquire_get_mset (notmuch, enquire, 0,
+					  notmuch->xapian_db->get_doccount ());
+
+	/* Visit the documents in order, so the value stream is read
+	 * sequentially. */
+	doc_ids.reserve (mset.size ());
+	for (Xapian::MSetIterator iterator = mset.begin (); iterator != mset.end (); iterator++)
+	    doc_ids.push_back (*iterator);
+	std::sort (doc_ids.begin (), doc_ids.end ());
+
+	if (slot != Xapian::BAD_VALUENO) {
+	    value = notmuch->xapian_db->valuestream_begin (slot);
+	    value_end = notmuch->xapian_db->valuestream_end (slot);
+	}
+
+	for (Xapian::docid doc_id : doc_ids) {
+	    if (slot != Xapian::BAD_VALUENO) {
+		if (value != value_end)
+		    value.skip_to (doc_id);
+		if (value != value_end && value.get_docid () == doc_id) {
+		    terms.insert (term_prefix + *value);
+		    continue;
+		}
+	    }
 
-	for (Xapian::MSetIterator iterator = mset.begin (); iterator != mset.end (); iterator++) {
-	    Xapian::docid doc_id = *iterator;
 	    Xapian::Document doc = notmuch->xapian_db->get_document (doc_id);
 	    Xapian::TermIterator i = doc.termlist_begin ();
 
@@ -888,6 +1475,8 @@ _notmuch_query_expand (notmuch_database_t *notmuch, const char *field, Xapian::Q
 		     subquery.get_description ().c_str ());
 	}
 
+	_notmuch_query_cache_store (notmuch, NOTMUCH_QUERY_CACHE_EXPANSION,
+				    key.c_str (), output);
     } catch (const Xapian::Error &error) {
 	_notmuch_database_log (notmuch,
 			       "A Xapian exception occurred expanding query: %s\n",
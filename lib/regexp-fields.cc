@@ -46,7 +46,7 @@ compile_regex (regex_t &regexp, const char *str, std::string &msg)
 }
 
 RegexpPostingSource::RegexpPostingSource (Xapian::valueno slot, const std::string &regexp)
-    : slot_ (slot)
+    : slot_ (slot), regexp_str_ (regexp)
 {
     std::string msg;
     notmuch_status_t status = compile_regex (regexp_, regexp.c_str (), msg);
@@ -134,6 +134,14 @@ RegexpPostingSource::check (Xapian::docid did, unused (double min_wt))
     return (regexec (&regexp_, (*it_).c_str (), 0, NULL, 0) == 0);
 }
 
+/* Distinct for distinct regexps, since cached subquery expansions
+ * are keyed by the description of the subquery. */
+std::string
+RegexpPostingSource::get_description () const
+{
+    return "RegexpPostingSource(" + std::to_string (slot_) + ", " + regexp_str_ + ")";
+}
+
 static inline Xapian::valueno
 _find_slot (std::string prefix)
 {
@@ -42,6 +42,7 @@ class RegexpPostingSource : public Xapian::PostingSource
 {
 protected:
     const Xapian::valueno slot_;
+    const std::string regexp_str_;
     regex_t regexp_;
     Xapian::Database db_;
     bool started_;
@@ -63,6 +64,7 @@ public:
     void next (unused (double min_wt));
     void skip_to (Xapian::docid did, unused (double min_wt));
     bool check (Xapian::docid did, unused (double min_wt));
+    std::string get_description () const;
 };
 
 
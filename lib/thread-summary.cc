@@ -0,0 +1,516 @@
+/* thread-summary.cc - Stored summaries of threads
+ *
+ * This file is part of notmuch.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see https://www.gnu.org/licenses/ .
+ */
+
+/* With NOTMUCH_FEATURE_THREAD_SUMMARIES, the metadata key
+ * THREAD_SUMMARY_PREFIX + thread id holds one entry per mail message
+ * of the thread, oldest first (the order in which _notmuch_thread_create
+ * reads them). The summary is a sequence of NUL-terminated fields:
+ *
+ *   version, revision, number of documents, number of entries, then
+ *   for each entry:
+ *   doc id, date, number of files, author, subject, number of tags, tags
+ *
+ * where the author and subject are prefixed with '+', or are "-" if
+ * the message has none.
+ *
+ * Writers don't update summaries in place: anything that changes a
+ * message marks its thread stale, and the summaries of stale threads
+ * are computed afresh from their messages, in batches (see
+ * _notmuch_thread_summary_flush_batch), each of which costs a search
+ * of the whole thread.
+ *
+ * A summary can thus lag behind its thread: changes may be committed
+ * before the summary is rewritten (Xapian commits by itself outside
+ * atomic sections, and a writer may be killed before it flushes). So
+ * each summary records the database revision it was computed at and
+ * the number of documents (including ghosts) in its thread, and is
+ * only used while no document of the thread has a later revision and
+ * their number is unchanged (which catches deletions). Otherwise the
+ * thread is built from its messages, as without summaries.
+ */
+
+#include "database-private.h"
+
+#include <glib.h>
+#include <limits.h>
+
+#include <map>
+
+#define THREAD_SUMMARY_VERSION "2"
+
+/* Rewrite stale summaries once this many threads are stale, even if
+ * the changes are not committed yet. */
+#define THREAD_SUMMARY_BATCH_MAX 1024
+
+static void
+_append_field (std::string &summary, const std::string &field)
+{
+    summary += field;
+    summary.push_back ('\0');
+}
+
+static void
+_append_optional_field (std::string &summary, const char *field)
+{
+    if (field)
+	_append_field (summary, std::string ("+") + field);
+    else
+	_append_field (summary, "-");
+}
+
+static void
+_append_entry (void *ctx, std::string &summary, notmuch_message_t *message)
+{
+    std::string tags;
+    unsigned int tag_count = 0;
+
+    _append_field (summary, std::to_string (_notmuch_message_get_doc_id (message)));
+    _append_field (summary, std::to_string ((long long) notmuch_message_get_date (message)));
+    _append_field (summary, std::to_string (notmuch_message_count_files (message)));
+    _append_optional_field (summary, _notmuch_thread_message_author (ctx, message));
+    _append_optional_field (summary, notmuch_message_get_header (message, "subject"));
+
+    for (notmuch_tags_t *iter = notmuch_message_get_tags (message);
+	 notmuch_tags_valid (iter);
+	 notmuch_tags_move_to_next (iter)) {
+	_append_field (tags, notmuch_tags_get (iter));
+	tag_count++;
+    }
+
+    _append_field (summary, std::to_string (tag_count));
+    summary += tags;
+}
+
+/* Compute the summary of 'thread_id' from its messages and store it,
+ * or delete it if no mail message is left in the thread. */
+static notmuch_status_t
+_notmuch_thread_summary_write (notmuch_database_t *notmuch,
+			       const char *thread_id)
+{
+    void *local = talloc_new (notmuch);
+    notmuch_query_t *query;
+    notmuch_messages_t *messages;
+    notmuch_status_t status;
+    std::string entries, summary;
+    unsigned int count = 0;
+    /* Changes in an unfinished atomic section get the next revision. */
+    unsigned long revision = notmuch->revision + (notmuch->atomic_dirty ? 1 : 0);
+    Xapian::doccount docs = 0;
+
+    query = notmuch_query_create (notmuch,
+				  talloc_asprintf (local, "thread:%s", thread_id));
+    if (unlikely (query == NULL)) {
+	status = NOTMUCH_STATUS_OUT_OF_MEMORY;
+	goto DONE;
+    }
+    talloc_steal (local, query);
+
+    notmuch_query_set_sort (query, NOTMUCH_SORT_OLDEST_FIRST);
+
+    status = notmuch_query_search_messages (query, &messages);
+    if (status)
+	goto DONE;
+
+    for (; notmuch_messages_valid (messages); notmuch_messages_move_to_next (messages)) {
+	notmuch_message_t *message = notmuch_messages_get (messages);
+
+	_append_entry (local, entries, message);
+	count++;
+	notmuch_message_destroy (message);
+    }
+
+    try {
+	docs = notmuch->xapian_db->get_termfreq (_find_prefix ("thread") + std::string (thread_id));
+    } catch (const Xapian::Error &error) {
+	_notmuch_database_log (notmuch, "A Xapian exception occurred reading a thread: %s.\n",
+			       error.get_msg ().c_str ());
+	notmuch->exception_reported = true;
+	status = _notmuch_xapian_error ();
+	goto DONE;
+    }
+
+    if (count) {
+	_append_field (summary, THREAD_SUMMARY_VERSION);
+	_append_field (summary, std::to_string (revision));
+	_append_field (summary, std::to_string (docs));
+	_append_field (summary, std::to_string (count));
+	summary += entries;
+    }
+
+    try {
+	/* An empty value deletes the key. */
+	notmuch->writable_xapian_db->set_metadata (THREAD_SUMMARY_PREFIX + std::string (thread_id),
+						   summary);
+    } catch (const Xapian::Error &error) {
+	_notmuch_database_log (notmuch, "A Xapian exception occurred writing a thread summary: %s.\n",
+			       error.get_msg ().c_str ());
+	notmuch->exception_reported = true;
+	status = _notmuch_xapian_error ();
+    }
+
+  DONE:
+    talloc_free (local);
+    return status;
+}
+
+/* Return the field at '*pos', and advance '*pos' past it, or return
+ * NULL if there is no complete field before 'end'. */
+static const char *
+_next_field (const char **pos, const char *end)
+{
+    const char *field = *pos;
+    const char *nul;
+
+    if (field >= end)
+	return NULL;
+
+    nul = (const char *) memchr (field, '\0', end - field);
+    if (! nul)
+	return NULL;
+
+    *pos = nul + 1;
+    return field;
+}
+
+static bool
+_next_number (const char **pos, const char *end, long long *number)
+{
+    const char *field = _next_field (pos, end);
+    char *number_end;
+
+    if (! field || ! *field)
+	return false;
+
+    *number = strtoll (field, &number_end, 10);
+    return *number_end == '\0';
+}
+
+static bool
+_next_optional_field (const void *ctx, const char **pos, const char *end,
+		      const char **value)
+{
+    const char *field = _next_field (pos, end);
+
+    if (! field)
+	return false;
+
+    if (field[0] == '+') {
+	*value = talloc_strdup (ctx, field + 1);
+	return *value != NULL;
+    }
+
+    *value = NULL;
+    return strcmp (field, "-") == 0;
+}
+
+/* Parse the entries of a summary, from 'pos' (just past its number
+ * of documents) to 'end', into a talloc array of '*count' entries,
+ * allocated from 'ctx', in '*entries'. Returns false if the summary
+ * is unreadable. */
+static bool
+_parse_entries (const void *ctx, const char *pos, const char *end,
+		notmuch_thread_summary_entry_t **entries, unsigned int *count)
+{
+    notmuch_thread_summary_entry_t *array;
+    long long count_field, number;
+    unsigned int i;
+
+    if (! _next_number (&pos, end, &count_field) || count_field <= 0 ||
+	count_field > UINT_MAX)
+	return false;
+
+    array = talloc_array (ctx, notmuch_thread_summary_entry_t, count_field);
+    if (unlikely (array == NULL))
+	return false;
+
+    for (i = 0; i < count_field; i++) {
+	notmuch_thread_summary_entry_t *entry = &array[i];
+	long long tag_count;
+
+	entry->tags = _notmuch_string_list_create (array);
+	if (unlikely (entry->tags == NULL))
+	    goto FAIL;
+
+	if (! _next_number (&pos, end, &number) || number <= 0 || number > UINT_MAX)
+	    goto FAIL;
+	entry->doc_id = number;
+
+	if (! _next_number (&pos, end, &number))
+	    goto FAIL;
+	entry->date = number;
+
+	if (! _next_number (&pos, end, &number) || number < 0 || number > INT_MAX)
+	    goto FAIL;
+	entry->files = number;
+
+	if (! _next_optional_field (array, &pos, end, &entry->author) ||
+	    ! _next_optional_field (array, &pos, end, &entry->subject))
+	    goto FAIL;
+
+	if (! _next_number (&pos, end, &tag_count) || tag_count < 0)
+	    goto FAIL;
+
+	for (; tag_count > 0; tag_count--) {
+	    const char *tag = _next_field (&pos, end);
+
+	    if (! tag)
+		goto FAIL;
+	    _notmuch_string_list_append (entry->tags, tag);
+	}
+    }
+
+    if (pos != end)
+	goto FAIL;
+
+    *entries = array;
+    *count = i;
+    return true;
+
+  FAIL:
+    talloc_free (array);
+    return false;
+}
+
+/* Load the summaries of the 'count' threads 'thread_ids' into talloc
+ * arrays allocated from 'ctx': entries[i] gets the '*counts[i]'
+ * entries of thread i, or NULL if the database does not keep thread
+ * summaries, or has none (or an unreadable or outdated one) for it.
+ *
+ * Whether the summaries are up to date is checked for all threads at
+ * once: their numbers of documents, then with a single search for
+ * documents of any of them changed after the oldest summary. */
+notmuch_private_status_t
+_notmuch_thread_summary_load (const void *ctx,
+			      notmuch_database_t *notmuch,
+			      const char **thread_ids,
+			      unsigned int count,
+			      notmuch_thread_summary_entry_t **entries,
+			      unsigned int *counts)
+{
+    const std::string prefix = _find_prefix ("thread");
+    std::vector<std::string> summaries (count);
+    /* where the entries of each usable summary start, else NULL */
+    std::vector<const char *> positions (count, NULL);
+    std::vector<long long> revisions (count);
+    std::map<std::string, unsigned int> thread_of_term;
+    std::vector<Xapian::Query> terms;
+    long long min_revision = LLONG_MAX;
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+	entries[i] = NULL;
+	counts[i] = 0;
+    }
+
+    if (! (notmuch->features & NOTMUCH_FEATURE_THREAD_SUMMARIES))
+	return NOTMUCH_PRIVATE_STATUS_SUCCESS;
+
+    try {
+	for (i = 0; i < count; i++) {
+	    std::string term = prefix + thread_ids[i];
+	    const char *pos, *end, *version;
+	    long long revision, docs;
+
+	    summaries[i] = notmuch->xapian_db->get_metadata (THREAD_SUMMARY_PREFIX +
+							     std::string (thread_ids[i]));
+	    pos = summaries[i].data ();
+	    end = pos + summaries[i].size ();
+
+	    version = _next_field (&pos, end);
+	    if (! version || strcmp (version, THREAD_SUMMARY_VERSION) != 0)
+		continue;
+
+	    if (! _next_number (&pos, end, &revision) || revision < 0 ||
+		! _next_number (&pos, end, &docs) || docs < 0)
+		continue;
+
+	    /* A document was added to or removed from the thread. */
+	    if (notmuch->xapian_db->get_termfreq (term) != (Xapian::doccount) docs)
+		continue;
+
+	    positions[i] = pos;
+	    revisions[i] = revision;
+	    thread_of_term[term] = i;
+	    terms.push_back (Xapian::Query (term));
+	    min_revision = MIN (min_revision, revision);
+	}
+
+	if ((notmuch->features & NOTMUCH_FEATURE_LAST_MOD) && ! terms.empty ()) {
+	    Xapian::Enquire enquire (*notmuch->xapian_db);
+	    Xapian::MSet changed;
+
+	    enquire.set_weighting_scheme (Xapian::BoolWeight ());
+	    enquire.set_query (Xapian::Query (Xapian::Query::OP_FILTER,
+					      Xapian::Query (Xapian::Query::OP_OR,
+							     terms.begin (), terms.end ()),
+					      Xapian::Query (Xapian::Query::OP_VALUE_GE,
+							     NOTMUCH_VALUE_LAST_MOD,
+							     Xapian::sortable_serialise (
+								 min_revision + 1))));
+	    changed = enquire.get_mset (0, notmuch->xapian_db->get_doccount ());
+
+	    /* A document of the thread changed after its summary. */
+	    for (Xapian::MSetIterator m = changed.begin (); m != changed.end (); m++) {
+		Xapian::Document doc = m.get_document ();
+		Xapian::TermIterator term = doc.termlist_begin ();
+		double last_mod = Xapian::sortable_unserialise (
+		    doc.get_value (NOTMUCH_VALUE_LAST_MOD));
+
+		term.skip_to (prefix);
+		if (term == doc.termlist_end ())
+		    continue;
+
+		auto thread = thread_of_term.find (*term);
+		if (thread != thread_of_term.end () && last_mod > revisions[thread->second])
+		    positions[thread->second] = NULL;
+	    }
+	}
+    } catch (const Xapian::Error &error) {
+	_notmuch_database_log (notmuch, "A Xapian exception occurred reading thread summaries: %s.\n",
+			       error.get_msg ().c_str ());
+	notmuch->exception_reported = true;
+	return NOTMUCH_PRIVATE_STATUS_XAPIAN_EXCEPTION;
+    }
+
+    for (i = 0; i < count; i++) {
+	if (positions[i] &&
+	    ! _parse_entries (ctx, positions[i], summaries[i].data () + summaries[i].size (),
+			      &entries[i], &counts[i]))
+	    entries[i] = NULL;
+    }
+
+    return NOTMUCH_PRIVATE_STATUS_SUCCESS;
+}
+
+/* Note that the summary of 'thread_id' must be rewritten. Does nothing
+ * unless the database keeps thread summaries. */
+void
+_notmuch_thread_summary_invalidate (notmuch_database_t *notmuch,
+				    const char *thread_id)
+{
+    if (! (notmuch->features & NOTMUCH_FEATURE_THREAD_SUMMARIES) || thread_id == NULL)
+	return;
+
+    if (! notmuch->stale_thread_summaries)
+	notmuch->stale_thread_summaries = g_hash_table_new_full (g_str_hash, g_str_equal,
+								 g_free, NULL);
+
+    g_hash_table_add (notmuch->stale_thread_summaries, g_strdup (thread_id));
+}
+
+/* Rewrite the summaries of all threads marked stale since the last
+ * flush. */
+notmuch_status_t
+_notmuch_thread_summary_flush (notmuch_database_t *notmuch)
+{
+    notmuch_status_t status = NOTMUCH_STATUS_SUCCESS;
+    GHashTableIter iter;
+    gpointer thread_id;
+
+    if (! notmuch->stale_thread_summaries || ! notmuch->open ||
+	_notmuch_database_mode (notmuch) == NOTMUCH_DATABASE_MODE_READ_ONLY)
+	return NOTMUCH_STATUS_SUCCESS;
+
+    g_hash_table_iter_init (&iter, notmuch->stale_thread_summaries);
+    while (! status && g_hash_table_iter_next (&iter, &thread_id, NULL))
+	status = _notmuch_thread_summary_write (notmuch, (const char *) thread_id);
+
+    g_hash_table_remove_all (notmuch->stale_thread_summaries);
+
+    return status;
+}
+
+/* Called at the end of each outermost atomic section: rewrite the
+ * stale summaries if the changes are about to be committed, or if
+ * many threads are stale. Rewriting a summary searches the whole
+ * thread, so doing it once per batch rather than once per atomic
+ * section keeps e.g. notmuch new from reading a long thread again for
+ * each message added to it. */
+notmuch_status_t
+_notmuch_thread_summary_flush_batch (notmuch_database_t *notmuch, bool committing)
+{
+    if (! notmuch->stale_thread_summaries)
+	return NOTMUCH_STATUS_SUCCESS;
+
+    if (! committing &&
+	g_hash_table_size (notmuch->stale_thread_summaries) < THREAD_SUMMARY_BATCH_MAX)
+	return NOTMUCH_STATUS_SUCCESS;
+
+    return _notmuch_thread_summary_flush (notmuch);
+}
+
+notmuch_status_t
+notmuch_database_set_thread_summaries (notmuch_database_t *notmuch,
+				       notmuch_bool_t enable)
+{
+    _notmuch_features old_features = notmuch->features;
+    notmuch_status_t status;
+    void *local;
+
+    status = _notmuch_database_ensure_writable (notmuch);
+    if (status)
+	return status;
+
+    if (! enable == ! (notmuch->features & NOTMUCH_FEATURE_THREAD_SUMMARIES))
+	return NOTMUCH_STATUS_SUCCESS;
+
+    local = talloc_new (notmuch);
+
+    try {
+	Xapian::WritableDatabase *db = notmuch->writable_xapian_db;
+
+	if (enable) {
+	    const std::string thread_prefix = _find_prefix ("thread");
+
+	    notmuch->features |= NOTMUCH_FEATURE_THREAD_SUMMARIES;
+
+	    for (Xapian::TermIterator t = db->allterms_begin (thread_prefix);
+		 t != db->allterms_end (thread_prefix); t++)
+		_notmuch_thread_summary_invalidate (notmuch,
+						    (*t).substr (thread_prefix.size ()).c_str ());
+
+	    status = _notmuch_thread_summary_flush (notmuch);
+	} else {
+	    std::vector<std::string> keys;
+
+	    notmuch->features = notmuch->features & ~NOTMUCH_FEATURE_THREAD_SUMMARIES;
+
+	    for (Xapian::TermIterator t = db->metadata_keys_begin (THREAD_SUMMARY_PREFIX);
+		 t != db->metadata_keys_end (THREAD_SUMMARY_PREFIX); t++)
+		keys.push_back (*t);
+
+	    for (auto &key : keys)
+		db->set_metadata (key, "");
+	}
+
+	if (! status)
+	    db->set_metadata ("features",
+			      _notmuch_database_print_features (local, notmuch->features));
+    } catch (const Xapian::Error &error) {
+	_notmuch_database_log (notmuch, "A Xapian exception occurred changing thread summaries: %s.\n",
+			       error.get_msg ().c_str ());
+	notmuch->exception_reported = true;
+	status = _notmuch_xapian_error ();
+    }
+
+    if (status)
+	notmuch->features = old_features;
+
+    talloc_free (local);
+    return status;
+}
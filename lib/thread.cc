@@ -31,6 +31,11 @@
 #define THREAD_DEBUG(format, ...) do {} while (0)       /* ignored */
 #endif
 
+/* Thread members are read in date order, which is rarely the order
+ * they are stored in. Loading them this many at a time lets their
+ * documents be read in storage order instead. */
+#define THREAD_PREFETCH_BATCH 256
+
 struct _notmuch_thread {
     notmuch_database_t *notmuch;
     char *thread_id;
@@ -53,6 +58,13 @@ struct _notmuch_thread {
     int matched_messages;
     time_t oldest;
     time_t newest;
+
+    /* For a thread built from its summary, the doc ids of the matched
+     * messages, which are not loaded until they are asked for. NULL
+     * once the messages are loaded, or if they always were. */
+    GHashTable *summary_matches;
+    notmuch_string_list_t *exclude_terms;
+    notmuch_exclude_t omit_excluded;
 };
 
 static int
@@ -63,6 +75,11 @@ _notmuch_thread_destructor (notmuch_thread_t *thread)
     g_hash_table_unref (thread->tags);
     g_hash_table_unref (thread->message_hash);
 
+    if (thread->summary_matches) {
+	g_hash_table_unref (thread->summary_matches);
+	thread->summary_matches = NULL;
+    }
+
     if (thread->authors_array) {
 	g_ptr_array_free (thread->authors_array, true);
 	thread->authors_array = NULL;
@@ -187,7 +204,7 @@ _resolve_thread_authors_string (notmuch_thread_t *thread)
  * "Last, First MI" <first.mi.last@company.com>
  */
 static char *
-_thread_cleanup_author (notmuch_thread_t *thread,
+_thread_cleanup_author (const void *ctx,
 			const char *author, const char *from)
 {
     char *clean_author, *test_author;
@@ -197,7 +214,7 @@ _thread_cleanup_author (notmuch_thread_t *thread,
 
     if (author == NULL)
 	return NULL;
-    clean_author = talloc_strdup (thread, author);
+    clean_author = talloc_strdup (ctx, author);
     if (clean_author == NULL)
 	return NULL;
     /* check if there's a comma in the name and that there's a
@@ -224,7 +241,7 @@ _thread_cleanup_author (notmuch_thread_t *thread,
 	strncpy (clean_author + fname + 1, author, lname);
 	*(clean_author + fname + 1 + lname) = '\0';
 	/* make a temporary copy and see if it matches the email */
-	test_author = talloc_strdup (thread, clean_author);
+	test_author = talloc_strdup (ctx, clean_author);
 
 	blank = strchr (test_author, ' ');
 	while (blank != NULL) {
@@ -239,6 +256,54 @@ _thread_cleanup_author (notmuch_thread_t *thread,
     return clean_author;
 }
 
+/* Return the author of 'message' as it is listed in the authors of
+ * its thread, allocated from 'ctx', or NULL if it has none. */
+char *
+_notmuch_thread_message_author (const void *ctx, notmuch_message_t *message)
+{
+    InternetAddressList *list = NULL;
+    InternetAddress *address;
+    const char *from, *author;
+    char *clean_author = NULL;
+
+    from = notmuch_message_get_header (message, "from");
+    if (from)
+	list = internet_address_list_parse (NULL, from);
+
+    if (list) {
+	address = internet_address_list_get_address (list, 0);
+	if (address) {
+	    author = internet_address_get_name (address);
+	    /* We treat quoted empty names as if they were empty. */
+	    if (author == NULL || author[0] == '\0') {
+		InternetAddressMailbox *mailbox;
+		mailbox = INTERNET_ADDRESS_MAILBOX (address);
+		author = internet_address_mailbox_get_addr (mailbox);
+	    }
+	    clean_author = _thread_cleanup_author (ctx, author, from);
+	}
+	g_object_unref (G_OBJECT (list));
+    }
+
+    return clean_author;
+}
+
+/* Does 'tag' exclude the messages carrying it? */
+static bool
+_thread_tag_excluded (const char *tag,
+		      notmuch_string_list_t *exclude_terms)
+{
+    for (notmuch_string_node_t *term = exclude_terms->head;
+	 term != NULL;
+	 term = term->next) {
+	/* Check for an empty string, and then ignore initial 'K'. */
+	if (*(term->string) && strcmp (tag, (term->string + 1)) == 0)
+	    return true;
+    }
+
+    return false;
+}
+
 /* Add 'message' as a message that belongs to 'thread'.
  *
  * The 'thread' will talloc_steal the 'message' and hold onto a
@@ -252,9 +317,6 @@ _thread_add_message (notmuch_thread_t *thread,
 {
     notmuch_tags_t *tags;
     const char *tag;
-    InternetAddressList *list = NULL;
-    InternetAddress *address;
-    const char *from, *author;
     char *clean_author;
     bool message_excluded = false;
 
@@ -264,15 +326,8 @@ _thread_add_message (notmuch_thread_t *thread,
 	     notmuch_tags_move_to_next (tags)) {
 	    tag = notmuch_tags_get (tags);
 	    /* Is message excluded? */
-	    for (notmuch_string_node_t *term = exclude_terms->head;
-		 term != NULL;
-		 term = term->next) {
-		/* Check for an empty string, and then ignore initial 'K'. */
-		if (*(term->string) && strcmp (tag, (term->string + 1)) == 0) {
-		    message_excluded = true;
-		    break;
-		}
-	    }
+	    if (_thread_tag_excluded (tag, exclude_terms))
+		message_excluded = true;
 	}
     }
 
@@ -288,25 +343,10 @@ _thread_add_message (notmuch_thread_t *thread,
 			 xstrdup (notmuch_message_get_message_id (message)),
 			 message);
 
-    from = notmuch_message_get_header (message, "from");
-    if (from)
-	list = internet_address_list_parse (NULL, from);
-
-    if (list) {
-	address = internet_address_list_get_address (list, 0);
-	if (address) {
-	    author = internet_address_get_name (address);
-	    /* We treat quoted empty names as if they were empty. */
-	    if (author == NULL || author[0] == '\0') {
-		InternetAddressMailbox *mailbox;
-		mailbox = INTERNET_ADDRESS_MAILBOX (address);
-		author = internet_address_mailbox_get_addr (mailbox);
-	    }
-	    clean_author = _thread_cleanup_author (thread, author, from);
-	    _thread_add_author (thread, clean_author);
-	    _notmuch_message_set_author (message, clean_author);
-	}
-	g_object_unref (G_OBJECT (list));
+    clean_author = _notmuch_thread_message_author (thread, message);
+    if (clean_author) {
+	_thread_add_author (thread, clean_author);
+	_notmuch_message_set_author (message, clean_author);
     }
 
     if (! thread->subject) {
@@ -328,13 +368,10 @@ _thread_add_message (notmuch_thread_t *thread,
 }
 
 static void
-_thread_set_subject_from_message (notmuch_thread_t *thread,
-				  notmuch_message_t *message)
+_thread_set_subject (notmuch_thread_t *thread, const char *subject)
 {
-    const char *subject;
     const char *cleaned_subject;
 
-    subject = notmuch_message_get_header (message, "subject");
     if (! subject)
 	return;
 
@@ -358,34 +395,43 @@ _thread_set_subject_from_message (notmuch_thread_t *thread,
     }
 }
 
-/* Add a message to this thread which is known to match the original
- * search specification. The 'sort' parameter controls whether the
+/* Update the dates of 'thread' for a matched message with the given
+ * 'date' and 'subject'. The 'sort' parameter controls whether the
  * oldest or newest matching subject is applied to the thread as a
- * whole. Returns 0 on success.
- */
-static int
-_thread_add_matched_message (notmuch_thread_t *thread,
-			     notmuch_message_t *message,
-			     notmuch_sort_t sort)
+ * whole. */
+static void
+_thread_add_matched_date (notmuch_thread_t *thread,
+			  time_t date,
+			  const char *subject,
+			  notmuch_sort_t sort)
 {
-    time_t date;
-    notmuch_message_t *hashed_message;
-    notmuch_bool_t is_set;
-
-    date = notmuch_message_get_date (message);
-
     if (date < thread->oldest || ! thread->matched_messages) {
 	thread->oldest = date;
 	if (sort == NOTMUCH_SORT_OLDEST_FIRST)
-	    _thread_set_subject_from_message (thread, message);
+	    _thread_set_subject (thread, subject);
     }
 
     if (date > thread->newest || ! thread->matched_messages) {
 	thread->newest = date;
 	const char *cur_subject = notmuch_thread_get_subject (thread);
 	if (sort != NOTMUCH_SORT_OLDEST_FIRST || EMPTY_STRING (cur_subject))
-	    _thread_set_subject_from_message (thread, message);
+	    _thread_set_subject (thread, subject);
     }
+}
+
+/* Add a message to this thread which is known to match the original
+ * search specification. Returns 0 on success.
+ */
+static int
+_thread_add_matched_message (notmuch_thread_t *thread,
+			     notmuch_message_t *message,
+			     notmuch_sort_t sort)
+{
+    notmuch_message_t *hashed_message;
+    notmuch_bool_t is_set;
+
+    _thread_add_matched_date (thread, notmuch_message_get_date (message),
+			      notmuch_message_get_header (message, "subject"), sort);
 
     if (notmuch_message_get_flag_st (message, NOTMUCH_MESSAGE_FLAG_EXCLUDED, &is_set))
 	return -1;
@@ -530,62 +576,20 @@ _resolve_thread_relationships (notmuch_thread_t *thread)
     talloc_free (local);
 }
 
-/* Create a new notmuch_thread_t object by finding the thread
- * containing the message with the given doc ID, treating any messages
- * contained in match_set as "matched".  Remove all messages in the
- * thread from match_set.
- *
- * Creating the thread will perform a database search to get all
- * messages belonging to the thread and will get the first subject
- * line, the total count of messages, and all authors in the thread.
- * Each message in the thread is checked against match_set to allow
- * for a separate count of matched messages, and to allow a viewer to
- * display these messages differently.
+/* Allocate an empty thread with the given 'thread_id', to be filled
+ * in with _thread_add_message.
  *
- * Here, 'ctx' is talloc context for the resulting thread object.
- *
- * This function write NULL in the case of any error.
- */
-notmuch_private_status_t
-_notmuch_thread_create (void *ctx,
-			notmuch_database_t *notmuch,
-			unsigned int seed_doc_id,
-			notmuch_doc_id_set_t *match_set,
-			notmuch_string_list_t *exclude_terms,
-			notmuch_exclude_t omit_excluded,
-			notmuch_sort_t sort,
-			notmuch_thread_t **pthread)
+ * Returns NULL on out of memory. */
+static notmuch_thread_t *
+_notmuch_thread_alloc (void *ctx,
+		       notmuch_database_t *notmuch,
+		       const char *thread_id)
 {
-    void *local = talloc_new (ctx);
-    notmuch_thread_t *thread = NULL;
-    notmuch_message_t *seed_message;
-    const char *thread_id;
-    char *thread_id_query_string;
-    notmuch_query_t *thread_id_query;
-
-    notmuch_messages_t *messages;
-    notmuch_message_t *message;
-    notmuch_private_status_t status;
-
-    *pthread = NULL;
+    notmuch_thread_t *thread;
 
-    seed_message = _notmuch_message_create (local, notmuch, seed_doc_id, &status);
-    if (status)
-	return status;
-
-    thread_id = notmuch_message_get_thread_id (seed_message);
-    thread_id_query_string = talloc_asprintf (local, "thread:%s", thread_id);
-    if (unlikely (thread_id_query_string == NULL))
-	goto DONE;
-
-    thread_id_query = talloc_steal (
-	local, notmuch_query_create (notmuch, thread_id_query_string));
-    if (unlikely (thread_id_query == NULL))
-	goto DONE;
-
-    thread = talloc (local, notmuch_thread_t);
+    thread = talloc (ctx, notmuch_thread_t);
     if (unlikely (thread == NULL))
-	goto DONE;
+	return NULL;
 
     talloc_set_destructor (thread, _notmuch_thread_destructor);
 
@@ -602,24 +606,153 @@ _notmuch_thread_create (void *ctx,
     thread->authors = NULL;
     thread->tags = g_hash_table_new_full (g_str_hash, g_str_equal,
 					  free, NULL);
+    thread->message_hash = g_hash_table_new_full (g_str_hash, g_str_equal,
+						  free, NULL);
 
     thread->message_list = _notmuch_message_list_create (thread);
     thread->toplevel_list = _notmuch_message_list_create (thread);
-    if (unlikely (thread->message_list == NULL ||
+    if (unlikely (thread->thread_id == NULL ||
+		  thread->message_list == NULL ||
 		  thread->toplevel_list == NULL)) {
-	thread = NULL;
-	goto DONE;
+	talloc_free (thread);
+	return NULL;
     }
 
-    thread->message_hash = g_hash_table_new_full (g_str_hash, g_str_equal,
-						  free, NULL);
-
     thread->total_messages = 0;
     thread->total_files = 0;
     thread->matched_messages = 0;
     thread->oldest = 0;
     thread->newest = 0;
 
+    thread->summary_matches = NULL;
+    thread->exclude_terms = NULL;
+    thread->omit_excluded = NOTMUCH_EXCLUDE_FALSE;
+
+    return thread;
+}
+
+/* Build the thread 'thread_id' from the 'count' entries of its
+ * summary (see _notmuch_thread_summary_load), treating the
+ * messages contained in match_set as "matched", exactly as
+ * _thread_build would from the messages themselves, and remove them
+ * from match_set. The messages themselves are loaded by
+ * _thread_ensure_messages.
+ *
+ * Returns NULL, leaving match_set alone, if 'entries' is NULL or on
+ * out of memory. */
+static notmuch_thread_t *
+_thread_create_from_summary (void *ctx,
+			     notmuch_database_t *notmuch,
+			     const char *thread_id,
+			     notmuch_thread_summary_entry_t *entries,
+			     unsigned int count,
+			     notmuch_doc_id_set_t *match_set,
+			     notmuch_string_list_t *exclude_terms,
+			     notmuch_exclude_t omit_excluded,
+			     notmuch_sort_t sort)
+{
+    notmuch_thread_t *thread;
+    GHashTableIter iter;
+    gpointer doc_id;
+    unsigned int i;
+    void *local;
+
+    if (entries == NULL)
+	return NULL;
+
+    local = talloc_new (ctx);
+
+    thread = _notmuch_thread_alloc (local, notmuch, thread_id);
+    if (unlikely (thread == NULL))
+	goto FAIL;
+
+    thread->summary_matches = g_hash_table_new (NULL, NULL);
+    thread->exclude_terms = exclude_terms;
+    thread->omit_excluded = omit_excluded;
+
+    for (i = 0; i < count; i++) {
+	notmuch_thread_summary_entry_t *entry = &entries[i];
+	bool excluded = false;
+
+	if (omit_excluded != NOTMUCH_EXCLUDE_FALSE) {
+	    for (notmuch_string_node_t *tag = entry->tags->head; tag; tag = tag->next)
+		if (_thread_tag_excluded (tag->string, exclude_terms))
+		    excluded = true;
+	}
+
+	if (excluded && omit_excluded == NOTMUCH_EXCLUDE_ALL)
+	    continue;
+
+	thread->total_messages++;
+	thread->total_files += entry->files;
+
+	_thread_add_author (thread, entry->author);
+
+	if (! thread->subject) {
+	    thread->subject = talloc_strdup (thread, entry->subject ? entry->subject : "");
+	    if (unlikely (thread->subject == NULL))
+		goto FAIL;
+	}
+
+	for (notmuch_string_node_t *tag = entry->tags->head; tag; tag = tag->next)
+	    g_hash_table_insert (thread->tags, xstrdup (tag->string), NULL);
+
+	if (_notmuch_doc_id_set_contains (match_set, entry->doc_id)) {
+	    _thread_add_matched_date (thread, entry->date, entry->subject, sort);
+	    if (! excluded)
+		thread->matched_messages++;
+	    g_hash_table_add (thread->summary_matches, GUINT_TO_POINTER (entry->doc_id));
+	    _thread_add_matched_author (thread, entry->author);
+	}
+    }
+
+    _resolve_thread_authors_string (thread);
+
+    g_hash_table_iter_init (&iter, thread->summary_matches);
+    while (g_hash_table_iter_next (&iter, &doc_id, NULL))
+	_notmuch_doc_id_set_remove (match_set, GPOINTER_TO_UINT (doc_id));
+
+    talloc_steal (ctx, thread);
+    talloc_free (local);
+    return thread;
+
+  FAIL:
+    talloc_free (local);
+    return NULL;
+}
+
+/* Fill in 'thread' from its messages, which are read from the
+ * database in one search, treating any messages contained in
+ * match_set (if not NULL) as "matched" and removing them from
+ * match_set. 'seed_message', if not NULL, is used in place of the
+ * same message read back from the database.
+ */
+static notmuch_private_status_t
+_thread_add_messages (notmuch_thread_t *thread,
+		      notmuch_message_t *seed_message,
+		      notmuch_doc_id_set_t *match_set,
+		      notmuch_string_list_t *exclude_terms,
+		      notmuch_exclude_t omit_excluded,
+		      notmuch_sort_t sort)
+{
+    void *local = talloc_new (thread);
+    char *thread_id_query_string;
+    notmuch_query_t *thread_id_query;
+
+    notmuch_messages_t *messages;
+    notmuch_message_t *message;
+    notmuch_private_status_t status = NOTMUCH_PRIVATE_STATUS_OUT_OF_MEMORY;
+    unsigned int i;
+
+    thread_id_query_string = talloc_asprintf (local, "thread:%s", thread->thread_id);
+    if (unlikely (thread_id_query_string == NULL))
+	goto DONE;
+
+    thread_id_query = talloc_steal (
+	local, notmuch_query_create (thread->notmuch, thread_id_query_string));
+    if (unlikely (thread_id_query == NULL))
+	goto DONE;
+
     /* We use oldest-first order unconditionally here to obtain the
      * proper author ordering for the thread. The 'sort' parameter
      * passed to this function is used only to indicate whether the
@@ -630,22 +763,29 @@ _notmuch_thread_create (void *ctx,
     if (status)
 	goto DONE;
 
-    for (;
+    for (i = 0;
 	 notmuch_messages_valid (messages);
-	 notmuch_messages_move_to_next (messages)) {
+	 notmuch_messages_move_to_next (messages), i++) {
 	unsigned int doc_id;
 
+	if (i % THREAD_PREFETCH_BATCH == 0) {
+	    status = (notmuch_private_status_t) _notmuch_mset_messages_prefetch (
+		messages, THREAD_PREFETCH_BATCH, false);
+	    if (status)
+		goto DONE;
+	}
+
 	message = notmuch_messages_get (messages);
 	doc_id = _notmuch_message_get_doc_id (message);
-	if (doc_id == seed_doc_id)
+	if (seed_message && doc_id == _notmuch_message_get_doc_id (seed_message))
 	    message = seed_message;
 
 	_thread_add_message (thread, message, exclude_terms, omit_excluded);
 
-	if ( _notmuch_doc_id_set_contains (match_set, doc_id)) {
+	if (match_set && _notmuch_doc_id_set_contains (match_set, doc_id)) {
 	    _notmuch_doc_id_set_remove (match_set, doc_id);
 	    if (_thread_add_matched_message (thread, message, sort)) {
-		thread = NULL;
+		status = NOTMUCH_PRIVATE_STATUS_OUT_OF_MEMORY;
 		goto DONE;
 	    }
 	}
@@ -657,6 +797,105 @@ _notmuch_thread_create (void *ctx,
 
     _resolve_thread_relationships (thread);
 
+  DONE:
+    talloc_free (local);
+    return status;
+}
+
+/* Load the messages of a thread built from its summary, flagging the
+ * matched ones as _thread_add_messages would have. */
+static void
+_thread_ensure_messages (notmuch_thread_t *thread)
+{
+    notmuch_thread_t *loaded;
+
+    if (! thread->summary_matches)
+	return;
+
+    loaded = _notmuch_thread_alloc (thread, thread->notmuch, thread->thread_id);
+    if (unlikely (loaded == NULL))
+	return;
+
+    if (_thread_add_messages (loaded, NULL, NULL, thread->exclude_terms,
+			      thread->omit_excluded, NOTMUCH_SORT_OLDEST_FIRST)) {
+	talloc_free (loaded);
+	return;
+    }
+
+    for (notmuch_message_node_t *node = loaded->message_list->head; node; node = node->next) {
+	if (g_hash_table_contains (thread->summary_matches,
+				   GUINT_TO_POINTER (_notmuch_message_get_doc_id (node->message))))
+	    notmuch_message_set_flag (node->message, NOTMUCH_MESSAGE_FLAG_MATCH, true);
+    }
+
+    /* The messages stay owned by 'loaded'. */
+    thread->message_list = loaded->message_list;
+    thread->toplevel_list = loaded->toplevel_list;
+
+    g_hash_table_unref (thread->summary_matches);
+    thread->summary_matches = NULL;
+}
+
+/* Create a new notmuch_thread_t object by finding the thread
+ * containing the message with the given doc ID, treating any messages
+ * contained in match_set as "matched".  Remove all messages in the
+ * thread from match_set.
+ *
+ * Creating the thread will perform a database search to get all
+ * messages belonging to the thread and will get the first subject
+ * line, the total count of messages, and all authors in the thread.
+ * Each message in the thread is checked against match_set to allow
+ * for a separate count of matched messages, and to allow a viewer to
+ * display these messages differently. If the database keeps thread
+ * summaries, all of this is read from the summary of the thread
+ * instead, and the messages are only loaded when asked for.
+ *
+ * Here, 'ctx' is talloc context for the resulting thread object.
+ *
+ * This function write NULL in the case of any error.
+ */
+notmuch_private_status_t
+_notmuch_thread_create (void *ctx,
+			notmuch_database_t *notmuch,
+			unsigned int seed_doc_id,
+			notmuch_doc_id_set_t *match_set,
+			notmuch_string_list_t *exclude_terms,
+			notmuch_exclude_t omit_excluded,
+			notmuch_sort_t sort,
+			notmuch_thread_t **pthread)
+{
+    void *local = talloc_new (ctx);
+    notmuch_thread_t *thread = NULL;
+    notmuch_message_t *seed_message;
+    notmuch_thread_summary_entry_t *entries;
+    const char *thread_id;
+    unsigned int count;
+    notmuch_private_status_t status;
+
+    *pthread = NULL;
+
+    seed_message = _notmuch_message_create (local, notmuch, seed_doc_id, &status);
+    if (status)
+	return status;
+
+    thread_id = notmuch_message_get_thread_id (seed_message);
+
+    /* Without a usable summary, build the thread from its messages. */
+    if (_notmuch_thread_summary_load (local, notmuch, &thread_id, 1, &entries, &count))
+	entries = NULL;
+    thread = _thread_create_from_summary (local, notmuch, thread_id, entries, count,
+					  match_set, exclude_terms, omit_excluded, sort);
+    if (! thread) {
+	thread = _notmuch_thread_alloc (local, notmuch, thread_id);
+	if (unlikely (thread == NULL))
+	    goto DONE;
+
+	status = _thread_add_messages (thread, seed_message, match_set,
+				       exclude_terms, omit_excluded, sort);
+	if (status)
+	    goto DONE;
+    }
+
     /* Commit to returning thread. */
     (void) talloc_steal (ctx, thread);
     *pthread = thread;
@@ -668,15 +907,189 @@ _notmuch_thread_create (void *ctx,
     return status;
 }
 
+/* Create the threads containing each of the 'count' messages in
+ * 'seed_messages', which must all belong to distinct threads, using a
+ * single database search, and store them in 'threads' in the same
+ * order. Messages are treated as "matched" and removed from match_set
+ * exactly as by _notmuch_thread_create, which also explains when
+ * threads are built from their summaries instead. The seed messages
+ * of the threads built from their messages become part of them.
+ *
+ * Here, 'ctx' is talloc context for the resulting thread objects.
+ *
+ * On error, every element of 'threads' is set to NULL.
+ */
+notmuch_private_status_t
+_notmuch_thread_create_batch (void *ctx,
+			      notmuch_database_t *notmuch,
+			      notmuch_message_t **seed_messages,
+			      unsigned int count,
+			      notmuch_doc_id_set_t *match_set,
+			      notmuch_string_list_t *exclude_terms,
+			      notmuch_exclude_t omit_excluded,
+			      notmuch_sort_t sort,
+			      notmuch_thread_t **threads)
+{
+    void *local;
+    GHashTable *threads_by_id, *seeds_by_doc_id;
+    const char *thread_id;
+    const char **thread_ids;
+    notmuch_thread_summary_entry_t **entries;
+    unsigned int *entry_counts;
+    char *query_string = NULL;
+    notmuch_query_t *query;
+    notmuch_messages_t *messages;
+    notmuch_message_t *message;
+    notmuch_thread_t *thread;
+    notmuch_private_status_t status = NOTMUCH_PRIVATE_STATUS_SUCCESS;
+    bool complete = false;
+    unsigned int i;
+
+    if (count == 0)
+	return NOTMUCH_PRIVATE_STATUS_SUCCESS;
+
+    for (i = 0; i < count; i++)
+	threads[i] = NULL;
+
+    local = talloc_new (ctx);
+    threads_by_id = g_hash_table_new (g_str_hash, g_str_equal);
+    seeds_by_doc_id = g_hash_table_new (NULL, NULL);
+
+    thread_ids = talloc_array (local, const char *, count);
+    entries = talloc_array (local, notmuch_thread_summary_entry_t *, count);
+    entry_counts = talloc_array (local, unsigned int, count);
+    if (unlikely (! thread_ids || ! entries || ! entry_counts))
+	goto DONE;
+
+    for (i = 0; i < count; i++)
+	thread_ids[i] = notmuch_message_get_thread_id (seed_messages[i]);
+
+    /* Threads without a usable summary are built from their messages. */
+    if (_notmuch_thread_summary_load (local, notmuch, thread_ids, count,
+				      entries, entry_counts)) {
+	for (i = 0; i < count; i++)
+	    entries[i] = NULL;
+    }
+
+    for (i = 0; i < count; i++) {
+	thread_id = thread_ids[i];
+	threads[i] = _thread_create_from_summary (local, notmuch, thread_id,
+						  entries[i], entry_counts[i], match_set,
+						  exclude_terms, omit_excluded, sort);
+	if (threads[i])
+	    continue;
+
+	threads[i] = _notmuch_thread_alloc (local, notmuch, thread_id);
+	if (unlikely (threads[i] == NULL))
+	    goto DONE;
+	g_hash_table_insert (threads_by_id, threads[i]->thread_id, threads[i]);
+	g_hash_table_insert (seeds_by_doc_id,
+			     GUINT_TO_POINTER (_notmuch_message_get_doc_id (seed_messages[i])),
+			     seed_messages[i]);
+
+	if (query_string)
+	    query_string = talloc_asprintf_append_buffer (query_string,
+							  " or thread:%s",
+							  thread_id);
+	else
+	    query_string = talloc_asprintf (local, "thread:%s", thread_id);
+	if (unlikely (query_string == NULL))
+	    goto DONE;
+    }
+
+    /* Every thread was built from its summary. */
+    if (! query_string)
+	goto RESOLVED;
+
+    query = talloc_steal (local, notmuch_query_create (notmuch, query_string));
+    if (unlikely (query == NULL))
+	goto DONE;
+
+    /* As in _notmuch_thread_create, oldest-first order gives each
+     * thread its proper author ordering. */
+    notmuch_query_set_sort (query, NOTMUCH_SORT_OLDEST_FIRST);
+
+    status = (notmuch_private_status_t) notmuch_query_search_messages (query, &messages);
+    if (status)
+	goto DONE;
+
+    for (i = 0;
+	 notmuch_messages_valid (messages);
+	 notmuch_messages_move_to_next (messages), i++) {
+	notmuch_message_t *seed_message;
+	unsigned int doc_id;
+
+	if (i % THREAD_PREFETCH_BATCH == 0) {
+	    status = (notmuch_private_status_t) _notmuch_mset_messages_prefetch (
+		messages, THREAD_PREFETCH_BATCH, false);
+	    if (status)
+		goto DONE;
+	}
+
+	message = notmuch_messages_get (messages);
+	doc_id = _notmuch_message_get_doc_id (message);
+	seed_message = (notmuch_message_t *) g_hash_table_lookup (
+	    seeds_by_doc_id, GUINT_TO_POINTER (doc_id));
+	if (seed_message)
+	    message = seed_message;
+
+	thread = (notmuch_thread_t *) g_hash_table_lookup (
+	    threads_by_id, notmuch_message_get_thread_id (message));
+	if (unlikely (thread == NULL)) {
+	    /* The message was moved to another thread since the
+	     * search started. */
+	    _notmuch_message_close (message);
+	    continue;
+	}
+
+	_thread_add_message (thread, message, exclude_terms, omit_excluded);
+
+	if (_notmuch_doc_id_set_contains (match_set, doc_id)) {
+	    _notmuch_doc_id_set_remove (match_set, doc_id);
+	    if (_thread_add_matched_message (thread, message, sort))
+		goto DONE;
+	}
+
+	_notmuch_message_close (message);
+    }
+
+    for (i = 0; i < count; i++) {
+	if (threads[i]->summary_matches)
+	    continue;
+	_resolve_thread_authors_string (threads[i]);
+	_resolve_thread_relationships (threads[i]);
+    }
+
+  RESOLVED:
+    /* Commit to returning the threads. */
+    for (i = 0; i < count; i++)
+	(void) talloc_steal (ctx, threads[i]);
+    complete = true;
+
+  DONE:
+    if (! complete) {
+	if (! status)
+	    status = NOTMUCH_PRIVATE_STATUS_OUT_OF_MEMORY;
+	for (i = 0; i < count; i++)
+	    threads[i] = NULL;
+    }
+    g_hash_table_unref (seeds_by_doc_id);
+    g_hash_table_unref (threads_by_id);
+    talloc_free (local);
+    return status;
+}
+
 notmuch_messages_t *
 notmuch_thread_get_toplevel_messages (notmuch_thread_t *thread)
 {
+    _thread_ensure_messages (thread);
     return _notmuch_messages_create (thread->toplevel_list);
 }
 
 notmuch_messages_t *
 notmuch_thread_get_messages (notmuch_thread_t *thread)
 {
+    _thread_ensure_messages (thread);
     return _notmuch_messages_create (thread->message_list);
 }
 
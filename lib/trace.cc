@@ -0,0 +1,117 @@
+/* trace.cc - Counters of the work done through a database handle
+ *
+ * This file is part of notmuch.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see https://www.gnu.org/licenses/ .
+ */
+
+#include "database-private.h"
+
+#include <time.h>
+
+static unsigned long long
+_trace_now (void)
+{
+    struct timespec ts;
+
+    if (clock_gettime (CLOCK_MONOTONIC, &ts))
+	return 0;
+
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool
+_notmuch_trace_enabled (void)
+{
+    const char *env = getenv ("NOTMUCH_TRACE");
+
+    return (env && strcmp (env, "") != 0);
+}
+
+void
+_notmuch_trace_count (notmuch_database_t *notmuch, notmuch_trace_counter_t counter,
+		      unsigned long long n)
+{
+    notmuch->trace[counter] += n;
+}
+
+unsigned long long
+_notmuch_trace_start (notmuch_database_t *notmuch)
+{
+    if (! notmuch->trace_timing)
+	return 0;
+
+    return _trace_now ();
+}
+
+void
+_notmuch_trace_end (notmuch_database_t *notmuch, notmuch_trace_counter_t counter,
+		    unsigned long long n, unsigned long long start)
+{
+    notmuch->trace[counter] += n;
+
+    if (start) {
+	unsigned long long now = _trace_now ();
+
+	if (now > start)
+	    notmuch->trace[counter + 1] += now - start;
+    }
+}
+
+unsigned long long
+notmuch_database_get_trace_counter (notmuch_database_t *notmuch,
+				    notmuch_trace_counter_t counter)
+{
+    if (counter < NOTMUCH_TRACE_FIRST || counter >= NOTMUCH_TRACE_LAST)
+	return 0;
+
+    return notmuch->trace[counter];
+}
+
+const char *
+notmuch_trace_counter_name (notmuch_trace_counter_t counter)
+{
+    switch (counter) {
+    case NOTMUCH_TRACE_QUERY_PARSE:
+	return "query_parse";
+    case NOTMUCH_TRACE_QUERY_PARSE_NS:
+	return "query_parse_ns";
+    case NOTMUCH_TRACE_ENQUIRE:
+	return "enquire";
+    case NOTMUCH_TRACE_ENQUIRE_NS:
+	return "enquire_ns";
+    case NOTMUCH_TRACE_DOCUMENT_FETCH:
+	return "document_fetch";
+    case NOTMUCH_TRACE_METADATA_LOAD:
+	return "metadata_load";
+    case NOTMUCH_TRACE_METADATA_LOAD_NS:
+	return "metadata_load_ns";
+    case NOTMUCH_TRACE_THREAD_CREATE:
+	return "thread_create";
+    case NOTMUCH_TRACE_THREAD_CREATE_NS:
+	return "thread_create_ns";
+    case NOTMUCH_TRACE_MODIFIED_RETRY:
+	return "modified_retry";
+    case NOTMUCH_TRACE_DIRECTORY_CACHE_HIT:
+	return "directory_cache_hit";
+    case NOTMUCH_TRACE_DIRECTORY_CACHE_MISS:
+	return "directory_cache_miss";
+    case NOTMUCH_TRACE_INDEX_HEADER_ONLY:
+	return "index_header_only";
+    case NOTMUCH_TRACE_QUERY_CACHE_HIT:
+	return "query_cache_hit";
+    default:
+	return NULL;
+    }
+}
@@ -82,6 +82,9 @@ typedef struct notmuch_show_params {
     _notmuch_crypto_t crypto;
     bool include_html;
     GMimeStream *out_stream;
+    /* Read-ahead of the files of the messages about to be shown, or
+     * NULL. */
+    struct show_prefetch *prefetch;
 } notmuch_show_params_t;
 
 /* There's no point in continuing when we've detected that we've done
@@ -100,6 +103,14 @@ typedef struct notmuch_show_params {
 
 #define ARRAY_SIZE(arr) (sizeof (arr) / sizeof (arr[0]))
 
+/* How many messages to load at once with notmuch_messages_prefetch
+ * when walking a long list of results. */
+#define NOTMUCH_PREFETCH_BATCH 256
+
+/* How many messages to change in one atomic section when tagging
+ * many messages at once (see tag_batch_create). */
+#define NOTMUCH_TAG_BATCH 1000
+
 #define STRNCMP_LITERAL(var, literal) \
     strncmp ((var), (literal), sizeof (literal) - 1)
 
@@ -200,6 +211,9 @@ notmuch_search_command (notmuch_database_t *notmuch, int argc, char *argv[]);
 int
 notmuch_address_command (notmuch_database_t *notmuch, int argc, char *argv[]);
 
+int
+notmuch_serve_command (notmuch_database_t *notmuch, int argc, char *argv[]);
+
 int
 notmuch_setup_command (notmuch_database_t *notmuch, int argc, char *argv[]);
 
@@ -454,7 +468,8 @@ notmuch_database_dump (notmuch_database_t *notmuch,
 		       const char *query_str,
 		       dump_format_t output_format,
 		       dump_include_t include,
-		       bool gzip_output);
+		       bool gzip_output,
+		       int jobs);
 
 /* If status indicates error print appropriate
  * messages to stderr.
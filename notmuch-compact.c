@@ -32,11 +32,13 @@ notmuch_compact_command (notmuch_database_t *notmuch, int argc, char *argv[])
     const char *backup_path = NULL;
     notmuch_status_t ret;
     bool quiet = false;
+    bool online = false;
     int opt_index;
 
     notmuch_opt_desc_t options[] = {
 	{ .opt_string = &backup_path, .name = "backup" },
 	{ .opt_bool =  &quiet, .name = "quiet" },
+	{ .opt_bool =  &online, .name = "online" },
 	{ .opt_inherit = notmuch_shared_options },
 	{ }
     };
@@ -49,8 +51,12 @@ notmuch_compact_command (notmuch_database_t *notmuch, int argc, char *argv[])
 
     if (! quiet)
 	printf ("Compacting database...\n");
-    ret = notmuch_database_compact_db (notmuch, backup_path,
-				       quiet ? NULL : status_update_cb, NULL);
+    if (online)
+	ret = notmuch_database_compact_online (notmuch, backup_path,
+					       quiet ? NULL : status_update_cb, NULL);
+    else
+	ret = notmuch_database_compact_db (notmuch, backup_path,
+					   quiet ? NULL : status_update_cb, NULL);
     if (ret) {
 	fprintf (stderr, "Compaction failed: %s\n", notmuch_status_to_string (ret));
 	return EXIT_FAILURE;
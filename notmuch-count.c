@@ -27,47 +27,12 @@ enum {
     OUTPUT_FILES,
 };
 
-/* Return the number of files matching the query, or -1 for an error */
-static int
-count_files (notmuch_query_t *query)
-{
-    notmuch_messages_t *messages;
-    notmuch_message_t *message;
-    notmuch_filenames_t *filenames;
-    notmuch_status_t status;
-    int count = 0;
-
-    status = notmuch_query_search_messages (query, &messages);
-    if (print_status_query ("notmuch count", query, status))
-	return -1;
-
-    for (;
-	 notmuch_messages_valid (messages);
-	 notmuch_messages_move_to_next (messages)) {
-	message = notmuch_messages_get (messages);
-	filenames = notmuch_message_get_filenames (message);
-
-	for (;
-	     notmuch_filenames_valid (filenames);
-	     notmuch_filenames_move_to_next (filenames))
-	    count++;
-
-	notmuch_filenames_destroy (filenames);
-	notmuch_message_destroy (message);
-    }
-
-    notmuch_messages_destroy (messages);
-
-    return count;
-}
-
 /* return 0 on success, -1 on failure */
 static int
 print_count (notmuch_database_t *notmuch, const char *query_str,
 	     notmuch_config_values_t *exclude_tags, int output, int print_lastmod)
 {
     notmuch_query_t *query;
-    int count;
     unsigned int ucount;
     unsigned long revision;
     const char *uuid;
@@ -109,13 +74,12 @@ print_count (notmuch_database_t *notmuch, const char *query_str,
 	printf ("%u", ucount);
 	break;
     case OUTPUT_FILES:
-	count = count_files (query);
-	if (count >= 0) {
-	    printf ("%d", count);
-	} else {
+	status = notmuch_query_count_files (query, &ucount);
+	if (print_status_query ("notmuch count", query, status)) {
 	    ret = -1;
 	    goto DONE;
 	}
+	printf ("%u", ucount);
 	break;
     }
 
@@ -23,8 +23,14 @@
 #include "string-util.h"
 #include "zlib-extra.h"
 
+/* The dump is formatted into a GString, which the serial dump passes
+ * on to the gzFile every DUMP_BUFFER_SIZE bytes, and the parallel
+ * dump (see database_dump_jobs) keeps until its turn to be written
+ * comes. */
+#define DUMP_BUFFER_SIZE (64 * 1024)
+
 static int
-database_dump_config (notmuch_database_t *notmuch, gzFile output)
+database_dump_config (notmuch_database_t *notmuch, GString *output)
 {
     notmuch_config_list_t *list;
     int ret = EXIT_FAILURE;
@@ -42,7 +48,7 @@ database_dump_config (notmuch_database_t *notmuch, gzFile output)
 		     notmuch_config_list_key (list));
 	    goto DONE;
 	}
-	GZPRINTF (output, "#@ %s", buffer);
+	g_string_append_printf (output, "#@ %s", buffer);
 
 	if (hex_encode (notmuch, notmuch_config_list_value (list),
 			&buffer, &buffer_size) != HEX_SUCCESS) {
@@ -51,9 +57,9 @@ database_dump_config (notmuch_database_t *notmuch, gzFile output)
 	    goto DONE;
 	}
 
-	GZPUTS (output, " ");
-	GZPUTS (output, buffer);
-	GZPUTS (output, "\n");
+	g_string_append (output, " ");
+	g_string_append (output, buffer);
+	g_string_append (output, "\n");
     }
 
     ret = EXIT_SUCCESS;
@@ -69,32 +75,32 @@ database_dump_config (notmuch_database_t *notmuch, gzFile output)
 }
 
 static void
-print_dump_header (gzFile output, int output_format, int include)
+print_dump_header (GString *output, int output_format, int include)
 {
     const char *sep = "";
 
-    GZPRINTF (output, "#notmuch-dump %s:%d ",
-	      (output_format == DUMP_FORMAT_SUP) ? "sup" : "batch-tag",
-	      NOTMUCH_DUMP_VERSION);
+    g_string_append_printf (output, "#notmuch-dump %s:%d ",
+			    (output_format == DUMP_FORMAT_SUP) ? "sup" : "batch-tag",
+			    NOTMUCH_DUMP_VERSION);
 
     if (include & DUMP_INCLUDE_CONFIG) {
-	GZPUTS (output, "config");
+	g_string_append (output, "config");
 	sep = ",";
     }
     if (include & DUMP_INCLUDE_PROPERTIES) {
-	GZPRINTF (output, "%sproperties", sep);
+	g_string_append_printf (output, "%sproperties", sep);
 	sep = ",";
     }
     if (include & DUMP_INCLUDE_TAGS) {
-	GZPRINTF (output, "%stags", sep);
+	g_string_append_printf (output, "%stags", sep);
     }
-    GZPUTS (output, "\n");
+    g_string_append (output, "\n");
 }
 
 static int
 dump_properties_message (void *ctx,
 			 notmuch_message_t *message,
-			 gzFile output,
+			 GString *output,
 			 char **buffer_p, size_t *size_p)
 {
     const char *message_id;
@@ -117,7 +123,7 @@ dump_properties_message (void *ctx,
 		fprintf (stderr, "Error: failed to hex-encode message-id %s\n", message_id);
 		return 1;
 	    }
-	    GZPRINTF (output, "#= %s", *buffer_p);
+	    g_string_append_printf (output, "#= %s", *buffer_p);
 	    first = false;
 	}
 
@@ -128,18 +134,18 @@ dump_properties_message (void *ctx,
 	    fprintf (stderr, "Error: failed to hex-encode key %s\n", key);
 	    return 1;
 	}
-	GZPRINTF (output, " %s", *buffer_p);
+	g_string_append_printf (output, " %s", *buffer_p);
 
 	if (hex_encode (ctx, val, buffer_p, size_p) != HEX_SUCCESS) {
 	    fprintf (stderr, "Error: failed to hex-encode value %s\n", val);
 	    return 1;
 	}
-	GZPRINTF (output, "=%s", *buffer_p);
+	g_string_append_printf (output, "=%s", *buffer_p);
     }
     notmuch_message_properties_destroy (list);
 
     if (! first)
-	GZPRINTF (output, "\n", *buffer_p);
+	g_string_append (output, "\n");
 
     return 0;
 }
@@ -147,7 +153,7 @@ dump_properties_message (void *ctx,
 static int
 dump_tags_message (void *ctx,
 		   notmuch_message_t *message, int output_format,
-		   gzFile output,
+		   GString *output,
 		   char **buffer_p, size_t *size_p)
 {
     int first = 1;
@@ -167,7 +173,7 @@ dump_tags_message (void *ctx,
     }
 
     if (output_format == DUMP_FORMAT_SUP) {
-	GZPRINTF (output, "%s (", message_id);
+	g_string_append_printf (output, "%s (", message_id);
     }
 
     for (notmuch_tags_t *tags = notmuch_message_get_tags (message);
@@ -176,12 +182,12 @@ dump_tags_message (void *ctx,
 	const char *tag_str = notmuch_tags_get (tags);
 
 	if (! first)
-	    GZPUTS (output, " ");
+	    g_string_append (output, " ");
 
 	first = 0;
 
 	if (output_format == DUMP_FORMAT_SUP) {
-	    GZPUTS (output, tag_str);
+	    g_string_append (output, tag_str);
 	} else {
 	    if (hex_encode (ctx, tag_str,
 			    buffer_p, size_p) != HEX_SUCCESS) {
@@ -189,12 +195,12 @@ dump_tags_message (void *ctx,
 			 tag_str);
 		return EXIT_FAILURE;
 	    }
-	    GZPRINTF (output, "+%s", *buffer_p);
+	    g_string_append_printf (output, "+%s", *buffer_p);
 	}
     }
 
     if (output_format == DUMP_FORMAT_SUP) {
-	GZPUTS (output, ")\n");
+	g_string_append (output, ")\n");
     } else {
 	if (make_boolean_term (ctx, "id", message_id,
 			       buffer_p, size_p)) {
@@ -202,73 +208,544 @@ dump_tags_message (void *ctx,
 		     message_id, strerror (errno));
 	    return EXIT_FAILURE;
 	}
-	GZPRINTF (output, " -- %s\n", *buffer_p);
+	g_string_append_printf (output, " -- %s\n", *buffer_p);
     }
     return EXIT_SUCCESS;
 }
 
+static int
+dump_message (void *ctx,
+	      notmuch_message_t *message, int output_format, int include,
+	      GString *output,
+	      char **buffer_p, size_t *size_p)
+{
+    if ((include & DUMP_INCLUDE_TAGS) &&
+	dump_tags_message (ctx, message, output_format, output,
+			   buffer_p, size_p))
+	return EXIT_FAILURE;
+
+    if ((include & DUMP_INCLUDE_PROPERTIES) &&
+	dump_properties_message (ctx, message, output,
+				 buffer_p, size_p))
+	return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+static notmuch_status_t
+dump_query_create (notmuch_database_t *notmuch, const char *query_str,
+		   notmuch_query_t **query)
+{
+    notmuch_status_t status;
+
+    if (! query_str)
+	query_str = "";
+
+    status = notmuch_query_create_with_syntax (notmuch, query_str,
+					       shared_option_query_syntax (),
+					       query);
+    if (status)
+	return status;
+
+    /* Don't ask xapian to sort by Message-ID. Xapian optimizes returning the
+     * first results quickly at the expense of total time.
+     */
+    notmuch_query_set_sort (*query, NOTMUCH_SORT_UNSORTED);
+
+    return NOTMUCH_STATUS_SUCCESS;
+}
+
+/* Write out and empty 'buffer'. Like GZPUTS, this exits on error. */
+static void
+gz_write_buffer (gzFile output, GString *buffer)
+{
+    if (buffer->len == 0)
+	return;
+
+    ASSERT_GZBYTES (output, gzwrite (output, buffer->str, buffer->len));
+    g_string_truncate (buffer, 0);
+}
+
 static int
 database_dump_file (notmuch_database_t *notmuch, gzFile output,
 		    const char *query_str, int output_format, int include)
 {
-    notmuch_query_t *query;
+    notmuch_query_t *query = NULL;
     notmuch_messages_t *messages;
     notmuch_message_t *message;
     notmuch_status_t status;
+    GString *text;
     char *buffer = NULL;
     size_t buffer_size = 0;
+    int ret = EXIT_FAILURE;
 
-    print_dump_header (output, output_format, include);
+    text = g_string_sized_new (DUMP_BUFFER_SIZE);
+
+    print_dump_header (text, output_format, include);
 
     if (include & DUMP_INCLUDE_CONFIG) {
 	if (print_status_database ("notmuch dump", notmuch,
-				   database_dump_config (notmuch, output)))
-	    return EXIT_FAILURE;
+				   database_dump_config (notmuch, text)))
+	    goto DONE;
     }
 
-    if (! (include & (DUMP_INCLUDE_TAGS | DUMP_INCLUDE_PROPERTIES)))
-	return EXIT_SUCCESS;
-
-    if (! query_str)
-	query_str = "";
+    if (! (include & (DUMP_INCLUDE_TAGS | DUMP_INCLUDE_PROPERTIES))) {
+	ret = EXIT_SUCCESS;
+	goto DONE;
+    }
 
-    status = notmuch_query_create_with_syntax (notmuch, query_str,
-					       shared_option_query_syntax (),
-					       &query);
+    status = dump_query_create (notmuch, query_str, &query);
     if (print_status_database ("notmuch dump", notmuch, status))
-	return EXIT_FAILURE;
-
-    /* Don't ask xapian to sort by Message-ID. Xapian optimizes returning the
-     * first results quickly at the expense of total time.
-     */
-    notmuch_query_set_sort (query, NOTMUCH_SORT_UNSORTED);
+	goto DONE;
 
     status = notmuch_query_search_messages (query, &messages);
     if (print_status_query ("notmuch dump", query, status))
+	goto DONE;
+
+    for (;
+	 notmuch_messages_valid (messages);
+	 notmuch_messages_move_to_next (messages)) {
+
+	message = notmuch_messages_get (messages);
+
+	if (dump_message (notmuch, message, output_format, include, text,
+			  &buffer, &buffer_size))
+	    goto DONE;
+
+	notmuch_message_destroy (message);
+
+	if (text->len >= DUMP_BUFFER_SIZE)
+	    gz_write_buffer (output, text);
+    }
+
+    ret = EXIT_SUCCESS;
+
+  DONE:
+    if (ret == EXIT_SUCCESS)
+	gz_write_buffer (output, text);
+
+    if (query)
+	notmuch_query_destroy (query);
+
+    g_string_free (text, TRUE);
+
+    return ret;
+}
+
+/* With --jobs, the messages matching the query are cut into chunks
+ * by ranges of consecutive document ids, the order of the serial
+ * dump. Each chunk is searched on its own (see
+ * notmuch_query_set_doc_id_range), so no worker pays for the results
+ * before its chunk. Worker threads format, and with --gzip compress, whole
+ * chunks into memory, each using a read-only database handle of its
+ * own, since a notmuch_database_t must not be used by two threads at
+ * once. The main thread writes the chunks out in order, so the
+ * uncompressed output is identical to that of a serial dump. Each
+ * compressed chunk is a gzip member of its own; gzip(1) and notmuch
+ * restore read a sequence of members as one stream.
+ */
+
+/* Largest number of messages in one chunk, if the matches are spread
+ * evenly over the document ids */
+#define DUMP_CHUNK_MESSAGES 20000
+
+/* How many chunks the workers may get ahead of the one to be written
+ * next, which bounds the memory used to hold them. */
+#define DUMP_CHUNKS_AHEAD(jobs) (2 * (jobs))
+
+/* How often to try to get all handles onto the same revision */
+#define DUMP_OPEN_ATTEMPTS 5
+
+typedef struct {
+    GString *data;
+    bool done;
+} dump_chunk_t;
+
+typedef struct {
+    GMutex mutex;
+    GCond cond;
+
+    dump_chunk_t *chunks;
+    unsigned int num_chunks;
+    unsigned int chunk_doc_ids;	/* document ids in each chunk */
+    unsigned int next_chunk;	/* next chunk to hand to a worker */
+    unsigned int next_write;	/* next chunk to be written out */
+    unsigned int ahead;
+    bool failed;
+
+    int output_format;
+    int include;
+    bool gzip_output;
+} dump_jobs_t;
+
+typedef struct {
+    dump_jobs_t *jobs;
+    notmuch_database_t *notmuch;
+    notmuch_query_t *query;
+    GThread *thread;
+} dump_worker_t;
+
+/* Compress 'text' into a gzip member, as gzdopen (fd, "w9") would.
+ * Returns NULL on failure. */
+static GString *
+gzip_buffer (GString *text)
+{
+    z_stream stream;
+    GString *out;
+    int zerr;
+
+    memset (&stream, 0, sizeof (stream));
+    if (deflateInit2 (&stream, 9, Z_DEFLATED, MAX_WBITS + 16, 8,
+		      Z_DEFAULT_STRATEGY) != Z_OK)
+	return NULL;
+
+    /* deflateBound is enough to finish in a single call. */
+    out = g_string_sized_new (deflateBound (&stream, text->len));
+
+    stream.next_in = (Bytef *) text->str;
+    stream.avail_in = text->len;
+    stream.next_out = (Bytef *) out->str;
+    stream.avail_out = out->allocated_len - 1;
+
+    zerr = deflate (&stream, Z_FINISH);
+    g_string_set_size (out, stream.total_out);
+    deflateEnd (&stream);
+
+    if (zerr != Z_STREAM_END) {
+	g_string_free (out, TRUE);
+	return NULL;
+    }
+
+    return out;
+}
+
+/* Format (and compress, if asked to) chunk number 'chunk' of the dump
+ * into a newly allocated *out. */
+static int
+dump_chunk (dump_worker_t *worker, unsigned int chunk, GString **out)
+{
+    dump_jobs_t *jobs = worker->jobs;
+    notmuch_messages_t *messages;
+    notmuch_message_t *message;
+    notmuch_status_t status;
+    GString *text, *compressed;
+    char *buffer = NULL;
+    size_t buffer_size = 0;
+    unsigned int first, last;
+    int ret = EXIT_FAILURE;
+
+    first = chunk * jobs->chunk_doc_ids + 1;
+
+    /* The last chunk takes whatever is left. */
+    if (chunk + 1 < jobs->num_chunks)
+	last = first + jobs->chunk_doc_ids - 1;
+    else
+	last = UINT_MAX;
+
+    notmuch_query_set_doc_id_range (worker->query, first, last);
+
+    status = notmuch_query_search_messages (worker->query, &messages);
+    if (print_status_query ("notmuch dump", worker->query, status))
 	return EXIT_FAILURE;
 
+    text = g_string_sized_new (DUMP_BUFFER_SIZE);
+
     for (;
 	 notmuch_messages_valid (messages);
 	 notmuch_messages_move_to_next (messages)) {
 
 	message = notmuch_messages_get (messages);
 
-	if ((include & DUMP_INCLUDE_TAGS) &&
-	    dump_tags_message (notmuch, message, output_format, output,
-			       &buffer, &buffer_size))
+	if (dump_message (worker->notmuch, message, jobs->output_format,
+			  jobs->include, text, &buffer, &buffer_size))
+	    goto DONE;
+
+	notmuch_message_destroy (message);
+    }
+
+    if (jobs->gzip_output) {
+	compressed = gzip_buffer (text);
+	if (! compressed) {
+	    fprintf (stderr, "Error: failed to compress dump output\n");
+	    goto DONE;
+	}
+	g_string_free (text, TRUE);
+	text = compressed;
+    }
+
+    *out = text;
+    text = NULL;
+    ret = EXIT_SUCCESS;
+
+  DONE:
+    notmuch_messages_destroy (messages);
+
+    if (text)
+	g_string_free (text, TRUE);
+
+    if (buffer)
+	talloc_free (buffer);
+
+    return ret;
+}
+
+static gpointer
+dump_worker_run (gpointer data)
+{
+    dump_worker_t *worker = (dump_worker_t *) data;
+    dump_jobs_t *jobs = worker->jobs;
+
+    g_mutex_lock (&jobs->mutex);
+    for (;;) {
+	unsigned int chunk;
+	GString *out = NULL;
+	int ret;
+
+	while (! jobs->failed && jobs->next_chunk < jobs->num_chunks &&
+	       jobs->next_chunk >= jobs->next_write + jobs->ahead)
+	    g_cond_wait (&jobs->cond, &jobs->mutex);
+
+	if (jobs->failed || jobs->next_chunk >= jobs->num_chunks)
+	    break;
+
+	chunk = jobs->next_chunk++;
+	g_mutex_unlock (&jobs->mutex);
+
+	ret = dump_chunk (worker, chunk, &out);
+
+	g_mutex_lock (&jobs->mutex);
+	jobs->chunks[chunk].data = out;
+	jobs->chunks[chunk].done = true;
+	if (ret)
+	    jobs->failed = true;
+	g_cond_broadcast (&jobs->cond);
+    }
+    g_mutex_unlock (&jobs->mutex);
+
+    return NULL;
+}
+
+static int
+write_buffer (int fd, GString *buffer)
+{
+    const char *data = buffer->str;
+    size_t len = buffer->len;
+
+    while (len > 0) {
+	ssize_t written = write (fd, data, len);
+
+	if (written < 0) {
+	    if (errno == EINTR)
+		continue;
+	    fprintf (stderr, "Error writing dump: %s\n", strerror (errno));
 	    return EXIT_FAILURE;
+	}
+	data += written;
+	len -= written;
+    }
+
+    return EXIT_SUCCESS;
+}
 
-	if ((include & DUMP_INCLUDE_PROPERTIES) &&
-	    dump_properties_message (notmuch, message, output,
-				     &buffer, &buffer_size))
+/* Open a read-only handle on the database of 'notmuch' for each
+ * worker. The handles must all see the same revision, or the chunks
+ * would not fit together. */
+static int
+dump_open_workers (notmuch_database_t *notmuch, dump_worker_t *workers,
+		   int num_jobs)
+{
+    const char *path = notmuch_config_get (notmuch, NOTMUCH_CONFIG_DATABASE_PATH);
+    notmuch_status_t status;
+    const char *uuid;
+    unsigned long revision;
+    int i, attempt;
+
+    for (i = 0; i < num_jobs; i++) {
+	char *status_string = NULL;
+
+	/* Configuration that matters to the dump (e.g. named
+	 * queries) is stored in the database itself. */
+	status = notmuch_database_open_with_config (path,
+						    NOTMUCH_DATABASE_MODE_READ_ONLY,
+						    "", NULL,
+						    &workers[i].notmuch,
+						    &status_string);
+	if (status_string) {
+	    fputs (status_string, stderr);
+	    free (status_string);
+	}
+	if (status)
 	    return EXIT_FAILURE;
+    }
 
-	notmuch_message_destroy (message);
+    for (attempt = 0; attempt < DUMP_OPEN_ATTEMPTS; attempt++) {
+	revision = notmuch_database_get_revision (workers[0].notmuch, &uuid);
+	for (i = 1; i < num_jobs; i++) {
+	    if (notmuch_database_get_revision (workers[i].notmuch, &uuid) != revision)
+		break;
+	}
+	if (i == num_jobs)
+	    return EXIT_SUCCESS;
+
+	/* Something was committed while opening the handles. */
+	for (i = 0; i < num_jobs; i++) {
+	    status = notmuch_database_reopen (workers[i].notmuch,
+					      NOTMUCH_DATABASE_MODE_READ_ONLY);
+	    if (print_status_database ("notmuch dump", workers[i].notmuch, status))
+		return EXIT_FAILURE;
+	}
     }
 
-    notmuch_query_destroy (query);
+    fprintf (stderr, "Error: database keeps changing, cannot dump it with --jobs\n");
+    return EXIT_FAILURE;
+}
+
+static int
+database_dump_jobs (notmuch_database_t *notmuch, int outfd,
+		    const char *query_str, int output_format, int include,
+		    bool gzip_output, int num_jobs)
+{
+    dump_jobs_t jobs;
+    dump_worker_t *workers;
+    GString *text = NULL, *compressed;
+    notmuch_status_t status;
+    unsigned int count = 0, chunk_size, last_doc_id, i;
+    int ret = EXIT_FAILURE;
 
-    return EXIT_SUCCESS;
+    memset (&jobs, 0, sizeof (jobs));
+    g_mutex_init (&jobs.mutex);
+    g_cond_init (&jobs.cond);
+    jobs.ahead = DUMP_CHUNKS_AHEAD (num_jobs);
+    jobs.output_format = output_format;
+    jobs.include = include;
+    jobs.gzip_output = gzip_output;
+
+    workers = talloc_zero_array (notmuch, dump_worker_t, num_jobs);
+    if (workers == NULL) {
+	fprintf (stderr, "Out of memory.\n");
+	goto DONE;
+    }
+
+    if (dump_open_workers (notmuch, workers, num_jobs))
+	goto DONE;
+
+    /* The header and configuration come from the same revision as
+     * the messages. */
+    text = g_string_sized_new (DUMP_BUFFER_SIZE);
+    print_dump_header (text, output_format, include);
+
+    if (include & DUMP_INCLUDE_CONFIG) {
+	if (print_status_database ("notmuch dump", workers[0].notmuch,
+				   database_dump_config (workers[0].notmuch, text)))
+	    goto DONE;
+    }
+
+    if (gzip_output) {
+	compressed = gzip_buffer (text);
+	if (! compressed) {
+	    fprintf (stderr, "Error: failed to compress dump output\n");
+	    goto DONE;
+	}
+	g_string_free (text, TRUE);
+	text = compressed;
+    }
+
+    if (write_buffer (outfd, text))
+	goto DONE;
+
+    if (! (include & (DUMP_INCLUDE_TAGS | DUMP_INCLUDE_PROPERTIES))) {
+	ret = EXIT_SUCCESS;
+	goto DONE;
+    }
+
+    /* Parse the query in each handle here, as query parsing is not
+     * known to be safe to run in several threads at once. */
+    for (i = 0; i < (unsigned int) num_jobs; i++) {
+	workers[i].jobs = &jobs;
+
+	status = dump_query_create (workers[i].notmuch, query_str, &workers[i].query);
+	if (print_status_database ("notmuch dump", workers[i].notmuch, status))
+	    goto DONE;
+
+	status = notmuch_query_count_messages (workers[i].query, &count);
+	if (print_status_query ("notmuch dump", workers[i].query, status))
+	    goto DONE;
+    }
+
+    /* Size the chunks as if the matches were spread evenly over the
+     * document ids, which the handles all agree on. */
+    chunk_size = MIN (DUMP_CHUNK_MESSAGES, count / num_jobs + 1);
+    jobs.num_chunks = count / chunk_size + 1;
+    last_doc_id = notmuch_database_get_last_doc_id (workers[0].notmuch);
+    jobs.chunk_doc_ids = last_doc_id / jobs.num_chunks + 1;
+    jobs.chunks = talloc_zero_array (workers, dump_chunk_t, jobs.num_chunks);
+    if (jobs.chunks == NULL) {
+	fprintf (stderr, "Out of memory.\n");
+	goto DONE;
+    }
+
+    for (i = 0; i < (unsigned int) num_jobs; i++)
+	workers[i].thread = g_thread_new ("notmuch-dump", dump_worker_run, &workers[i]);
+
+    for (i = 0; i < jobs.num_chunks; i++) {
+	GString *data;
+
+	g_mutex_lock (&jobs.mutex);
+	while (! jobs.chunks[i].done && ! jobs.failed)
+	    g_cond_wait (&jobs.cond, &jobs.mutex);
+	data = jobs.chunks[i].data;
+	jobs.chunks[i].data = NULL;
+	g_mutex_unlock (&jobs.mutex);
+
+	if (! data)
+	    break;
+
+	ret = write_buffer (outfd, data);
+	g_string_free (data, TRUE);
+	if (ret)
+	    break;
+
+	g_mutex_lock (&jobs.mutex);
+	jobs.next_write = i + 1;
+	g_cond_broadcast (&jobs.cond);
+	g_mutex_unlock (&jobs.mutex);
+    }
+
+    ret = (i == jobs.num_chunks) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    /* Stop the workers early if writing failed. */
+    g_mutex_lock (&jobs.mutex);
+    if (ret)
+	jobs.failed = true;
+    g_cond_broadcast (&jobs.cond);
+    g_mutex_unlock (&jobs.mutex);
+
+    for (i = 0; i < (unsigned int) num_jobs; i++)
+	g_thread_join (workers[i].thread);
+
+  DONE:
+    if (jobs.chunks) {
+	for (i = 0; i < jobs.num_chunks; i++) {
+	    if (jobs.chunks[i].data)
+		g_string_free (jobs.chunks[i].data, TRUE);
+	}
+    }
+
+    if (workers) {
+	for (i = 0; i < (unsigned int) num_jobs; i++) {
+	    if (workers[i].notmuch)
+		notmuch_database_destroy (workers[i].notmuch);
+	}
+	talloc_free (workers);
+    }
+
+    if (text)
+	g_string_free (text, TRUE);
+
+    g_cond_clear (&jobs.cond);
+    g_mutex_clear (&jobs.mutex);
+
+    return ret;
 }
 
 /* Dump database into output_file_name if it's non-NULL, stdout
@@ -280,7 +757,8 @@ notmuch_database_dump (notmuch_database_t *notmuch,
 		       const char *query_str,
 		       dump_format_t output_format,
 		       dump_include_t include,
-		       bool gzip_output)
+		       bool gzip_output,
+		       int jobs)
 {
     gzFile output = NULL;
     const char *mode = gzip_output ? "w9" : "wT";
@@ -303,24 +781,31 @@ notmuch_database_dump (notmuch_database_t *notmuch,
 	goto DONE;
     }
 
-    output = gzdopen (outfd, mode);
+    if (jobs > 1) {
+	ret = database_dump_jobs (notmuch, outfd, query_str, output_format,
+				  include, gzip_output, jobs);
+	if (ret) goto DONE;
+    } else {
+	output = gzdopen (outfd, mode);
 
-    if (output == NULL) {
-	fprintf (stderr, "Error opening %s for (gzip) writing: %s\n",
-		 name_for_error, strerror (errno));
-	if (close (outfd))
-	    fprintf (stderr, "Error closing %s during shutdown: %s\n",
+	if (output == NULL) {
+	    fprintf (stderr, "Error opening %s for (gzip) writing: %s\n",
 		     name_for_error, strerror (errno));
-	goto DONE;
-    }
+	    if (close (outfd))
+		fprintf (stderr, "Error closing %s during shutdown: %s\n",
+			 name_for_error, strerror (errno));
+	    outfd = -1;
+	    goto DONE;
+	}
 
-    ret = database_dump_file (notmuch, output, query_str, output_format, include);
-    if (ret) goto DONE;
+	ret = database_dump_file (notmuch, output, query_str, output_format, include);
+	if (ret) goto DONE;
 
-    ret = gzflush (output, Z_FINISH);
-    if (ret) {
-	fprintf (stderr, "Error flushing output: %s\n", gzerror_str (output));
-	goto DONE;
+	ret = gzflush (output, Z_FINISH);
+	if (ret) {
+	    fprintf (stderr, "Error flushing output: %s\n", gzerror_str (output));
+	    goto DONE;
+	}
     }
 
     if (output_file_name) {
@@ -332,15 +817,26 @@ notmuch_database_dump (notmuch_database_t *notmuch,
 	}
     }
 
-    ret = gzclose_w (output);
-    if (ret) {
-	fprintf (stderr, "Error closing %s: %s\n", name_for_error,
-		 gzerror_str (output));
-	ret = EXIT_FAILURE;
-	output = NULL;
-	goto DONE;
-    } else
-	output = NULL;
+    if (output) {
+	ret = gzclose_w (output);
+	outfd = -1;
+	if (ret) {
+	    fprintf (stderr, "Error closing %s: %s\n", name_for_error,
+		     gzerror_str (output));
+	    ret = EXIT_FAILURE;
+	    output = NULL;
+	    goto DONE;
+	} else
+	    output = NULL;
+    } else {
+	ret = close (outfd);
+	outfd = -1;
+	if (ret) {
+	    fprintf (stderr, "Error closing %s: %s\n", name_for_error,
+		     strerror (errno));
+	    goto DONE;
+	}
+    }
 
     if (output_file_name) {
 	ret = rename (tempname, output_file_name);
@@ -354,6 +850,8 @@ notmuch_database_dump (notmuch_database_t *notmuch,
   DONE:
     if (ret != EXIT_SUCCESS && output)
 	(void) gzclose_w (output);
+    else if (ret != EXIT_SUCCESS && outfd >= 0)
+	(void) close (outfd);
 
     if (ret != EXIT_SUCCESS && output_file_name)
 	(void) unlink (tempname);
@@ -373,6 +871,7 @@ notmuch_dump_command (notmuch_database_t *notmuch, int argc, char *argv[])
     int output_format = DUMP_FORMAT_BATCH_TAG;
     int include = 0;
     bool gzip_output = 0;
+    int jobs = 1;
 
     notmuch_opt_desc_t options[] = {
 	{ .opt_keyword = &output_format, .name = "format", .keywords =
@@ -385,6 +884,7 @@ notmuch_dump_command (notmuch_database_t *notmuch, int argc, char *argv[])
 				      { "tags", DUMP_INCLUDE_TAGS } } },
 	{ .opt_string = &output_file_name, .name = "output" },
 	{ .opt_bool = &gzip_output, .name = "gzip" },
+	{ .opt_int = &jobs, .name = "jobs" },
 	{ .opt_inherit = notmuch_shared_options },
 	{ }
     };
@@ -395,6 +895,11 @@ notmuch_dump_command (notmuch_database_t *notmuch, int argc, char *argv[])
 
     notmuch_process_shared_options (notmuch, argv[0]);
 
+    if (jobs < 1) {
+	fprintf (stderr, "Error: --jobs must be at least 1.\n");
+	return EXIT_FAILURE;
+    }
+
     if (include == 0)
 	include = DUMP_INCLUDE_CONFIG | DUMP_INCLUDE_TAGS | DUMP_INCLUDE_PROPERTIES;
 
@@ -407,7 +912,7 @@ notmuch_dump_command (notmuch_database_t *notmuch, int argc, char *argv[])
     }
 
     ret = notmuch_database_dump (notmuch, output_file_name, query_str,
-				 output_format, include, gzip_output);
+				 output_format, include, gzip_output, jobs);
 
     notmuch_database_destroy (notmuch);
 
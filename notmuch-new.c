@@ -22,6 +22,11 @@
 #include "tag-util.h"
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#if HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
 
 typedef struct _filename_node {
     char *filename;
@@ -50,6 +55,8 @@ typedef struct {
     enum verbosity verbosity;
     bool debug;
     bool full_scan;
+    bool watch;
+    int jobs;
     notmuch_config_values_t *new_tags;
     const char **ignore_verbatim;
     size_t ignore_verbatim_length;
@@ -60,12 +67,21 @@ typedef struct {
     int processed_files;
     int added_messages, removed_messages, renamed_messages;
     int vanished_files;
+    /* Files of already indexed messages that were added from their
+     * headers alone (see notmuch_database_index_file). */
+    unsigned long long header_only_files;
     struct timeval tv_start;
 
     _filename_list_t *removed_files;
     _filename_list_t *removed_directories;
     _filename_list_t *directory_mtimes;
 
+    /* Directories named in the journal written by notmuch new
+     * --watch, and how much of the journal they were read from. */
+    char **journal_dirs;
+    size_t journal_dirs_length;
+    off_t journal_offset;
+
     notmuch_bool_t synchronize_flags;
 } add_files_state_t;
 
@@ -239,6 +255,47 @@ _entries_resemble_maildir (const char *path, struct dirent **entries, int count)
     return 0;
 }
 
+/* Test if 'path' is the cur/ folder of a maildir whose new/ folder
+ * lost files the database knows about, which may have been moved to
+ * 'path'. Mail only stays in new/ until it is seen, so this checks
+ * few files. */
+static bool
+_maildir_new_lost_files (notmuch_database_t *notmuch, const char *path)
+{
+    notmuch_directory_t *directory = NULL;
+    notmuch_filenames_t *files;
+    size_t len = strlen (path);
+    char *new_path;
+    bool lost = false;
+
+    if (len < 4 || strcmp (path + len - 4, "/cur") != 0)
+	return false;
+
+    new_path = talloc_asprintf (notmuch, "%.*s/new", (int) (len - 4), path);
+    if (new_path == NULL ||
+	notmuch_database_get_directory (notmuch, new_path, &directory) ||
+	directory == NULL)
+	goto DONE;
+
+    for (files = notmuch_directory_get_child_files (directory);
+	 notmuch_filenames_valid (files) && ! lost;
+	 notmuch_filenames_move_to_next (files)) {
+	char *file = talloc_asprintf (new_path, "%s/%s", new_path,
+				      notmuch_filenames_get (files));
+
+	if (file && access (file, F_OK) && errno == ENOENT)
+	    lost = true;
+    }
+    notmuch_filenames_destroy (files);
+
+  DONE:
+    if (directory)
+	notmuch_directory_destroy (directory);
+    talloc_free (new_path);
+
+    return lost;
+}
+
 static bool
 _special_directory (const char *entry)
 {
@@ -452,7 +509,10 @@ add_file (notmuch_database_t *notmuch, const char *filename,
  *     (via scandir and stored in fs_entries)
  *
  *   o Pass 1: For each directory in fs_entries, recursively call into
- *     this same function.
+ *     this same function. If 'recurse' is false, only descend into
+ *     directories the database does not know about yet; this is used
+ *     for directories taken from the watch journal, whose known
+ *     sub-directories are in the journal themselves if they changed.
  *
  *   o Compare fs_mtime to db_mtime. If they are equivalent, terminate
  *     the algorithm at this point, (this directory has not been
@@ -487,7 +547,8 @@ add_file (notmuch_database_t *notmuch, const char *filename,
 static notmuch_status_t
 add_files (notmuch_database_t *notmuch,
 	   const char *path,
-	   add_files_state_t *state)
+	   add_files_state_t *state,
+	   bool recurse)
 {
     struct dirent *entry = NULL;
     char *next = NULL;
@@ -498,9 +559,13 @@ add_files (notmuch_database_t *notmuch,
     notmuch_directory_t *directory;
     notmuch_filenames_t *db_files = NULL;
     notmuch_filenames_t *db_subdirs = NULL;
+    notmuch_filenames_t *known_subdirs = NULL;
     time_t stat_time;
     struct stat st;
     bool is_maildir;
+    char **new_files = NULL;
+    int num_new_files = 0, num_prepared = 0;
+    unsigned removed_files;
 
     if (stat (path, &st)) {
 	fprintf (stderr, "Error reading directory %s: %s\n",
@@ -573,6 +638,9 @@ add_files (notmuch_database_t *notmuch,
     /* Pass 1: Recurse into all sub-directories. */
     is_maildir = _entries_resemble_maildir (path, fs_entries, num_fs_entries);
 
+    if (! recurse && directory)
+	known_subdirs = notmuch_directory_get_child_directories (directory);
+
     for (i = 0; i < num_fs_entries && ! interrupted; i++) {
 	entry = fs_entries[i];
 
@@ -613,8 +681,19 @@ add_files (notmuch_database_t *notmuch,
 	     && (strcmp (path, state->mail_root)) == 0))
 	    continue;
 
+	/* Both lists are in strcmp order when the directory is known. */
+	if (! recurse) {
+	    while (notmuch_filenames_valid (known_subdirs) &&
+		   strcmp (notmuch_filenames_get (known_subdirs), entry->d_name) < 0)
+		notmuch_filenames_move_to_next (known_subdirs);
+
+	    if (notmuch_filenames_valid (known_subdirs) &&
+		strcmp (notmuch_filenames_get (known_subdirs), entry->d_name) == 0)
+		continue;
+	}
+
 	next = talloc_asprintf (notmuch, "%s/%s", path, entry->d_name);
-	status = add_files (notmuch, next, state);
+	status = add_files (notmuch, next, state, true);
 	if (status) {
 	    ret = status;
 	    goto DONE;
@@ -643,6 +722,7 @@ add_files (notmuch_database_t *notmuch,
     }
 
     /* Pass 2: Scan for new files, removed files, and removed directories. */
+    removed_files = state->removed_files->count;
     for (i = 0; i < num_fs_entries && ! interrupted; i++) {
 	entry = fs_entries[i];
 
@@ -698,7 +778,8 @@ add_files (notmuch_database_t *notmuch,
 	if (entry_type == -1) {
 	    fprintf (stderr, "Error reading file %s/%s: %s\n",
 		     path, entry->d_name, strerror (errno));
-	    return NOTMUCH_STATUS_FILE_ERROR;
+	    ret = NOTMUCH_STATUS_FILE_ERROR;
+	    goto DONE;
 	} else if (entry_type != S_IFREG) {
 	    continue;
 	}
@@ -711,36 +792,11 @@ add_files (notmuch_database_t *notmuch,
 	}
 
 	/* We're now looking at a regular file that doesn't yet exist
-	 * in the database, so add it. */
-	next = talloc_asprintf (notmuch, "%s/%s", path, entry->d_name);
-
-	state->processed_files++;
-
-	if (state->verbosity >= VERBOSITY_VERBOSE) {
-	    if (state->output_is_a_tty)
-		printf ("\r\033[K");
-
-	    printf ("%i/%i: %s", state->processed_files, state->total_files,
-		    next);
-
-	    putchar ((state->output_is_a_tty) ? '\r' : '\n');
-	    fflush (stdout);
-	}
-
-	status = add_file (notmuch, next, state);
-	if (status) {
-	    ret = status;
-	    goto DONE;
-	}
-
-	if (do_print_progress) {
-	    do_print_progress = 0;
-	    generic_print_progress ("Processed", "files", state->tv_start,
-				    state->processed_files, state->total_files);
-	}
-
-	talloc_free (next);
-	next = NULL;
+	 * in the database, so queue it for addition. */
+	if (new_files == NULL)
+	    new_files = talloc_array (notmuch, char *, num_fs_entries);
+	new_files[num_new_files++] = talloc_asprintf (new_files, "%s/%s",
+						      path, entry->d_name);
     }
 
     if (interrupted)
@@ -776,6 +832,62 @@ add_files (notmuch_database_t *notmuch,
 	notmuch_filenames_move_to_next (db_subdirs);
     }
 
+    /* A file can only be a renamed file of an indexed message if
+     * some file disappeared, so don't let notmuch_database_index_file
+     * look for renames otherwise. */
+    status = notmuch_indexopts_set_expect_renames (
+	state->indexopts,
+	state->removed_files->count > removed_files ||
+	_maildir_new_lost_files (notmuch, path));
+    if (status) {
+	ret = status;
+	goto DONE;
+    }
+
+    /* Add the new files. With --jobs, keep the next few of them
+     * being parsed in the background while each one is added. */
+    for (i = 0; i < num_new_files && ! interrupted; i++) {
+	const char *filename = new_files[i];
+
+	for (; state->jobs > 0 && num_prepared < num_new_files &&
+	     num_prepared <= i + 4 * state->jobs; num_prepared++) {
+	    status = notmuch_database_prepare_index_file (notmuch,
+							  new_files[num_prepared]);
+	    if (status) {
+		ret = status;
+		goto DONE;
+	    }
+	}
+
+	state->processed_files++;
+
+	if (state->verbosity >= VERBOSITY_VERBOSE) {
+	    if (state->output_is_a_tty)
+		printf ("\r\033[K");
+
+	    printf ("%i/%i: %s", state->processed_files, state->total_files,
+		    filename);
+
+	    putchar ((state->output_is_a_tty) ? '\r' : '\n');
+	    fflush (stdout);
+	}
+
+	status = add_file (notmuch, filename, state);
+	if (status) {
+	    ret = status;
+	    goto DONE;
+	}
+
+	if (do_print_progress) {
+	    do_print_progress = 0;
+	    generic_print_progress ("Processed", "files", state->tv_start,
+				    state->processed_files, state->total_files);
+	}
+    }
+
+    if (interrupted)
+	goto DONE;
+
     /* If the directory's mtime is the same as the wall-clock time
      * when we stat'ed the directory, we skip updating the mtime in
      * the database because a message could be delivered later in this
@@ -787,6 +899,8 @@ add_files (notmuch_database_t *notmuch,
   DONE:
     if (next)
 	talloc_free (next);
+    if (new_files)
+	talloc_free (new_files);
     if (fs_entries) {
 	for (i = 0; i < num_fs_entries; i++)
 	    free (fs_entries[i]);
@@ -795,6 +909,8 @@ add_files (notmuch_database_t *notmuch,
     }
     if (db_subdirs)
 	notmuch_filenames_destroy (db_subdirs);
+    if (known_subdirs)
+	notmuch_filenames_destroy (known_subdirs);
     if (db_files)
 	notmuch_filenames_destroy (db_files);
     if (directory)
@@ -1052,6 +1168,12 @@ print_results (const add_files_state_t *state)
 		state->renamed_messages == 1 ? "rename" : "renames");
 
     printf ("\n");
+
+    if (state->verbosity >= VERBOSITY_VERBOSE && state->processed_files)
+	printf ("Added %llu of %d %s from %s headers alone.\n",
+		state->header_only_files, state->processed_files,
+		state->processed_files == 1 ? "file" : "files",
+		state->processed_files == 1 ? "its" : "their");
 }
 
 static int
@@ -1090,7 +1212,7 @@ _maybe_upgrade (notmuch_database_t *notmuch, add_files_state_t *state)
 	}
 
 	if (notmuch_database_dump (notmuch, backup_name, "",
-				   DUMP_FORMAT_BATCH_TAG, DUMP_INCLUDE_DEFAULT, true)) {
+				   DUMP_FORMAT_BATCH_TAG, DUMP_INCLUDE_DEFAULT, true, 1)) {
 	    fprintf (stderr, "Backup failed. Aborting upgrade.");
 	    return EXIT_FAILURE;
 	}
@@ -1112,6 +1234,479 @@ _maybe_upgrade (notmuch_database_t *notmuch, add_files_state_t *state)
     return EXIT_SUCCESS;
 }
 
+/* notmuch new --watch records the directories in which entries were
+ * created, removed or renamed in a journal next to the database, one
+ * path (relative to the mail root, "." for the mail root itself) per
+ * line. A line consisting of JOURNAL_FULL_SCAN means that changes may
+ * have been missed, e.g. before the watcher started or when the
+ * kernel event queue overflowed.
+ *
+ * The watcher holds an exclusive lock on WATCH_LOCK_FILE for as long
+ * as it runs. Only while that lock is held is the journal known to be
+ * complete, and notmuch new walks just the journaled directories
+ * instead of the whole mail store. Writers and readers of the journal
+ * serialize with flock (2) on the journal itself. */
+#define JOURNAL_FILE "new-journal"
+#define WATCH_LOCK_FILE "new-watch.lock"
+#define JOURNAL_FULL_SCAN "/"
+
+static char *
+_watch_file_path (const void *ctx, const add_files_state_t *state, const char *name)
+{
+    /* Keep the files out of the mail store with the legacy layout,
+     * where the database lives in <mail root>/.notmuch. */
+    if (strcmp (state->db_path, state->mail_root) == 0)
+	return talloc_asprintf (ctx, "%s/.notmuch/%s", state->db_path, name);
+
+    return talloc_asprintf (ctx, "%s/%s", state->db_path, name);
+}
+
+static int
+_journal_dir_cmp (const void *a, const void *b)
+{
+    return strcmp (*(char *const *) a, *(char *const *) b);
+}
+
+/* Read the journal into state->journal_dirs, sorted so that parents
+ * come before their sub-directories. Returns true if the journaled
+ * directories are all that need to be scanned. */
+static bool
+_read_watch_journal (const void *ctx, add_files_state_t *state)
+{
+    char *lock_path = _watch_file_path (ctx, state, WATCH_LOCK_FILE);
+    char *journal_path = _watch_file_path (ctx, state, JOURNAL_FILE);
+    GHashTable *seen = NULL;
+    FILE *journal = NULL;
+    char *line = NULL;
+    size_t line_size = 0;
+    bool watched = false, complete = true;
+    int fd;
+
+    fd = open (lock_path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+	watched = (flock (fd, LOCK_EX | LOCK_NB) < 0 && errno == EWOULDBLOCK);
+	close (fd);
+    }
+
+    journal = fopen (journal_path, "r");
+    if (! journal)
+	return false;
+
+    if (flock (fileno (journal), LOCK_SH) < 0) {
+	complete = false;
+	goto DONE;
+    }
+
+    seen = g_hash_table_new (g_str_hash, g_str_equal);
+    while (getline (&line, &line_size, journal) != -1) {
+	chomp_newline (line);
+	if (strcmp (line, JOURNAL_FULL_SCAN) == 0) {
+	    complete = false;
+	} else if (*line && ! g_hash_table_contains (seen, line)) {
+	    state->journal_dirs = talloc_realloc (ctx, state->journal_dirs, char *,
+						  state->journal_dirs_length + 1);
+	    state->journal_dirs[state->journal_dirs_length] = talloc_strdup (ctx, line);
+	    g_hash_table_add (seen, state->journal_dirs[state->journal_dirs_length]);
+	    state->journal_dirs_length++;
+	}
+    }
+    state->journal_offset = ftello (journal);
+
+    if (state->journal_dirs_length)
+	qsort (state->journal_dirs, state->journal_dirs_length, sizeof (char *),
+	       _journal_dir_cmp);
+
+  DONE:
+    if (seen)
+	g_hash_table_unref (seen);
+    free (line);
+    fclose (journal);
+
+    return watched && complete;
+}
+
+/* Drop the part of the journal read by _read_watch_journal, keeping
+ * anything the watcher appended since. */
+static void
+_consume_watch_journal (const void *ctx, const add_files_state_t *state)
+{
+    char *journal_path = _watch_file_path (ctx, state, JOURNAL_FILE);
+    char *tail = NULL;
+    struct stat st;
+    ssize_t len = 0;
+    int fd;
+
+    if (state->journal_offset <= 0)
+	return;
+
+    fd = open (journal_path, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+	return;
+
+    if (flock (fd, LOCK_EX) < 0 || fstat (fd, &st) < 0 ||
+	st.st_size < state->journal_offset)
+	goto DONE;
+
+    if (st.st_size > state->journal_offset) {
+	tail = talloc_size (ctx, st.st_size - state->journal_offset);
+	len = pread (fd, tail, st.st_size - state->journal_offset, state->journal_offset);
+	if (len < 0)
+	    goto DONE;
+    }
+
+    if (ftruncate (fd, 0) < 0 || (len > 0 && pwrite (fd, tail, len, 0) != len))
+	fprintf (stderr, "Warning: failed to update %s: %s\n",
+		 journal_path, strerror (errno));
+
+  DONE:
+    talloc_free (tail);
+    close (fd);
+}
+
+/* Scan only the directories named in the watch journal. Directories
+ * the database does not know are found from their parent, which is
+ * journaled too; this also drops events from maildir tmp/ folders. */
+static notmuch_status_t
+add_journal_files (notmuch_database_t *notmuch, add_files_state_t *state)
+{
+    notmuch_status_t status;
+    notmuch_directory_t *directory;
+    struct stat st;
+    size_t i;
+
+    for (i = 0; i < state->journal_dirs_length && ! interrupted; i++) {
+	const char *dir = state->journal_dirs[i];
+	char *path;
+
+	if (strcmp (dir, ".") == 0)
+	    path = talloc_strdup (notmuch, state->mail_root);
+	else
+	    path = talloc_asprintf (notmuch, "%s/%s", state->mail_root, dir);
+
+	/* A removed directory is noticed when scanning its parent. */
+	if (stat (path, &st) < 0 && errno == ENOENT)
+	    goto NEXT;
+
+	if (strcmp (dir, ".") != 0) {
+	    status = notmuch_database_get_directory (notmuch, path, &directory);
+	    if (status)
+		return status;
+	    if (! directory)
+		goto NEXT;
+	    notmuch_directory_destroy (directory);
+	}
+
+	if (state->debug)
+	    printf ("(D) add_journal_files: scanning %s\n", path);
+
+	status = add_files (notmuch, path, state, false);
+	if (status)
+	    return status;
+
+      NEXT:
+	talloc_free (path);
+    }
+
+    return NOTMUCH_STATUS_SUCCESS;
+}
+
+#if HAVE_INOTIFY
+
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+typedef struct {
+    add_files_state_t *state;
+    int fd;
+    const char *journal_path;
+    /* watch descriptor -> directory relative to the mail root */
+    GHashTable *dirs;
+    /* directories to append to the journal */
+    GHashTable *changed;
+} watch_state_t;
+
+static char *
+_watch_join (const char *dir, const char *name)
+{
+    if (strcmp (dir, ".") == 0)
+	return g_strdup (name);
+
+    return g_strdup_printf ("%s/%s", dir, name);
+}
+
+static char *
+_watch_absolute (const watch_state_t *watch, const char *dir)
+{
+    if (strcmp (dir, ".") == 0)
+	return g_strdup (watch->state->mail_root);
+
+    return g_strdup_printf ("%s/%s", watch->state->mail_root, dir);
+}
+
+static void
+_watch_mark_changed (watch_state_t *watch, const char *dir)
+{
+    if (strchr (dir, '\n'))
+	dir = JOURNAL_FULL_SCAN;
+
+    g_hash_table_add (watch->changed, g_strdup (dir));
+}
+
+/* Whether entry 'name' of 'dir' is to be watched, using the same
+ * rules as add_files. Maildir tmp/ folders are watched, but since
+ * they never appear in the database their events are dropped when
+ * the journal is read. */
+static bool
+_watch_wanted (watch_state_t *watch, const char *dir, const char *name)
+{
+    char *path;
+    bool ignored;
+
+    if (_special_directory (name))
+	return false;
+
+    if (strcmp (dir, ".") == 0 && strcmp (name, ".notmuch") == 0)
+	return false;
+
+    path = _watch_absolute (watch, dir);
+    ignored = _entry_in_ignore_list (watch->state, path, name);
+    g_free (path);
+
+    return ! ignored;
+}
+
+/* Watch 'dir' and everything below it, and mark them all as changed
+ * since files may have appeared before the watches were in place. */
+static notmuch_status_t
+_watch_add (watch_state_t *watch, const char *dir)
+{
+    struct dirent **fs_entries = NULL;
+    notmuch_status_t ret = NOTMUCH_STATUS_SUCCESS;
+    char *path = _watch_absolute (watch, dir);
+    int i, num_fs_entries = 0, wd;
+
+    wd = inotify_add_watch (watch->fd, path, WATCH_EVENTS);
+    if (wd < 0) {
+	/* Raced with removal; the parent has an event for it. */
+	if (errno == ENOENT || errno == ENOTDIR)
+	    goto DONE;
+
+	fprintf (stderr, "Error: cannot watch %s: %s\n", path, strerror (errno));
+	if (errno == ENOSPC)
+	    fprintf (stderr, "Hint: raise the fs.inotify.max_user_watches sysctl.\n");
+	ret = NOTMUCH_STATUS_FILE_ERROR;
+	goto DONE;
+    }
+
+    g_hash_table_replace (watch->dirs, GINT_TO_POINTER (wd), g_strdup (dir));
+    _watch_mark_changed (watch, dir);
+
+    num_fs_entries = scandir (path, &fs_entries, 0, dirent_sort_inode);
+    for (i = 0; i < num_fs_entries; i++) {
+	struct dirent *entry = fs_entries[i];
+	char *next;
+
+	if (ret || interrupted || ! _watch_wanted (watch, dir, entry->d_name) ||
+	    dirent_type (path, entry) != S_IFDIR)
+	    continue;
+
+	next = _watch_join (dir, entry->d_name);
+	ret = _watch_add (watch, next);
+	g_free (next);
+    }
+
+  DONE:
+    if (fs_entries) {
+	for (i = 0; i < num_fs_entries; i++)
+	    free (fs_entries[i]);
+
+	free (fs_entries);
+    }
+    g_free (path);
+
+    return ret;
+}
+
+typedef struct {
+    watch_state_t *watch;
+    const char *dir;
+} watch_remove_t;
+
+static gboolean
+_watch_remove_under (gpointer key, gpointer value, gpointer user_data)
+{
+    watch_remove_t *under = user_data;
+    const char *dir = value;
+    size_t len = strlen (under->dir);
+
+    if (strncmp (dir, under->dir, len) != 0 || (dir[len] && dir[len] != '/'))
+	return FALSE;
+
+    inotify_rm_watch (under->watch->fd, GPOINTER_TO_INT (key));
+    return TRUE;
+}
+
+static int
+_journal_append (watch_state_t *watch)
+{
+    GHashTableIter iter;
+    gpointer key;
+    GString *lines;
+    int fd, ret = 0;
+
+    if (g_hash_table_size (watch->changed) == 0)
+	return 0;
+
+    lines = g_string_new (NULL);
+    g_hash_table_iter_init (&iter, watch->changed);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+	g_string_append_printf (lines, "%s\n", (const char *) key);
+    g_hash_table_remove_all (watch->changed);
+
+    fd = open (watch->journal_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0 || flock (fd, LOCK_EX) < 0 ||
+	write (fd, lines->str, lines->len) != (ssize_t) lines->len) {
+	fprintf (stderr, "Error: cannot write %s: %s\n",
+		 watch->journal_path, strerror (errno));
+	ret = -1;
+    }
+
+    if (fd >= 0)
+	close (fd);
+    g_string_free (lines, TRUE);
+
+    return ret;
+}
+
+static void
+_watch_handle_event (watch_state_t *watch, const struct inotify_event *event)
+{
+    const char *dir;
+    char *child;
+
+    if (event->mask & IN_Q_OVERFLOW) {
+	_watch_mark_changed (watch, JOURNAL_FULL_SCAN);
+	return;
+    }
+
+    if (event->mask & IN_IGNORED) {
+	g_hash_table_remove (watch->dirs, GINT_TO_POINTER (event->wd));
+	return;
+    }
+
+    dir = g_hash_table_lookup (watch->dirs, GINT_TO_POINTER (event->wd));
+    if (! dir)
+	return;
+
+    _watch_mark_changed (watch, dir);
+
+    if (! (event->mask & IN_ISDIR) || ! event->len)
+	return;
+
+    child = _watch_join (dir, event->name);
+
+    /* Watches follow the directory, not its name. */
+    if (event->mask & IN_MOVED_FROM) {
+	watch_remove_t under = { watch, child };
+	g_hash_table_foreach_remove (watch->dirs, _watch_remove_under, &under);
+    }
+
+    if ((event->mask & (IN_CREATE | IN_MOVED_TO)) &&
+	_watch_wanted (watch, dir, event->name) &&
+	_watch_add (watch, child))
+	_watch_mark_changed (watch, JOURNAL_FULL_SCAN);
+
+    g_free (child);
+}
+
+/* Run as notmuch new --watch until interrupted. */
+static int
+watch_mail_root (const void *ctx, add_files_state_t *state)
+{
+    watch_state_t watch = { .state = state, .fd = -1 };
+    char *lock_path = _watch_file_path (ctx, state, WATCH_LOCK_FILE);
+    char buf[64 * 1024] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    struct sigaction action;
+    int lock_fd = -1;
+    int ret = EXIT_FAILURE;
+    ssize_t len;
+
+    watch.journal_path = _watch_file_path (ctx, state, JOURNAL_FILE);
+    watch.dirs = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+    watch.changed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    lock_fd = open (lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock_fd < 0) {
+	fprintf (stderr, "Error: cannot open %s: %s\n", lock_path, strerror (errno));
+	goto DONE;
+    }
+    if (flock (lock_fd, LOCK_EX | LOCK_NB) < 0) {
+	fprintf (stderr, "Error: another notmuch new --watch is already running.\n");
+	goto DONE;
+    }
+
+    /* No SA_RESTART, so that a blocked read returns. */
+    memset (&action, 0, sizeof (struct sigaction));
+    action.sa_handler = handle_sigint;
+    sigemptyset (&action.sa_mask);
+    sigaction (SIGINT, &action, NULL);
+    sigaction (SIGTERM, &action, NULL);
+
+    watch.fd = inotify_init1 (IN_CLOEXEC);
+    if (watch.fd < 0) {
+	fprintf (stderr, "Error: cannot initialize inotify: %s\n", strerror (errno));
+	goto DONE;
+    }
+
+    if (_watch_add (&watch, "."))
+	goto DONE;
+
+    /* Anything changed before the watches were in place is only
+     * found by walking the whole mail store once more. */
+    g_hash_table_remove_all (watch.changed);
+    _watch_mark_changed (&watch, JOURNAL_FULL_SCAN);
+    if (_journal_append (&watch))
+	goto DONE;
+
+    if (state->verbosity >= VERBOSITY_VERBOSE)
+	printf ("Watching %u directories.\n", g_hash_table_size (watch.dirs));
+
+    while (! interrupted) {
+	char *p;
+
+	len = read (watch.fd, buf, sizeof (buf));
+	if (len < 0) {
+	    if (errno == EINTR)
+		continue;
+	    fprintf (stderr, "Error: reading inotify events: %s\n", strerror (errno));
+	    goto DONE;
+	}
+
+	for (p = buf; p < buf + len;) {
+	    const struct inotify_event *event = (const struct inotify_event *) p;
+
+	    _watch_handle_event (&watch, event);
+	    p += sizeof (struct inotify_event) + event->len;
+	}
+
+	if (_journal_append (&watch))
+	    goto DONE;
+    }
+
+    ret = EXIT_SUCCESS;
+
+  DONE:
+    if (watch.fd >= 0)
+	close (watch.fd);
+    if (lock_fd >= 0)
+	close (lock_fd);
+    g_hash_table_unref (watch.dirs);
+    g_hash_table_unref (watch.changed);
+
+    return ret;
+}
+
+#endif
+
 int
 notmuch_new_command (notmuch_database_t *notmuch, int argc, char *argv[])
 {
@@ -1129,8 +1724,11 @@ notmuch_new_command (notmuch_database_t *notmuch, int argc, char *argv[])
     int opt_index;
     unsigned int i;
     bool timer_is_active = false;
+    bool incremental = false;
     bool hooks = true;
     bool quiet = false, verbose = false;
+    bool thread_summaries = false, thread_summaries_set = false;
+    bool message_values = false, message_values_set = false;
     notmuch_status_t status;
 
     notmuch_opt_desc_t options[] = {
@@ -1138,7 +1736,15 @@ notmuch_new_command (notmuch_database_t *notmuch, int argc, char *argv[])
 	{ .opt_bool = &verbose, .name = "verbose" },
 	{ .opt_bool = &add_files_state.debug, .name = "debug" },
 	{ .opt_bool = &add_files_state.full_scan, .name = "full-scan" },
+#if HAVE_INOTIFY
+	{ .opt_bool = &add_files_state.watch, .name = "watch" },
+#endif
+	{ .opt_int = &add_files_state.jobs, .name = "jobs" },
 	{ .opt_bool = &hooks, .name = "hooks" },
+	{ .opt_bool = &thread_summaries, .name = "thread-summaries",
+	  .present = &thread_summaries_set },
+	{ .opt_bool = &message_values, .name = "message-values",
+	  .present = &message_values_set },
 	{ .opt_inherit = notmuch_shared_indexing_options },
 	{ .opt_inherit = notmuch_shared_options },
 	{ }
@@ -1189,6 +1795,16 @@ notmuch_new_command (notmuch_database_t *notmuch, int argc, char *argv[])
 	}
     }
 
+#if HAVE_INOTIFY
+    if (add_files_state.watch) {
+	/* Don't hold the write lock while waiting for changes. */
+	notmuch_database_close (notmuch);
+	ret = watch_mail_root (notmuch, &add_files_state);
+	notmuch_database_destroy (notmuch);
+	return ret;
+    }
+#endif
+
     if (hooks) {
 	/* Drop write lock to run hook */
 	status = notmuch_database_reopen (notmuch, NOTMUCH_DATABASE_MODE_READ_ONLY);
@@ -1205,8 +1821,16 @@ notmuch_new_command (notmuch_database_t *notmuch, int argc, char *argv[])
 	    return EXIT_FAILURE;
     }
 
+    /* Read the journal after the pre-new hook, which may deliver
+     * mail. It is read even if the whole mail store is walked, so that
+     * the entries it covers are dropped afterwards. */
+    incremental = _read_watch_journal (notmuch, &add_files_state) &&
+		  ! add_files_state.full_scan;
+
     if (notmuch_database_get_revision (notmuch, NULL) == 0) {
 	int count = 0;
+
+	incremental = false;
 	count_files (mail_root, &count, &add_files_state);
 	if (interrupted)
 	    return EXIT_FAILURE;
@@ -1232,6 +1856,17 @@ notmuch_new_command (notmuch_database_t *notmuch, int argc, char *argv[])
 	return EXIT_FAILURE;
     }
 
+    if (add_files_state.jobs < 0) {
+	fprintf (stderr, "Error: --jobs must not be negative.\n");
+	return EXIT_FAILURE;
+    }
+
+    if (add_files_state.jobs > 0) {
+	status = notmuch_database_set_index_jobs (notmuch, add_files_state.jobs);
+	if (print_status_database ("notmuch new", notmuch, status))
+	    return EXIT_FAILURE;
+    }
+
     /* Set up our handler for SIGINT. We do this after having
      * potentially done a database upgrade we this interrupt handler
      * won't support. */
@@ -1253,7 +1888,10 @@ notmuch_new_command (notmuch_database_t *notmuch, int argc, char *argv[])
 	timer_is_active = true;
     }
 
-    ret = add_files (notmuch, mail_root, &add_files_state);
+    if (incremental)
+	ret = add_journal_files (notmuch, &add_files_state);
+    else
+	ret = add_files (notmuch, mail_root, &add_files_state, true);
     if (ret)
 	goto DONE;
 
@@ -1293,6 +1931,22 @@ notmuch_new_command (notmuch_database_t *notmuch, int argc, char *argv[])
 	}
     }
 
+    if (! interrupted)
+	_consume_watch_journal (notmuch, &add_files_state);
+
+    /* Done after the scan, so that new mail is summarised only once. */
+    if (thread_summaries_set && ! interrupted) {
+	status = notmuch_database_set_thread_summaries (notmuch, thread_summaries);
+	if (print_status_database ("notmuch new", notmuch, status))
+	    ret = status;
+    }
+
+    if (message_values_set && ! interrupted) {
+	status = notmuch_database_set_message_values (notmuch, message_values);
+	if (print_status_database ("notmuch new", notmuch, status))
+	    ret = status;
+    }
+
   DONE:
     talloc_free (add_files_state.removed_files);
     talloc_free (add_files_state.removed_directories);
@@ -1301,6 +1955,9 @@ notmuch_new_command (notmuch_database_t *notmuch, int argc, char *argv[])
     if (timer_is_active)
 	stop_progress_printing_timer ();
 
+    add_files_state.header_only_files =
+	notmuch_database_get_trace_counter (notmuch, NOTMUCH_TRACE_INDEX_HEADER_ONLY);
+
     if (add_files_state.verbosity >= VERBOSITY_NORMAL)
 	print_results (&add_files_state);
 
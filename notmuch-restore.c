@@ -133,7 +133,8 @@ tag_message (unused (void *ctx),
 	     notmuch_database_t *notmuch,
 	     const char *message_id,
 	     tag_op_list_t *tag_ops,
-	     tag_op_flag_t flags)
+	     tag_op_flag_t flags,
+	     tag_batch_t *tag_batch)
 {
     notmuch_status_t status;
     notmuch_message_t *message = NULL;
@@ -155,13 +156,131 @@ tag_message (unused (void *ctx),
     /* In order to detect missing messages, this check/optimization is
      * intentionally done *after* first finding the message. */
     if ((flags & TAG_FLAG_REMOVE_ALL) || tag_op_list_size (tag_ops))
-	ret = tag_op_list_apply (message, tag_ops, flags);
+	ret = tag_batch_apply (tag_batch, message, tag_ops, flags);
 
     notmuch_message_destroy (message);
 
     return ret;
 }
 
+/* With --bulk, tag lines are collected into runs of up to
+ * RESTORE_RUN_SIZE messages, and each run is sorted by message-id
+ * before it is applied. That is the order of the message-id terms in
+ * the database, so the lookups walk the term index from one end to
+ * the other instead of jumping around in it. Lines for the same
+ * message keep their relative order.
+ */
+#define RESTORE_RUN_SIZE 100000
+
+typedef struct {
+    const char *message_id;
+    tag_op_list_t *tag_ops;
+    size_t seq;
+} restore_entry_t;
+
+typedef struct {
+    /* Owns the entries of the current run */
+    void *ctx;
+    restore_entry_t *entries;
+    size_t count;
+    size_t seq;
+} restore_run_t;
+
+static restore_run_t *
+restore_run_create (void *ctx)
+{
+    restore_run_t *run;
+
+    run = talloc_zero (ctx, restore_run_t);
+    if (run == NULL)
+	return NULL;
+
+    run->ctx = talloc_new (run);
+    run->entries = talloc_array (run, restore_entry_t, RESTORE_RUN_SIZE);
+    if (run->ctx == NULL || run->entries == NULL) {
+	talloc_free (run);
+	return NULL;
+    }
+
+    return run;
+}
+
+/* Add a copy of 'message_id' and 'tag_ops' to the run. The parsed
+ * tags point into the line buffer, which is overwritten by the next
+ * line. */
+static int
+restore_run_add (restore_run_t *run, const char *message_id,
+		 const tag_op_list_t *tag_ops)
+{
+    restore_entry_t *entry = &run->entries[run->count];
+    size_t i;
+
+    entry->message_id = talloc_strdup (run->ctx, message_id);
+    entry->tag_ops = tag_op_list_create (run->ctx);
+    if (entry->message_id == NULL || entry->tag_ops == NULL)
+	goto OOM;
+
+    for (i = 0; i < tag_op_list_size (tag_ops); i++) {
+	const char *tag = talloc_strdup (run->ctx, tag_op_list_tag (tag_ops, i));
+
+	if (tag == NULL ||
+	    tag_op_list_append (entry->tag_ops, tag, tag_op_list_isremove (tag_ops, i)))
+	    goto OOM;
+    }
+
+    entry->seq = run->seq++;
+    run->count++;
+
+    return 0;
+
+  OOM:
+    fprintf (stderr, "Out of memory.\n");
+    return 1;
+}
+
+static int
+restore_entry_cmp (const void *a, const void *b)
+{
+    const restore_entry_t *ea = (const restore_entry_t *) a;
+    const restore_entry_t *eb = (const restore_entry_t *) b;
+    int cmp;
+
+    cmp = strcmp (ea->message_id, eb->message_id);
+    if (cmp)
+	return cmp;
+
+    return (ea->seq > eb->seq) - (ea->seq < eb->seq);
+}
+
+/* Apply and then forget the entries of the run. */
+static int
+restore_run_flush (notmuch_database_t *notmuch, restore_run_t *run,
+		   tag_op_flag_t flags, tag_batch_t *tag_batch)
+{
+    size_t i;
+    int ret = 0;
+
+    qsort (run->entries, run->count, sizeof (restore_entry_t), restore_entry_cmp);
+
+    for (i = 0; i < run->count && ! ret; i++) {
+	restore_entry_t *entry = &run->entries[i];
+
+	ret = tag_message (run->ctx, notmuch, entry->message_id,
+			   entry->tag_ops, flags, tag_batch);
+    }
+
+    talloc_free (run->ctx);
+    run->ctx = talloc_new (run);
+    run->count = 0;
+
+    if (run->ctx == NULL) {
+	fprintf (stderr, "Out of memory.\n");
+	return 1;
+    }
+
+    return ret;
+}
+
 /* Sup dump output is one line per message. We match a sequence of
  * non-space characters for the message-id, then one or more
  * spaces, then a list of space-separated tags as a sequence of
@@ -222,8 +341,11 @@ int
 notmuch_restore_command (notmuch_database_t *notmuch, int argc, char *argv[])
 {
     bool accumulate = false;
+    bool bulk = false;
     tag_op_flag_t flags = 0;
     tag_op_list_t *tag_ops;
+    tag_batch_t *tag_batch = NULL;
+    restore_run_t *run = NULL;
 
     const char *input_file_name = NULL;
     const char *name_for_error = NULL;
@@ -262,6 +384,7 @@ notmuch_restore_command (notmuch_database_t *notmuch, int argc, char *argv[])
 
 	{ .opt_string = &input_file_name, .name = "input" },
 	{ .opt_bool = &accumulate, .name = "accumulate" },
+	{ .opt_bool = &bulk, .name = "bulk" },
 	{ .opt_inherit = notmuch_shared_options },
 	{ }
     };
@@ -312,6 +435,22 @@ notmuch_restore_command (notmuch_database_t *notmuch, int argc, char *argv[])
 	goto DONE;
     }
 
+    tag_batch = tag_batch_create (notmuch, notmuch, NOTMUCH_TAG_BATCH);
+    if (tag_batch == NULL) {
+	fprintf (stderr, "Out of memory.\n");
+	ret = EXIT_FAILURE;
+	goto DONE;
+    }
+
+    if (bulk) {
+	run = restore_run_create (notmuch);
+	if (run == NULL) {
+	    fprintf (stderr, "Out of memory.\n");
+	    ret = EXIT_FAILURE;
+	    goto DONE;
+	}
+    }
+
     tag_ops = tag_op_list_create (notmuch);
     if (tag_ops == NULL) {
 	fprintf (stderr, "Out of memory.\n");
@@ -422,8 +561,17 @@ notmuch_restore_command (notmuch_database_t *notmuch, int argc, char *argv[])
 	if (ret < 0)
 	    break;
 
+	if (run) {
+	    ret = restore_run_add (run, query_string, tag_ops);
+	    if (! ret && run->count == RESTORE_RUN_SIZE)
+		ret = restore_run_flush (notmuch, run, flags, tag_batch);
+	    if (ret)
+		break;
+	    continue;
+	}
+
 	ret = tag_message (line_ctx, notmuch, query_string,
-			   tag_ops, flags);
+			   tag_ops, flags, tag_batch);
 	if (ret)
 	    break;
 
@@ -434,6 +582,8 @@ notmuch_restore_command (notmuch_database_t *notmuch, int argc, char *argv[])
      * impossible here */
     if (ret == UTIL_EOF) {
 	ret = EXIT_SUCCESS;
+	if (run && restore_run_flush (notmuch, run, flags, tag_batch))
+	    ret = EXIT_FAILURE;
     } else {
 	fprintf (stderr, "Error reading (gzipped) input: %s\n",
 		 gz_error_string (ret, input));
@@ -451,6 +601,9 @@ notmuch_restore_command (notmuch_database_t *notmuch, int argc, char *argv[])
     if (line_ctx != NULL)
 	talloc_free (line_ctx);
 
+    if (tag_batch && tag_batch_flush (tag_batch))
+	ret = EXIT_FAILURE;
+
     if (notmuch)
 	notmuch_database_destroy (notmuch);
 
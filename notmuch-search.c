@@ -63,7 +63,7 @@ typedef struct {
     int offset;
     int limit;
     int dupe;
-    GHashTable *addresses;
+    struct mailbox_set *addresses;
     int dedup;
 } search_context_t;
 
@@ -71,8 +71,40 @@ typedef struct {
     const char *name;
     const char *addr;
     int count;
+    /* Index of the next mailbox with the same address (ignoring
+     * case) in a mailbox_set_t, or -1. */
+    int next;
 } mailbox_t;
 
+/* Mailboxes with the same address, ignoring case, in order of
+ * appearance. */
+typedef struct {
+    int first;
+    int last;
+} mailbox_group_t;
+
+/* The distinct mailboxes (name/address pairs) seen so far, for
+ * deduplication.
+ *
+ * Mailing lists can yield tens of thousands of name variants for a
+ * single address, so mailboxes are found through an open addressing
+ * hash table of (name, address) rather than by walking the variants
+ * of their address.  The strings of each mailbox are interned, so
+ * that variants share their address. */
+typedef struct mailbox_set {
+    GStringChunk *strings;
+    /* mailbox_t, in order of appearance */
+    GArray *mailboxes;
+    /* mailbox_group_t, in order of appearance */
+    GArray *groups;
+    /* Indices into mailboxes plus one, or 0 for an empty slot. */
+    unsigned int *slots;
+    /* Number of slots, a power of two. */
+    unsigned int size;
+    /* Interned address -> index into groups plus one */
+    GHashTable *group_index;
+} mailbox_set_t;
+
 /* Return two stable query strings that identify exactly the matched
  * and unmatched messages currently in thread.  If there are no
  * matched or unmatched messages, the returned buffers will be
@@ -272,33 +304,76 @@ do_search_threads (search_context_t *ctx)
     return 0;
 }
 
-static mailbox_t *
-new_mailbox (void *ctx, const char *name, const char *addr)
+#define MAILBOX_SET_INITIAL_SIZE 1024
+
+static mailbox_set_t *
+mailbox_set_create (void)
 {
-    mailbox_t *mailbox;
+    mailbox_set_t *set = g_new0 (mailbox_set_t, 1);
 
-    mailbox = talloc (ctx, mailbox_t);
-    if (! mailbox)
-	return NULL;
+    set->strings = g_string_chunk_new (4096);
+    set->mailboxes = g_array_new (false, false, sizeof (mailbox_t));
+    set->groups = g_array_new (false, false, sizeof (mailbox_group_t));
+    set->size = MAILBOX_SET_INITIAL_SIZE;
+    set->slots = g_new0 (unsigned int, set->size);
+    set->group_index = g_hash_table_new (strcase_hash, strcase_equal);
+
+    return set;
+}
 
-    mailbox->name = talloc_strdup (mailbox, name);
-    mailbox->addr = talloc_strdup (mailbox, addr);
-    mailbox->count = 1;
+static void
+mailbox_set_destroy (mailbox_set_t *set)
+{
+    g_hash_table_unref (set->group_index);
+    g_free (set->slots);
+    g_array_free (set->groups, true);
+    g_array_free (set->mailboxes, true);
+    g_string_chunk_free (set->strings);
+    g_free (set);
+}
+
+static unsigned int
+mailbox_hash (const char *name, const char *addr)
+{
+    unsigned int hash = g_str_hash (addr);
 
-    return mailbox;
+    /* Tell a missing name from an empty one. */
+    return hash * 33 + (name ? g_str_hash (name) : 1);
 }
 
-static int
-mailbox_compare (const void *v1, const void *v2)
+/* Return the slot holding the mailbox name/addr, or the empty slot
+ * where it belongs. */
+static unsigned int
+mailbox_set_find (const mailbox_set_t *set, const char *name, const char *addr)
 {
-    const mailbox_t *m1 = v1, *m2 = v2;
-    int ret;
+    unsigned int mask = set->size - 1;
+    unsigned int i;
 
-    ret = strcmp_null (m1->name, m2->name);
-    if (! ret)
-	ret = strcmp (m1->addr, m2->addr);
+    for (i = mailbox_hash (name, addr) & mask; set->slots[i]; i = (i + 1) & mask) {
+	const mailbox_t *mailbox = &g_array_index (set->mailboxes, mailbox_t,
+						   set->slots[i] - 1);
+
+	if (strcmp (mailbox->addr, addr) == 0 && strcmp_null (mailbox->name, name) == 0)
+	    break;
+    }
 
-    return ret;
+    return i;
+}
+
+static void
+mailbox_set_grow (mailbox_set_t *set)
+{
+    unsigned int i;
+
+    g_free (set->slots);
+    set->size *= 2;
+    set->slots = g_new0 (unsigned int, set->size);
+
+    for (i = 0; i < set->mailboxes->len; i++) {
+	const mailbox_t *mailbox = &g_array_index (set->mailboxes, mailbox_t, i);
+
+	set->slots[mailbox_set_find (set, mailbox->name, mailbox->addr)] = i + 1;
+    }
 }
 
 /* Returns true iff name and addr is duplicate. If not, stores the
@@ -306,53 +381,43 @@ mailbox_compare (const void *v1, const void *v2)
 static bool
 is_duplicate (const search_context_t *ctx, const char *name, const char *addr)
 {
-    char *key;
-    GList *list, *l;
-    mailbox_t *mailbox;
-
-    list = g_hash_table_lookup (ctx->addresses, addr);
-    if (list) {
-	mailbox_t find = {
-	    .name = name,
-	    .addr = addr,
-	};
-
-	l = g_list_find_custom (list, &find, mailbox_compare);
-	if (l) {
-	    mailbox = l->data;
-	    mailbox->count++;
-	    return true;
-	}
+    mailbox_set_t *set = ctx->addresses;
+    unsigned int slot, group_pos;
+    mailbox_t mailbox;
+    int pos;
+
+    slot = mailbox_set_find (set, name, addr);
+    if (set->slots[slot]) {
+	g_array_index (set->mailboxes, mailbox_t, set->slots[slot] - 1).count++;
+	return true;
+    }
 
-	mailbox = new_mailbox (ctx->format, name, addr);
-	if (! mailbox)
-	    return false;
+    mailbox.name = name ? g_string_chunk_insert_const (set->strings, name) : NULL;
+    mailbox.addr = g_string_chunk_insert_const (set->strings, addr);
+    mailbox.count = 1;
+    mailbox.next = -1;
 
-	/*
-	 * XXX: It would be more efficient to prepend to the list, but
-	 * then we'd have to store the changed list head back to the
-	 * hash table. This check is here just to avoid the compiler
-	 * warning for unused result.
-	 */
-	if (list != g_list_append (list, mailbox))
-	    INTERNAL_ERROR ("appending to list changed list head\n");
+    pos = set->mailboxes->len;
+    g_array_append_val (set->mailboxes, mailbox);
+    set->slots[slot] = pos + 1;
 
-	return false;
-    }
+    group_pos = GPOINTER_TO_UINT (g_hash_table_lookup (set->group_index, mailbox.addr));
+    if (group_pos) {
+	mailbox_group_t *group = &g_array_index (set->groups, mailbox_group_t, group_pos - 1);
 
-    key = talloc_strdup (ctx->format, addr);
-    if (! key)
-	return false;
-
-    mailbox = new_mailbox (ctx->format, name, addr);
-    if (! mailbox)
-	return false;
+	g_array_index (set->mailboxes, mailbox_t, group->last).next = pos;
+	group->last = pos;
+    } else {
+	mailbox_group_t group = { .first = pos, .last = pos };
 
-    list = g_list_append (NULL, mailbox);
-    if (! list)
-	return false;
+	g_array_append_val (set->groups, group);
+	g_hash_table_insert (set->group_index, (char *) mailbox.addr,
+			     GUINT_TO_POINTER (set->groups->len));
+    }
 
-    g_hash_table_insert (ctx->addresses, key, list);
+    /* Keep the table at most half full. */
+    if (set->mailboxes->len * 2 > set->size)
+	mailbox_set_grow (set);
 
     return false;
 }
@@ -460,31 +525,19 @@ process_address_header (const search_context_t *ctx, const char *value)
     g_object_unref (list);
 }
 
-/* Destructor for talloc-allocated GHashTable keys and values. */
-static void
-_talloc_free_for_g_hash (void *ptr)
-{
-    talloc_free (ptr);
-}
-
-static void
-_list_free_for_g_hash (void *ptr)
-{
-    g_list_free_full (ptr, _talloc_free_for_g_hash);
-}
-
-/* Print the most common variant of a list of unique mailboxes, and
+/* Print the most common variant of a group of unique mailboxes, and
  * conflate the counts. */
 static void
-print_popular (const search_context_t *ctx, GList *list)
+print_popular (const search_context_t *ctx, const mailbox_group_t *group)
 {
-    GList *l;
+    GArray *mailboxes = ctx->addresses->mailboxes;
     mailbox_t *mailbox = NULL, *m;
     int max = 0;
     int total = 0;
+    int i;
 
-    for (l = list; l; l = l->next) {
-	m = l->data;
+    for (i = group->first; i >= 0; i = m->next) {
+	m = &g_array_index (mailboxes, mailbox_t, i);
 	total += m->count;
 	if (m->count > max) {
 	    mailbox = m;
@@ -493,7 +546,7 @@ print_popular (const search_context_t *ctx, GList *list)
     }
 
     if (! mailbox)
-	INTERNAL_ERROR ("Empty list in address hash table\n");
+	INTERNAL_ERROR ("Empty mailbox group\n");
 
     /* The original count is no longer needed, so overwrite. */
     mailbox->count = total;
@@ -501,39 +554,20 @@ print_popular (const search_context_t *ctx, GList *list)
     print_mailbox (ctx, mailbox);
 }
 
+/* Print the mailboxes collected in a full pass. */
 static void
-print_list_value (void *mailbox, void *context)
-{
-    print_mailbox (context, mailbox);
-}
-
-static void
-print_hash_value (unused (void *key), void *list, void *context)
+print_mailbox_set (const search_context_t *ctx)
 {
-    const search_context_t *ctx = context;
-
-    if (ctx->dedup == DEDUP_ADDRESS)
-	print_popular (ctx, list);
-    else
-	g_list_foreach (list, print_list_value, context);
-}
+    const mailbox_set_t *set = ctx->addresses;
+    unsigned int i;
 
-static int
-_count_filenames (notmuch_message_t *message)
-{
-    notmuch_filenames_t *filenames;
-    int i = 0;
-
-    filenames = notmuch_message_get_filenames (message);
-
-    while (notmuch_filenames_valid (filenames)) {
-	notmuch_filenames_move_to_next (filenames);
-	i++;
+    if (ctx->dedup == DEDUP_ADDRESS) {
+	for (i = 0; i < set->groups->len; i++)
+	    print_popular (ctx, &g_array_index (set->groups, mailbox_group_t, i));
+    } else {
+	for (i = 0; i < set->mailboxes->len; i++)
+	    print_mailbox (ctx, &g_array_index (set->mailboxes, mailbox_t, i));
     }
-
-    notmuch_filenames_destroy (filenames);
-
-    return i;
 }
 
 static int
@@ -543,8 +577,9 @@ do_search_messages (search_context_t *ctx)
     notmuch_messages_t *messages;
     notmuch_filenames_t *filenames;
     sprinter_t *format = ctx->format;
-    int i;
     notmuch_status_t status;
+    bool prefetch;
+    unsigned int i;
 
     if (ctx->offset < 0) {
 	unsigned count;
@@ -558,17 +593,29 @@ do_search_messages (search_context_t *ctx)
 	    ctx->offset = 0;
     }
 
+    /* Let the library skip and limit the results, rather than
+     * retrieving all of them only to throw most away. */
+    notmuch_query_set_offset (ctx->query, ctx->offset);
+    notmuch_query_set_limit (ctx->query, ctx->limit);
+
     status = notmuch_query_search_messages (ctx->query, &messages);
     if (print_status_query ("notmuch search", ctx->query, status))
 	return 1;
 
+    /* Address output reads headers rather than the message metadata,
+     * so there is nothing to gain from loading the latter in bulk. */
+    prefetch = (ctx->output == OUTPUT_FILES || ctx->output == OUTPUT_MESSAGES);
+
     format->begin_list (format);
 
     for (i = 0;
-	 notmuch_messages_valid (messages) && (ctx->limit < 0 || i < ctx->offset + ctx->limit);
+	 notmuch_messages_valid (messages);
 	 notmuch_messages_move_to_next (messages), i++) {
-	if (i < ctx->offset)
-	    continue;
+	if (prefetch && i % NOTMUCH_PREFETCH_BATCH == 0) {
+	    status = notmuch_messages_prefetch (messages, NOTMUCH_PREFETCH_BATCH);
+	    if (print_status_query ("notmuch search", ctx->query, status))
+		return 1;
+	}
 
 	message = notmuch_messages_get (messages);
 
@@ -589,7 +636,7 @@ do_search_messages (search_context_t *ctx)
 
 	} else if (ctx->output == OUTPUT_MESSAGES) {
 	    /* special case 1 for speed */
-	    if (ctx->dupe <= 1 || ctx->dupe <= _count_filenames (message)) {
+	    if (ctx->dupe <= 1 || ctx->dupe <= notmuch_message_count_files (message)) {
 		format->set_prefix (format, "id");
 		format->string (format,
 				notmuch_message_get_message_id (message));
@@ -620,7 +667,7 @@ do_search_messages (search_context_t *ctx)
 
     if (ctx->addresses &&
 	(ctx->output & OUTPUT_COUNT || ctx->dedup == DEDUP_ADDRESS))
-	g_hash_table_foreach (ctx->addresses, print_hash_value, ctx);
+	print_mailbox_set (ctx);
 
     notmuch_messages_destroy (messages);
 
@@ -906,9 +953,7 @@ notmuch_address_command (notmuch_database_t *notmuch, int argc, char *argv[])
     if (_notmuch_search_prepare (ctx, argc - opt_index, argv + opt_index))
 	return EXIT_FAILURE;
 
-    ctx->addresses = g_hash_table_new_full (strcase_hash, strcase_equal,
-					    _talloc_free_for_g_hash,
-					    _list_free_for_g_hash);
+    ctx->addresses = mailbox_set_create ();
 
     /* The order is not guaranteed if a full pass is required, so go
      * for fastest. */
@@ -917,7 +962,7 @@ notmuch_address_command (notmuch_database_t *notmuch, int argc, char *argv[])
 
     ret = do_search_messages (ctx);
 
-    g_hash_table_unref (ctx->addresses);
+    mailbox_set_destroy (ctx->addresses);
 
 
     _notmuch_search_cleanup (ctx);
@@ -0,0 +1,356 @@
+/* notmuch - Not much of an email program, (just index and search)
+ *
+ * Copyright © 2026 agent
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see https://www.gnu.org/licenses/ .
+ *
+ * Author: agent <agent@local>
+ */
+
+#include "notmuch-client.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+/* notmuch serve keeps one read-only database (with its configuration,
+ * query parser and range processors) open, and serves each connection
+ * in a child process forked from it, so that a client staying
+ * connected does not hold up the others. That child in turn runs each
+ * request in a child process of its own, which gets a private copy of
+ * all client state, so the commands below can be used unchanged even
+ * though they call exit () and destroy the database when done. */
+
+static volatile sig_atomic_t interrupted;
+
+static void
+handle_sigterm (unused (int sig))
+{
+    interrupted = 1;
+}
+
+typedef struct serve_command {
+    const char *name;
+    int (*function)(notmuch_database_t *notmuch, int argc, char *argv[]);
+    bool write;
+} serve_command_t;
+
+static const serve_command_t serve_commands[] = {
+    { "search", notmuch_search_command, false },
+    { "address", notmuch_address_command, false },
+    { "show", notmuch_show_command, false },
+    { "count", notmuch_count_command, false },
+    { "reply", notmuch_reply_command, false },
+    { "tag", notmuch_tag_command, true },
+};
+
+static const serve_command_t *
+find_serve_command (const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE (serve_commands); i++)
+	if (strcmp (name, serve_commands[i].name) == 0)
+	    return &serve_commands[i];
+
+    return NULL;
+}
+
+/* Run 'command' in a child process with stdout and stderr redirected
+ * to 'out' and 'err'. Returns the exit status of the command. */
+static int
+serve_fork_command (notmuch_database_t *notmuch, const serve_command_t *command,
+		    int argc, char *argv[], FILE *out, FILE *err)
+{
+    pid_t pid;
+    int wstatus;
+
+    fflush (stdout);
+    fflush (stderr);
+    fflush (err);
+
+    pid = fork ();
+    if (pid < 0) {
+	fprintf (err, "Error: cannot fork: %s\n", strerror (errno));
+	return EXIT_FAILURE;
+    }
+
+    if (pid == 0) {
+	signal (SIGINT, SIG_DFL);
+	signal (SIGTERM, SIG_DFL);
+	signal (SIGPIPE, SIG_DFL);
+
+	if (dup2 (fileno (out), STDOUT_FILENO) < 0 ||
+	    dup2 (fileno (err), STDERR_FILENO) < 0)
+	    _exit (EXIT_FAILURE);
+
+	if (command->write) {
+	    notmuch_status_t status;
+
+	    status = notmuch_database_reopen (notmuch, NOTMUCH_DATABASE_MODE_READ_WRITE);
+	    if (print_status_database ("notmuch serve", notmuch, status))
+		exit (EXIT_FAILURE);
+	}
+
+	exit ((command->function)(notmuch, argc, argv));
+    }
+
+    while (waitpid (pid, &wstatus, 0) < 0) {
+	if (errno != EINTR) {
+	    fprintf (err, "Error: waiting for %s: %s\n", command->name, strerror (errno));
+	    return EXIT_FAILURE;
+	}
+    }
+
+    if (WIFEXITED (wstatus))
+	return WEXITSTATUS (wstatus);
+
+    fprintf (err, "Error: %s terminated by signal %d\n", command->name,
+	     WIFSIGNALED (wstatus) ? WTERMSIG (wstatus) : 0);
+    return EXIT_FAILURE;
+}
+
+static int
+copy_stream (FILE *from, FILE *to)
+{
+    char buf[4096];
+    size_t len;
+
+    rewind (from);
+    while ((len = fread (buf, 1, sizeof (buf), from)) > 0) {
+	if (fwrite (buf, 1, len, to) != len)
+	    return -1;
+    }
+
+    return ferror (from) ? -1 : 0;
+}
+
+/* Send the response to one request: a line "<exit status> <stdout
+ * length> <stderr length>" followed by the two captured streams. */
+static int
+serve_write_reply (FILE *reply, int exit_status, FILE *out, FILE *err)
+{
+    long out_len, err_len;
+
+    if (fflush (out) || fflush (err) ||
+	fseek (out, 0, SEEK_END) || fseek (err, 0, SEEK_END))
+	return -1;
+
+    out_len = ftell (out);
+    err_len = ftell (err);
+    if (out_len < 0 || err_len < 0)
+	return -1;
+
+    fprintf (reply, "%d %ld %ld\n", exit_status, out_len, err_len);
+    if (copy_stream (out, reply) || copy_stream (err, reply))
+	return -1;
+
+    return fflush (reply) ? -1 : 0;
+}
+
+static int
+serve_request (notmuch_database_t *notmuch, const char *line, FILE *reply)
+{
+    const serve_command_t *command;
+    GError *error = NULL;
+    gchar **argv = NULL;
+    gint argc;
+    FILE *out = NULL, *err = NULL;
+    int exit_status = EXIT_FAILURE;
+    int ret = -1;
+
+    out = tmpfile ();
+    err = tmpfile ();
+    if (! out || ! err) {
+	fprintf (stderr, "Error: cannot create temporary file: %s\n", strerror (errno));
+	goto DONE;
+    }
+
+    if (! g_shell_parse_argv (line, &argc, &argv, &error)) {
+	fprintf (err, "Error: malformed request: %s\n", error->message);
+	g_error_free (error);
+    } else if (! (command = find_serve_command (argv[0]))) {
+	fprintf (err, "Error: '%s' is not available through notmuch serve\n", argv[0]);
+    } else {
+	exit_status = serve_fork_command (notmuch, command, argc, argv, out, err);
+    }
+
+    ret = serve_write_reply (reply, exit_status, out, err);
+
+  DONE:
+    if (out)
+	fclose (out);
+    if (err)
+	fclose (err);
+    g_strfreev (argv);
+
+    return ret;
+}
+
+static void
+serve_connection (notmuch_database_t *notmuch, int fd)
+{
+    FILE *in, *reply;
+    char *line = NULL;
+    size_t line_size = 0;
+    notmuch_status_t status;
+
+    in = fdopen (fd, "r");
+    if (! in) {
+	close (fd);
+	return;
+    }
+
+    reply = fdopen (dup (fd), "w");
+    if (! reply) {
+	fclose (in);
+	return;
+    }
+
+    while (! interrupted && getline (&line, &line_size, in) != -1) {
+	chomp_newline (line);
+
+	/* Pick up changes made by other writers (and by earlier tag
+	 * requests) before every request. This is also what recovers
+	 * from Xapian::DatabaseModifiedError. */
+	status = notmuch_database_reopen (notmuch, NOTMUCH_DATABASE_MODE_READ_ONLY);
+	if (print_status_database ("notmuch serve", notmuch, status))
+	    break;
+
+	if (serve_request (notmuch, line, reply))
+	    break;
+    }
+
+    free (line);
+    fclose (reply);
+    fclose (in);
+}
+
+int
+notmuch_serve_command (notmuch_database_t *notmuch, int argc, char *argv[])
+{
+    const char *socket_path = NULL;
+    struct sockaddr_un addr;
+    struct sigaction action;
+    struct stat st;
+    int opt_index;
+    int listen_fd;
+    mode_t old_umask;
+    int ret = EXIT_SUCCESS;
+
+    notmuch_opt_desc_t options[] = {
+	{ .opt_string = &socket_path, .name = "socket" },
+	{ .opt_inherit = notmuch_shared_options },
+	{ }
+    };
+
+    opt_index = parse_arguments (argc, argv, options, 1);
+    if (opt_index < 0)
+	return EXIT_FAILURE;
+
+    notmuch_process_shared_options (notmuch, argv[0]);
+
+    if (opt_index < argc) {
+	fprintf (stderr, "Error: unexpected argument '%s'\n", argv[opt_index]);
+	return EXIT_FAILURE;
+    }
+
+    if (! socket_path) {
+	fprintf (stderr, "Error: notmuch serve requires --socket=<path>\n");
+	return EXIT_FAILURE;
+    }
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen (socket_path) >= sizeof (addr.sun_path)) {
+	fprintf (stderr, "Error: socket path too long: %s\n", socket_path);
+	return EXIT_FAILURE;
+    }
+    strcpy (addr.sun_path, socket_path);
+
+    /* Remove a socket left behind by a previous server, but never
+     * anything else. */
+    if (lstat (socket_path, &st) == 0 && S_ISSOCK (st.st_mode))
+	unlink (socket_path);
+
+    listen_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+	fprintf (stderr, "Error: cannot create socket: %s\n", strerror (errno));
+	return EXIT_FAILURE;
+    }
+
+    /* Anyone who can connect can read and tag all mail. */
+    old_umask = umask (077);
+    if (bind (listen_fd, (struct sockaddr *) &addr, sizeof (addr)) < 0) {
+	fprintf (stderr, "Error: cannot bind to %s: %s\n", socket_path, strerror (errno));
+	umask (old_umask);
+	close (listen_fd);
+	return EXIT_FAILURE;
+    }
+    umask (old_umask);
+
+    if (listen (listen_fd, SOMAXCONN) < 0) {
+	fprintf (stderr, "Error: cannot listen on %s: %s\n", socket_path, strerror (errno));
+	ret = EXIT_FAILURE;
+	goto DONE;
+    }
+
+    /* No SA_RESTART, so that a blocked accept () or read returns. */
+    memset (&action, 0, sizeof (struct sigaction));
+    action.sa_handler = handle_sigterm;
+    sigemptyset (&action.sa_mask);
+    sigaction (SIGINT, &action, NULL);
+    sigaction (SIGTERM, &action, NULL);
+    signal (SIGPIPE, SIG_IGN);
+    /* Connection processes are not waited for. */
+    signal (SIGCHLD, SIG_IGN);
+
+    while (! interrupted) {
+	pid_t pid;
+	int fd = accept (listen_fd, NULL, NULL);
+
+	if (fd < 0) {
+	    if (errno == EINTR || errno == ECONNABORTED)
+		continue;
+	    fprintf (stderr, "Error: accept failed: %s\n", strerror (errno));
+	    ret = EXIT_FAILURE;
+	    break;
+	}
+
+	pid = fork ();
+	if (pid < 0) {
+	    fprintf (stderr, "Error: cannot fork: %s\n", strerror (errno));
+	    close (fd);
+	    continue;
+	}
+
+	if (pid == 0) {
+	    /* Requests are run in children that must be waited for. */
+	    signal (SIGCHLD, SIG_DFL);
+	    close (listen_fd);
+	    serve_connection (notmuch, fd);
+	    _exit (EXIT_SUCCESS);
+	}
+
+	close (fd);
+    }
+
+  DONE:
+    close (listen_fd);
+    unlink (socket_path);
+
+    notmuch_database_destroy (notmuch);
+
+    return ret;
+}
@@ -23,6 +23,8 @@
 #include "sprinter.h"
 #include "zlib-extra.h"
 
+#include <fcntl.h>
+
 static const char *
 _get_filename (notmuch_message_t *message, int index)
 {
@@ -951,12 +953,27 @@ format_part_raw (unused (const void *ctx), unused (sprinter_t *sp),
 	    goto DONE;
 	}
 
-	stream = g_mime_stream_gzfile_open (filename);
+	stream = g_mime_stream_gzfile_open_mapped (filename);
 	if (stream == NULL) {
 	    fprintf (stderr, "Error: Cannot open file %s: %s\n", filename, strerror (errno));
 	    goto DONE;
 	}
 
+	/* Uncompressed files are mapped; write them out without
+	 * copying through buf. */
+	if (GMIME_IS_STREAM_MMAP (stream)) {
+	    GMimeStreamMmap *mmap_stream = GMIME_STREAM_MMAP (stream);
+
+	    if (mmap_stream->maplen > 0 &&
+		fwrite (mmap_stream->map, mmap_stream->maplen, 1, stdout) != 1) {
+		fprintf (stderr, "Error: Write %zu chars to stdout failed\n",
+			 mmap_stream->maplen);
+		goto DONE;
+	    }
+	    ret = NOTMUCH_STATUS_SUCCESS;
+	    goto DONE;
+	}
+
 	while (! g_mime_stream_eos (stream)) {
 	    ssize = g_mime_stream_read (stream, buf, sizeof (buf));
 	    if (ssize < 0) {
@@ -1006,6 +1023,164 @@ format_part_raw (unused (const void *ctx), unused (sprinter_t *sp),
     return NOTMUCH_STATUS_SUCCESS;
 }
 
+/* While one message is formatted, the files of the next few
+ * messages to be shown are opened, and the kernel asked to read them
+ * in (with posix_fadvise), by background threads. This way a cold
+ * cache or a network file system does not stall each message of a
+ * long thread in turn. */
+typedef struct show_prefetch {
+    GThreadPool *pool;
+    /* Files of the current thread, in the order they are shown. */
+    GPtrArray *files;
+    /* Index in files of the next file to queue. */
+    guint next;
+    /* How many files to read ahead. */
+    guint window;
+    /* Set when the show is done, so that queued files are skipped. */
+    gint cancelled;
+} show_prefetch_t;
+
+#define PREFETCH_MAX_THREADS 16
+
+static void
+_prefetch_file (gpointer data, gpointer user_data)
+{
+    show_prefetch_t *prefetch = (show_prefetch_t *) user_data;
+    char *filename = (char *) data;
+    int fd;
+
+    if (! g_atomic_int_get (&prefetch->cancelled)) {
+	fd = open (filename, O_RDONLY);
+	if (fd >= 0) {
+#ifdef POSIX_FADV_WILLNEED
+	    (void) posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+#else
+	    char buf[65536];
+
+	    while (read (fd, buf, sizeof (buf)) > 0)
+		;
+#endif
+	    close (fd);
+	}
+    }
+
+    g_free (filename);
+}
+
+static show_prefetch_t *
+_prefetch_create (void *ctx, int window)
+{
+    show_prefetch_t *prefetch;
+
+    if (window <= 0)
+	return NULL;
+
+    prefetch = talloc_zero (ctx, show_prefetch_t);
+    if (prefetch == NULL)
+	return NULL;
+
+    prefetch->window = window;
+    prefetch->files = g_ptr_array_new_with_free_func (g_free);
+    prefetch->pool = g_thread_pool_new (_prefetch_file, prefetch,
+					MIN (window, PREFETCH_MAX_THREADS), FALSE, NULL);
+    if (prefetch->pool == NULL) {
+	g_ptr_array_unref (prefetch->files);
+	talloc_free (prefetch);
+	return NULL;
+    }
+
+    return prefetch;
+}
+
+static void
+_prefetch_destroy (show_prefetch_t *prefetch)
+{
+    if (prefetch == NULL)
+	return;
+
+    /* Let the threads drain the queue without opening anything. */
+    g_atomic_int_set (&prefetch->cancelled, 1);
+    g_thread_pool_free (prefetch->pool, FALSE, TRUE);
+    g_ptr_array_unref (prefetch->files);
+    talloc_free (prefetch);
+}
+
+/* Queue the next file of the current thread, if any. */
+static void
+_prefetch_advance (show_prefetch_t *prefetch)
+{
+    if (prefetch == NULL || prefetch->next >= prefetch->files->len)
+	return;
+
+    g_thread_pool_push (prefetch->pool,
+			g_strdup ((char *) g_ptr_array_index (prefetch->files,
+							      prefetch->next++)),
+			NULL);
+}
+
+/* Collect the files of 'messages' and their replies that show_messages
+ * will show, in the same order. */
+static void
+_prefetch_collect (show_prefetch_t *prefetch, notmuch_messages_t *messages,
+		   const notmuch_show_params_t *params)
+{
+    for (;
+	 notmuch_messages_valid (messages);
+	 notmuch_messages_move_to_next (messages)) {
+	notmuch_message_t *message = notmuch_messages_get (messages);
+	bool match = notmuch_message_get_flag (message, NOTMUCH_MESSAGE_FLAG_MATCH);
+	bool excluded = notmuch_message_get_flag (message, NOTMUCH_MESSAGE_FLAG_EXCLUDED);
+
+	if ((match && (! excluded || ! params->omit_excluded)) || params->entire_thread) {
+	    const char *filename = NULL;
+
+	    /* The same file mime_node_open will read for display */
+	    if (params->duplicate <= 0) {
+		filename = notmuch_message_get_filename (message);
+		if (filename)
+		    g_ptr_array_add (prefetch->files, g_strdup (filename));
+	    } else {
+		notmuch_filenames_t *filenames;
+		int i = 1;
+
+		for (filenames = notmuch_message_get_filenames (message);
+		     notmuch_filenames_valid (filenames);
+		     notmuch_filenames_move_to_next (filenames), i++) {
+		    if (i == params->duplicate) {
+			filename = notmuch_filenames_get (filenames);
+			g_ptr_array_add (prefetch->files, g_strdup (filename));
+			break;
+		    }
+		}
+		notmuch_filenames_destroy (filenames);
+	    }
+	}
+
+	_prefetch_collect (prefetch, notmuch_message_get_replies (message), params);
+    }
+}
+
+/* Start reading ahead the files of 'thread'. */
+static void
+_prefetch_thread (show_prefetch_t *prefetch, notmuch_thread_t *thread,
+		  const notmuch_show_params_t *params)
+{
+    if (prefetch == NULL)
+	return;
+
+    g_ptr_array_set_size (prefetch->files, 0);
+    prefetch->next = 0;
+
+    _prefetch_collect (prefetch, notmuch_thread_get_toplevel_messages (thread), params);
+
+    /* The first file is opened for display right away. */
+    if (prefetch->files->len > 0)
+	prefetch->next = 1;
+
+    while (prefetch->next < prefetch->files->len && prefetch->next <= prefetch->window)
+	_prefetch_advance (prefetch);
+}
+
 static notmuch_status_t
 show_message (void *ctx,
 	      const notmuch_show_format_t *format,
@@ -1024,6 +1199,8 @@ show_message (void *ctx,
 	session_key_count_error = notmuch_message_count_properties (message, "session-key",
 								    &session_keys);
 
+    _prefetch_advance (params->prefetch);
+
     status = mime_node_open (local, message, params->duplicate, &(params->crypto), &root);
     if (status)
 	goto DONE;
@@ -1188,6 +1365,15 @@ do_show_threaded (void *ctx,
 	    continue;
 	}
 
+	/* Building the thread loaded most of the metadata already; this
+	 * fills in the filenames of all its messages in one pass. */
+	status = notmuch_messages_prefetch (notmuch_thread_get_messages (thread),
+					    notmuch_thread_get_total_messages (thread));
+	if (print_status_query ("notmuch show", query, status))
+	    return 1;
+
+	_prefetch_thread (params->prefetch, thread, params);
+
 	messages = notmuch_thread_get_toplevel_messages (thread);
 
 	if (messages == NULL)
@@ -1218,7 +1404,7 @@ do_show_unthreaded (void *ctx,
     notmuch_message_t *message;
     notmuch_status_t status, res = NOTMUCH_STATUS_SUCCESS;
     notmuch_bool_t excluded;
-    int i;
+    unsigned int i;
 
     if (params->offset < 0) {
 	unsigned count;
@@ -1231,6 +1417,9 @@ do_show_unthreaded (void *ctx,
 	    params->offset = 0;
     }
 
+    notmuch_query_set_offset (query, params->offset);
+    notmuch_query_set_limit (query, params->limit);
+
     status = notmuch_query_search_messages (query, &messages);
     if (print_status_query ("notmuch show", query, status))
 	return 1;
@@ -1238,10 +1427,12 @@ do_show_unthreaded (void *ctx,
     sp->begin_list (sp);
 
     for (i = 0;
-	 notmuch_messages_valid (messages) && (params->limit < 0 || i < params->offset + params->limit);
+	 notmuch_messages_valid (messages);
 	 notmuch_messages_move_to_next (messages), i++) {
-	if (i < params->offset) {
-	    continue;
+	if (i % NOTMUCH_PREFETCH_BATCH == 0) {
+	    status = notmuch_messages_prefetch (messages, NOTMUCH_PREFETCH_BATCH);
+	    if (print_status_query ("notmuch show", query, status))
+		return 1;
 	}
 
 	sp->begin_list (sp);
@@ -1333,6 +1524,7 @@ notmuch_show_command (notmuch_database_t *notmuch, int argc, char *argv[])
     bool unthreaded = FALSE;
     notmuch_status_t status;
     int sort = NOTMUCH_SORT_NEWEST_FIRST;
+    int prefetch = 8;
 
     notmuch_opt_desc_t options[] = {
 	{ .opt_keyword = &sort, .name = "sort", .keywords =
@@ -1365,6 +1557,7 @@ notmuch_show_command (notmuch_database_t *notmuch, int argc, char *argv[])
 	{ .opt_int = &params.duplicate, .name = "duplicate" },
 	{ .opt_int = &params.limit, .name = "limit" },
 	{ .opt_int = &params.offset, .name = "offset" },
+	{ .opt_int = &prefetch, .name = "prefetch" },
 	{ .opt_inherit = notmuch_shared_options },
 	{ }
     };
@@ -1503,10 +1696,14 @@ notmuch_show_command (notmuch_database_t *notmuch, int argc, char *argv[])
 	    params.omit_excluded = false;
 	}
 
-	if (unthreaded)
+	if (unthreaded) {
 	    ret = do_show_unthreaded (notmuch, query, formatter, sprinter, &params);
-	else
+	} else {
+	    params.prefetch = _prefetch_create (notmuch, prefetch);
 	    ret = do_show_threaded (notmuch, query, formatter, sprinter, &params);
+	    _prefetch_destroy (params.prefetch);
+	    params.prefetch = NULL;
+	}
     }
 
   DONE:
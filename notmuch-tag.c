@@ -119,7 +119,7 @@ _optimize_tag_query (void *ctx, const char *orig_query_string,
  */
 static int
 tag_query (void *ctx, notmuch_database_t *notmuch, const char *query_string,
-	   tag_op_list_t *tag_ops, tag_op_flag_t flags)
+	   tag_op_list_t *tag_ops, tag_op_flag_t flags, tag_batch_t *tag_batch)
 {
     notmuch_query_t *query;
     notmuch_messages_t *messages;
@@ -158,7 +158,7 @@ tag_query (void *ctx, notmuch_database_t *notmuch, const char *query_string,
 	 notmuch_messages_valid (messages) && ! interrupted;
 	 notmuch_messages_move_to_next (messages)) {
 	message = notmuch_messages_get (messages);
-	ret = tag_op_list_apply (message, tag_ops, flags);
+	ret = tag_batch_apply (tag_batch, message, tag_ops, flags);
 	notmuch_message_destroy (message);
 	if (ret != NOTMUCH_STATUS_SUCCESS)
 	    break;
@@ -171,7 +171,7 @@ tag_query (void *ctx, notmuch_database_t *notmuch, const char *query_string,
 
 static int
 tag_file (void *ctx, notmuch_database_t *notmuch, tag_op_flag_t flags,
-	  FILE *input)
+	  FILE *input, tag_batch_t *tag_batch)
 {
     char *line = NULL;
     char *query_string = NULL;
@@ -180,6 +180,12 @@ tag_file (void *ctx, notmuch_database_t *notmuch, tag_op_flag_t flags,
     int ret = 0;
     int warn = 0;
     tag_op_list_t *tag_ops;
+    struct stat st;
+    bool commit_each_line;
+
+    /* Someone feeding lines through a pipe may wait for each change
+     * to be visible before sending the next line. */
+    commit_each_line = fstat (fileno (input), &st) || ! S_ISREG (st.st_mode);
 
     tag_ops = tag_op_list_create (ctx);
     if (tag_ops == NULL) {
@@ -204,9 +210,15 @@ tag_file (void *ctx, notmuch_database_t *notmuch, tag_op_flag_t flags,
 	if (ret < 0)
 	    break;
 
-	ret = tag_query (ctx, notmuch, query_string, tag_ops, flags);
+	ret = tag_query (ctx, notmuch, query_string, tag_ops, flags, tag_batch);
 	if (ret)
 	    break;
+
+	if (commit_each_line) {
+	    ret = tag_batch_flush (tag_batch);
+	    if (ret)
+		break;
+	}
     }
 
     if (line)
@@ -219,6 +231,7 @@ int
 notmuch_tag_command (notmuch_database_t *notmuch, int argc, char *argv[])
 {
     tag_op_list_t *tag_ops = NULL;
+    tag_batch_t *tag_batch;
     char *query_string = NULL;
     struct sigaction action;
     tag_op_flag_t tag_flags = TAG_FLAG_NONE;
@@ -303,10 +316,20 @@ notmuch_tag_command (notmuch_database_t *notmuch, int argc, char *argv[])
     if (remove_all)
 	tag_flags |= TAG_FLAG_REMOVE_ALL;
 
+    tag_batch = tag_batch_create (notmuch, notmuch, NOTMUCH_TAG_BATCH);
+    if (tag_batch == NULL) {
+	fprintf (stderr, "Out of memory.\n");
+	return EXIT_FAILURE;
+    }
+
     if (batch)
-	ret = tag_file (notmuch, notmuch, tag_flags, input);
+	ret = tag_file (notmuch, notmuch, tag_flags, input, tag_batch);
     else
-	ret = tag_query (notmuch, notmuch, query_string, tag_ops, tag_flags);
+	ret = tag_query (notmuch, notmuch, query_string, tag_ops, tag_flags, tag_batch);
+
+    /* Keep the changes made before an error or interruption. */
+    if (tag_batch_flush (tag_batch))
+	ret = 1;
 
     notmuch_database_destroy (notmuch);
 
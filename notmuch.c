@@ -21,6 +21,7 @@
  */
 
 #include "notmuch-client.h"
+#include "sprinter.h"
 
 /*
  * Notmuch subcommand hook.
@@ -197,6 +198,8 @@ static const command_t commands[] = {
       "Re-index all messages matching the search terms." },
     { "config", notmuch_config_command, NOTMUCH_COMMAND_CONFIG_LOAD,
       "Get or set settings in the notmuch configuration file." },
+    { "serve", notmuch_serve_command, NOTMUCH_COMMAND_DATABASE_EARLY,
+      "Answer search, show, count and tag requests over a socket." },
 #if WITH_EMACS
     { "emacs-mua", NULL, 0,
       "send mail with notmuch and emacs." },
@@ -460,6 +463,73 @@ try_external_command (const char *config_file_name, char *argv[])
     return ret;
 }
 
+typedef struct {
+    notmuch_database_t *notmuch;
+    const char *command_name;
+    const char *path;
+} trace_report_t;
+
+/*
+ * Append the database's trace counters, as one JSON object per line,
+ * to the file named by NOTMUCH_TRACE. This runs as a talloc
+ * destructor so that it sees everything done up to the moment the
+ * command destroys its database.
+ */
+static int
+_trace_report_destructor (trace_report_t *report)
+{
+    struct sprinter *sp;
+    FILE *file;
+    int counter;
+
+    file = fopen (report->path, "a");
+    if (! file) {
+	fprintf (stderr, "Error: unable to write trace report to %s: %s\n",
+		 report->path, strerror (errno));
+	return 0;
+    }
+
+    sp = sprinter_json_create (NULL, file);
+    if (sp) {
+	sp->begin_map (sp);
+	sp->map_key (sp, "command");
+	sp->string (sp, report->command_name);
+	sp->map_key (sp, "counters");
+	sp->begin_map (sp);
+	for (counter = NOTMUCH_TRACE_FIRST; counter < NOTMUCH_TRACE_LAST; counter++) {
+	    sp->map_key (sp, notmuch_trace_counter_name ((notmuch_trace_counter_t) counter));
+	    sp->integer (sp, notmuch_database_get_trace_counter (
+			     report->notmuch, (notmuch_trace_counter_t) counter));
+	}
+	sp->end (sp);
+	sp->end (sp);
+	fputc ('\n', file);
+	talloc_free (sp);
+    }
+
+    fclose (file);
+    return 0;
+}
+
+static void
+_trace_report_attach (notmuch_database_t *notmuch, const char *command_name)
+{
+    const char *path = getenv ("NOTMUCH_TRACE");
+    trace_report_t *report;
+
+    if (! notmuch || ! path || strcmp (path, "") == 0)
+	return;
+
+    report = talloc (notmuch, trace_report_t);
+    if (! report)
+	return;
+
+    report->notmuch = notmuch;
+    report->command_name = talloc_strdup (report, command_name ? command_name : "");
+    report->path = talloc_strdup (report, path);
+    talloc_set_destructor (report, _trace_report_destructor);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -597,6 +667,8 @@ main (int argc, char *argv[])
 
     }
 
+    _trace_report_attach (notmuch, command_name);
+
     ret = (command->function)(notmuch, argc - opt_index, argv + opt_index);
 
   DONE:
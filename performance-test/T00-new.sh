@@ -38,4 +38,9 @@ perl -nle 'link $_, "$_.copy"' $manifest
 
 time_run "new ($count cp)" 'notmuch new'
 
+for jobs in 0 1 2 4 8; do
+    rm -rf ${MAIL_DIR}/.notmuch/xapian
+    time_run "new (--jobs=$jobs)" "notmuch new --quiet --jobs=$jobs"
+done
+
 time_done
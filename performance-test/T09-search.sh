@@ -0,0 +1,14 @@
+#!/usr/bin/env bash
+
+test_description='search'
+
+. $(dirname "$0")/perf-test-lib.sh || exit 1
+
+time_start
+
+time_run 'search *' "notmuch search '*' 1>/dev/null"
+time_run 'search tag:inbox' "notmuch search tag:inbox 1>/dev/null"
+time_run 'search --limit=20 *' "notmuch search --limit=20 '*' 1>/dev/null"
+time_run 'search --format=json *' "notmuch search --format=json '*' 1>/dev/null"
+
+time_done
@@ -0,0 +1,14 @@
+#!/usr/bin/env bash
+
+test_description='address'
+
+. $(dirname "$0")/perf-test-lib.sh || exit 1
+
+time_start
+
+time_run 'address --output=sender *' "notmuch address --output=sender '*' 1>/dev/null"
+time_run 'address --output=recipients *' "notmuch address --output=recipients '*' 1>/dev/null"
+time_run 'address --output=count *' "notmuch address --output=sender --output=recipients --output=count '*' 1>/dev/null"
+time_run 'address --deduplicate=address *' "notmuch address --output=sender --output=recipients --deduplicate=address '*' 1>/dev/null"
+
+time_done
@@ -0,0 +1,655 @@
+/*
+ * In-process micro-benchmarks for libnotmuch.
+ *
+ * Unlike the time and memory tests, these need no downloaded corpus:
+ * a synthetic maildir is generated from a fixed seed, so runs on the
+ * same machine are comparable. Each benchmark is repeated, and the
+ * results are printed as JSON (one map per benchmark) so that they
+ * can be compared between builds by a script.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see https://www.gnu.org/licenses/ .
+ */
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "notmuch-client.h"
+#include "command-line-arguments.h"
+#include "sprinter.h"
+
+#define BENCH_AUTHORS 64
+#define BENCH_SUBJECTS 256
+
+static const char *words[] = {
+    "notmuch", "mail", "index", "thread", "message", "search", "query",
+    "xapian", "database", "maildir", "patch", "review", "release", "bug",
+    "fix", "test", "build", "emacs", "tag", "inbox", "unread", "reply",
+    "header", "subject", "author", "date", "folder", "file", "term",
+    "value", "slot", "commit", "series", "version", "config", "hook",
+    "the", "a", "of", "and", "to", "in", "is", "that", "for", "it", "on",
+    "with", "as", "this", "was", "at", "by", "be", "from", "or", "have",
+};
+
+typedef struct {
+    const char *dir;
+    int messages;
+    int repeat;
+    int seed;
+    const char *only;
+
+    /* generated corpus */
+    char **filenames;
+    char **message_ids;
+    uint64_t rng;
+
+    notmuch_database_t *notmuch;
+    sprinter_t *results;
+} bench_t;
+
+typedef struct {
+    /* per repetition, in nanoseconds */
+    int64_t *elapsed;
+    int done;
+    int64_t ops;
+} bench_timing_t;
+
+/* xorshift64*, so that the corpus does not depend on the libc. */
+static uint64_t
+bench_random (bench_t *bench)
+{
+    bench->rng ^= bench->rng >> 12;
+    bench->rng ^= bench->rng << 25;
+    bench->rng ^= bench->rng >> 27;
+    return bench->rng * UINT64_C (2685821657736338717);
+}
+
+static int64_t
+bench_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+_rmtree_cb (const char *path,
+	    unused (const struct stat *sb),
+	    unused (int type),
+	    unused (struct FTW *ftw))
+{
+    return remove (path);
+}
+
+static int
+rmtree (const char *path)
+{
+    return nftw (path, _rmtree_cb, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+/* Write a maildir of 'bench->messages' messages. About one in four
+ * messages starts a new thread, the others reply to one of the last
+ * few messages, so that threads of various depths appear. */
+static int
+generate_corpus (void *ctx, bench_t *bench)
+{
+    char *cur = talloc_asprintf (ctx, "%s/cur", bench->dir);
+    time_t date = 1262304000; /* 2010-01-01 */
+    int i, j;
+
+    if (mkdir (cur, 0755) && errno != EEXIST) {
+	fprintf (stderr, "Error: cannot create %s: %s\n", cur, strerror (errno));
+	return -1;
+    }
+
+    bench->filenames = talloc_array (ctx, char *, bench->messages);
+    bench->message_ids = talloc_array (ctx, char *, bench->messages);
+    bench->rng = (uint64_t) bench->seed * UINT64_C (0x9E3779B97F4A7C15) + 1;
+
+    for (i = 0; i < bench->messages; i++) {
+	int parent = -1;
+	int author = bench_random (bench) % BENCH_AUTHORS;
+	int body_words = 40 + bench_random (bench) % 400;
+	char date_str[64];
+	FILE *file;
+
+	if (i > 0 && bench_random (bench) % 4)
+	    parent = i - 1 - (int) (bench_random (bench) % (i < 16 ? i : 16));
+
+	date += bench_random (bench) % 3600;
+	strftime (date_str, sizeof (date_str), "%a, %d %b %Y %H:%M:%S +0000", gmtime (&date));
+	bench->message_ids[i] = talloc_asprintf (bench->message_ids,
+						 "bench-%d-%d@notmuchmail.org",
+						 bench->seed, i);
+	bench->filenames[i] = talloc_asprintf (bench->filenames,
+					       "%s/%06d.bench:2,%s", cur, i,
+					       bench_random (bench) % 2 ? "S" : "");
+
+	file = fopen (bench->filenames[i], "w");
+	if (! file) {
+	    fprintf (stderr, "Error: cannot create %s: %s\n",
+		     bench->filenames[i], strerror (errno));
+	    return -1;
+	}
+
+	fprintf (file, "From: Author %d <author%d@example.org>\n", author, author);
+	fprintf (file, "To: Notmuch Benchmark <bench@notmuchmail.org>\n");
+	fprintf (file, "Subject: %ssynthetic topic %d\n",
+		 parent >= 0 ? "Re: " : "",
+		 (int) (bench_random (bench) % BENCH_SUBJECTS));
+	fprintf (file, "Message-ID: <%s>\n", bench->message_ids[i]);
+	if (parent >= 0)
+	    fprintf (file, "In-Reply-To: <%s>\nReferences: <%s>\n",
+		     bench->message_ids[parent], bench->message_ids[parent]);
+	fprintf (file, "Date: %s\n", date_str);
+	fprintf (file, "\n");
+
+	for (j = 0; j < body_words; j++)
+	    fprintf (file, "%s%s", words[bench_random (bench) % ARRAY_SIZE (words)],
+		     j % 12 == 11 ? "\n" : " ");
+	fprintf (file, "\n");
+
+	if (fclose (file)) {
+	    fprintf (stderr, "Error: writing %s: %s\n",
+		     bench->filenames[i], strerror (errno));
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+static notmuch_database_t *
+create_database (bench_t *bench)
+{
+    notmuch_database_t *notmuch;
+    char *notmuch_path, *msg = NULL;
+
+    notmuch_path = talloc_asprintf (NULL, "%s/.notmuch", bench->dir);
+    rmtree (notmuch_path);
+    talloc_free (notmuch_path);
+
+    if (notmuch_database_create_with_config (bench->dir, "", NULL, &notmuch, &msg)) {
+	fprintf (stderr, "Error: cannot create database in %s: %s\n",
+		 bench->dir, msg ? msg : "");
+	free (msg);
+	return NULL;
+    }
+
+    return notmuch;
+}
+
+static bool
+bench_selected (const bench_t *bench, const char *name)
+{
+    return ! bench->only || strstr (name, bench->only);
+}
+
+static int
+_compare_int64 (const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Print the result of one benchmark, with the fastest and the median
+ * repetition. */
+static void
+report (bench_t *bench, const char *name, bench_timing_t *timing)
+{
+    sprinter_t *sp = bench->results;
+    int64_t ops = timing->ops > 0 ? timing->ops : 1;
+
+    qsort (timing->elapsed, timing->done, sizeof (int64_t), _compare_int64);
+
+    sp->begin_map (sp);
+    sp->map_key (sp, "name");
+    sp->string (sp, name);
+    sp->map_key (sp, "ops");
+    sp->integer (sp, timing->ops);
+    sp->map_key (sp, "repeat");
+    sp->integer (sp, timing->done);
+    sp->map_key (sp, "min_ns_per_op");
+    sp->integer (sp, timing->elapsed[0] / ops);
+    sp->map_key (sp, "median_ns_per_op");
+    sp->integer (sp, timing->elapsed[timing->done / 2] / ops);
+    sp->end (sp);
+    sp->separator (sp);
+}
+
+static bench_timing_t *
+timing_create (void *ctx, bench_t *bench)
+{
+    bench_timing_t *timing = talloc_zero (ctx, bench_timing_t);
+
+    timing->elapsed = talloc_zero_array (timing, int64_t, bench->repeat);
+    return timing;
+}
+
+static void
+timing_add (bench_timing_t *timing, int64_t start, int64_t ops)
+{
+    timing->elapsed[timing->done++] = bench_now () - start;
+    timing->ops = ops;
+}
+
+/* notmuch_database_index_file, one atomic section per file as in
+ * notmuch new, into a fresh database each time. */
+static int
+bench_index_file (void *ctx, bench_t *bench)
+{
+    bench_timing_t *timing = timing_create (ctx, bench);
+    int r, i;
+
+    for (r = 0; r < bench->repeat; r++) {
+	notmuch_database_t *notmuch;
+	int64_t start;
+
+	if (bench->notmuch)
+	    notmuch_database_destroy (bench->notmuch);
+	bench->notmuch = notmuch = create_database (bench);
+	if (! notmuch)
+	    return -1;
+
+	start = bench_now ();
+	for (i = 0; i < bench->messages; i++) {
+	    notmuch_message_t *message;
+	    notmuch_status_t status;
+
+	    if (notmuch_database_begin_atomic (notmuch))
+		return -1;
+	    status = notmuch_database_index_file (notmuch, bench->filenames[i], NULL, &message);
+	    if (print_status_database ("notmuch-bench", notmuch, status))
+		return -1;
+	    notmuch_message_destroy (message);
+	    if (notmuch_database_end_atomic (notmuch))
+		return -1;
+	}
+	timing_add (timing, start, bench->messages);
+    }
+
+    report (bench, "index_file", timing);
+    return 0;
+}
+
+static void
+ensure_database (bench_t *bench)
+{
+    int i;
+
+    if (bench->notmuch)
+	return;
+
+    bench->notmuch = create_database (bench);
+    if (! bench->notmuch)
+	exit (EXIT_FAILURE);
+
+    for (i = 0; i < bench->messages; i++) {
+	if (notmuch_database_index_file (bench->notmuch, bench->filenames[i], NULL, NULL)) {
+	    fprintf (stderr, "Error: cannot index %s\n", bench->filenames[i]);
+	    exit (EXIT_FAILURE);
+	}
+    }
+}
+
+static int
+bench_find_message (void *ctx, bench_t *bench)
+{
+    bench_timing_t *timing = timing_create (ctx, bench);
+    int r, i;
+
+    for (r = 0; r < bench->repeat; r++) {
+	int64_t start = bench_now ();
+
+	for (i = 0; i < bench->messages; i++) {
+	    notmuch_message_t *message;
+
+	    if (notmuch_database_find_message (bench->notmuch, bench->message_ids[i], &message) ||
+		! message)
+		return -1;
+	    notmuch_message_destroy (message);
+	}
+	timing_add (timing, start, bench->messages);
+    }
+
+    report (bench, "find_message", timing);
+    return 0;
+}
+
+static int
+bench_get_filenames (void *ctx, bench_t *bench)
+{
+    bench_timing_t *timing = timing_create (ctx, bench);
+    int r;
+
+    for (r = 0; r < bench->repeat; r++) {
+	notmuch_query_t *query;
+	notmuch_messages_t *messages;
+	int64_t start = bench_now ();
+	int64_t count = 0;
+
+	if (notmuch_query_create_with_syntax (bench->notmuch, "*",
+					      NOTMUCH_QUERY_SYNTAX_XAPIAN, &query) ||
+	    notmuch_query_search_messages (query, &messages))
+	    return -1;
+
+	for (; notmuch_messages_valid (messages); notmuch_messages_move_to_next (messages)) {
+	    notmuch_message_t *message = notmuch_messages_get (messages);
+	    notmuch_filenames_t *filenames;
+
+	    for (filenames = notmuch_message_get_filenames (message);
+		 notmuch_filenames_valid (filenames);
+		 notmuch_filenames_move_to_next (filenames))
+		count++;
+	    notmuch_message_destroy (message);
+	}
+	notmuch_query_destroy (query);
+	timing_add (timing, start, count);
+    }
+
+    report (bench, "get_filenames", timing);
+    return 0;
+}
+
+/* Running the query, and building the threads from its results (by
+ * _notmuch_thread_create), are timed separately. */
+static int
+bench_search_threads (void *ctx, bench_t *bench)
+{
+    bench_timing_t *search = timing_create (ctx, bench);
+    bench_timing_t *create = timing_create (ctx, bench);
+    int r;
+
+    for (r = 0; r < bench->repeat; r++) {
+	notmuch_query_t *query;
+	notmuch_threads_t *threads;
+	int64_t start = bench_now ();
+	int64_t count = 0;
+
+	if (notmuch_query_create_with_syntax (bench->notmuch, "*",
+					      NOTMUCH_QUERY_SYNTAX_XAPIAN, &query) ||
+	    notmuch_query_search_threads (query, &threads))
+	    return -1;
+	timing_add (search, start, 1);
+
+	start = bench_now ();
+	for (; notmuch_threads_valid (threads); notmuch_threads_move_to_next (threads)) {
+	    notmuch_thread_t *thread = notmuch_threads_get (threads);
+
+	    if (notmuch_thread_get_thread_id (thread))
+		count++;
+	    notmuch_thread_destroy (thread);
+	}
+	notmuch_query_destroy (query);
+	timing_add (create, start, count);
+    }
+
+    report (bench, "search_threads", search);
+    report (bench, "thread_create", create);
+    return 0;
+}
+
+/* Parse every message file of the (page-cache hot) corpus with GMime,
+ * reading it through 'stream_new', as indexing and show do. */
+static int
+bench_parse_file (void *ctx, bench_t *bench, const char *name,
+		  GMimeStream *(*stream_new)(int fd))
+{
+    bench_timing_t *timing = timing_create (ctx, bench);
+    int r, i;
+
+    g_mime_init ();
+
+    /* The first pass only warms the page cache. */
+    for (r = -1; r < bench->repeat; r++) {
+	int64_t start = bench_now ();
+
+	for (i = 0; i < bench->messages; i++) {
+	    GMimeStream *stream;
+	    GMimeParser *parser;
+	    GMimeMessage *message;
+	    int fd;
+
+	    fd = open (bench->filenames[i], O_RDONLY);
+	    if (fd < 0) {
+		fprintf (stderr, "Error: cannot open %s: %s\n", bench->filenames[i],
+			 strerror (errno));
+		return -1;
+	    }
+
+	    stream = stream_new (fd);
+	    if (! stream) {
+		close (fd);
+		return -1;
+	    }
+
+	    parser = g_mime_parser_new_with_stream (stream);
+	    message = g_mime_parser_construct_message (parser, NULL);
+	    g_object_unref (parser);
+	    g_object_unref (stream);
+	    if (! message)
+		return -1;
+	    g_object_unref (message);
+	}
+	if (r >= 0)
+	    timing_add (timing, start, bench->messages);
+    }
+
+    report (bench, name, timing);
+    return 0;
+}
+
+typedef struct {
+    const char *thread_id;
+    const char *authors;
+    const char *subject;
+    time_t newest;
+    int matched, total;
+    const char **tags;
+} bench_summary_t;
+
+/* Format a search summary of every thread, as notmuch search does,
+ * from data collected beforehand so that only the printer is timed. */
+static int
+bench_sprinter (void *ctx, bench_t *bench, const char *name,
+		sprinter_t *(*create)(notmuch_database_t *db, FILE *stream))
+{
+    bench_timing_t *timing = timing_create (ctx, bench);
+    bench_summary_t *summaries = NULL;
+    notmuch_query_t *query;
+    notmuch_threads_t *threads;
+    FILE *devnull;
+    int r, i, count = 0;
+
+    if (notmuch_query_create_with_syntax (bench->notmuch, "*",
+					  NOTMUCH_QUERY_SYNTAX_XAPIAN, &query) ||
+	notmuch_query_search_threads (query, &threads))
+	return -1;
+
+    for (; notmuch_threads_valid (threads); notmuch_threads_move_to_next (threads)) {
+	notmuch_thread_t *thread = notmuch_threads_get (threads);
+	notmuch_tags_t *tags;
+	bench_summary_t *summary;
+	int ntags = 0;
+
+	summaries = talloc_realloc (ctx, summaries, bench_summary_t, count + 1);
+	summary = &summaries[count++];
+	summary->thread_id = talloc_strdup (summaries, notmuch_thread_get_thread_id (thread));
+	summary->authors = talloc_strdup (summaries, notmuch_thread_get_authors (thread));
+	summary->subject = talloc_strdup (summaries, notmuch_thread_get_subject (thread));
+	summary->newest = notmuch_thread_get_newest_date (thread);
+	summary->matched = notmuch_thread_get_matched_messages (thread);
+	summary->total = notmuch_thread_get_total_messages (thread);
+	summary->tags = talloc_array (summaries, const char *, 1);
+	for (tags = notmuch_thread_get_tags (thread);
+	     notmuch_tags_valid (tags);
+	     notmuch_tags_move_to_next (tags)) {
+	    summary->tags = talloc_realloc (summaries, summary->tags, const char *, ntags + 2);
+	    summary->tags[ntags++] = talloc_strdup (summaries, notmuch_tags_get (tags));
+	}
+	summary->tags[ntags] = NULL;
+	notmuch_thread_destroy (thread);
+    }
+    notmuch_query_destroy (query);
+
+    devnull = fopen ("/dev/null", "w");
+    if (! devnull)
+	return -1;
+
+    for (r = 0; r < bench->repeat; r++) {
+	sprinter_t *sp = create (NULL, devnull);
+	int64_t start = bench_now ();
+
+	sp->begin_list (sp);
+	for (i = 0; i < count; i++) {
+	    const char **tag;
+
+	    sp->begin_map (sp);
+	    sp->map_key (sp, "thread");
+	    sp->string (sp, summaries[i].thread_id);
+	    sp->map_key (sp, "timestamp");
+	    sp->integer (sp, summaries[i].newest);
+	    sp->map_key (sp, "matched");
+	    sp->integer (sp, summaries[i].matched);
+	    sp->map_key (sp, "total");
+	    sp->integer (sp, summaries[i].total);
+	    sp->map_key (sp, "authors");
+	    sp->string (sp, summaries[i].authors);
+	    sp->map_key (sp, "subject");
+	    sp->string (sp, summaries[i].subject);
+	    sp->map_key (sp, "tags");
+	    sp->begin_list (sp);
+	    for (tag = summaries[i].tags; *tag; tag++)
+		sp->string (sp, *tag);
+	    sp->end (sp);
+	    sp->end (sp);
+	    sp->separator (sp);
+	}
+	sp->end (sp);
+	fflush (devnull);
+	timing_add (timing, start, count);
+	talloc_free (sp);
+    }
+
+    fclose (devnull);
+    report (bench, name, timing);
+    return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+    void *ctx = talloc_new (NULL);
+    bench_t bench = {
+	.messages = 2000,
+	.repeat = 5,
+	.seed = 8675309,
+    };
+    char *dir = NULL;
+    bool keep = false;
+    int opt_index;
+    int ret = EXIT_FAILURE;
+
+    notmuch_opt_desc_t options[] = {
+	{ .opt_int = &bench.messages, .name = "messages" },
+	{ .opt_int = &bench.repeat, .name = "repeat" },
+	{ .opt_int = &bench.seed, .name = "seed" },
+	{ .opt_string = &bench.only, .name = "only" },
+	{ .opt_string = &bench.dir, .name = "dir" },
+	{ .opt_bool = &keep, .name = "keep" },
+	{ }
+    };
+
+    opt_index = parse_arguments (argc, argv, options, 1);
+    if (opt_index < 0)
+	return EXIT_FAILURE;
+
+    if (bench.messages < 1 || bench.repeat < 1) {
+	fprintf (stderr, "Error: --messages and --repeat must be positive.\n");
+	return EXIT_FAILURE;
+    }
+
+    if (! bench.dir) {
+	const char *tmpdir = getenv ("TMPDIR");
+
+	dir = talloc_asprintf (ctx, "%s/notmuch-bench.XXXXXX", tmpdir ? tmpdir : "/tmp");
+	if (! mkdtemp (dir)) {
+	    fprintf (stderr, "Error: cannot create %s: %s\n", dir, strerror (errno));
+	    return EXIT_FAILURE;
+	}
+	bench.dir = dir;
+    } else if (mkdir (bench.dir, 0755) && errno != EEXIST) {
+	fprintf (stderr, "Error: cannot create %s: %s\n", bench.dir, strerror (errno));
+	return EXIT_FAILURE;
+    }
+
+    if (generate_corpus (ctx, &bench))
+	goto DONE;
+
+    bench.results = sprinter_json_create (NULL, stdout);
+    bench.results->begin_list (bench.results);
+
+    if (bench_selected (&bench, "index_file") && bench_index_file (ctx, &bench))
+	goto DONE;
+
+    ensure_database (&bench);
+
+    if (bench_selected (&bench, "find_message") && bench_find_message (ctx, &bench))
+	goto DONE;
+
+    if (bench_selected (&bench, "get_filenames") && bench_get_filenames (ctx, &bench))
+	goto DONE;
+
+    if ((bench_selected (&bench, "search_threads") || bench_selected (&bench, "thread_create")) &&
+	bench_search_threads (ctx, &bench))
+	goto DONE;
+
+    if (bench_selected (&bench, "parse_file_read") &&
+	bench_parse_file (ctx, &bench, "parse_file_read", g_mime_stream_fs_new))
+	goto DONE;
+
+    if (bench_selected (&bench, "parse_file_mmap") &&
+	bench_parse_file (ctx, &bench, "parse_file_mmap", g_mime_stream_mapped_new))
+	goto DONE;
+
+    if (bench_selected (&bench, "sprinter_json") &&
+	bench_sprinter (ctx, &bench, "sprinter_json", sprinter_json_create))
+	goto DONE;
+
+    if (bench_selected (&bench, "sprinter_sexp") &&
+	bench_sprinter (ctx, &bench, "sprinter_sexp", sprinter_sexp_create))
+	goto DONE;
+
+    bench.results->end (bench.results);
+    printf ("\n");
+    ret = EXIT_SUCCESS;
+
+  DONE:
+    if (ret)
+	fprintf (stderr, "Error: benchmark failed, corpus left in %s\n", bench.dir);
+
+    if (bench.notmuch)
+	notmuch_database_destroy (bench.notmuch);
+
+    if (dir && ! keep && ret == EXIT_SUCCESS)
+	rmtree (dir);
+
+    talloc_free (bench.results);
+    talloc_free (ctx);
+
+    return ret;
+}
@@ -16,6 +16,13 @@ struct _tag_op_list_t {
     size_t size;
 };
 
+struct _tag_batch_t {
+    notmuch_database_t *notmuch;
+    unsigned size;
+    /* Messages changed in the open atomic section, if any. */
+    unsigned pending;
+};
+
 static tag_parse_status_t
 line_error (tag_parse_status_t status,
 	    const char *line,
@@ -424,3 +431,70 @@ tag_op_list_tag (const tag_op_list_t *list, size_t i)
     assert (i < list->count);
     return list->ops[i].tag;
 }
+
+tag_batch_t *
+tag_batch_create (void *ctx, notmuch_database_t *notmuch, unsigned size)
+{
+    tag_batch_t *batch;
+
+    batch = talloc (ctx, tag_batch_t);
+    if (batch == NULL)
+	return NULL;
+
+    batch->notmuch = notmuch;
+    batch->size = size;
+    batch->pending = 0;
+
+    /* An atomic section can't be opened before an upgrade. */
+    if (notmuch_database_needs_upgrade (notmuch))
+	batch->size = 0;
+
+    return batch;
+}
+
+notmuch_status_t
+tag_batch_apply (tag_batch_t *batch,
+		 notmuch_message_t *message,
+		 tag_op_list_t *tag_ops,
+		 tag_op_flag_t flags)
+{
+    notmuch_status_t status;
+
+    if (batch->size == 0)
+	return tag_op_list_apply (message, tag_ops, flags);
+
+    if (batch->pending == 0) {
+	status = notmuch_database_begin_atomic (batch->notmuch);
+	if (status) {
+	    message_error (message, status, "starting transaction");
+	    return status;
+	}
+    }
+    batch->pending++;
+
+    status = tag_op_list_apply (message, tag_ops, flags);
+    if (status)
+	return status;
+
+    if (batch->pending >= batch->size)
+	return tag_batch_flush (batch);
+
+    return NOTMUCH_STATUS_SUCCESS;
+}
+
+notmuch_status_t
+tag_batch_flush (tag_batch_t *batch)
+{
+    notmuch_status_t status;
+
+    if (batch->pending == 0)
+	return NOTMUCH_STATUS_SUCCESS;
+
+    batch->pending = 0;
+    status = notmuch_database_end_atomic (batch->notmuch);
+    if (status)
+	fprintf (stderr, "Error: committing tag changes: %s\n",
+		 notmuch_status_to_string (status));
+
+    return status;
+}
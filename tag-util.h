@@ -5,6 +5,7 @@
 
 typedef struct _tag_operation_t tag_operation_t;
 typedef struct _tag_op_list_t tag_op_list_t;
+typedef struct _tag_batch_t tag_batch_t;
 
 /* Use powers of 2 */
 typedef enum {
@@ -160,4 +161,35 @@ tag_op_list_tag (const tag_op_list_t *list, size_t i);
 bool
 tag_op_list_isremove (const tag_op_list_t *list, size_t i);
 
+/*
+ * Create a batch to group the changes of many calls to
+ * tag_batch_apply into atomic sections of up to 'size' messages.
+ *
+ * Each message changed is then no longer a transaction of its own:
+ * Xapian buffers the changes of the whole section and commits them
+ * together, and all messages in a section share one revision. Pass
+ * 0 to apply every change on its own.
+ */
+
+tag_batch_t *
+tag_batch_create (void *ctx, notmuch_database_t *notmuch, unsigned size);
+
+/*
+ * Like tag_op_list_apply, but as part of 'batch'.
+ */
+
+notmuch_status_t
+tag_batch_apply (tag_batch_t *batch,
+		 notmuch_message_t *message,
+		 tag_op_list_t *tag_ops,
+		 tag_op_flag_t flags);
+
+/*
+ * Commit the changes made by tag_batch_apply so far. Must be called
+ * (also after an error) before the database is closed.
+ */
+
+notmuch_status_t
+tag_batch_flush (tag_batch_t *batch);
+
 #endif
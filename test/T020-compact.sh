@@ -31,4 +31,205 @@ thread:XXX   2001-01-05 [1/1] Notmuch Test Suite; One (inbox tag1 unread)
 thread:XXX   2001-01-05 [1/1] Notmuch Test Suite; Two (inbox tag1 tag2 unread)
 thread:XXX   2001-01-05 [1/1] Notmuch Test Suite; Three (inbox tag3 unread)"
 
+test_begin_subtest "Online compaction preserves database"
+notmuch compact --online --quiet
+output=$(notmuch search \* | notmuch_search_sanitize)
+test_expect_equal "$output" "\
+thread:XXX   2001-01-05 [1/1] Notmuch Test Suite; One (inbox tag1 unread)
+thread:XXX   2001-01-05 [1/1] Notmuch Test Suite; Two (inbox tag1 tag2 unread)
+thread:XXX   2001-01-05 [1/1] Notmuch Test Suite; Three (inbox tag3 unread)"
+
+test_begin_subtest "Online compaction lets others write"
+cat <<'EOF' | test_C ${MAIL_DIR}
+#include <notmuch-test.h>
+
+static void
+status_cb (const char *status, void *closure)
+{
+    static int done = 0;
+    notmuch_database_t *db;
+    notmuch_message_t *message;
+    const char *filename;
+
+    /* Change the database once the snapshot is being compacted. */
+    if (done || strncmp (status, "compacting table", strlen ("compacting table")))
+	return;
+    done = 1;
+
+    EXPECT0 (notmuch_database_open_with_config (closure, NOTMUCH_DATABASE_MODE_READ_WRITE,
+						NULL, NULL, &db, NULL));
+    EXPECT0 (notmuch_database_find_message (db, "msg-001@notmuch-test-suite", &message));
+    EXPECT0 (notmuch_message_add_tag (message, "during"));
+    EXPECT0 (notmuch_database_find_message (db, "msg-003@notmuch-test-suite", &message));
+    filename = talloc_strdup (db, notmuch_message_get_filename (message));
+    EXPECT0 (notmuch_database_remove_message (db, filename));
+    EXPECT0 (notmuch_database_destroy (db));
+}
+
+int main (int argc, char **argv)
+{
+    notmuch_database_t *db;
+
+    EXPECT0 (notmuch_database_open_with_config (argv[1], NOTMUCH_DATABASE_MODE_READ_WRITE,
+						NULL, NULL, &db, NULL));
+    EXPECT0 (notmuch_database_compact_online (db, NULL, status_cb, argv[1]));
+    printf ("compacted\n");
+}
+EOF
+cat <<EOF > EXPECTED
+== stdout ==
+compacted
+== stderr ==
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "Changes made during online compaction are in the compacted database"
+output=$(notmuch search \* | notmuch_search_sanitize)
+test_expect_equal "$output" "\
+thread:XXX   2001-01-05 [1/1] Notmuch Test Suite; One (during inbox tag1 unread)
+thread:XXX   2001-01-05 [1/1] Notmuch Test Suite; Two (inbox tag1 tag2 unread)"
+
+test_begin_subtest "Several commits during online compaction"
+cat <<'EOF' | test_C ${MAIL_DIR}
+#include <notmuch-test.h>
+
+#define COMMITS 4
+
+static int commits = 0;
+
+static void
+status_cb (const char *status, void *closure)
+{
+    notmuch_database_t *db;
+    notmuch_message_t *message;
+    char tag[16];
+
+    /* Commit a change as each of the first tables is compacted, more
+     * than enough for Xapian to lose the state being compacted. */
+    if (commits == COMMITS || strncmp (status, "compacting table", strlen ("compacting table")))
+	return;
+    commits++;
+
+    EXPECT0 (notmuch_database_open_with_config (closure, NOTMUCH_DATABASE_MODE_READ_WRITE,
+						NULL, NULL, &db, NULL));
+    EXPECT0 (notmuch_database_find_message (db, "msg-002@notmuch-test-suite", &message));
+    snprintf (tag, sizeof (tag), "commit%d", commits);
+    EXPECT0 (notmuch_message_add_tag (message, tag));
+    EXPECT0 (notmuch_database_destroy (db));
+}
+
+int main (int argc, char **argv)
+{
+    notmuch_database_t *db;
+
+    EXPECT0 (notmuch_database_open_with_config (argv[1], NOTMUCH_DATABASE_MODE_READ_WRITE,
+						NULL, NULL, &db, NULL));
+    EXPECT0 (notmuch_database_compact_online (db, NULL, status_cb, argv[1]));
+    printf ("compacted\n");
+}
+EOF
+cat <<EOF > EXPECTED
+== stdout ==
+compacted
+== stderr ==
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "Commits made during online compaction are all kept"
+output=$(notmuch search --output=tags id:msg-002@notmuch-test-suite | grep commit)
+test_expect_equal "$output" "\
+commit1
+commit2
+commit3
+commit4"
+
+test_begin_subtest "Only one compaction runs at a time"
+cat <<'EOF' | test_C ${MAIL_DIR}
+#include <notmuch-test.h>
+
+static void
+status_cb (const char *status, void *closure)
+{
+    static int done = 0;
+    notmuch_database_t *db;
+
+    if (done || strncmp (status, "compacting table", strlen ("compacting table")))
+	return;
+    done = 1;
+
+    EXPECT0 (notmuch_database_open_with_config (closure, NOTMUCH_DATABASE_MODE_READ_WRITE,
+						NULL, NULL, &db, NULL));
+    printf ("second compaction: %d\n",
+	    notmuch_database_compact_online (db, NULL, NULL, NULL) == NOTMUCH_STATUS_FILE_ERROR);
+}
+
+int main (int argc, char **argv)
+{
+    notmuch_database_t *db;
+
+    EXPECT0 (notmuch_database_open_with_config (argv[1], NOTMUCH_DATABASE_MODE_READ_WRITE,
+						NULL, NULL, &db, NULL));
+    EXPECT0 (notmuch_database_compact_online (db, NULL, status_cb, argv[1]));
+    printf ("compacted\n");
+}
+EOF
+cat <<EOF > EXPECTED
+== stdout ==
+second compaction: 1
+compacted
+== stderr ==
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "Writers wait for the compacted database to be in place"
+cat <<'EOF' | test_C ${MAIL_DIR}
+#include <notmuch-test.h>
+
+static pid_t writer = -1;
+
+static void
+status_cb (const char *status, void *closure)
+{
+    if (strcmp (status, "moving the compacted database into place"))
+	return;
+
+    /* Run the writer in a new program, which doesn't inherit our
+     * locks. */
+    writer = fork ();
+    if (writer == 0) {
+	execlp ("notmuch", "notmuch", "tag", "+after-swap", "id:msg-001@notmuch-test-suite",
+		(char *) NULL);
+	_exit (127);
+    }
+
+    /* Give it time to start waiting. */
+    sleep (1);
+}
+
+int main (int argc, char **argv)
+{
+    notmuch_database_t *db;
+    int status;
+
+    EXPECT0 (notmuch_database_open_with_config (argv[1], NOTMUCH_DATABASE_MODE_READ_WRITE,
+						NULL, NULL, &db, NULL));
+    EXPECT0 (notmuch_database_compact_online (db, NULL, status_cb, argv[1]));
+    if (writer < 0 || waitpid (writer, &status, 0) != writer) {
+	fprintf (stderr, "no writer\n");
+	exit (1);
+    }
+    printf ("writer exited with %d\n", WEXITSTATUS (status));
+}
+EOF
+cat <<EOF > EXPECTED
+== stdout ==
+writer exited with 0
+== stderr ==
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "Changes from a writer waiting during the move are kept"
+output=$(notmuch search --output=tags id:msg-001@notmuch-test-suite | grep after-swap)
+test_expect_equal "$output" "after-swap"
+
 test_done
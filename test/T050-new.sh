@@ -29,6 +29,16 @@ generate_message
 output=$(NOTMUCH_NEW --debug --full-scan 2>&1)
 test_expect_equal "$output" "Added 2 new messages to the database."
 
+test_begin_subtest "Multiple new messages (--jobs)"
+generate_message
+generate_message
+generate_message
+output=$(NOTMUCH_NEW --debug --jobs=2)
+test_expect_equal "$output" "Added 3 new messages to the database."
+
+test_begin_subtest "Negative --jobs is an error"
+test_expect_code 1 "notmuch new --jobs=-1"
+
 test_begin_subtest "No new messages (non-empty DB)"
 output=$(NOTMUCH_NEW --debug)
 test_expect_equal "$output" "No new mail."
@@ -89,6 +99,32 @@ No new mail. Removed 1 message."
 
 
 
+test_begin_subtest "Maildir flag change is added from the headers"
+generate_message [dir]=cur [filename]=flags-test:2,
+notmuch new > /dev/null
+mv "$gen_msg_filename" "${gen_msg_filename}S"
+output=$(NOTMUCH_NEW --verbose | grep -v '^[0-9]*/[0-9]*: ')
+test_expect_equal "$output" "No new mail. Detected 1 file rename.
+Added 1 of 1 file from its headers alone."
+
+test_begin_subtest "Copy under another name is indexed in full"
+cp "${gen_msg_filename}S" "${MAIL_DIR}/cur/flags-test-copy:2,S"
+output=$(NOTMUCH_NEW --verbose | grep -v '^[0-9]*/[0-9]*: ')
+test_expect_equal "$output" "No new mail.
+Added 0 of 1 file from its headers alone."
+rm "${gen_msg_filename}S" "${MAIL_DIR}/cur/flags-test-copy:2,S"
+notmuch new > /dev/null
+
+test_begin_subtest "Move from new/ to cur/ is added from the headers (--jobs)"
+generate_message [dir]=new [filename]=move-test
+notmuch new > /dev/null
+mv "$gen_msg_filename" "${MAIL_DIR}/cur/move-test:2,S"
+output=$(NOTMUCH_NEW --verbose --jobs=2 | grep -v '^[0-9]*/[0-9]*: ')
+test_expect_equal "$output" "No new mail. Detected 1 file rename.
+Added 1 of 1 file from its headers alone."
+rm "${MAIL_DIR}/cur/move-test:2,S"
+notmuch new > /dev/null
+
 test_begin_subtest "Renamed directory"
 
 generate_message [dir]=dir
@@ -457,6 +493,14 @@ notmuch config set database.mail_root
 rm home/Maildir
 test_expect_equal_file EXPECTED OUTPUT
 
+test_begin_subtest "Parsing in the background indexes the same threads"
+add_email_corpus
+notmuch search --sort=oldest-first '*' > EXPECTED
+rm -rf "${MAIL_DIR}"/.notmuch
+NOTMUCH_NEW --jobs=4 > /dev/null
+notmuch search --sort=oldest-first '*' > OUTPUT
+test_expect_equal_file EXPECTED OUTPUT
+
 add_email_corpus broken
 test_begin_subtest "reference loop does not crash"
 test_expect_code 0 "notmuch show --format=json id:mid-loop-12@example.org id:mid-loop-21@example.org > OUTPUT"
@@ -470,4 +514,58 @@ Date: Fri, 17 Jun 2016 22:14:41 -0400
 EOF
 test_expect_equal_file EXPECTED OUTPUT
 
+
+if [ "${NOTMUCH_HAVE_INOTIFY-0}" = "1" ]; then
+    JOURNAL="${MAIL_DIR}/.notmuch/new-journal"
+
+    wait_for_journal () {
+	for i in $(seq 50); do
+	    grep -q -x -F "$1" "$JOURNAL" 2>/dev/null && return
+	    sleep 0.1
+	done
+    }
+
+    notmuch new --watch &
+    WATCH_PID=$!
+    wait_for_journal /
+
+    test_begin_subtest "First run after --watch scans everything"
+    output=$(NOTMUCH_NEW --debug)
+    test_expect_equal "$output" "No new mail."
+
+    test_begin_subtest "Journal is emptied after a run"
+    test_expect_success "test ! -s '$JOURNAL'"
+
+    test_begin_subtest "Only journaled directories are scanned"
+    generate_message
+    wait_for_journal .
+    output=$(NOTMUCH_NEW --debug)
+    test_expect_equal "$output" "(D) add_journal_files: scanning ${MAIL_DIR}
+Added 1 new message to the database."
+
+    test_begin_subtest "Removal is picked up from the journal"
+    rm "$gen_msg_filename"
+    wait_for_journal .
+    output=$(NOTMUCH_NEW)
+    test_expect_equal "$output" "No new mail. Removed 1 message."
+
+    test_begin_subtest "New directory is picked up from the journal"
+    mkdir "${MAIL_DIR}"/watched
+    generate_message [dir]=watched
+    wait_for_journal watched
+    output=$(NOTMUCH_NEW)
+    test_expect_equal "$output" "Added 1 new message to the database."
+
+    test_begin_subtest "Second watcher is refused"
+    test_expect_code 1 "notmuch new --watch"
+
+    kill -TERM $WATCH_PID
+    wait $WATCH_PID
+
+    test_begin_subtest "Without a watcher the whole mail store is scanned"
+    generate_message [dir]=watched
+    output=$(NOTMUCH_NEW)
+    test_expect_equal "$output" "Added 1 new message to the database."
+fi
+
 test_done
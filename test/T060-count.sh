@@ -38,6 +38,19 @@ test_expect_equal \
     "2" \
     "`notmuch count --output=files id:20091117232137.GA7669@griffis1.net`"
 
+backup_database
+test_begin_subtest "files count follows added and removed copies"
+notmuch new --message-values > /dev/null
+file=$(notmuch search --output=files id:20091117232137.GA7669@griffis1.net | head -n 1)
+cp "$file" "${MAIL_DIR}/copy-of-griffis"
+NOTMUCH_NEW > /dev/null
+output=$(notmuch count --output=files id:20091117232137.GA7669@griffis1.net)
+rm "${MAIL_DIR}/copy-of-griffis"
+NOTMUCH_NEW > /dev/null
+output="$output $(notmuch count --output=files id:20091117232137.GA7669@griffis1.net)"
+test_expect_equal "$output" "3 2"
+restore_database
+
 test_begin_subtest "count with no matching messages"
 test_expect_equal \
     "0" \
@@ -120,7 +133,35 @@ EOF
 backup_database
 test_begin_subtest "error message from query_search_messages"
 ln -s ${MAIL_DIR}/.notmuch/xapian/postlist.* target_postlist
-notmuch_with_shim qsm-shim count --output=files '*' 2>OUTPUT 1>/dev/null
+notmuch_with_shim qsm-shim search --output=files '*' 2>OUTPUT 1>/dev/null
+cat <<EOF > EXPECTED
+notmuch search: A Xapian exception occurred
+A Xapian exception occurred performing query
+Query string was: *
+EOF
+sed 's/^\(A Xapian exception [^:]*\):.*$/\1/' < OUTPUT > OUTPUT.clean
+test_expect_equal_file EXPECTED OUTPUT.clean
+restore_database
+
+make_shim qcf-shim<<EOF
+#include <notmuch-test.h>
+
+WRAP_DLFUNC (notmuch_status_t, notmuch_query_count_files, (notmuch_query_t *query, unsigned int *count))
+
+  /* XXX WARNING THIS CORRUPTS THE DATABASE */
+  int fd = open ("target_postlist", O_WRONLY|O_TRUNC);
+  if (fd < 0)
+    exit (8);
+  close (fd);
+
+  return notmuch_query_count_files_orig(query, count);
+}
+EOF
+
+backup_database
+test_begin_subtest "error message from query_count_files"
+ln -sf ${MAIL_DIR}/.notmuch/xapian/postlist.* target_postlist
+notmuch_with_shim qcf-shim count --output=files '*' 2>OUTPUT 1>/dev/null
 cat <<EOF > EXPECTED
 notmuch count: A Xapian exception occurred
 A Xapian exception occurred performing query
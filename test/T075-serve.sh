@@ -0,0 +1,121 @@
+#!/usr/bin/env bash
+test_description='"notmuch serve"'
+. $(dirname "$0")/test-lib.sh || exit 1
+
+test_require_external_prereq ${NOTMUCH_PYTHON}
+
+add_email_corpus
+
+SOCKET="${TMP_DIRECTORY}/serve.sock"
+
+cat <<'EOF' > serve_client.py
+import socket, sys
+
+# Send each argument as one request and print the replies.
+conn = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+conn.connect(sys.argv[1])
+replies = conn.makefile('rb')
+for request in sys.argv[2:]:
+    conn.sendall(request.encode('utf-8') + b'\n')
+    status, out_len, err_len = map(int, replies.readline().split())
+    sys.stdout.buffer.write(replies.read(out_len))
+    sys.stdout.buffer.write(replies.read(err_len))
+    print("exit: %d" % status)
+EOF
+
+serve_client () {
+    $NOTMUCH_PYTHON serve_client.py "$SOCKET" "$@"
+}
+
+notmuch serve --socket="$SOCKET" &
+SERVE_PID=$!
+for i in $(seq 50); do
+    test -S "$SOCKET" && break
+    sleep 0.1
+done
+
+test_begin_subtest "serve requires --socket"
+test_expect_code 1 "notmuch serve"
+
+test_begin_subtest "count over socket"
+serve_client "count '*'" > OUTPUT
+cat <<EOF > EXPECTED
+$(notmuch count '*')
+exit: 0
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "search --format=json over socket"
+serve_client "search --format=json --limit=3 tag:inbox" > OUTPUT
+{ notmuch search --format=json --limit=3 tag:inbox; echo "exit: 0"; } > EXPECTED
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "several requests on one connection"
+serve_client "count tag:attachment" "show --format=sexp id:877h1wv7mg.fsf@inf-8657.int-evry.fr" > OUTPUT
+{ notmuch count tag:attachment; echo "exit: 0";
+  notmuch show --format=sexp id:877h1wv7mg.fsf@inf-8657.int-evry.fr; echo "exit: 0"; } > EXPECTED
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "tag over socket is seen by later requests"
+serve_client "tag +served -- from:cworth" "count tag:served" > OUTPUT
+cat <<EOF > EXPECTED
+exit: 0
+$(notmuch count from:cworth)
+exit: 0
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "changes made outside the server are seen"
+notmuch tag -served -- from:cworth
+serve_client "count tag:served" > OUTPUT
+cat <<EOF > EXPECTED
+0
+exit: 0
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "command errors are reported"
+serve_client "search --output=bogus '*'" > OUTPUT
+cat <<EOF > EXPECTED
+Unknown keyword argument "bogus" for option "output".
+Unrecognized option: --output=bogus
+exit: 1
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "unsupported commands are refused"
+serve_client "new" > OUTPUT
+cat <<EOF > EXPECTED
+Error: 'new' is not available through notmuch serve
+exit: 1
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "an idle connection does not block others"
+cat <<'EOF' > serve_idle.py
+import socket, sys
+
+idle = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+idle.connect(sys.argv[1])
+conn = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+conn.settimeout(10)
+conn.connect(sys.argv[1])
+replies = conn.makefile('rb')
+conn.sendall(b"count '*'\n")
+status, out_len, err_len = map(int, replies.readline().split())
+sys.stdout.buffer.write(replies.read(out_len))
+print("exit: %d" % status)
+EOF
+$NOTMUCH_PYTHON serve_idle.py "$SOCKET" > OUTPUT 2>&1
+cat <<EOF > EXPECTED
+$(notmuch count '*')
+exit: 0
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "SIGTERM removes the socket"
+kill -TERM $SERVE_PID
+wait $SERVE_PID
+test_expect_success "test ! -e '$SOCKET'"
+
+test_done
@@ -325,6 +325,21 @@ cat <<EOF >EXPECTED
 EOF
 test_expect_equal_file EXPECTED OUTPUT
 
+test_begin_subtest "recipients are read from the database"
+notmuch new --message-values > /dev/null
+add_message '[subject]="stored recipients"' '[to]="To Person <to@example.org>"' \
+	    '[cc]="Cc Person <cc@example.org>"' '[header]="Bcc: bcc@example.org"'
+file=$(notmuch search --output=files subject:"stored recipients")
+mv "$file" "$file.away"
+notmuch address --output=recipients subject:"stored recipients" >OUTPUT
+mv "$file.away" "$file"
+cat <<EOF >EXPECTED
+To Person <to@example.org>
+Cc Person <cc@example.org>
+bcc@example.org
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
 if [ "${NOTMUCH_HAVE_SFSEXP-0}" = "1" ]; then
     test_begin_subtest "sexpr query: all messages"
     notmuch address '*' > EXPECTED
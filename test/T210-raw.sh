@@ -75,4 +75,50 @@ sort OUTPUT.raw > OUTPUT
 notmuch search --output=files id:${ID} | xargs md5sum | cut -f1 -d ' ' | sort > EXPECTED
 test_expect_equal_file_nonempty EXPECTED OUTPUT
 
+test_begin_subtest "mapped streams fall back to read(2)"
+: > empty
+cat <<'EOF' | test_private_C
+#include "gmime-extra.h"
+
+static void
+check (const char *what, int fd)
+{
+    GMimeStream *stream;
+    char buf[64];
+    ssize_t len;
+
+    stream = g_mime_stream_mapped_new (fd);
+    len = g_mime_stream_read (stream, buf, sizeof (buf));
+    printf ("%s: %s %zd\n", what,
+	    GMIME_IS_STREAM_MMAP (stream) ? "mmap" : "fs", len);
+    g_object_unref (stream);
+}
+
+int
+main (unused (int argc), unused (char **argv))
+{
+    int fds[2];
+
+    g_mime_init ();
+
+    check ("empty file", open ("empty", O_RDONLY));
+
+    if (pipe (fds))
+	return 1;
+    if (write (fds[1], "From: nobody\n", 13) != 13)
+	return 1;
+    close (fds[1]);
+    check ("pipe", fds[0]);
+
+    return 0;
+}
+EOF
+cat <<EOF > EXPECTED
+== stdout ==
+empty file: fs 0
+pipe: fs 13
+== stderr ==
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
 test_done
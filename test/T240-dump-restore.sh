@@ -108,6 +108,25 @@ notmuch restore --input=backup.gz
 notmuch dump --output=dump.actual
 test_expect_equal_file dump.expected dump.actual
 
+test_begin_subtest "dump --jobs=4"
+notmuch dump --jobs=4 > dump-jobs.actual
+test_expect_equal_file dump.expected dump-jobs.actual
+
+test_begin_subtest "dump --jobs=4 --gzip --output=outfile"
+notmuch dump --jobs=4 --gzip --output=dump-jobs-gzip.gz
+gunzip dump-jobs-gzip.gz
+test_expect_equal_file dump.expected dump-jobs-gzip
+
+test_begin_subtest "restoring gzipped dump --jobs"
+notmuch dump --jobs=4 --gzip --output=backup.gz
+notmuch tag +new_tag '*'
+notmuch restore --input=backup.gz
+notmuch dump --output=dump.actual
+test_expect_equal_file dump.expected dump.actual
+
+test_begin_subtest "dump --jobs=0 is an error"
+test_expect_code 1 "notmuch dump --jobs=0"
+
 # Note, we assume all messages from cworth have a message-id
 # containing cworth.org
 
@@ -130,6 +149,10 @@ if [ "${NOTMUCH_HAVE_SFSEXP-0}" = "1" ]; then
 
 fi
 
+test_begin_subtest "dump --jobs=3 -- from:cworth"
+notmuch dump --jobs=3 -- from:cworth > dump-jobs-cworth.actual
+test_expect_equal_file dump-cworth.expected dump-jobs-cworth.actual
+
 test_begin_subtest "dump --output=outfile from:cworth"
 notmuch dump --output=dump-outfile-cworth.actual from:cworth
 test_expect_equal_file dump-cworth.expected dump-outfile-cworth.actual
@@ -286,6 +309,23 @@ notmuch restore < EXPECTED.$test_count
 notmuch dump --format=sup > OUTPUT.$test_count
 test_expect_equal_file EXPECTED.$test_count OUTPUT.$test_count
 
+test_begin_subtest 'restore --bulk'
+notmuch dump > EXPECTED.$test_count
+notmuch tag +new_tag -inbox '*'
+notmuch restore --bulk < EXPECTED.$test_count
+notmuch dump > OUTPUT.$test_count
+test_expect_equal_file EXPECTED.$test_count OUTPUT.$test_count
+
+test_begin_subtest 'restore --bulk keeps the order of lines for one message'
+notmuch dump --output=BACKUP.$test_count id:20091117232137.GA7669@griffis1.net
+notmuch restore --bulk <<EOF
++first -- id:20091117232137.GA7669@griffis1.net
++second -- id:20091117232137.GA7669@griffis1.net
+EOF
+output=$(notmuch search --output=tags id:20091117232137.GA7669@griffis1.net)
+notmuch restore --input=BACKUP.$test_count
+test_expect_equal "$output" "second"
+
 test_begin_subtest 'restore: checking error messages'
 notmuch restore <<EOF 2>OUTPUT
 # the next line has a space
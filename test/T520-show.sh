@@ -106,4 +106,14 @@ for dup in {1..5}; do
     test_json_nodes <<<"$output" "dup:['duplicate']=${dup}"
 done
 
+test_begin_subtest "--prefetch does not change the output"
+notmuch show --prefetch=0 '*' > EXPECTED
+notmuch show --prefetch=2 '*' > OUTPUT
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "--prefetch does not change the output, entire threads"
+notmuch show --format=json --prefetch=0 '*' > EXPECTED
+notmuch show --format=json --prefetch=64 '*' > OUTPUT
+test_expect_equal_file EXPECTED OUTPUT
+
 test_done
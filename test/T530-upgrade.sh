@@ -54,6 +54,18 @@ for key in 'from/subject/message-ID in database' \
     restore_database
 done
 
+for key in 'thread IDs in database' \
+	       'to/cc/bcc in database' \
+	       'file counts in database'; do
+    backup_database
+    test_begin_subtest "upgrade not triggered by missing '$key'"
+    notmuch new --message-values > /dev/null
+    delete_feature "$key"
+    output=$(notmuch new | grep Welcome)
+    test_expect_equal "$output" ""
+    restore_database
+done
+
 test_begin_subtest "upgrade with configured backup dir"
 notmuch config set database.backup_dir ${HOME}/backups
 delete_feature 'modification tracking'
@@ -424,4 +424,116 @@ cat <<EOF > EXPECTED
 EOF
 test_expect_equal_file EXPECTED OUTPUT
 
+test_begin_subtest "directory paths are cached across messages"
+cat c_head - c_tail <<'EOF' | test_C ${MAIL_DIR}
+    {
+        notmuch_query_t *query;
+        notmuch_messages_t *messages;
+        unsigned long hits, misses, files = 0;
+
+        query = notmuch_query_create (db, "*");
+        EXPECT0(notmuch_query_search_messages (query, &messages));
+        for (; notmuch_messages_valid (messages); notmuch_messages_move_to_next (messages)) {
+            notmuch_filenames_t *filenames;
+
+            filenames = notmuch_message_get_filenames (notmuch_messages_get (messages));
+            for (; notmuch_filenames_valid (filenames); notmuch_filenames_move_to_next (filenames))
+                files++;
+        }
+        notmuch_database_get_directory_cache_stats (db, &hits, &misses);
+        printf("%d\n%d\n", hits + misses == files, misses < files);
+    }
+EOF
+cat <<EOF > EXPECTED
+== stdout ==
+1
+1
+== stderr ==
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "trace counters follow a search"
+cat c_head - c_tail <<'EOF' | test_C ${MAIL_DIR}
+    {
+        notmuch_query_t *query;
+        notmuch_messages_t *messages;
+        unsigned long long parses, enquires, fetches;
+        int count = 0;
+
+        parses = notmuch_database_get_trace_counter (db, NOTMUCH_TRACE_QUERY_PARSE);
+        enquires = notmuch_database_get_trace_counter (db, NOTMUCH_TRACE_ENQUIRE);
+        fetches = notmuch_database_get_trace_counter (db, NOTMUCH_TRACE_DOCUMENT_FETCH);
+        query = notmuch_query_create (db, "from:cworth");
+        EXPECT0(notmuch_query_search_messages (query, &messages));
+        for (; notmuch_messages_valid (messages); notmuch_messages_move_to_next (messages))
+            count++;
+        printf("%d\n", notmuch_database_get_trace_counter (db, NOTMUCH_TRACE_QUERY_PARSE) == parses + 1);
+        printf("%d\n", notmuch_database_get_trace_counter (db, NOTMUCH_TRACE_ENQUIRE) > enquires);
+        printf("%d\n", notmuch_database_get_trace_counter (db, NOTMUCH_TRACE_DOCUMENT_FETCH) >= fetches + count);
+    }
+EOF
+cat <<EOF > EXPECTED
+== stdout ==
+1
+1
+1
+== stderr ==
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "repeated query strings reuse their parse"
+cat c_head - c_tail <<'EOF' | test_C ${MAIL_DIR}
+    {
+        notmuch_query_t *query;
+        unsigned int count;
+        unsigned long long hits;
+
+        hits = notmuch_database_get_trace_counter (db, NOTMUCH_TRACE_QUERY_CACHE_HIT);
+        for (int i = 0; i < 2; i++) {
+            query = notmuch_query_create (db, "from:cworth and subject:notmuch");
+            EXPECT0(notmuch_query_count_messages (query, &count));
+            notmuch_query_destroy (query);
+        }
+        printf("%llu\n", notmuch_database_get_trace_counter (db, NOTMUCH_TRACE_QUERY_CACHE_HIT) - hits);
+        for (int i = 0; i < 2; i++) {
+            query = notmuch_query_create (db, "date:2009-11-18..");
+            EXPECT0(notmuch_query_count_messages (query, &count));
+            notmuch_query_destroy (query);
+        }
+        printf("%llu\n", notmuch_database_get_trace_counter (db, NOTMUCH_TRACE_QUERY_CACHE_HIT) - hits);
+    }
+EOF
+cat <<EOF > EXPECTED
+== stdout ==
+1
+1
+== stderr ==
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "trace counter names"
+cat c_head - c_tail <<'EOF' | test_C ${MAIL_DIR}
+    {
+        printf("%s\n", notmuch_trace_counter_name (NOTMUCH_TRACE_ENQUIRE_NS));
+        printf("%d\n", notmuch_trace_counter_name (NOTMUCH_TRACE_LAST) == NULL);
+        printf("%llu\n", notmuch_database_get_trace_counter (db, NOTMUCH_TRACE_LAST));
+    }
+EOF
+cat <<EOF > EXPECTED
+== stdout ==
+enquire_ns
+1
+0
+== stderr ==
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "NOTMUCH_TRACE appends a JSON report"
+rm -f trace.json
+NOTMUCH_TRACE=trace.json notmuch count '*' > /dev/null
+NOTMUCH_TRACE=trace.json notmuch search '*' > /dev/null
+output=$(sed 's/"counters": {.*$//' trace.json)
+test_expect_equal "$output" '{"command": "count", 
+{"command": "search", '
+
 test_done
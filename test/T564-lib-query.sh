@@ -251,4 +251,110 @@ SUCCESS
 EOF
 test_expect_equal_file EXPECTED OUTPUT
 
+test_begin_subtest "offset and limit on search_messages"
+cat c_head - c_tail <<'EOF' | test_C ${MAIL_DIR}
+    {
+        notmuch_query_t *query;
+        notmuch_messages_t *messages;
+        int count = 0;
+
+        query = notmuch_query_create (db, "*");
+        notmuch_query_set_offset (query, 2);
+        notmuch_query_set_limit (query, 3);
+        EXPECT0(notmuch_query_search_messages (query, &messages));
+        for (; notmuch_messages_valid (messages); notmuch_messages_move_to_next (messages))
+            count++;
+
+        printf("%d\n", count);
+    }
+EOF
+cat <<EOF > EXPECTED
+== stdout ==
+3
+== stderr ==
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "doc id ranges split search_messages results"
+cat c_head - c_tail <<'EOF' | test_C ${MAIL_DIR}
+    {
+        notmuch_query_t *query;
+        notmuch_messages_t *all, *part;
+        unsigned int last, step, first;
+        int same = 1, count = 0;
+
+        query = notmuch_query_create (db, "*");
+        notmuch_query_set_sort (query, NOTMUCH_SORT_UNSORTED);
+        EXPECT0(notmuch_query_search_messages (query, &all));
+
+        last = notmuch_database_get_last_doc_id (db);
+        step = last / 3 + 1;
+        for (first = 1; first <= last; first += step) {
+            notmuch_query_set_doc_id_range (query, first, first + step - 1);
+            EXPECT0(notmuch_query_search_messages (query, &part));
+            for (; notmuch_messages_valid (part); notmuch_messages_move_to_next (part)) {
+                notmuch_message_t *a, *b;
+
+                if (! notmuch_messages_valid (all)) {
+                    same = 0;
+                    break;
+                }
+                a = notmuch_messages_get (all);
+                b = notmuch_messages_get (part);
+                if (strcmp (notmuch_message_get_message_id (a), notmuch_message_get_message_id (b)))
+                    same = 0;
+                notmuch_messages_move_to_next (all);
+                count++;
+            }
+        }
+        if (notmuch_messages_valid (all))
+            same = 0;
+
+        printf("%d %d\n", count > 0, same);
+    }
+EOF
+cat <<EOF > EXPECTED
+== stdout ==
+1 1
+== stderr ==
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "prefetch does not change search_messages results"
+cat c_head - c_tail <<'EOF' | test_C ${MAIL_DIR}
+    {
+        notmuch_query_t *query;
+        notmuch_messages_t *plain, *prefetched;
+        int i = 0, same = 1;
+
+        query = notmuch_query_create (db, "*");
+        EXPECT0(notmuch_query_search_messages (query, &plain));
+        EXPECT0(notmuch_query_search_messages (query, &prefetched));
+        for (; notmuch_messages_valid (plain);
+             notmuch_messages_move_to_next (plain),
+             notmuch_messages_move_to_next (prefetched), i++) {
+            notmuch_message_t *a, *b;
+
+            if (i % 7 == 0)
+                EXPECT0(notmuch_messages_prefetch (prefetched, 7));
+            a = notmuch_messages_get (plain);
+            b = notmuch_messages_get (prefetched);
+            if (strcmp (notmuch_message_get_message_id (a), notmuch_message_get_message_id (b)) ||
+                strcmp (notmuch_message_get_filename (a), notmuch_message_get_filename (b)))
+                same = 0;
+            notmuch_message_destroy (a);
+            notmuch_message_destroy (b);
+        }
+
+        printf("%d\n%d\n", same, notmuch_messages_valid (prefetched));
+    }
+EOF
+cat <<EOF > EXPECTED
+== stdout ==
+1
+0
+== stderr ==
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
 test_done
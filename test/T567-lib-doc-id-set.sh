@@ -0,0 +1,218 @@
+#!/usr/bin/env bash
+test_description="document id sets"
+
+. $(dirname "$0")/test-lib.sh || exit 1
+
+cat <<'EOF' > c_head
+#include <notmuch-test.h>
+
+#define KEY(n) ((n) << 16)
+
+static void
+check (notmuch_doc_id_set_t *doc_ids, unsigned int doc_id)
+{
+    printf ("%u.%u %d\n", doc_id >> 16, doc_id & 0xffff,
+	    _notmuch_doc_id_set_contains (doc_ids, doc_id));
+}
+
+int
+main (int argc, char **argv)
+{
+    void *ctx = talloc_new (NULL);
+    notmuch_doc_id_set_t *doc_ids;
+    unsigned int *ids = talloc_array (ctx, unsigned int, 1 << 16);
+    unsigned int n = 0;
+
+    (void) argc;
+    (void) argv;
+EOF
+
+cat <<'EOF' > c_tail
+    talloc_free (ctx);
+    return 0;
+}
+EOF
+
+test_begin_subtest "sparse chunk (array)"
+cat c_head - c_tail <<'EOF' | test_private_C
+    {
+	ids[n++] = 7;
+	ids[n++] = 1000;
+	ids[n++] = 3;
+	ids[n++] = 1000;
+	ids[n++] = 65535;
+	doc_ids = _notmuch_doc_id_set_create (ctx, ids, n);
+	check (doc_ids, 3);
+	check (doc_ids, 4);
+	check (doc_ids, 1000);
+	check (doc_ids, 65535);
+	check (doc_ids, KEY (1));
+	_notmuch_doc_id_set_remove (doc_ids, 1000);
+	_notmuch_doc_id_set_remove (doc_ids, 1001);
+	check (doc_ids, 7);
+	check (doc_ids, 1000);
+	check (doc_ids, 65535);
+    }
+EOF
+cat <<EOF > EXPECTED
+== stdout ==
+0.3 1
+0.4 0
+0.1000 1
+0.65535 1
+1.0 0
+0.7 1
+0.1000 0
+0.65535 1
+== stderr ==
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "dense chunk (bitmap)"
+cat c_head - c_tail <<'EOF' | test_private_C
+    {
+	unsigned int i;
+
+	/* More than 4096 ids, none of them adjacent */
+	for (i = 0; i < 5000; i++)
+	    ids[n++] = KEY (1) + 2 * i;
+	doc_ids = _notmuch_doc_id_set_create (ctx, ids, n);
+	check (doc_ids, KEY (1));
+	check (doc_ids, KEY (1) + 1);
+	check (doc_ids, KEY (1) + 9998);
+	check (doc_ids, KEY (1) + 10000);
+	check (doc_ids, KEY (0) + 2);
+	_notmuch_doc_id_set_remove (doc_ids, KEY (1) + 4096);
+	check (doc_ids, KEY (1) + 4094);
+	check (doc_ids, KEY (1) + 4096);
+	check (doc_ids, KEY (1) + 4098);
+    }
+EOF
+cat <<EOF > EXPECTED
+== stdout ==
+1.0 1
+1.1 0
+1.9998 1
+1.10000 0
+0.2 0
+1.4094 1
+1.4096 0
+1.4098 1
+== stderr ==
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "contiguous chunk (runs), converted to a bitmap on removal"
+cat c_head - c_tail <<'EOF' | test_private_C
+    {
+	unsigned int i;
+
+	for (i = 10; i < 60000; i++)
+	    ids[n++] = KEY (2) + i;
+	doc_ids = _notmuch_doc_id_set_create (ctx, ids, n);
+	check (doc_ids, KEY (2) + 9);
+	check (doc_ids, KEY (2) + 10);
+	check (doc_ids, KEY (2) + 59999);
+	check (doc_ids, KEY (2) + 60000);
+	/* not in the set: stays a run chunk */
+	_notmuch_doc_id_set_remove (doc_ids, KEY (2) + 5);
+	check (doc_ids, KEY (2) + 10);
+	_notmuch_doc_id_set_remove (doc_ids, KEY (2) + 30000);
+	check (doc_ids, KEY (2) + 10);
+	check (doc_ids, KEY (2) + 29999);
+	check (doc_ids, KEY (2) + 30000);
+	check (doc_ids, KEY (2) + 30001);
+	check (doc_ids, KEY (2) + 59999);
+	check (doc_ids, KEY (2) + 60000);
+	_notmuch_doc_id_set_remove (doc_ids, KEY (2) + 59999);
+	check (doc_ids, KEY (2) + 59998);
+	check (doc_ids, KEY (2) + 59999);
+    }
+EOF
+cat <<EOF > EXPECTED
+== stdout ==
+2.9 0
+2.10 1
+2.59999 1
+2.60000 0
+2.10 1
+2.10 1
+2.29999 1
+2.30000 0
+2.30001 1
+2.59999 1
+2.60000 0
+2.59998 1
+2.59999 0
+== stderr ==
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "chunks of each kind in one set"
+cat c_head - c_tail <<'EOF' | test_private_C
+    {
+	unsigned int i;
+
+	/* given out of order, as from a multi-shard query */
+	for (i = 0; i < 5000; i++)
+	    ids[n++] = KEY (5) + 3 * i;
+	for (i = 0; i < 100; i++)
+	    ids[n++] = KEY (9) + i;
+	ids[n++] = KEY (1) + 42;
+	ids[n++] = KEY (7) + 65535;
+	doc_ids = _notmuch_doc_id_set_create (ctx, ids, n);
+	check (doc_ids, KEY (1) + 42);
+	check (doc_ids, KEY (5) + 14997);
+	check (doc_ids, KEY (9) + 99);
+	check (doc_ids, KEY (7) + 65535);
+	check (doc_ids, KEY (9) + 100);
+	check (doc_ids, KEY (6));
+	check (doc_ids, KEY (10));
+	check (doc_ids, 0);
+	_notmuch_doc_id_set_remove (doc_ids, KEY (9) + 50);
+	_notmuch_doc_id_set_remove (doc_ids, KEY (5) + 3);
+	_notmuch_doc_id_set_remove (doc_ids, KEY (1) + 42);
+	check (doc_ids, KEY (9) + 49);
+	check (doc_ids, KEY (9) + 50);
+	check (doc_ids, KEY (5) + 3);
+	check (doc_ids, KEY (5) + 6);
+	check (doc_ids, KEY (1) + 42);
+    }
+EOF
+cat <<EOF > EXPECTED
+== stdout ==
+1.42 1
+5.14997 1
+9.99 1
+7.65535 1
+9.100 0
+6.0 0
+10.0 0
+0.0 0
+9.49 1
+9.50 0
+5.3 0
+5.6 1
+1.42 0
+== stderr ==
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "empty set"
+cat c_head - c_tail <<'EOF' | test_private_C
+    {
+	doc_ids = _notmuch_doc_id_set_create (ctx, ids, n);
+	_notmuch_doc_id_set_remove (doc_ids, 1);
+	check (doc_ids, 0);
+	check (doc_ids, 1);
+    }
+EOF
+cat <<EOF > EXPECTED
+== stdout ==
+0.0 0
+0.1 0
+== stderr ==
+EOF
+test_expect_equal_file EXPECTED OUTPUT
+
+test_done
@@ -52,6 +52,11 @@ after=$(notmuch count --lastmod '*' | cut -f3)
 result=$(($before < $after))
 test_expect_equal 1 ${result}
 
+test_begin_subtest "tagging many messages commits one revision"
+notmuch tag +a-random-tag-8743633 '*'
+after=$(notmuch count --lastmod '*' | cut -f3)
+test_expect_equal "$(notmuch count lastmod:$after..$after)" "$(notmuch count '*')"
+
 notmuch count --lastmod '*' | cut -f2 > UUID
 
 test_begin_subtest "search succeeds with correct uuid"
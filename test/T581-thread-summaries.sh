@@ -0,0 +1,92 @@
+#!/usr/bin/env bash
+test_description='searching with precomputed thread summaries'
+
+. $(dirname "$0")/test-lib.sh || exit 1
+
+add_email_corpus
+
+# Search with the incrementally maintained summaries, then rebuild
+# them from scratch and search again; both must match a search
+# without summaries.
+compare_with_rebuild () {
+    notmuch search "$@" > OUTPUT
+    notmuch new --no-thread-summaries > /dev/null
+    notmuch search "$@" > EXPECTED
+    cat EXPECTED EXPECTED > EXPECTED.twice
+    notmuch new --thread-summaries > /dev/null
+    notmuch search "$@" >> OUTPUT
+    mv EXPECTED.twice EXPECTED
+    test_expect_equal_file EXPECTED OUTPUT
+}
+
+notmuch search '*' > BEFORE
+notmuch search --format=json '*' > BEFORE.json
+
+test_begin_subtest "Enabling thread summaries"
+output=$(notmuch new --thread-summaries)
+test_expect_equal "$output" "No new mail."
+
+test_begin_subtest "Search output is unchanged"
+notmuch search '*' > OUTPUT
+test_expect_equal_file BEFORE OUTPUT
+
+test_begin_subtest "JSON search output is unchanged"
+notmuch search --format=json '*' > OUTPUT.json
+test_expect_equal_file BEFORE.json OUTPUT.json
+
+test_begin_subtest "Oldest-first search"
+compare_with_rebuild --sort=oldest-first '*'
+
+test_begin_subtest "Partially matching threads"
+compare_with_rebuild from:cworth
+
+test_begin_subtest "Search after tagging"
+notmuch tag +summary-test from:cworth
+compare_with_rebuild '*'
+
+test_begin_subtest "Search with excluded tags"
+notmuch config set search.exclude_tags deleted
+notmuch tag +deleted id:1258471718-6781-1-git-send-email-dottedmag@dottedmag.net
+compare_with_rebuild '*'
+
+test_begin_subtest "Search with excluded tags, --exclude=false"
+compare_with_rebuild --exclude=false '*'
+
+test_begin_subtest "Search after adding a reply"
+add_message '[in-reply-to]=\<1258471718-6781-1-git-send-email-dottedmag@dottedmag.net\>' \
+	    '[subject]="summary reply"'
+compare_with_rebuild '*'
+
+test_begin_subtest "Search after removing a message"
+rm -f "$(notmuch search --output=files id:${gen_msg_id})"
+notmuch new > /dev/null
+compare_with_rebuild '*'
+
+test_begin_subtest "Summaries left stale by a killed writer are not used"
+cat <<'EOF' | XAPIAN_FLUSH_THRESHOLD=1 test_C ${MAIL_DIR}
+#include <notmuch-test.h>
+
+int main (int argc, char **argv)
+{
+    notmuch_database_t *db;
+    notmuch_message_t *message;
+
+    EXPECT0 (notmuch_database_open_with_config (argv[1], NOTMUCH_DATABASE_MODE_READ_WRITE,
+						NULL, NULL, &db, NULL));
+    EXPECT0 (notmuch_database_find_message (db, "877h1wv7mg.fsf@inf-8657.int-evry.fr",
+					    &message));
+    /* Committed by Xapian right away, but the summary is never
+     * rewritten. */
+    EXPECT0 (notmuch_message_add_tag (message, "killed"));
+    _exit (0);
+}
+EOF
+compare_with_rebuild '*'
+
+test_begin_subtest "Disabling thread summaries"
+notmuch search '*' > EXPECTED
+notmuch new --no-thread-summaries > /dev/null
+notmuch search '*' > OUTPUT
+test_expect_equal_file EXPECTED OUTPUT
+
+test_done
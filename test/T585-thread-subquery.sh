@@ -34,6 +34,33 @@ thread:XXX   2009-11-18 [7/7] Lars Kellogg-Stedman, Mikhail Gusarov, Keith Packa
 EOF
 test_expect_equal_file EXPECTED OUTPUT
 
+test_begin_subtest "Subquery follows merged threads"
+add_message '[subject]="subquery orphan"' '[id]=orphan@notmuch-test-suite'
+add_message '[subject]="Re: subquery orphan"' '[in-reply-to]=<orphan@notmuch-test-suite>' \
+	    '[references]="<yun3a4cegoa.fsf@aiko.keithp.com> <orphan@notmuch-test-suite>"'
+output=$(notmuch count thread:{subject:orphan})
+output="$output $(notmuch count --output=threads thread:{subject:orphan})"
+test_expect_equal "$output" "9 1"
+
+test_begin_subtest "Repeated subquery in one query"
+notmuch search thread:{from:keithp} and thread:{from:keithp} | notmuch_search_sanitize > OUTPUT
+notmuch search thread:{from:keithp} | notmuch_search_sanitize > EXPECTED
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "Subquery with thread IDs stored in the database"
+notmuch search thread:{from:keithp} and thread:{to:keithp} > EXPECTED
+notmuch new --message-values > /dev/null
+notmuch search thread:{from:keithp} and thread:{to:keithp} > OUTPUT
+test_expect_equal_file EXPECTED OUTPUT
+
+test_begin_subtest "Stored thread IDs follow merged threads"
+add_message '[subject]="stored orphan"' '[id]=stored-orphan@notmuch-test-suite'
+add_message '[subject]="Re: stored orphan"' '[in-reply-to]=<stored-orphan@notmuch-test-suite>' \
+	    '[references]="<yun3a4cegoa.fsf@aiko.keithp.com> <stored-orphan@notmuch-test-suite>"'
+output=$(notmuch count 'thread:{subject:"stored orphan"}')
+output="$output $(notmuch count --output=threads 'thread:{subject:"stored orphan"}')"
+test_expect_equal "$output" "11 1"
+
 test_begin_subtest "Syntax/quoting error in subquery"
 notmuch search 'thread:{from:keithp and date:2009} and thread:{to:keithp}' 1>OUTPUT 2>&1
 cat<<EOF > EXPECTED
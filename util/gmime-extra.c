@@ -1,5 +1,8 @@
 #include "gmime-extra.h"
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 static
 GMimeStream *
@@ -37,6 +40,26 @@ _gzfile_maybe_filter (GMimeStream *file_stream)
     }
 }
 
+GMimeStream *
+g_mime_stream_mapped_new (int fd)
+{
+    GMimeStream *stream;
+
+    stream = g_mime_stream_mmap_new (fd, PROT_READ, MAP_PRIVATE);
+    if (stream) {
+	GMimeStreamMmap *mmap_stream = GMIME_STREAM_MMAP (stream);
+
+	/* Message files are read once, front to back. */
+	(void) posix_madvise (mmap_stream->map, mmap_stream->maplen,
+			      POSIX_MADV_SEQUENTIAL);
+	return stream;
+    }
+
+    /* Empty files, pipes, and file systems (or GMime builds) without
+     * mmap support are read with read(2) instead. */
+    return g_mime_stream_fs_new (fd);
+}
+
 GMimeStream *
 g_mime_stream_gzfile_new (int fd)
 {
@@ -49,18 +72,40 @@ g_mime_stream_gzfile_new (int fd)
     return _gzfile_maybe_filter (file_stream);
 }
 
-GMimeStream *
-g_mime_stream_gzfile_open (const char *filename)
+static GMimeStream *
+_gzfile_open (const char *filename, gboolean mapped)
 {
     GMimeStream *file_stream;
+    int fd;
 
-    file_stream = g_mime_stream_fs_open (filename, 0, 0, NULL);
-    if (! file_stream)
+    fd = open (filename, O_RDONLY);
+    if (fd < 0)
 	return NULL;
 
+    if (mapped)
+	file_stream = g_mime_stream_mapped_new (fd);
+    else
+	file_stream = g_mime_stream_fs_new (fd);
+    if (! file_stream) {
+	close (fd);
+	return NULL;
+    }
+
     return _gzfile_maybe_filter (file_stream);
 }
 
+GMimeStream *
+g_mime_stream_gzfile_open (const char *filename)
+{
+    return _gzfile_open (filename, FALSE);
+}
+
+GMimeStream *
+g_mime_stream_gzfile_open_mapped (const char *filename)
+{
+    return _gzfile_open (filename, TRUE);
+}
+
 GMimeStream *
 g_mime_stream_stdout_new ()
 {
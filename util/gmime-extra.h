@@ -9,6 +9,13 @@ extern "C" {
 
 GMimeStream *g_mime_stream_stdout_new (void);
 
+/* Return a GMime stream reading this open file descriptor through a
+ * read-only mapping of the file, or with read(2) if it cannot be
+ * mapped. The stream takes ownership of fd. Reading a mapping past
+ * the end of a file truncated meanwhile raises SIGBUS, so this is
+ * only for short-lived readers. */
+GMimeStream *g_mime_stream_mapped_new (int fd);
+
 /* Return a GMime stream for this open file descriptor, un-gzipping if
  * necessary */
 GMimeStream *g_mime_stream_gzfile_new (int fd);
@@ -17,6 +24,10 @@ GMimeStream *g_mime_stream_gzfile_new (int fd);
  * necessary */
 GMimeStream *g_mime_stream_gzfile_open (const char *filename);
 
+/* Like g_mime_stream_gzfile_open, but reading through
+ * g_mime_stream_mapped_new */
+GMimeStream *g_mime_stream_gzfile_open_mapped (const char *filename);
+
 /**
  * Get last 16 hex digits of fingerprint ("keyid")
  */